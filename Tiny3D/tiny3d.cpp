@@ -31,14 +31,23 @@ SOFTWARE.
 #include "tiny3d_string_convertor.h"
 #include "tiny3d_message_box.h"
 #include "tiny3d_error.h"
+#include "tiny3d_log.h"
 
 int main(int argc, char* argv[])
 {
     Tiny3DApp* app = nullptr;
+    Log::Start("tiny3d.log");
 
     try
     {
         app = new Tiny3DApp();
+
+        for (int i = 1; i < argc; ++i)
+        {
+            if (std::string(argv[i]) == "--hot-reload")
+                app->EnableHotReload(true);
+        }
+
         app->InitializeGraphicSystem();
         app->InitRenderDevice();
         app->Run();
@@ -49,6 +58,7 @@ int main(int argc, char* argv[])
     }
     catch (std::exception e)
     {
+        Log::Error("Unhandled exception: {}", e.what());
         std::wstring exception_desc;
         StringConvertor::ANSItoUTF16LE(e.what(), exception_desc);
         ErrorMessageBox(std::wstring(L" : Unhandled Exception, aborting"), exception_desc);
@@ -57,5 +67,6 @@ int main(int argc, char* argv[])
     app->DestroyRenderDevice();
     app->ShutdownGraphicSystem();
     delete[] app;
+    Log::Shutdown();
     return 0;
 }
\ No newline at end of file
@@ -29,33 +29,45 @@ SOFTWARE.
 #include <new>
 
 
-template<typename T>
-class AlignedClass
+// 按align_size字节对齐分配内存，失败时抛出std::bad_alloc
+inline void* AlignedMalloc(std::size_t size, std::size_t align_size)
 {
-public:
-    void* operator new(std::size_t size)
+    void* ptr = nullptr;
+#if defined(WIN32) || defined(_WIN32)
+    ptr = _aligned_malloc(size, align_size);
+#else
+    // aligned_alloc要求分配大小是对齐值的整数倍
+    ptr = std::aligned_alloc(align_size, (size + align_size - 1) / align_size * align_size);
+#endif
+    if (!ptr)
     {
-        void* ptr = nullptr;
-        std::size_t align_size = alignof(T);
+        throw std::bad_alloc();
+    }
+
+    return ptr;
+}
+
+// 释放由AlignedMalloc分配的内存
+inline void AlignedFree(void* ptr) noexcept
+{
 #if defined(WIN32) || defined(_WIN32)
-        ptr = _aligned_malloc(size, align_size);
+    _aligned_free(ptr);
 #else
-        void* ptr = std::aligned_alloc(align_size, size);
+    std::free(ptr);
 #endif
-        if (!ptr)
-        {
-            throw std::bad_alloc();
-        }
+}
 
-        return ptr;
+template<typename T>
+class AlignedClass
+{
+public:
+    void* operator new(std::size_t size)
+    {
+        return AlignedMalloc(size, alignof(T));
     }
 
     void operator delete(void* ptr) noexcept
     {
-#if defined(WIN32) || defined(_WIN32)
-        _aligned_free(ptr);
-#else
-        std::free(ptr);
-#endif
+        AlignedFree(ptr);
     }
 };
\ No newline at end of file
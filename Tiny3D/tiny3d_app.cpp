@@ -22,12 +22,21 @@ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
 SOFTWARE.
 *********************************************************************************************/
 #include <chrono>
+#include <cstring>
 
 #include "SDL_image.h"
 #include "fmt/format.h"
 
 #include "tiny3d_app.h"
+#include "tiny3d_profiler.h"
+#include "tiny3d_trace.h"
 #include "tiny3d_error.h"
+#include "tiny3d_log.h"
+#include "tiny3d_math.h"
+#include "tiny3d_plg_loader.h"
+
+// 显示过度绘制热力图时，每隔这么多帧把统计数据写一次日志
+static const uint32_t kOverdrawLogInterval = 120;
 
 Tiny3DApp::Tiny3DApp()
 {
@@ -53,7 +62,17 @@ Tiny3DApp::Tiny3DApp()
     mouse_wnd_offset_x_ = 0;
     mouse_wnd_offset_y_ = 0;
     render_device_ = nullptr;
+    job_system_ = nullptr;
     box_rotation_delta_ = 0.0f;
+    render_state_ = RENDER_STATE_TEXTURE;
+    overdraw_frame_count_ = 0;
+    show_hud_ = false;
+    show_model_ = false;
+    pipelined_rendering_ = true;
+    max_frames_in_flight_ = 2;
+    render_targets_.fill(nullptr);
+    render_thread_running_ = false;
+    hot_reload_ = false;
 }
 
 Tiny3DApp::~Tiny3DApp()
@@ -90,10 +109,81 @@ void Tiny3DApp::InitializeGraphicSystem()
 
 void Tiny3DApp::InitRenderDevice()
 {
+    job_system_ = new JobSystem();
+    job_system_->Initialize(0);
+
     render_device_ = new Device();
     render_device_->Initialize(wnd_render_area_width_, wnd_render_area_height_);
+    render_device_->set_job_system(job_system_);
+
+    // 有工作线程时按行交错的方式多线程光栅化
+    if (job_system_->worker_count() > 0)
+    {
+        render_device_->SetRasterMode(RASTER_MODE_INTERLEAVED, 0);
+    }
+
     render_device_->ResetCamera(3, 0, 0);
-    render_device_->CreateTextureFromFile("assets/images/wood_box.jpg");
+
+    // 模型的光照：一盏从摄影机左上方照过来的白色方向光，一盏暖色的点光源，再加一点环境光
+    T3DLight key_light = {};
+    key_light.type = LIGHT_DIRECTIONAL;
+    key_light.color = { 0.8f, 0.8f, 0.8f };
+    key_light.direction = { -0.577f, 0.577f, -0.577f, 0.0f };
+    T3DLight fill_light = {};
+    fill_light.type = LIGHT_POINT;
+    fill_light.color = { 0.6f, 0.4f, 0.2f };
+    fill_light.position = { 2.0f, -2.0f, 1.0f, 1.0f };
+    fill_light.attenuation[0] = 1.0f;
+    fill_light.attenuation[2] = 0.1f;
+    render_device_->SetAmbientLight({ 0.2f, 0.2f, 0.2f });
+    render_device_->AddLight(key_light);
+    render_device_->AddLight(fill_light);
+    TextureHandle box_texture = render_device_->CreateTextureFromFile("assets/images/wood_box.jpg");
+    PlgLoader::LoadFromFile("assets/models/cube_2.plg", &model_mesh_);
+
+    if (hot_reload_)
+    {
+        if (box_texture != kInvalidTextureHandle)
+            asset_watcher_.WatchTexture("assets/images/wood_box.jpg", box_texture);
+
+        asset_watcher_.WatchMesh("assets/models/cube_2.plg", &model_mesh_);
+        asset_watcher_.Start();
+    }
+
+    if (pipelined_rendering_)
+    {
+        CreateRenderTargets();
+    }
+}
+
+void Tiny3DApp::EnablePipelinedRendering(bool enable, uint32_t max_frames_in_flight)
+{
+    pipelined_rendering_ = enable;
+    max_frames_in_flight_ = Clamp<uint32_t>(max_frames_in_flight, 2, kMaxRenderTargets);
+}
+
+void Tiny3DApp::EnableHotReload(bool enable)
+{
+    hot_reload_ = enable;
+}
+
+void Tiny3DApp::CreateRenderTargets()
+{
+    for (uint32_t i = 0; i < max_frames_in_flight_; ++i)
+    {
+        // 按cache line对齐，多线程光栅化时各线程负责的行才不会共享cache line
+        size_t bytes = sizeof(uint32_t) * wnd_render_area_width_ * wnd_render_area_height_;
+        render_targets_[i] = static_cast<uint32_t*>(AlignedMalloc(bytes, 64));
+    }
+}
+
+void Tiny3DApp::DestroyRenderTargets()
+{
+    for (uint32_t i = 0; i < kMaxRenderTargets; ++i)
+    {
+        AlignedFree(render_targets_[i]);
+        render_targets_[i] = nullptr;
+    }
 }
 
 void Tiny3DApp::ShutdownGraphicSystem()
@@ -102,16 +192,35 @@ void Tiny3DApp::ShutdownGraphicSystem()
     SDL_DestroyWindow(window_);
     back_surface_ = nullptr;
     window_ = nullptr;
+    IMG_Quit();
     SDL_Quit();
 }
 
 void Tiny3DApp::DestroyRenderDevice()
 {
+    // 异常退出时渲染线程可能还在运行，必须先让它结束才能销毁设备
+    if (render_thread_.joinable())
+    {
+        render_thread_running_.store(false, std::memory_order_release);
+        render_thread_.join();
+    }
+
+    // 监视线程解码出的资源要换进设备，必须在设备销毁之前停下
+    asset_watcher_.Stop();
+    DestroyRenderTargets();
+
     if (nullptr != render_device_)
     {
         delete render_device_;
         render_device_ = nullptr;
     }
+
+    if (nullptr != job_system_)
+    {
+        job_system_->Shutdown();
+        delete job_system_;
+        job_system_ = nullptr;
+    }
 }
 
 void Tiny3DApp::LockBackSurface()
@@ -183,14 +292,39 @@ void Tiny3DApp::OnKeyUp(SDL_Event& e)
     switch (sym)
     {
     case SDLK_F1:
-        render_device_->set_render_state(RENDER_STATE_WIREFRAME);
+        render_state_ = RENDER_STATE_WIREFRAME | (render_state_ & (RENDER_STATE_OVERDRAW | RENDER_STATE_LIGHTING));
         break;
     case SDLK_F2:
-        render_device_->set_render_state(RENDER_STATE_COLOR);
+        render_state_ = RENDER_STATE_COLOR | (render_state_ & (RENDER_STATE_OVERDRAW | RENDER_STATE_LIGHTING));
         break;
     case SDLK_F3:
-        render_device_->set_render_state(RENDER_STATE_TEXTURE);
+        render_state_ = RENDER_STATE_TEXTURE | (render_state_ & (RENDER_STATE_OVERDRAW | RENDER_STATE_LIGHTING));
+        break;
+    case SDLK_F5:
+        // 打开或关闭过度绘制热力图
+        render_state_ ^= RENDER_STATE_OVERDRAW;
+        break;
+    case SDLK_F6:
+        // 打开或关闭性能信息
+        show_hud_ = !show_hud_;
+        break;
+    case SDLK_F7:
+        // 在立方体和PLG模型之间切换
+        show_model_ = !show_model_;
         break;
+    case SDLK_F8:
+        // 打开或关闭PLG模型的光照
+        render_state_ ^= RENDER_STATE_LIGHTING;
+        break;
+#if defined(TINY3D_ENABLE_PROFILER)
+    case SDLK_F4:
+        // 开始或停止录制时间线
+        if (TraceRecorder::IsRecording())
+            TraceRecorder::Stop();
+        else
+            TraceRecorder::Start("tiny3d_trace.json");
+        break;
+#endif
     }
 }
 
@@ -221,39 +355,259 @@ void Tiny3DApp::OnMouseDragging(SDL_Window* window, SDL_Event& e)
 
 void Tiny3DApp::RenderScene()
 {
+    TINY3D_TRACE_SCOPE("render_frame");
+    asset_watcher_.ApplyPending(render_device_);
     LockBackSurface();
 
     render_device_->ResetZBuffer();
 
+    render_device_->set_render_state(render_state_);
+
     render_device_->SetFrameBufer(back_buffer_pointer_);
 
-    render_device_->DrawBox(box_rotation_delta_, box_mesh_.data());
+    if (render_state_ & RENDER_STATE_OVERDRAW)
+        render_device_->ClearOverdrawBuffer();
+
+    if (show_model_)
+        DrawModel(box_rotation_delta_);
+    else
+        render_device_->DrawBox(box_rotation_delta_, box_mesh_.data());
+
+    render_device_->FlushDeferredRaster();
+
+    if (render_state_ & RENDER_STATE_OVERDRAW)
+        ShowOverdrawHeatmap();
+
+    if (show_hud_)
+        perf_hud_.Draw(render_device_);
+
+    render_device_->EndFrame();
 
     UnlockBackSurface();
 }
 
 void Tiny3DApp::Run()
+{
+    TINY3D_TRACE_THREAD_NAME("main");
+
+    if (pipelined_rendering_)
+    {
+        RunPipelined();
+    }
+    else
+    {
+        RunSerial();
+    }
+
+    // 退出时还在录制的话，把已经采集到的时间线写完
+    TraceRecorder::Stop();
+}
+
+void Tiny3DApp::RunSerial()
 {
     while (is_running_)
     {
         SDL_Event event;
 
-        while (SDL_PollEvent(&event))
         {
-            ProcessInput(event);
-            OnMouseDragging(window_, event);
+            TINY3D_PROFILE_SCOPE(PROFILE_STAGE_EVENT_POLL);
+            TINY3D_TRACE_SCOPE("event_poll");
+
+            while (SDL_PollEvent(&event))
+            {
+                ProcessInput(event);
+                OnMouseDragging(window_, event);
+            }
         }
 
         render_device_->ResetCamera(3.5, 0, 0);
 
-        SDL_FillRect(back_surface_, nullptr, 0xFFc0c0c0); //ARGB
-        SDL_FillRect(screen_surface_, nullptr, 0);
+        {
+            TINY3D_PROFILE_SCOPE(PROFILE_STAGE_CLEAR);
+            SDL_FillRect(back_surface_, nullptr, 0xFFc0c0c0); //ARGB
+            SDL_FillRect(screen_surface_, nullptr, 0);
+        }
 
         RenderScene();
 
-        SDL_BlitSurface(back_surface_, nullptr, screen_surface_, nullptr);
-        SDL_UpdateWindowSurface(window_);
+        {
+            TINY3D_PROFILE_SCOPE(PROFILE_STAGE_PRESENT);
+            TINY3D_TRACE_SCOPE("present");
+            SDL_BlitSurface(back_surface_, nullptr, screen_surface_, nullptr);
+            SDL_UpdateWindowSurface(window_);
+        }
 
         back_buffer_pointer_ = nullptr;
+        TINY3D_PROFILE_END_FRAME();
+    }
+}
+
+void Tiny3DApp::RunPipelined()
+{
+    // 一开始所有的渲染目标都是空闲的，全部交给渲染线程
+    for (uint32_t i = 0; i < max_frames_in_flight_; ++i)
+    {
+        free_frames_.Push({ i, box_rotation_delta_, render_state_, show_hud_, show_model_ });
     }
+
+    render_thread_running_.store(true, std::memory_order_release);
+    render_thread_ = std::thread(&Tiny3DApp::RenderThreadMain, this);
+    TraceSpan wait_span;
+
+    while (is_running_)
+    {
+        SDL_Event event;
+
+        {
+            TINY3D_PROFILE_SCOPE(PROFILE_STAGE_EVENT_POLL);
+            TINY3D_TRACE_SCOPE("event_poll");
+
+            while (SDL_PollEvent(&event))
+            {
+                ProcessInput(event);
+                OnMouseDragging(window_, event);
+            }
+        }
+
+        FrameTicket ticket;
+
+        if (!ready_frames_.Pop(ticket))
+        {
+            // 渲染线程还没画完下一帧，让出时间片后继续处理事件
+            wait_span.Begin();
+            std::this_thread::yield();
+            continue;
+        }
+
+        wait_span.End("wait_ready_frame");
+        PresentRenderTarget(render_targets_[ticket.target_index]);
+        TINY3D_PROFILE_END_FRAME();
+
+        // 呈现完毕，渲染目标带上最新的输入状态交还给渲染线程
+        ticket.box_rotation = box_rotation_delta_;
+        ticket.render_state = render_state_;
+        ticket.show_hud = show_hud_;
+        ticket.show_model = show_model_;
+        free_frames_.Push(ticket);
+    }
+
+    render_thread_running_.store(false, std::memory_order_release);
+    render_thread_.join();
+}
+
+void Tiny3DApp::RenderThreadMain()
+{
+    FrameTicket ticket;
+    TraceSpan wait_span;
+    TINY3D_TRACE_THREAD_NAME("render");
+
+    while (render_thread_running_.load(std::memory_order_acquire))
+    {
+        if (!free_frames_.Pop(ticket))
+        {
+            wait_span.Begin();
+            std::this_thread::yield();
+            continue;
+        }
+
+        wait_span.End("wait_free_frame");
+        RenderFrame(ticket);
+
+        // 队列容量大于渲染目标个数，这里不会失败
+        ready_frames_.Push(ticket);
+    }
+}
+
+void Tiny3DApp::RenderFrame(const FrameTicket& ticket)
+{
+    TINY3D_TRACE_SCOPE("render_frame");
+    uint32_t* target = render_targets_[ticket.target_index];
+
+    // 上一帧的延迟光栅化已经全部完成，这时换入重新加载的资源是安全的
+    asset_watcher_.ApplyPending(render_device_);
+
+    render_device_->ResetCamera(3.5, 0, 0);
+    render_device_->set_render_state(ticket.render_state);
+    render_device_->SetFrameBufer(reinterpret_cast<uint8_t*>(target));
+    render_device_->ClearFrameBuffer(render_device_->background_color_);
+    render_device_->ResetZBuffer();
+
+    if (ticket.render_state & RENDER_STATE_OVERDRAW)
+        render_device_->ClearOverdrawBuffer();
+
+    if (ticket.show_model)
+        DrawModel(ticket.box_rotation);
+    else
+        render_device_->DrawBox(ticket.box_rotation, box_mesh_.data());
+
+    render_device_->FlushDeferredRaster();
+
+    if (ticket.render_state & RENDER_STATE_OVERDRAW)
+        ShowOverdrawHeatmap();
+
+    if (ticket.show_hud)
+        perf_hud_.Draw(render_device_);
+
+    render_device_->EndFrame();
+}
+
+void Tiny3DApp::DrawModel(float rotation)
+{
+    // cube_2.plg的边长是10，立方体的边长是2
+    T3DMatrix4X4 scaling;
+    T3DMatrix4X4 rotating;
+    T3DMatrix4X4 world;
+    T3DMatrixMakeScaling(&scaling, 0.2f, 0.2f, 0.2f);
+    T3DMatrixMakeRotation(&rotating, -1.0f, -0.5f, 1.0f, rotation);
+    T3DMatrixMultiply(&world, &scaling, &rotating);
+    render_device_->transform_.SetWorldMatrix(world);
+    render_device_->transform_.Update();
+
+    // PLG模型没有纹理坐标，纹理模式下改用顶点颜色
+    uint32_t render_state = render_device_->render_state();
+
+    if (render_state & RENDER_STATE_TEXTURE)
+        render_device_->set_render_state((render_state & ~RENDER_STATE_TEXTURE) | RENDER_STATE_COLOR);
+
+    render_device_->DrawMesh(&model_mesh_);
+    render_device_->set_render_state(render_state);
+}
+
+void Tiny3DApp::ShowOverdrawHeatmap()
+{
+    render_device_->ApplyOverdrawHeatmap(OVERDRAW_VIEW_TESTED);
+
+    if (++overdraw_frame_count_ % kOverdrawLogInterval != 0)
+        return;
+
+    OverdrawStats stats;
+    render_device_->GatherOverdrawStats(&stats);
+    Log::Info("Overdraw: {} pixels covered, depth complexity mean {:.2f} max {}, writes mean {:.2f} max {}",
+        stats.covered_pixels, stats.mean_tested, stats.max_tested, stats.mean_passed, stats.max_passed);
+}
+
+void Tiny3DApp::PresentRenderTarget(const uint32_t* target)
+{
+    TINY3D_PROFILE_SCOPE(PROFILE_STAGE_PRESENT);
+    TINY3D_TRACE_SCOPE("present");
+    LockBackSurface();
+
+    uint8_t* back_buffer = back_buffer_pointer_;
+    uint32_t pitch = static_cast<uint32_t>(back_surface_->pitch);
+    uint32_t width = wnd_render_area_width_;
+    uint32_t row_bytes = width * sizeof(uint32_t);
+
+    // 按行分块并行拷贝到后台页面
+    job_system_->ParallelFor(wnd_render_area_height_, 32, [=](uint32_t begin, uint32_t end)
+        {
+            for (uint32_t y = begin; y < end; ++y)
+            {
+                memcpy(back_buffer + y * pitch, target + y * width, row_bytes);
+            }
+        });
+
+    UnlockBackSurface();
+
+    SDL_BlitSurface(back_surface_, nullptr, screen_surface_, nullptr);
+    SDL_UpdateWindowSurface(window_);
 }
\ No newline at end of file
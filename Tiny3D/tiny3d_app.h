@@ -25,11 +25,17 @@ SOFTWARE.
 
 #include <cstdint>
 #include <array>
+#include <atomic>
+#include <thread>
 #include "SDL.h"
 
 #include "tiny3d_aligned_class.h"
+#include "tiny3d_asset_watcher.h"
 #include "tiny3d_geometry.h"
 #include "tiny3d_device.h"
+#include "tiny3d_perf_hud.h"
+#include "tiny3d_mesh.h"
+#include "tiny3d_spsc_queue.h"
 
 class alignas(16) Tiny3DApp : public AlignedClass<Tiny3DApp>
 {
@@ -83,7 +89,37 @@ public:
     *************************************************************************************/
     void DestroyRenderDevice();
 
+    /**************************************************************************************
+    设置是否使用流水线渲染模式。流水线模式下由独立的渲染线程绘制第N+1帧，主线程同时
+    呈现第N帧并处理SDL事件。必须在InitRenderDevice之前调用
+    @name: Tiny3DApp::EnablePipelinedRendering
+    @return: void
+    @param: bool enable
+    @param: uint32_t max_frames_in_flight 同时在途的帧数，即渲染目标的个数，取值2或3
+    *************************************************************************************/
+    void EnablePipelinedRendering(bool enable, uint32_t max_frames_in_flight);
+
+    /**************************************************************************************
+    设置是否监视纹理和模型文件，文件被改写后在后台重新加载并在两帧之间换进去。
+    必须在InitRenderDevice之前调用
+    @name: Tiny3DApp::EnableHotReload
+    @return: void
+    @param: bool enable
+    *************************************************************************************/
+    void EnableHotReload(bool enable);
+
 private:
+    // 在渲染线程和主线程之间传递的帧票据，携带了绘制这一帧所需要的全部参数
+    struct FrameTicket
+    {
+        uint32_t target_index;      // 渲染目标的索引
+        float box_rotation;         // 立方体的旋转角度
+        uint32_t render_state;      // 渲染状态
+        bool show_hud;              // 是否叠加显示性能信息
+        bool show_model;            // 绘制PLG模型而不是立方体
+    };
+
+    static const uint32_t kMaxRenderTargets = 3;
     /**************************************************************************************
     
     @name: Tiny3DApp::LockBackSurface
@@ -137,8 +173,75 @@ private:
     @return: void
     *************************************************************************************/
     void RenderScene();
+
+    /**************************************************************************************
+    单线程模式的主循环：事件处理、渲染、呈现依次串行执行
+    @name: Tiny3DApp::RunSerial
+    @return: void
+    *************************************************************************************/
+    void RunSerial();
+
+    /**************************************************************************************
+    流水线模式的主循环：主线程只负责事件处理和呈现，渲染交给渲染线程
+    @name: Tiny3DApp::RunPipelined
+    @return: void
+    *************************************************************************************/
+    void RunPipelined();
+
+    /**************************************************************************************
+    渲染线程的入口函数
+    @name: Tiny3DApp::RenderThreadMain
+    @return: void
+    *************************************************************************************/
+    void RenderThreadMain();
+
+    /**************************************************************************************
+    把一帧画面绘制到指定的渲染目标上
+    @name: Tiny3DApp::RenderFrame
+    @return: void
+    @param: const FrameTicket & ticket
+    *************************************************************************************/
+    void RenderFrame(const FrameTicket& ticket);
+
+    /**************************************************************************************
+    把渲染目标的内容拷贝到后台页面，并呈现到窗口上
+    @name: Tiny3DApp::PresentRenderTarget
+    @return: void
+    @param: const uint32_t * target
+    *************************************************************************************/
+    void PresentRenderTarget(const uint32_t* target);
+
+    /**************************************************************************************
+    用顶点颜色绘制PLG模型，模型按立方体的大小缩放并和立方体一样旋转
+    @name: Tiny3DApp::DrawModel
+    @return: void
+    @param: float rotation
+    *************************************************************************************/
+    void DrawModel(float rotation);
+
+    /**************************************************************************************
+    把刚画完的一帧染成深度复杂度热力图，并定期把过度绘制统计写入日志。只在渲染线程调用
+    @name: Tiny3DApp::ShowOverdrawHeatmap
+    @return: void
+    *************************************************************************************/
+    void ShowOverdrawHeatmap();
+
+    /**************************************************************************************
+
+    @name: Tiny3DApp::CreateRenderTargets
+    @return: void
+    *************************************************************************************/
+    void CreateRenderTargets();
+
+    /**************************************************************************************
+
+    @name: Tiny3DApp::DestroyRenderTargets
+    @return: void
+    *************************************************************************************/
+    void DestroyRenderTargets();
 private:
     Device* render_device_;
+    JobSystem* job_system_;             // 渲染器各阶段共用的任务系统
     uint8_t* back_buffer_pointer_;    // 后台页面的首指针
     SDL_Surface* back_surface_;
     SDL_Surface* screen_surface_;
@@ -151,5 +254,22 @@ private:
     int mouse_wnd_offset_x_;
     int mouse_wnd_offset_y_;
     float box_rotation_delta_ = 0.0f;
+    uint32_t render_state_;             // 由主线程修改，随帧票据传给渲染线程
+    uint32_t overdraw_frame_count_;     // 显示热力图的帧数，只由渲染线程访问
+    bool show_hud_;                     // 由主线程修改，随帧票据传给渲染线程
+    PerfHud perf_hud_;                  // 只由渲染线程访问
     std::array<T3DVertex,8> box_mesh_;
+    T3DMesh model_mesh_;                // 从PLG文件加载的模型
+    bool show_model_;                   // 由主线程修改，随帧票据传给渲染线程
+
+    bool pipelined_rendering_;          // 是否使用流水线渲染模式
+    uint32_t max_frames_in_flight_;     // 流水线模式下渲染目标的个数
+    std::array<uint32_t*, kMaxRenderTargets> render_targets_;
+    SpscQueue<FrameTicket, 4> free_frames_;     // 主线程 -> 渲染线程：可以绘制的渲染目标
+    SpscQueue<FrameTicket, 4> ready_frames_;    // 渲染线程 -> 主线程：已经绘制完成的渲染目标
+    std::thread render_thread_;
+    std::atomic<bool> render_thread_running_;
+
+    bool hot_reload_;                   // 是否监视资源文件
+    AssetWatcher asset_watcher_;        // 换入资源只在渲染线程进行
 };
\ No newline at end of file
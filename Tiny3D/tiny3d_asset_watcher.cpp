@@ -0,0 +1,331 @@
+﻿/*********************************************************************************************
+MIT License
+
+Copyright (c) 2024 kumakoko www.xionggf.com
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*********************************************************************************************/
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <exception>
+#include <filesystem>
+#include <system_error>
+#include <utility>
+
+#if defined(__linux__)
+#include <poll.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+#endif
+
+#include "tiny3d_asset_watcher.h"
+#include "tiny3d_device.h"
+#include "tiny3d_error.h"
+#include "tiny3d_log.h"
+#include "tiny3d_mesh_file.h"
+#include "tiny3d_obj_loader.h"
+#include "tiny3d_plg_loader.h"
+#include "tiny3d_trace.h"
+
+namespace
+{
+    int64_t FileModifyTime(const std::string& path)
+    {
+        std::error_code error;
+        std::filesystem::file_time_type time = std::filesystem::last_write_time(path, error);
+        return error ? 0 : static_cast<int64_t>(time.time_since_epoch().count());
+    }
+
+    // 按扩展名选择模型的加载方式
+    void LoadMesh(const std::string& path, T3DMesh* mesh)
+    {
+        std::string extension = std::filesystem::path(path).extension().string();
+        std::transform(extension.begin(), extension.end(), extension.begin(),
+            [](unsigned char c) { return static_cast<char>(std::tolower(c)); });
+
+        if (extension == ".obj")
+        {
+            // 源文件变了，缓存会因为大小或者修改时间不一致而被重新生成
+            ObjLoader::LoadFromFile(path.c_str(), mesh, nullptr);
+        }
+        else if (extension == ObjLoader::kCacheExtension)
+        {
+            MeshFile mesh_file;
+
+            if (!mesh_file.Open(path.c_str()))
+                throw Error("Invalid mesh file " + path);
+
+            mesh_file.CopyTo(mesh);
+        }
+        else
+        {
+            PlgLoader::LoadFromFile(path.c_str(), mesh);
+        }
+    }
+}
+
+AssetWatcher::AssetWatcher() : running_(false)
+{
+}
+
+AssetWatcher::~AssetWatcher()
+{
+    Stop();
+}
+
+void AssetWatcher::WatchTexture(const char* file_path, TextureHandle handle)
+{
+    AddAsset(file_path, ASSET_TYPE_TEXTURE, handle, nullptr);
+}
+
+void AssetWatcher::WatchMesh(const char* file_path, T3DMesh* mesh)
+{
+    AddAsset(file_path, ASSET_TYPE_MESH, kInvalidTextureHandle, mesh);
+}
+
+void AssetWatcher::AddAsset(const char* file_path, AssetType type, TextureHandle texture_handle, T3DMesh* mesh)
+{
+    std::error_code error;
+    std::filesystem::path path = std::filesystem::absolute(file_path, error).lexically_normal();
+    std::string directory = path.parent_path().string();
+
+    WatchedAsset asset;
+    asset.path = path.string();
+    asset.file_name = path.filename().string();
+    asset.directory_index = static_cast<uint32_t>(std::find(directories_.begin(), directories_.end(), directory) - directories_.begin());
+    asset.type = type;
+    asset.texture_handle = texture_handle;
+    asset.mesh = mesh;
+    asset.modify_time = FileModifyTime(asset.path);
+
+    if (asset.directory_index == directories_.size())
+        directories_.push_back(directory);
+
+    assets_.push_back(asset);
+}
+
+bool AssetWatcher::Start()
+{
+    if (assets_.empty())
+        return false;
+
+    if (!running_.load())
+    {
+        running_.store(true);
+        watcher_thread_ = std::thread(&AssetWatcher::WatcherMain, this);
+    }
+
+    return true;
+}
+
+void AssetWatcher::Stop()
+{
+    running_.store(false);
+
+    if (watcher_thread_.joinable())
+        watcher_thread_.join();
+
+    ReloadedAsset reloaded;
+
+    while (reloaded_.Pop(reloaded))
+    {
+        FreeReloadedAsset(reloaded);
+    }
+}
+
+uint32_t AssetWatcher::ApplyPending(Device* device)
+{
+    uint32_t count = 0;
+    ReloadedAsset reloaded;
+
+    while (reloaded_.Pop(reloaded))
+    {
+        const WatchedAsset& asset = assets_[reloaded.asset_index];
+
+        if (asset.type == ASSET_TYPE_TEXTURE)
+        {
+            device->ReplaceTexture(asset.texture_handle, reloaded.texture);
+        }
+        else
+        {
+            std::swap(*asset.mesh, *reloaded.mesh);
+            delete reloaded.mesh;
+        }
+
+        ++count;
+    }
+
+    return count;
+}
+
+void AssetWatcher::WatcherMain()
+{
+    TINY3D_TRACE_THREAD_NAME("asset_watcher");
+    std::vector<uint32_t> changed;
+
+#if defined(__linux__)
+    // 编辑器保存时要么直接改写文件（IN_CLOSE_WRITE），要么写临时文件再改名（IN_MOVED_TO）
+    int inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    std::vector<int> watch_descriptors(directories_.size(), -1);
+
+    for (uint32_t i = 0; i < directories_.size() && inotify_fd >= 0; ++i)
+    {
+        watch_descriptors[i] = inotify_add_watch(inotify_fd, directories_[i].c_str(), IN_CLOSE_WRITE | IN_MOVED_TO);
+
+        if (watch_descriptors[i] < 0)
+        {
+            Log::Warn("Cannot watch {}, falling back to polling", directories_[i]);
+            close(inotify_fd);
+            inotify_fd = -1;
+        }
+    }
+#endif
+
+    while (running_.load())
+    {
+        changed.clear();
+
+#if defined(__linux__)
+        if (inotify_fd >= 0)
+        {
+            pollfd poll_fd = { inotify_fd, POLLIN, 0 };
+
+            if (poll(&poll_fd, 1, kPollMilliseconds) <= 0)
+                continue;
+
+            alignas(inotify_event) char buffer[4096];
+            ssize_t length;
+
+            while ((length = read(inotify_fd, buffer, sizeof(buffer))) > 0)
+            {
+                for (const char* p = buffer; p < buffer + length; )
+                {
+                    const inotify_event* event = reinterpret_cast<const inotify_event*>(p);
+
+                    for (uint32_t i = 0; i < assets_.size() && event->len > 0; ++i)
+                    {
+                        if (watch_descriptors[assets_[i].directory_index] == event->wd && assets_[i].file_name == event->name)
+                            changed.push_back(i);
+                    }
+
+                    p += sizeof(inotify_event) + event->len;
+                }
+            }
+        }
+        else
+#endif
+        {
+            std::this_thread::sleep_for(std::chrono::milliseconds(kPollMilliseconds));
+            PollModifyTimes(changed);
+        }
+
+        if (changed.empty())
+            continue;
+
+        // 编辑器保存文件可能分几步完成，稍等一下再读
+        std::this_thread::sleep_for(std::chrono::milliseconds(kSettleMilliseconds));
+        std::sort(changed.begin(), changed.end());
+        changed.erase(std::unique(changed.begin(), changed.end()), changed.end());
+
+        for (uint32_t asset_index : changed)
+        {
+            Reload(asset_index);
+        }
+    }
+
+#if defined(__linux__)
+    if (inotify_fd >= 0)
+        close(inotify_fd);
+#endif
+}
+
+void AssetWatcher::PollModifyTimes(std::vector<uint32_t>& changed)
+{
+    for (uint32_t i = 0; i < assets_.size(); ++i)
+    {
+        int64_t modify_time = FileModifyTime(assets_[i].path);
+
+        if (modify_time != 0 && modify_time != assets_[i].modify_time)
+        {
+            assets_[i].modify_time = modify_time;
+            changed.push_back(i);
+        }
+    }
+}
+
+void AssetWatcher::Reload(uint32_t asset_index)
+{
+    TINY3D_TRACE_SCOPE("reload_asset");
+    const WatchedAsset& asset = assets_[asset_index];
+    ReloadedAsset reloaded = { asset_index, nullptr, nullptr };
+
+    try
+    {
+        if (asset.type == ASSET_TYPE_TEXTURE)
+        {
+            reloaded.texture = Device::DecodeTextureFile(asset.path.c_str(), nullptr);
+
+            if (reloaded.texture == nullptr)
+                throw Error("cannot decode image");
+        }
+        else
+        {
+            reloaded.mesh = new T3DMesh();
+            LoadMesh(asset.path, reloaded.mesh);
+        }
+    }
+    catch (const Error& e)
+    {
+        Log::Warn("Cannot reload {}: {}", asset.path, e.Message());
+        FreeReloadedAsset(reloaded);
+        return;
+    }
+    catch (const std::exception& e)
+    {
+        Log::Warn("Cannot reload {}: {}", asset.path, e.what());
+        FreeReloadedAsset(reloaded);
+        return;
+    }
+
+    // 队列满说明渲染线程很久没有取走资源，等它取走或者监视停止
+    while (!reloaded_.Push(reloaded))
+    {
+        if (!running_.load())
+        {
+            FreeReloadedAsset(reloaded);
+            return;
+        }
+
+        std::this_thread::sleep_for(std::chrono::milliseconds(kPollMilliseconds));
+    }
+
+    Log::Info("Reloaded {}", asset.path);
+}
+
+void AssetWatcher::FreeReloadedAsset(const ReloadedAsset& reloaded)
+{
+    if (reloaded.texture != nullptr)
+    {
+        delete[] reloaded.texture->texels;
+        delete reloaded.texture;
+    }
+
+    delete reloaded.mesh;
+}
@@ -0,0 +1,166 @@
+﻿/*********************************************************************************************
+MIT License
+
+Copyright (c) 2024 kumakoko www.xionggf.com
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*********************************************************************************************/
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "tiny3d_mesh.h"
+#include "tiny3d_spsc_queue.h"
+#include "tiny3d_texture.h"
+
+class Device;
+
+//=====================================================================
+// 资源热重载
+//=====================================================================
+
+// 监视已加载的纹理和模型所在的目录。文件被改写之后由监视线程重新解码，解码好的资源放进队列，
+// 渲染线程在两帧之间把它们换进原来的纹理句柄和网格里。渲染线程只做不阻塞的出队和指针交换，
+// 从不等待磁盘读取和解码；文件写了一半导致解码失败时保留旧的资源，等下一次写完再重试。
+// Linux上用inotify接收目录的变化，其他平台定期比较文件的修改时间
+class AssetWatcher
+{
+public:
+    AssetWatcher();
+
+    ~AssetWatcher();
+
+    /**************************************************************************************
+    监视纹理文件，变化后替换handle对应的纹理。必须在Start之前调用
+    @name: AssetWatcher::WatchTexture
+    @return: void
+    @param: const char * file_path
+    @param: TextureHandle handle
+    *************************************************************************************/
+    void WatchTexture(const char* file_path, TextureHandle handle);
+
+    /**************************************************************************************
+    监视模型文件（PLG/PLX/OBJ/网格文件），变化后替换mesh的内容。mesh必须存活到Stop之后。
+    必须在Start之前调用
+    @name: AssetWatcher::WatchMesh
+    @return: void
+    @param: const char * file_path
+    @param: T3DMesh * mesh
+    *************************************************************************************/
+    void WatchMesh(const char* file_path, T3DMesh* mesh);
+
+    /**************************************************************************************
+    启动监视线程，监视所有已登记文件所在的目录
+    @name: AssetWatcher::Start
+    @return: bool 没有登记任何文件时返回false
+    *************************************************************************************/
+    bool Start();
+
+    /**************************************************************************************
+    停止监视线程并丢弃还没有换进去的资源
+    @name: AssetWatcher::Stop
+    @return: void
+    *************************************************************************************/
+    void Stop();
+
+    /**************************************************************************************
+    把已经解码好的资源换进设备和网格。只能在渲染线程的两帧之间调用，不会阻塞
+    @name: AssetWatcher::ApplyPending
+    @return: uint32_t 这次替换的资源个数
+    @param: Device * device
+    *************************************************************************************/
+    uint32_t ApplyPending(Device* device);
+
+private:
+    enum AssetType
+    {
+        ASSET_TYPE_TEXTURE = 0,
+        ASSET_TYPE_MESH,
+    };
+
+    // 一个被监视的文件
+    struct WatchedAsset
+    {
+        std::string path;           // 规范化之后的完整路径
+        std::string file_name;
+        uint32_t directory_index;   // 所在目录在directories_中的下标
+        AssetType type;
+        TextureHandle texture_handle;
+        T3DMesh* mesh;
+        int64_t modify_time;        // 上一次看到的修改时间，轮询时使用
+    };
+
+    // 解码完成、等待换进去的资源
+    struct ReloadedAsset
+    {
+        uint32_t asset_index;       // 在assets_中的下标
+        T3DTexture* texture;
+        T3DMesh* mesh;
+    };
+
+    static const uint32_t kPollMilliseconds = 100;   // 监视线程检查停止标志和轮询修改时间的间隔
+    static const uint32_t kSettleMilliseconds = 50;  // 收到变化之后再等这么久才解码，等编辑器写完文件
+
+    /**************************************************************************************
+    监视线程的入口函数
+    @name: AssetWatcher::WatcherMain
+    @return: void
+    *************************************************************************************/
+    void WatcherMain();
+
+    /**************************************************************************************
+    重新解码一个资源并放进队列，失败时写日志并保留旧的资源
+    @name: AssetWatcher::Reload
+    @return: void
+    @param: uint32_t asset_index
+    *************************************************************************************/
+    void Reload(uint32_t asset_index);
+
+    /**************************************************************************************
+    比较每个文件的修改时间，返回发生变化的文件
+    @name: AssetWatcher::PollModifyTimes
+    @return: void
+    @param: std::vector<uint32_t> & changed
+    *************************************************************************************/
+    void PollModifyTimes(std::vector<uint32_t>& changed);
+
+    /**************************************************************************************
+    登记一个被监视的文件
+    @name: AssetWatcher::AddAsset
+    @return: void
+    @param: const char * file_path
+    @param: AssetType type
+    @param: TextureHandle texture_handle
+    @param: T3DMesh * mesh
+    *************************************************************************************/
+    void AddAsset(const char* file_path, AssetType type, TextureHandle texture_handle, T3DMesh* mesh);
+
+    static void FreeReloadedAsset(const ReloadedAsset& reloaded);
+
+    std::vector<WatchedAsset> assets_;
+    std::vector<std::string> directories_;
+    SpscQueue<ReloadedAsset, 64> reloaded_;     // 监视线程 -> 渲染线程
+    std::thread watcher_thread_;
+    std::atomic<bool> running_;
+};
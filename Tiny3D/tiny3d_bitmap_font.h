@@ -0,0 +1,77 @@
+﻿/*********************************************************************************************
+MIT License
+
+Copyright (c) 2024 kumakoko www.xionggf.com
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*********************************************************************************************/
+
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+//=====================================================================
+// 点阵字体
+//=====================================================================
+
+// 5x7的点阵字体，覆盖ASCII 32到126。字形数据以每行一个字节的形式编译进程序，
+// 构造时展开成每个点一个字节的字形图集，绘制时不需要再做位运算。小写字母使用大写字母的字形
+class BitmapFont
+{
+public:
+    static const uint32_t kGlyphWidth = 5;      // 字形的宽度，单位为点
+    static const uint32_t kGlyphHeight = 7;     // 字形的高度，单位为点
+    static const uint32_t kAdvanceX = 6;        // 相邻两个字符的水平间距，包含1点空白
+    static const uint32_t kAdvanceY = 9;        // 相邻两行的垂直间距，包含2点空白
+    static const uint32_t kFirstChar = 32;
+    static const uint32_t kLastChar = 126;
+
+    /**************************************************************************************
+    构造函数，展开字形图集
+    @name: BitmapFont::BitmapFont
+    @return:
+    *************************************************************************************/
+    BitmapFont();
+
+    /**************************************************************************************
+    取得字符的字形，kGlyphWidth * kGlyphHeight个字节，按行排列，非0表示该点需要绘制。
+    不在字体范围内的字符返回'?'的字形
+    @name: BitmapFont::Glyph
+    @return: const uint8_t*
+    @param: char c
+    *************************************************************************************/
+    const uint8_t* Glyph(char c) const;
+
+    /**************************************************************************************
+    计算一段文字绘制出来的宽度和高度，单位为像素。文字中可以包含换行符
+    @name: BitmapFont::Measure
+    @return: void
+    @param: const char * text
+    @param: uint32_t scale 每个点放大的倍数
+    @param: uint32_t * width
+    @param: uint32_t * height
+    *************************************************************************************/
+    static void Measure(const char* text, uint32_t scale, uint32_t* width, uint32_t* height);
+
+private:
+    static const uint32_t kGlyphSize = kGlyphWidth * kGlyphHeight;
+
+    std::vector<uint8_t> atlas_;    // 字形图集，第i个字形从 (i - kFirstChar) * kGlyphSize 开始
+};
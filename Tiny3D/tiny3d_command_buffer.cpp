@@ -0,0 +1,108 @@
+﻿/*********************************************************************************************
+MIT License
+
+Copyright (c) 2024 kumakoko www.xionggf.com
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*********************************************************************************************/
+#include "tiny3d_command_buffer.h"
+#include "tiny3d_device.h"
+
+CommandBuffer::CommandBuffer()
+{
+    Reset();
+}
+
+void CommandBuffer::Reset()
+{
+    commands_.clear();
+    matrices_.clear();
+    vertices_.clear();
+    render_state_ = RENDER_STATE_TEXTURE;
+    texture_ = kInvalidTextureHandle;
+    translucent_ = false;
+
+    // 没有调用过SetWorldMatrix时使用单位矩阵
+    T3DMatrix4X4 identity;
+    T3DMatrixIdentity(&identity);
+    matrices_.push_back(identity);
+}
+
+void CommandBuffer::SetWorldMatrix(const T3DMatrix4X4& m)
+{
+    matrices_.push_back(m);
+}
+
+void CommandBuffer::SetTexture(TextureHandle texture)
+{
+    texture_ = texture;
+}
+
+void CommandBuffer::SetRenderState(uint32_t render_state)
+{
+    render_state_ = render_state;
+}
+
+void CommandBuffer::SetTranslucent(bool translucent)
+{
+    translucent_ = translucent;
+}
+
+void CommandBuffer::DrawPrimitive(const T3DVertex* v1, const T3DVertex* v2, const T3DVertex* v3)
+{
+    const T3DVertex* vertices[3] = { v1, v2, v3 };
+    Record(DRAW_COMMAND_PRIMITIVE, vertices, 3);
+}
+
+void CommandBuffer::DrawPlane(const T3DVertex* p1, const T3DVertex* p2, const T3DVertex* p3, const T3DVertex* p4)
+{
+    const T3DVertex* vertices[4] = { p1, p2, p3, p4 };
+    Record(DRAW_COMMAND_PLANE, vertices, 4);
+}
+
+void CommandBuffer::DrawBox(const T3DVertex* box_vertices)
+{
+    const T3DVertex* vertices[8];
+
+    for (uint32_t i = 0; i < 8; ++i)
+    {
+        vertices[i] = &box_vertices[i];
+    }
+
+    Record(DRAW_COMMAND_BOX, vertices, 8);
+}
+
+void CommandBuffer::Record(DrawCommandType type, const T3DVertex* const* vertices, uint32_t vertex_count)
+{
+    DrawCommand command;
+    command.type = type;
+    command.matrix_index = static_cast<uint32_t>(matrices_.size() - 1);
+    command.vertex_offset = static_cast<uint32_t>(vertices_.size());
+    command.render_state = render_state_;
+    command.texture = texture_;
+    command.translucent = translucent_;
+
+    // 顶点按值拷贝，录制完成后调用者的顶点数据可以随意修改或释放
+    for (uint32_t i = 0; i < vertex_count; ++i)
+    {
+        vertices_.push_back(*vertices[i]);
+    }
+
+    commands_.push_back(command);
+}
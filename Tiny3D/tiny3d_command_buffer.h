@@ -0,0 +1,175 @@
+﻿/*********************************************************************************************
+MIT License
+
+Copyright (c) 2024 kumakoko www.xionggf.com
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*********************************************************************************************/
+
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "tiny3d_geometry.h"
+#include "tiny3d_matrix.h"
+#include "tiny3d_texture.h"
+
+//=====================================================================
+// 命令缓冲区
+//=====================================================================
+
+// 绘制命令的类型，决定了命令在顶点数组中占用的顶点数
+enum DrawCommandType
+{
+    DRAW_COMMAND_PRIMITIVE = 0, // 三角形，3个顶点
+    DRAW_COMMAND_PLANE,         // 平面，4个顶点
+    DRAW_COMMAND_BOX            // 立方体，8个顶点
+};
+
+// 录制下来的一条绘制命令。矩阵和顶点存放在命令缓冲区的线性数组里，命令本身只记录下标
+struct DrawCommand
+{
+    DrawCommandType type;
+    uint32_t matrix_index;      // 世界矩阵在matrices_中的下标
+    uint32_t vertex_offset;     // 第一个顶点在vertices_中的下标
+    uint32_t render_state;      // 渲染状态
+    TextureHandle texture;      // 纹理，kInvalidTextureHandle表示使用提交时设备绑定的纹理
+    bool translucent;           // 是否半透明
+};
+
+// 每个线程各自持有一个命令缓冲区录制绘制命令，录制过程不需要任何同步，
+// 最后统一交给Device::SubmitCommandBuffers排序回放
+class CommandBuffer
+{
+public:
+    /**************************************************************************************
+    构造函数
+    @name: CommandBuffer::CommandBuffer
+    @return:
+    *************************************************************************************/
+    CommandBuffer();
+
+    /**************************************************************************************
+    清空录制的命令，恢复默认状态。已分配的内存保留给下一帧使用
+    @name: CommandBuffer::Reset
+    @return: void
+    *************************************************************************************/
+    void Reset();
+
+    /**************************************************************************************
+    设置之后录制的命令使用的世界矩阵
+    @name: CommandBuffer::SetWorldMatrix
+    @return: void
+    @param: const T3DMatrix4X4 & m
+    *************************************************************************************/
+    void SetWorldMatrix(const T3DMatrix4X4& m);
+
+    /**************************************************************************************
+    设置之后录制的命令使用的纹理
+    @name: CommandBuffer::SetTexture
+    @return: void
+    @param: TextureHandle texture
+    *************************************************************************************/
+    void SetTexture(TextureHandle texture);
+
+    /**************************************************************************************
+    设置之后录制的命令使用的渲染状态
+    @name: CommandBuffer::SetRenderState
+    @return: void
+    @param: uint32_t render_state
+    *************************************************************************************/
+    void SetRenderState(uint32_t render_state);
+
+    /**************************************************************************************
+    设置之后录制的命令是否半透明。半透明命令排在不透明命令之后，由远及近绘制
+    @name: CommandBuffer::SetTranslucent
+    @return: void
+    @param: bool translucent
+    *************************************************************************************/
+    void SetTranslucent(bool translucent);
+
+    /**************************************************************************************
+    录制一个三角形
+    @name: CommandBuffer::DrawPrimitive
+    @return: void
+    @param: const T3DVertex * v1
+    @param: const T3DVertex * v2
+    @param: const T3DVertex * v3
+    *************************************************************************************/
+    void DrawPrimitive(const T3DVertex* v1, const T3DVertex* v2, const T3DVertex* v3);
+
+    /**************************************************************************************
+    录制一个平面
+    @name: CommandBuffer::DrawPlane
+    @return: void
+    @param: const T3DVertex * p1
+    @param: const T3DVertex * p2
+    @param: const T3DVertex * p3
+    @param: const T3DVertex * p4
+    *************************************************************************************/
+    void DrawPlane(const T3DVertex* p1, const T3DVertex* p2, const T3DVertex* p3, const T3DVertex* p4);
+
+    /**************************************************************************************
+    录制一个立方体
+    @name: CommandBuffer::DrawBox
+    @return: void
+    @param: const T3DVertex * box_vertices 立方体的8个顶点
+    *************************************************************************************/
+    void DrawBox(const T3DVertex* box_vertices);
+
+    inline uint32_t command_count() const
+    {
+        return static_cast<uint32_t>(commands_.size());
+    }
+
+    inline const DrawCommand& command(uint32_t index) const
+    {
+        return commands_[index];
+    }
+
+    inline const T3DMatrix4X4& matrix(uint32_t index) const
+    {
+        return matrices_[index];
+    }
+
+    inline const T3DVertex* vertices(uint32_t offset) const
+    {
+        return &vertices_[offset];
+    }
+
+private:
+    /**************************************************************************************
+    以当前状态追加一条命令，并把顶点拷贝进顶点数组
+    @name: CommandBuffer::Record
+    @return: void
+    @param: DrawCommandType type
+    @param: const T3DVertex * const * vertices
+    @param: uint32_t vertex_count
+    *************************************************************************************/
+    void Record(DrawCommandType type, const T3DVertex* const* vertices, uint32_t vertex_count);
+
+private:
+    std::vector<DrawCommand> commands_;     // 录制的命令
+    std::vector<T3DMatrix4X4> matrices_;    // 命令引用的世界矩阵
+    std::vector<T3DVertex> vertices_;       // 命令引用的顶点
+    uint32_t render_state_;                 // 当前的渲染状态
+    TextureHandle texture_;                 // 当前的纹理
+    bool translucent_;                      // 当前是否半透明
+};
@@ -1,322 +1,1376 @@
-﻿#include <cstdlib>
+#include <cstdlib>
 #include <cassert>
 #include <cstring>
+#include <cmath>
+#include <algorithm>
 #include "SDL.h"
 #include "SDL_image.h"
 
 #include "tiny3d_device.h"
 #include "tiny3d_math.h"
 #include "tiny3d_error.h"
+#include "tiny3d_aligned_class.h"
+#include "tiny3d_command_buffer.h"
+#include "tiny3d_log.h"
+#include "tiny3d_profiler.h"
+#include "tiny3d_trace.h"
+#include "tiny3d_simd.h"
+#include "tiny3d_texture_file.h"
+#include "tiny3d_vertex_shader.h"
+
+// 清屏、纹理转换等按行并行的工作，每个任务处理的行数
+static const uint32_t kRowsPerJob = 32;
+
+// 和Device::ParallelFor相同，供不访问设备状态的静态函数使用
+template<typename F>
+static void ParallelRows(JobSystem* job_system, uint32_t row_count, F&& f)
+{
+    if (job_system != nullptr)
+        job_system->ParallelFor(row_count, kRowsPerJob, f);
+    else
+        f(0, row_count);
+}
+
+// 多线程光栅化时，保证各线程负责的行组起始地址对齐的cache line大小
+static const uint32_t kCacheLineSize = 64;
+
+// 并行变换顶点时每个任务处理的顶点数
+static const uint32_t kVerticesPerJob = 256;
+
+// 延迟光栅化时每次从帧内存池分配的梯形个数
+static const uint32_t kTrapezoidsPerBin = 256;
 
+// 最初的若干帧里各种容器还在增长，之后才开始检查每帧的堆分配
+static const uint32_t kAllocationWarmupFrames = 8;
+
+// 投影矩阵的近、远裁剪面
+static const float kNearClip = 1.0f;
+static const float kFarClip = 500.0f;
+
+// 命令排序键中深度的位数，近、远裁剪面之间均匀地分成2^kCommandDepthBits个深度段
+static const uint32_t kCommandDepthBits = 12;
+
+// 过度绘制热力图的调色板，下标为次数，最后一项用于所有更大的次数
+static const uint32_t kOverdrawPalette[] =
+{
+    0x00000000, 0xFF0000C0, 0xFF0080FF, 0xFF00C000, 0xFFFFFF00, 0xFFFF8000, 0xFFFF0000, 0xFFFF00FF
+};
+static const uint32_t kOverdrawPaletteSize = sizeof(kOverdrawPalette) / sizeof(kOverdrawPalette[0]);
 
 void Device::Initialize(int width, int height)
 {
-    this->texture_width_ = 0;
-    this->texture_height_ = 0;
     this->texture_ = nullptr;
-    this->z_buffer_ = new float[width * height];
-    this->max_u_ = 1.0f;
-    this->max_v_ = 1.0f;
+    this->pixel_shader_ = nullptr;
+    this->pixel_shader_rasterizer_ = nullptr;
+    this->ambient_light_ = { 0.0f, 0.0f, 0.0f };
+    this->light_count_ = 0;
+    this->z_buffer_ = static_cast<float*>(AlignedMalloc(sizeof(float) * width * height, kCacheLineSize));
+    this->overdraw_buffer_ = static_cast<OverdrawSample*>(AlignedMalloc(sizeof(OverdrawSample) * width * height, kCacheLineSize));
+    std::memset(this->overdraw_buffer_, 0, sizeof(OverdrawSample) * width * height);
+    this->font_ = new BitmapFont();
     this->window_width_ = width;
     this->window_height_ = height;
     this->background_color_ = 0xFFc0c0c0;
     this->foreground_color_ = 0xFFFFFFFF;
     this->render_state_ = RENDER_STATE_TEXTURE;
-    float near_clip = 1.0f;
-    float far_clip = 500.0f;
-    this->transform_.Init(width, height, near_clip, far_clip);
+    this->job_system_ = nullptr;
+    this->raster_mode_ = RASTER_MODE_IMMEDIATE;
+    this->raster_thread_count_ = 0;
+    this->deferred_bins_ = nullptr;
+    this->deferred_bins_tail_ = nullptr;
+    this->deferred_trapezoid_count_ = 0;
+    this->frame_arenas_.push_back(new FrameArena());
+    this->frame_count_ = 0;
+    this->frame_allocation_mark_ = 0;
+    this->transform_.Init(width, height, kNearClip, kFarClip);
 }
 
 // 删除设备
 void Device::Destroy()
 {
     this->frame_buffer_ = nullptr;
-    delete[] this->z_buffer_;
+    AlignedFree(this->z_buffer_);
     this->z_buffer_ = nullptr;
-    delete[] this->texture_;
+    AlignedFree(this->overdraw_buffer_);
+    this->overdraw_buffer_ = nullptr;
+    delete this->font_;
+    this->font_ = nullptr;
     this->texture_ = nullptr;
+
+    for (T3DTexture* texture : this->textures_)
+    {
+        delete[] texture->texels;
+        delete texture;
+    }
+
+    this->textures_.clear();
+
+    for (FrameArena* arena : this->frame_arenas_)
+    {
+        delete arena;
+    }
+
+    this->frame_arenas_.clear();
+    this->deferred_bins_ = nullptr;
+    this->deferred_bins_tail_ = nullptr;
+    this->deferred_trapezoid_count_ = 0;
+}
+
+void Device::set_job_system(JobSystem* job_system)
+{
+    this->job_system_ = job_system;
+    uint32_t thread_count = (job_system != nullptr) ? job_system->worker_count() + 1 : 1;
+
+    while (this->frame_arenas_.size() < thread_count)
+    {
+        this->frame_arenas_.push_back(new FrameArena());
+    }
 }
 
 // 清空 framebuffer 和 zbuffer
 void Device::ResetZBuffer()
 {
-    // 清空zbuffer
-    for (uint32_t y = 0; y < this->window_height_ * this->window_width_; y++)
+    TINY3D_PROFILE_SCOPE(PROFILE_STAGE_CLEAR);
+    TINY3D_TRACE_SCOPE("clear_depth");
+
+    // 清空zbuffer，按行分块并行
+    float* z_buffer = this->z_buffer_;
+    uint32_t width = this->window_width_;
+
+    ParallelFor(this->window_height_, kRowsPerJob, [z_buffer, width](uint32_t begin, uint32_t end)
+        {
+            std::fill(z_buffer + begin * width, z_buffer + end * width, 0.0f);
+        });
+}
+
+// 用指定颜色填充framebuffer
+void Device::ClearFrameBuffer(uint32_t color)
+{
+    TINY3D_PROFILE_SCOPE(PROFILE_STAGE_CLEAR);
+    TINY3D_TRACE_SCOPE("clear_color");
+    uint32_t* frame_buffer = this->frame_buffer_;
+    uint32_t width = this->window_width_;
+
+    ParallelFor(this->window_height_, kRowsPerJob, [frame_buffer, width, color](uint32_t begin, uint32_t end)
+        {
+            std::fill(frame_buffer + begin * width, frame_buffer + end * width, color);
+        });
+}
+
+void Device::ClearOverdrawBuffer()
+{
+    TINY3D_PROFILE_SCOPE(PROFILE_STAGE_CLEAR);
+    OverdrawSample* overdraw = this->overdraw_buffer_;
+    uint32_t width = this->window_width_;
+    ParallelFor(this->window_height_, kRowsPerJob, [overdraw, width](uint32_t begin, uint32_t end)
+        {
+            std::memset(overdraw + begin * width, 0, sizeof(OverdrawSample) * (end - begin) * width);
+        });
+}
+
+void Device::ApplyOverdrawHeatmap(OverdrawView view)
+{
+    uint32_t* frame_buffer = this->frame_buffer_;
+    const OverdrawSample* overdraw = this->overdraw_buffer_;
+    uint32_t width = this->window_width_;
+    ParallelFor(this->window_height_, kRowsPerJob, [frame_buffer, overdraw, width, view](uint32_t begin, uint32_t end)
+        {
+            for (uint32_t i = begin * width; i < end * width; ++i)
+            {
+                uint32_t count = (view == OVERDRAW_VIEW_TESTED) ? overdraw[i].tested : overdraw[i].passed;
+
+                if (count == 0)
+                    continue;
+
+                // 原色和热力图颜色各取一半
+                uint32_t heat = kOverdrawPalette[std::min(count, kOverdrawPaletteSize - 1)];
+                frame_buffer[i] = 0xFF000000 | (((frame_buffer[i] >> 1) & 0x7F7F7F) + ((heat >> 1) & 0x7F7F7F));
+            }
+        });
+}
+
+void Device::GatherOverdrawStats(OverdrawStats* stats) const
+{
+    std::memset(stats, 0, sizeof(OverdrawStats));
+    uint64_t total_tested = 0;
+    uint64_t total_passed = 0;
+    uint32_t pixel_count = this->window_width_ * this->window_height_;
+
+    for (uint32_t i = 0; i < pixel_count; ++i)
+    {
+        const OverdrawSample& sample = this->overdraw_buffer_[i];
+
+        if (sample.tested == 0)
+            continue;
+
+        ++stats->covered_pixels;
+        total_tested += sample.tested;
+        total_passed += sample.passed;
+        stats->max_tested = std::max<uint32_t>(stats->max_tested, sample.tested);
+        stats->max_passed = std::max<uint32_t>(stats->max_passed, sample.passed);
+        ++stats->passed_histogram[std::min<uint32_t>(sample.passed, kOverdrawHistogramBins - 1)];
+    }
+
+    if (stats->covered_pixels > 0)
+    {
+        stats->mean_tested = static_cast<double>(total_tested) / stats->covered_pixels;
+        stats->mean_passed = static_cast<double>(total_passed) / stats->covered_pixels;
+    }
+}
+
+// 画点
+void Device::WritePixel(uint32_t x, uint32_t y, uint32_t color)
+{
+    if (x < this->window_width_ && y < this->window_height_)
+    {
+        uint32_t idx = x + this->window_width_ * y;
+        this->frame_buffer_[idx] = color;
+    }
+}
+
+void Device::WritePixel(uint32_t x, uint32_t y, uint32_t color, const RasterRowSet& rows)
+{
+    if (x >= this->window_width_ || y >= this->window_height_)
+        return;
+
+    int32_t row = static_cast<int32_t>(y);
+
+    if (rows.mode == RASTER_MODE_INTERLEAVED)
+    {
+        if ((row / rows.granule) % rows.count != rows.index)
+            return;
+    }
+    else if (row < rows.band_begin || row >= rows.band_end)
+    {
+        return;
+    }
+
+    this->frame_buffer_[x + this->window_width_ * y] = color;
+}
+
+void Device::FillRect(int32_t x, int32_t y, int32_t width, int32_t height, uint32_t color, uint32_t alpha)
+{
+    int32_t x0 = std::max(x, 0);
+    int32_t y0 = std::max(y, 0);
+    int32_t x1 = std::min(x + width, static_cast<int32_t>(this->window_width_));
+    int32_t y1 = std::min(y + height, static_cast<int32_t>(this->window_height_));
+
+    if (x0 >= x1 || y0 >= y1)
+        return;
+
+    if (alpha >= 255)
+    {
+        for (int32_t row = y0; row < y1; ++row)
+        {
+            uint32_t* dst = this->frame_buffer_ + row * this->window_width_;
+            std::fill(dst + x0, dst + x1, color);
+        }
+
+        return;
+    }
+
+    // 红蓝两个通道放在同一个32位整数里一起乘，绿色通道单独乘
+    uint32_t src_rb = (color & 0xFF00FF) * alpha;
+    uint32_t src_g = (color & 0x00FF00) * alpha;
+    uint32_t inv_alpha = 255 - alpha;
+
+    for (int32_t row = y0; row < y1; ++row)
+    {
+        uint32_t* dst = this->frame_buffer_ + row * this->window_width_;
+
+        for (int32_t col = x0; col < x1; ++col)
+        {
+            uint32_t c = dst[col];
+            uint32_t rb = ((c & 0xFF00FF) * inv_alpha + src_rb) >> 8;
+            uint32_t g = ((c & 0x00FF00) * inv_alpha + src_g) >> 8;
+            dst[col] = 0xFF000000 | (rb & 0xFF00FF) | (g & 0x00FF00);
+        }
+    }
+}
+
+void Device::DrawString(int32_t x, int32_t y, const char* text, uint32_t color, uint32_t scale)
+{
+    int32_t width = static_cast<int32_t>(this->window_width_);
+    int32_t height = static_cast<int32_t>(this->window_height_);
+    int32_t pen_x = x;
+    int32_t pen_y = y;
+    int32_t step = static_cast<int32_t>(scale);
+
+    for (const char* p = text; *p != '\0'; ++p)
+    {
+        if (*p == '\n')
+        {
+            pen_x = x;
+            pen_y += BitmapFont::kAdvanceY * step;
+            continue;
+        }
+
+        const uint8_t* glyph = this->font_->Glyph(*p);
+
+        for (uint32_t gy = 0; gy < BitmapFont::kGlyphHeight; ++gy)
+        {
+            for (uint32_t gx = 0; gx < BitmapFont::kGlyphWidth; ++gx)
+            {
+                if (glyph[gy * BitmapFont::kGlyphWidth + gx] == 0)
+                    continue;
+
+                // 每个点放大成scale * scale的方块
+                int32_t px = pen_x + static_cast<int32_t>(gx) * step;
+                int32_t py = pen_y + static_cast<int32_t>(gy) * step;
+
+                for (int32_t sy = std::max(py, 0); sy < std::min(py + step, height); ++sy)
+                {
+                    uint32_t* dst = this->frame_buffer_ + sy * this->window_width_;
+
+                    for (int32_t sx = std::max(px, 0); sx < std::min(px + step, width); ++sx)
+                    {
+                        dst[sx] = color;
+                    }
+                }
+            }
+        }
+
+        pen_x += BitmapFont::kAdvanceX * step;
+    }
+}
+
+// 绘制线段
+void Device::DrawLine(uint32_t x1, uint32_t y1, uint32_t x2, uint32_t y2, uint32_t c)
+{
+    ForEachLinePixel(x1, y1, x2, y2, [&](uint32_t x, uint32_t y)
+        {
+            WritePixel(x, y, c);
+        });
+}
+
+void Device::DrawLine(uint32_t x1, uint32_t y1, uint32_t x2, uint32_t y2, uint32_t c, const RasterRowSet& rows)
+{
+    // 线段完全落在别的线程负责的行里时不必逐点遍历，线框的线段通常都很短
+    uint32_t y_min = std::min(y1, y2);
+    uint32_t y_max = std::max(y1, y2);
+
+    if (rows.mode == RASTER_MODE_INTERLEAVED)
+    {
+        uint32_t group = y_min / static_cast<uint32_t>(rows.granule);
+
+        if (group == y_max / static_cast<uint32_t>(rows.granule) && group % static_cast<uint32_t>(rows.count) != static_cast<uint32_t>(rows.index))
+            return;
+    }
+    else if (y_max < static_cast<uint32_t>(rows.band_begin) || y_min >= static_cast<uint32_t>(rows.band_end))
+    {
+        return;
+    }
+
+    ForEachLinePixel(x1, y1, x2, y2, [&](uint32_t x, uint32_t y)
+        {
+            WritePixel(x, y, c, rows);
+        });
+}
+
+// 根据坐标读取纹理
+uint32_t Device::GetTexel(float u, float v)
+{
+    return GetTexel(this->texture_, u, v);
+}
+
+uint32_t Device::GetTexel(const T3DTexture* texture, float u, float v)
+{
+    return T3DTextureSample(texture, u, v);
+}
+
+// 绘制扫描线
+void Device::DrawScanline(scanline_t* scanline)
+{
+    DrawScanline(scanline, this->render_state_, this->texture_);
+}
+
+void Device::DrawScanline(scanline_t* scanline, uint32_t render_state, const T3DTexture* texture)
+{
+    uint32_t pixels_tested = 0;
+    uint32_t pixels_written = 0;
+    bool fetch_texel = (render_state & RENDER_STATE_TEXTURE) && texture != nullptr;
+    bool count_overdraw = (render_state & RENDER_STATE_OVERDRAW) != 0;
+    bool depth_test = !(render_state & RENDER_STATE_NO_DEPTH_TEST);
+
+    // 根据扫描线的y，即帧缓冲像素点所在行，算出要写入的frame buffer首指针
+    // 以及对应的z buffer首指针
+    uint32_t* fb = this->frame_buffer_ + this->window_width_ * scanline->y;
+    float* zbuffer = this->z_buffer_ + this->window_width_ * scanline->y;
+    OverdrawSample* overdraw = this->overdraw_buffer_ + this->window_width_ * scanline->y;
+
+    int32_t x = scanline->left_end_point_x;
+    int32_t w = scanline->width;
+    int32_t width = static_cast<int32_t>(this->window_width_);
+
+    for (; w > 0; x++, w--)
+    {
+        if (x >= 0 && x < width) // 只绘制在屏幕内扫描线部分
+        {
+            float rhw = scanline->interpolated_point.rhw;
+            ++pixels_tested;
+
+            if (count_overdraw)
+                ++overdraw[x].tested;
+
+            if (!depth_test || rhw >= zbuffer[x]) // 比较Z缓冲区值，只有大于当前zbuffer值，即比当前像素点靠近镜头的像素点会写入到fb
+            {
+                float w = 1.0f / rhw;
+
+                if (depth_test)
+                    zbuffer[x] = rhw;
+
+                ++pixels_written;
+
+                if (count_overdraw)
+                    ++overdraw[x].passed;
+
+                if (render_state & RENDER_STATE_COLOR)
+                {
+                    uint32_t R = static_cast<uint32_t>(scanline->interpolated_point.color.r * w * 255.0f);
+                    uint32_t G = static_cast<uint32_t>(scanline->interpolated_point.color.g * w * 255.0f);
+                    uint32_t B = static_cast<uint32_t>(scanline->interpolated_point.color.b * w * 255.0f);
+                    R = Clamp<uint32_t>(R, 0, 255);
+                    G = Clamp<uint32_t>(G, 0, 255);
+                    B = Clamp<uint32_t>(B, 0, 255);
+                    fb[x] = 0xFF000000 | (R << 16) | (G << 8) | (B);
+                }
+
+                if (fetch_texel)
+                {
+                    float u = scanline->interpolated_point.tc.u * w;
+                    float v = scanline->interpolated_point.tc.v * w;
+                    uint32_t cc = GetTexel(texture, u, v);
+                    fb[x] = 0xFF000000 | cc;
+                }
+            }
+        }
+
+        // 从左腰边的插值点开始，每循环一次递加一次【插值步】，然后进行渲染写入操作
+        T3DVertexAdd(&scanline->interpolated_point, &scanline->interpolated_step);
+
+        if (x >= width)
+            break;
+    }
+
+    TINY3D_PROFILE_COUNT(PROFILE_COUNTER_PIXELS_TESTED, pixels_tested);
+    TINY3D_PROFILE_COUNT(PROFILE_COUNTER_PIXELS_WRITTEN, pixels_written);
+    TINY3D_PROFILE_COUNT(PROFILE_COUNTER_TEXEL_FETCHES, fetch_texel ? pixels_written : 0);
+}
+
+// 主渲染函数，把一个梯形分解成若干条扫描线，然后绘制
+// 扫描线
+void Device::RenderTrapezoid(const Trapezoid* trap)
+{
+    TINY3D_PROFILE_SCOPE(PROFILE_STAGE_RASTER);
+    RasterRowSet rows = { RASTER_MODE_IMMEDIATE, 0, 1, 1, 0, static_cast<int32_t>(window_height_) };
+    DeferredTrapezoid item = { *trap, this->render_state_, this->texture_, this->pixel_shader_rasterizer_, this->pixel_shader_, 0 };
+    RenderDeferredTrapezoid(item, rows);
+}
+
+void Device::RenderTrapezoid(const Trapezoid* trap, const RasterRowSet& rows, uint32_t render_state, const T3DTexture* texture)
+{
+    TINY3D_PROFILE_SCOPE(PROFILE_STAGE_SHADING);
+    uint32_t scanline_count = ForEachScanline(trap, rows, [&](scanline_t* scanline)
+        {
+            DrawScanline(scanline, render_state, texture);
+        });
+
+    TINY3D_PROFILE_COUNT(PROFILE_COUNTER_SCANLINES, scanline_count);
+}
+
+void Device::DrawFlatScanline(scanline_t* scanline, uint32_t color, uint32_t render_state)
+{
+    uint32_t pixels_written = 0;
+    bool count_overdraw = (render_state & RENDER_STATE_OVERDRAW) != 0;
+    bool depth_test = !(render_state & RENDER_STATE_NO_DEPTH_TEST);
+
+    uint32_t* fb = this->frame_buffer_ + this->window_width_ * scanline->y;
+    float* zbuffer = this->z_buffer_ + this->window_width_ * scanline->y;
+    OverdrawSample* overdraw = this->overdraw_buffer_ + this->window_width_ * scanline->y;
+
+    int32_t x = scanline->left_end_point_x;
+    int32_t w = scanline->width;
+    int32_t width = static_cast<int32_t>(this->window_width_);
+
+    // 颜色处处相同，只有1/w需要逐像素递加。屏幕左边之外的像素也照样递加，
+    // 这样每个像素的1/w和DrawScanline逐个累加出来的值完全相同
+    float rhw = scanline->interpolated_point.rhw;
+    float rhw_step = scanline->interpolated_step.rhw;
+
+    for (; w > 0 && x < 0; x++, w--)
+        rhw += rhw_step;
+
+    // 先把扫描线裁剪到屏幕内，后面的循环不再逐像素判断边界
+    w = std::min(w, width - x);
+
+    if (w <= 0)
+        return;
+
+    int32_t end = x + w;
+    uint32_t pixels_tested = static_cast<uint32_t>(w);
+
+    if (!depth_test)
+    {
+        // 不做深度测试时整段就是一次填充，编译器会把它展开成宽的存储指令
+        std::fill_n(fb + x, w, color);
+        pixels_written = pixels_tested;
+
+        for (; count_overdraw && x < end; x++)
+        {
+            ++overdraw[x].tested;
+            ++overdraw[x].passed;
+        }
+    }
+    else
     {
-        this->z_buffer_[y] = 0;
+#if defined(TINY3D_SIMD_SSE)
+        // 一次比较4个像素的深度，按通过的掩码混合后整体写回深度缓存和帧缓存
+        if (!count_overdraw)
+        {
+            __m128i color4 = _mm_set1_epi32(static_cast<int>(color));
+
+            for (; x + SIMD_WIDTH <= end; x += SIMD_WIDTH)
+            {
+                float rhw1 = rhw + rhw_step;
+                float rhw2 = rhw1 + rhw_step;
+                float rhw3 = rhw2 + rhw_step;
+                __m128 z = _mm_set_ps(rhw3, rhw2, rhw1, rhw);
+                rhw = rhw3 + rhw_step;
+
+                __m128 old_z = _mm_loadu_ps(zbuffer + x);
+                __m128 pass = _mm_cmpge_ps(z, old_z);
+                uint32_t mask = static_cast<uint32_t>(_mm_movemask_ps(pass));
+
+                if (mask == 0)
+                    continue;
+
+                __m128i* fb4 = reinterpret_cast<__m128i*>(fb + x);
+
+                if (mask == 0xF)
+                {
+                    _mm_storeu_ps(zbuffer + x, z);
+                    _mm_storeu_si128(fb4, color4);
+                    pixels_written += SIMD_WIDTH;
+                    continue;
+                }
+
+                __m128i pass_i = _mm_castps_si128(pass);
+                _mm_storeu_ps(zbuffer + x, _mm_or_ps(_mm_and_ps(pass, z), _mm_andnot_ps(pass, old_z)));
+                _mm_storeu_si128(fb4, _mm_or_si128(_mm_and_si128(pass_i, color4), _mm_andnot_si128(pass_i, _mm_loadu_si128(fb4))));
+                pixels_written += (mask & 1) + ((mask >> 1) & 1) + ((mask >> 2) & 1) + (mask >> 3);
+            }
+        }
+#endif
+
+        for (; x < end; x++)
+        {
+            if (count_overdraw)
+                ++overdraw[x].tested;
+
+            if (rhw >= zbuffer[x])
+            {
+                zbuffer[x] = rhw;
+                fb[x] = color;
+                ++pixels_written;
+
+                if (count_overdraw)
+                    ++overdraw[x].passed;
+            }
+
+            rhw += rhw_step;
+        }
     }
+
+    TINY3D_PROFILE_COUNT(PROFILE_COUNTER_PIXELS_TESTED, pixels_tested);
+    TINY3D_PROFILE_COUNT(PROFILE_COUNTER_PIXELS_WRITTEN, pixels_written);
+}
+
+void Device::RenderFlatTrapezoid(const Trapezoid* trap, const RasterRowSet& rows, uint32_t render_state, uint32_t color)
+{
+    TINY3D_PROFILE_SCOPE(PROFILE_STAGE_SHADING);
+    uint32_t scanline_count = ForEachScanline(trap, rows, [&](scanline_t* scanline)
+        {
+            DrawFlatScanline(scanline, color, render_state);
+        });
+
+    TINY3D_PROFILE_COUNT(PROFILE_COUNTER_SCANLINES, scanline_count);
+}
+
+void Device::RenderDeferredTrapezoid(const DeferredTrapezoid& item, const RasterRowSet& rows)
+{
+    if (item.rasterizer != nullptr)
+        item.rasterizer(this, &item.trapezoid, rows, item.render_state, item.texture, item.shader);
+    else if (item.flat_color != 0)
+        RenderFlatTrapezoid(&item.trapezoid, rows, item.render_state, item.flat_color);
+    else
+        RenderTrapezoid(&item.trapezoid, rows, item.render_state, item.texture);
+}
+
+void Device::ClearPixelShader()
+{
+    this->pixel_shader_ = nullptr;
+    this->pixel_shader_rasterizer_ = nullptr;
+}
+
+void Device::SetRasterMode(RasterMode mode, uint32_t thread_count)
+{
+    // 切换模式之前先把已经记录下来的图元画完
+    FlushDeferredRaster();
+    this->raster_mode_ = mode;
+    this->raster_thread_count_ = thread_count;
+}
+
+void Device::FlushDeferredRaster()
+{
+    if (deferred_bins_ == nullptr && deferred_lines_.empty())
+        return;
+
+    TINY3D_TRACE_SCOPE("flush_deferred_raster");
+    int32_t thread_count = static_cast<int32_t>(raster_thread_count_);
+
+    if (thread_count == 0)
+        thread_count = (job_system_ != nullptr) ? static_cast<int32_t>(job_system_->worker_count()) + 1 : 1;
+
+    // 行组的行数取能使每组起始地址都对齐到cache line的最小值，
+    // 例如宽度为1024像素时一行就是4096字节，行组只需要一行
+    uint32_t row_bytes = window_width_ * sizeof(uint32_t);
+    uint32_t alignment = kCacheLineSize;
+
+    while (alignment > 1 && (row_bytes % alignment) != 0)
+        alignment >>= 1;
+
+    int32_t granule = static_cast<int32_t>(kCacheLineSize / alignment);
+    int32_t wnd_h = static_cast<int32_t>(window_height_);
+    int32_t band_rows = (wnd_h + thread_count - 1) / thread_count;
+    band_rows = (band_rows + granule - 1) / granule * granule;
+    RasterMode mode = raster_mode_;
+
+    // 最后一个梯形之后记录的线段不会再被梯形覆盖，不必每个线程都遍历一遍，
+    // 留到最后在当前线程按顺序画出。只画线框时所有线段都属于这一部分
+    const DeferredLine* lines_begin = deferred_lines_.data();
+    const DeferredLine* lines_end = lines_begin + deferred_lines_.size();
+    const DeferredLine* trailing_lines = lines_end;
+
+    while (trailing_lines != lines_begin && (trailing_lines - 1)->sequence == deferred_trapezoid_count_)
+        --trailing_lines;
+
+    ParallelFor(static_cast<uint32_t>(thread_count), 1, [&](uint32_t begin, uint32_t end)
+        {
+            for (uint32_t k = begin; k < end; ++k)
+            {
+                TINY3D_TRACE_SCOPE("raster_band");
+                TINY3D_PROFILE_SCOPE(PROFILE_STAGE_RASTER);
+                int32_t index = static_cast<int32_t>(k);
+                RasterRowSet rows = { mode, index, thread_count, granule,
+                    std::min(index * band_rows, wnd_h), std::min((index + 1) * band_rows, wnd_h) };
+
+                // 线框线段和梯形按记录的顺序交替绘制，每个线程只画本线程负责的行，
+                // 后画的覆盖先画的，结果和立即模式完全相同
+                const DeferredLine* line = lines_begin;
+                uint32_t sequence = 0;
+
+                for (const TrapezoidBin* bin = deferred_bins_; bin != nullptr; bin = bin->next)
+                {
+                    for (uint32_t i = 0; i < bin->count; ++i, ++sequence)
+                    {
+                        for (; line != trailing_lines && line->sequence <= sequence; ++line)
+                            DrawLine(line->x1, line->y1, line->x2, line->y2, line->color, rows);
+
+                        // 梯形在光栅化时是只读的，所有线程共用同一份
+                        RenderDeferredTrapezoid(bin->items[i], rows);
+                    }
+                }
+            }
+        });
+
+    if (trailing_lines != lines_end)
+    {
+        TINY3D_PROFILE_SCOPE(PROFILE_STAGE_RASTER);
+
+        for (const DeferredLine* line = trailing_lines; line != lines_end; ++line)
+            DrawLine(line->x1, line->y1, line->x2, line->y2, line->color);
+    }
+
+    // 梯形占用的内存在EndFrame时随帧内存池一起回收；
+    // clear只会重置元素个数，保留已分配的容量供下一帧使用
+    deferred_bins_ = nullptr;
+    deferred_bins_tail_ = nullptr;
+    deferred_trapezoid_count_ = 0;
+    deferred_lines_.clear();
+}
+
+void Device::EndFrame()
+{
+    assert(deferred_bins_ == nullptr);
+
+    for (FrameArena* arena : frame_arenas_)
+    {
+        arena->Reset();
+    }
+
+#if defined(TINY3D_COUNT_ALLOCATIONS)
+    uint64_t allocation_count = HeapAllocationCount();
+
+    if (frame_count_ >= kAllocationWarmupFrames && allocation_count != frame_allocation_mark_)
+    {
+        Log::Warn("Frame {} performed {} heap allocations", frame_count_, allocation_count - frame_allocation_mark_);
+    }
+
+    frame_allocation_mark_ = allocation_count;
+#endif
+
+    ++frame_count_;
+}
+
+bool Device::TransformVertex(T3DVertex* transformed, const T3DVertex* vertex) const
+{
+    T3DVector4 c;
+
+    // 把传递进来的顶点，乘以WVP矩阵，变换到裁剪空间
+    this->transform_.Apply(&c, &vertex->pos);
+
+    // 裁剪，注意此处可以完善为具体判断几个点在 cvv内以及同cvv相交平面的坐标比例
+    // 进行进一步精细裁剪，将一个分解为几个完全处在 cvv内的三角形
+    if (this->transform_.CheckCVV(&c) != 0)
+        return false;
+
+    // 把裁剪空间归一化到齐次的NDC空间，w保留裁剪空间的值供透视除使用
+    *transformed = *vertex;
+    this->transform_.Homogenize(&transformed->pos, &c);
+    transformed->pos.w = c.w;
+
+    T3DVertexRHWInit(transformed); // 重新对纹理映射坐标和颜色值做透视除
+    return true;
+}
+
+// 根据三角形在CVV之内的顶点个数决定是否丢弃，同时统计剔除和裁剪的三角形数。
+// 目前还没有裁剪器，和CVV相交的三角形也整个丢弃
+static bool RejectTriangle(uint32_t inside_count)
+{
+    if (inside_count == 3)
+        return false;
+
+    if (inside_count == 0)
+        TINY3D_PROFILE_COUNT(PROFILE_COUNTER_TRIANGLES_CULLED, 1);
+    else
+        TINY3D_PROFILE_COUNT(PROFILE_COUNTER_TRIANGLES_CLIPPED, 1);
+
+    return true;
+}
+
+// 根据 render_state 绘制原始三角形
+void Device::DrawPrimitive(const T3DVertex* v1, const T3DVertex* v2, const T3DVertex* v3)
+{
+    TINY3D_PROFILE_COUNT(PROFILE_COUNTER_TRIANGLES_SUBMITTED, 1);
+
+    // 延迟光栅化时梯形引用的顶点要存活到FlushDeferredRaster，放在帧内存池里
+    T3DVertex local[3];
+    T3DVertex* t = (this->raster_mode_ != RASTER_MODE_IMMEDIATE) ? frame_arena()->AllocateClippedVertices(3) : local;
+    uint32_t inside_count = 0;
+
+    {
+        TINY3D_PROFILE_SCOPE(PROFILE_STAGE_VERTEX_TRANSFORM);
+        inside_count += TransformVertex(&t[0], v1) ? 1 : 0;
+        inside_count += TransformVertex(&t[1], v2) ? 1 : 0;
+        inside_count += TransformVertex(&t[2], v3) ? 1 : 0;
+    }
+
+    {
+        TINY3D_PROFILE_SCOPE(PROFILE_STAGE_CLIP_CULL);
+
+        if (RejectTriangle(inside_count))
+            return;
+    }
+
+    SetupTriangle(&t[0], &t[1], &t[2]);
+}
+
+// 屏幕空间中y轴向下，顶点按顺时针排列的三角形是正面
+static bool IsBackFacing(const T3DVertex* t1, const T3DVertex* t2, const T3DVertex* t3)
+{
+    float area = (t2->pos.x - t1->pos.x) * (t3->pos.y - t1->pos.y) - (t2->pos.y - t1->pos.y) * (t3->pos.x - t1->pos.x);
+
+    if (area < 0.0f)
+    {
+        TINY3D_PROFILE_COUNT(PROFILE_COUNTER_TRIANGLES_CULLED, 1);
+        return true;
+    }
+
+    return false;
+}
+
+void Device::DrawIndexedPrimitives(const T3DPackedVertex* vertices, uint32_t vertex_count, const uint32_t* indices, uint32_t index_count,
+    const uint8_t* triangle_flags)
+{
+    TINY3D_TRACE_SCOPE("draw_indexed_primitives");
+    assert(T3DMeshIndicesInRange(indices, index_count, vertex_count));
+    uint32_t triangle_count = index_count / 3;
+    TINY3D_PROFILE_COUNT(PROFILE_COUNTER_TRIANGLES_SUBMITTED, triangle_count);
+
+    // 变换后顶点缓存，以及每个顶点是否在CVV之内
+    FrameArena* arena = frame_arena();
+    T3DVertex* cache = arena->AllocateClippedVertices(vertex_count);
+    uint8_t* inside = arena->AllocateArray<uint8_t>(vertex_count);
+
+    ParallelFor(vertex_count, kVerticesPerJob, [&](uint32_t begin, uint32_t end)
+        {
+            TINY3D_PROFILE_SCOPE(PROFILE_STAGE_VERTEX_TRANSFORM);
+
+            for (uint32_t i = begin; i < end; ++i)
+            {
+                T3DVertex vertex;
+                T3DVertexUnpack(&vertex, &vertices[i]);
+                inside[i] = TransformVertex(&cache[i], &vertex) ? 1 : 0;
+            }
+        });
+
+    SetupIndexedTriangles(cache, inside, indices, triangle_count, triangle_flags);
+}
+
+void Device::SetupIndexedTriangles(const T3DVertex* cache, const uint8_t* inside, const uint32_t* indices, uint32_t triangle_count,
+    const uint8_t* triangle_flags)
+{
+    // 先剔除，把留下来的三角形在索引数组中的位置紧凑地记录下来，再逐个设置
+    uint32_t* accepted = frame_arena()->AllocateArray<uint32_t>(triangle_count);
+    uint32_t accepted_count = 0;
+
+    {
+        TINY3D_PROFILE_SCOPE(PROFILE_STAGE_CLIP_CULL);
+        accepted_count = CullTriangles(cache, inside, indices, triangle_flags, 0, triangle_count, accepted, 0);
+    }
+
+    for (uint32_t k = 0; k < accepted_count; ++k)
+    {
+        const uint32_t* triangle = &indices[accepted[k]];
+        SetupTriangle(&cache[triangle[0]], &cache[triangle[1]], &cache[triangle[2]]);
+    }
+}
+
+uint32_t Device::CullTriangles(const T3DVertex* cache, const uint8_t* inside, const uint32_t* indices, const uint8_t* triangle_flags,
+    uint32_t first_index, uint32_t triangle_count, uint32_t* accepted, uint32_t accepted_count)
+{
+    uint32_t end = first_index + triangle_count * 3;
+
+    for (uint32_t i = first_index; i < end; i += 3)
+    {
+        uint32_t inside_count = inside[indices[i]] + inside[indices[i + 1]] + inside[indices[i + 2]];
+
+        if (RejectTriangle(inside_count))
+            continue;
+
+        if (triangle_flags != nullptr && !(triangle_flags[i / 3] & POLY_FLAG_2SIDED) &&
+            IsBackFacing(&cache[indices[i]], &cache[indices[i + 1]], &cache[indices[i + 2]]))
+            continue;
+
+        accepted[accepted_count++] = i;
+    }
+
+    return accepted_count;
+}
+
+void Device::DrawMesh(const T3DMesh* mesh)
+{
+    if (this->render_state_ & RENDER_STATE_LIGHTING)
+    {
+        DrawLitMesh(mesh);
+        return;
+    }
+
+    DrawIndexedPrimitives(mesh->vertices.data(), static_cast<uint32_t>(mesh->vertices.size()),
+        mesh->indices.data(), static_cast<uint32_t>(mesh->indices.size()), T3DMeshTriangleFlags(mesh));
+}
+
+// RGBA8颜色换算成[0, 1]，和T3DVertexUnpack相同
+static T3DColor UnpackColor(uint32_t packed)
+{
+    const float inv_255 = 1.0f / 255.0f;
+    T3DColor color;
+    color.r = static_cast<float>(packed & 0xFF) * inv_255;
+    color.g = static_cast<float>((packed >> 8) & 0xFF) * inv_255;
+    color.b = static_cast<float>((packed >> 16) & 0xFF) * inv_255;
+    return color;
+}
+
+// [0, 1]的颜色换算成帧缓存格式，和DrawScanline相同
+static uint32_t PackFrameBufferColor(const T3DColor& color)
+{
+    uint32_t R = Clamp<uint32_t>(static_cast<uint32_t>(color.r * 255.0f), 0, 255);
+    uint32_t G = Clamp<uint32_t>(static_cast<uint32_t>(color.g * 255.0f), 0, 255);
+    uint32_t B = Clamp<uint32_t>(static_cast<uint32_t>(color.b * 255.0f), 0, 255);
+    return 0xFF000000 | (R << 16) | (G << 8) | (B);
 }
 
-// 画点
-void Device::WritePixel(uint32_t x, uint32_t y, uint32_t color)
+// 变换后的顶点颜色已经乘过1/w，先除回去再换算成帧缓存格式
+static uint32_t PackVertexColor(const T3DVertex* vertex)
 {
-    if (x < this->window_width_ && y < this->window_height_)
-    {
-        uint32_t idx = x + this->window_width_ * y;
-        this->frame_buffer_[idx] = color;
-    }
+    float w = 1.0f / vertex->rhw;
+    T3DColor color = { vertex->color.r * w, vertex->color.g * w, vertex->color.b * w };
+    return PackFrameBufferColor(color);
 }
 
-// 绘制线段
-void Device::DrawLine(uint32_t x1, uint32_t y1, uint32_t x2, uint32_t y2, uint32_t c)
+void Device::DrawLitMesh(const T3DMesh* mesh)
 {
-    uint32_t x, y, rem = 0;
+    TINY3D_TRACE_SCOPE("draw_lit_mesh");
+    const T3DPackedVertex* vertices = mesh->vertices.data();
+    const uint32_t* indices = mesh->indices.data();
+    const uint8_t* triangle_flags = T3DMeshTriangleFlags(mesh);
+    uint32_t vertex_count = static_cast<uint32_t>(mesh->vertices.size());
+    uint32_t triangle_count = static_cast<uint32_t>(mesh->indices.size() / 3);
+    bool has_normals = !mesh->normals.empty();
+    assert(T3DMeshIndicesInRange(indices, mesh->indices.size(), vertex_count));
+    TINY3D_PROFILE_COUNT(PROFILE_COUNTER_TRIANGLES_SUBMITTED, triangle_count);
+
+    FrameArena* arena = frame_arena();
+    T3DVertex* cache = arena->AllocateClippedVertices(vertex_count);
+    uint8_t* inside = arena->AllocateArray<uint8_t>(vertex_count);
+    VertexStreams streams = MakeVertexStreams(mesh);
+    const T3DMatrix4X4& world = this->transform_.world_matrix();
+    const T3DMatrix4X4& wvp = this->transform_.wvp_matrix();
+    float screen_width = static_cast<float>(this->window_width_);
+    float screen_height = static_cast<float>(this->window_height_);
+
+    // 逐顶点光照，每SIMD_WIDTH个顶点一批
+    ParallelFor((vertex_count + SIMD_WIDTH - 1) / SIMD_WIDTH, kVertexBatchesPerJob, [&](uint32_t begin, uint32_t end)
+        {
+            TINY3D_PROFILE_SCOPE(PROFILE_STAGE_VERTEX_TRANSFORM);
+
+            for (uint32_t b = begin; b < end; ++b)
+            {
+                uint32_t first = b * SIMD_WIDTH;
+                uint32_t count = std::min<uint32_t>(SIMD_WIDTH, vertex_count - first);
+                VertexBatchInput input;
+                VertexBatchOutput output;
+                LoadVertexBatch(streams, first, count, VERTEX_ATTRIBUTE_NORMAL | VERTEX_ATTRIBUTE_COLOR | VERTEX_ATTRIBUTE_TEXCOORD, &input);
+                TransformPoint(output.position, input.position, wvp);
+                output.texcoord[0] = input.texcoord[0];
+                output.texcoord[1] = input.texcoord[1];
+
+                if (has_normals)
+                {
+                    SimdFloat position[4], normal[3], light[3];
+                    TransformPoint(position, input.position, world);
+                    TransformDirection(normal, input.normal, world);
+                    Normalize3(normal);
+                    EvaluateLights(light, position, normal, lights_, light_count_, ambient_light_);
+
+                    for (uint32_t c = 0; c < 3; ++c)
+                        output.color[c] = input.color[c] * light[c];
+                }
+                else
+                {
+                    for (uint32_t c = 0; c < 3; ++c)
+                        output.color[c] = input.color[c];
+                }
+
+                FinishVertexBatch(output, count, screen_width, screen_height, cache + first, inside + first);
+            }
+        });
+
+    uint32_t* accepted = arena->AllocateArray<uint32_t>(triangle_count);
+    uint32_t accepted_count = 0;
 
-    // 首先检查 x1 == x2 && y1 == y2，即起点和终点重合的情况。这种情况下，仅需在 x1, y1
-    // 位置调用 WritePixel 写入颜色 c 即可。
-    if (x1 == x2 && y1 == y2)
     {
-        WritePixel(x1, y1, c);
+        TINY3D_PROFILE_SCOPE(PROFILE_STAGE_CLIP_CULL);
+        accepted_count = CullTriangles(cache, inside, indices, triangle_flags, 0, triangle_count, accepted, 0);
     }
-    else if (x1 == x2) // o	如果 x1 == x2，说明线段垂直
-    {
-        // 通过检查 y1 <= y2 来确定绘制的方向（向上或向下）
-        int32_t inc = (y1 <= y2) ? 1 : -1;
 
-        for (y = y1; y != y2; y += inc)
-        {
-            // 从 y1行递增或递减到y2行，每次在x1列调用 WritePixel绘制
-            WritePixel(x1, y, c);
-        }
+    // 挑出要逐面计算光照的三角形，没有法线时Gouraud着色也退化成平面着色
+    uint32_t* flat = arena->AllocateArray<uint32_t>(accepted_count);
+    uint32_t flat_count = 0;
 
-        WritePixel(x2, y2, c); // 最后，在x2,y2位置再调用一次WritePixel以确保终点被绘制
-    }
-    else if (y1 == y2) // 如果 y1 == y2，说明线段水平
+    for (uint32_t k = 0; k < accepted_count; ++k)
     {
-        // 如果 y1 == y2，说明线段水平。同样，通过检查 x1 <= x2 来确定绘制方向（向左或向右），
-        // 然后在y1行从x1列到x2列逐步绘制。最后，调用 WritePixel(x2, y2, c) 绘制终点。
-        int32_t inc = (x1 <= x2) ? 1 : -1;
+        uint8_t shade_mode = (triangle_flags != nullptr) ? (triangle_flags[accepted[k] / 3] & POLY_SHADE_MODE_MASK) : POLY_SHADE_MODE_GOURAUD;
 
-        for (x = x1; x != x2; x += inc)
-        {
-            WritePixel(x, y1, c);
-        }
-
-        WritePixel(x2, y2, c); // 最后，在x2,y2位置再调用一次WritePixel以确保终点被绘制
+        if (shade_mode == POLY_SHADE_MODE_FLAT || (shade_mode != POLY_SHADE_MODE_CONSTANT && !has_normals))
+            flat[flat_count++] = accepted[k];
     }
-    else
-    {
-        // 如果线段既不是水平线也不是垂直线，将根据 dx（水平距离）和 dy（垂直距离）来选择绘制主方向
 
-        uint32_t dx = (x1 < x2) ? x2 - x1 : x1 - x2; // 水平方向距离 
-        uint32_t dy = (y1 < y2) ? y2 - y1 : y1 - y2; // 垂直方向距离 
+    // 逐面光照，每SIMD_WIDTH个面一批。法线取面的法线，位置取重心，颜色取第一个顶点的颜色
+    T3DColor* face_colors = arena->AllocateArray<T3DColor>(flat_count);
 
-        if (dx >= dy) // 如果 dx >= dy，说明水平距离较大，则在 x 方向上逐步绘制
+    ParallelFor((flat_count + SIMD_WIDTH - 1) / SIMD_WIDTH, kVertexBatchesPerJob, [&](uint32_t begin, uint32_t end)
         {
-            if (x2 < x1)
-            {
-                std::swap(x1, x2);
-                std::swap(y1, y2);
-                //x = x1, y = y1, x1 = x2, y1 = y2, x2 = x, y2 = y;
-            }
+            TINY3D_PROFILE_SCOPE(PROFILE_STAGE_VERTEX_TRANSFORM);
 
-            // 程序从 x1 到 x2 逐步递增 x，并调用 WritePixel 绘制每个像素。
-            // 变量 rem 用来记录累积的误差。当累积的误差 rem >= dx 时，次方向 
-            // y 会递增或递减一次，并更新 rem -= dx 来重置误差。
-            for (x = x1, y = y1; x <= x2; x++)
+            for (uint32_t b = begin; b < end; ++b)
             {
-                WritePixel(x, y, c);
-                rem += dy;
+                uint32_t first = b * SIMD_WIDTH;
+                uint32_t count = std::min<uint32_t>(SIMD_WIDTH, flat_count - first);
+                float corners[3][3][SIMD_WIDTH];
+                float base[3][SIMD_WIDTH];
 
-                // 从 x1 开始，每次绘制(x, y) 处的像素，并增加 rem += dy。
-                // 当 rem >= dx 时，说明需要调整 y 方向的坐标，此时将 y 递增或递减一次，并 rem -= dx。
-                if (rem >= dx)
+                for (uint32_t k = 0; k < SIMD_WIDTH; ++k)
                 {
-                    rem -= dx;
-                    y += (y2 >= y1) ? 1 : -1;
-                    WritePixel(x, y, c);
+                    const uint32_t* triangle = &indices[flat[first + std::min(k, count - 1)]];
+
+                    for (uint32_t v = 0; v < 3; ++v)
+                    {
+                        corners[v][0][k] = vertices[triangle[v]].x;
+                        corners[v][1][k] = vertices[triangle[v]].y;
+                        corners[v][2][k] = vertices[triangle[v]].z;
+                    }
+
+                    T3DColor color = UnpackColor(vertices[triangle[0]].color);
+                    base[0][k] = color.r;
+                    base[1][k] = color.g;
+                    base[2][k] = color.b;
                 }
-            }
 
-            WritePixel(x2, y2, c);
-        }
-        else // 如果 dx < dy，说明垂直距离较大，则在y方向上逐步绘制
-        {
-            if (y2 < y1)
-            {
-                std::swap(x1, x2);
-                std::swap(y1, y2);
-                //x = x1, y = y1, x1 = x2, y1 = y2, x2 = x, y2 = y;
-            }
+                SimdFloat p[3][3], e1[3], e2[3], centroid[3], normal[3], world_normal[3], position[4], light[3];
+                SimdFloat one_third = SimdFloat::Splat(1.0f / 3.0f);
 
-            // 程序从 y1 到 y2 逐步递增 y，并在(x, y) 处绘制像素。
-            // 变量 rem 记录误差。当 rem >= dy 时，水平方向 x 会递增或递减一次，随后 rem -= dy 来重置误差。
-            for (x = x1, y = y1; y <= y2; y++)
-            {
-                WritePixel(x, y, c);
-                rem += dx;
+                for (uint32_t v = 0; v < 3; ++v)
+                {
+                    for (uint32_t c = 0; c < 3; ++c)
+                        p[v][c] = SimdFloat::Load(corners[v][c]);
+                }
 
-                // 从 y1 开始，每次绘制(x, y) 处的像素，并增加 rem += dx。
-                // 当 rem >= dy 时，调整 x 方向的坐标，递增或递减一次 x 并 rem -= dy。
-                if (rem >= dy)
+                for (uint32_t c = 0; c < 3; ++c)
                 {
-                    rem -= dy;
-                    x += (x2 >= x1) ? 1 : -1;
-                    WritePixel(x, y, c);
+                    e1[c] = p[1][c] - p[0][c];
+                    e2[c] = p[2][c] - p[0][c];
+                    centroid[c] = (p[0][c] + p[1][c] + p[2][c]) * one_third;
                 }
+
+                normal[0] = e1[1] * e2[2] - e1[2] * e2[1];
+                normal[1] = e1[2] * e2[0] - e1[0] * e2[2];
+                normal[2] = e1[0] * e2[1] - e1[1] * e2[0];
+                TransformPoint(position, centroid, world);
+                TransformDirection(world_normal, normal, world);
+                Normalize3(world_normal);
+                EvaluateLights(light, position, world_normal, lights_, light_count_, ambient_light_);
+
+                float lit[3][SIMD_WIDTH];
+
+                for (uint32_t c = 0; c < 3; ++c)
+                    (SimdFloat::Load(base[c]) * light[c]).Store(lit[c]);
+
+                for (uint32_t k = 0; k < count; ++k)
+                    face_colors[first + k] = { lit[0][k], lit[1][k], lit[2][k] };
             }
+        });
+
+    // 平面着色和固定颜色的三角形把三个顶点拷贝出来换上不插值的颜色，颜色处处相同时走固定颜色填充
+    uint32_t f = 0;
+
+    for (uint32_t k = 0; k < accepted_count; ++k)
+    {
+        const uint32_t* triangle = &indices[accepted[k]];
+        uint8_t shade_mode = (triangle_flags != nullptr) ? (triangle_flags[accepted[k] / 3] & POLY_SHADE_MODE_MASK) : POLY_SHADE_MODE_GOURAUD;
+        bool is_flat = (f < flat_count && flat[f] == accepted[k]);
+
+        if (!is_flat && shade_mode != POLY_SHADE_MODE_CONSTANT)
+        {
+            SetupTriangle(&cache[triangle[0]], &cache[triangle[1]], &cache[triangle[2]]);
+            continue;
+        }
+
+        T3DVertex* t = arena->AllocateClippedVertices(3);
+        uint32_t flat_color = 0;
+
+        for (uint32_t v = 0; v < 3; ++v)
+        {
+            t[v] = cache[triangle[v]];
+            T3DColor color = is_flat ? face_colors[f] : UnpackColor(vertices[triangle[v]].color);
+            t[v].color.r = color.r * t[v].rhw;
+            t[v].color.g = color.g * t[v].rhw;
+            t[v].color.b = color.b * t[v].rhw;
+        }
 
-            WritePixel(x2, y2, c);
+        if (is_flat)
+        {
+            flat_color = PackFrameBufferColor(face_colors[f]);
+            ++f;
+        }
+        else if (vertices[triangle[0]].color == vertices[triangle[1]].color && vertices[triangle[0]].color == vertices[triangle[2]].color)
+        {
+            flat_color = PackFrameBufferColor(UnpackColor(vertices[triangle[0]].color));
         }
+
+        SetupTriangle(&t[0], &t[1], &t[2], flat_color);
     }
 }
 
-// 根据坐标读取纹理
-uint32_t Device::GetTexel(float u, float v)
+void Device::SetAmbientLight(const T3DColor& color)
 {
-    u = u * this->max_u_;
-    v = v * this->max_v_;
-    int32_t x = static_cast<int32_t>(u + 0.5f);
-    int32_t y = static_cast<int32_t>(v + 0.5f);
-    x = Clamp<int32_t>(x, 0, this->texture_width_ - 1);
-    y = Clamp<int32_t>(y, 0, this->texture_height_ - 1);
-    return this->texture_[y * texture_width_ + x];
+    this->ambient_light_ = color;
 }
 
-// 绘制扫描线
-void Device::DrawScanline(scanline_t* scanline)
+bool Device::AddLight(const T3DLight& light)
 {
-    // 根据扫描线的y，即帧缓冲像素点所在行，算出要写入的frame buffer首指针
-    // 以及对应的z buffer首指针
-    uint32_t* fb = this->frame_buffer_ + this->window_width_ * scanline->y;
-    float* zbuffer = this->z_buffer_ + this->window_width_ * scanline->y;
+    if (this->light_count_ >= kMaxLights)
+        return false;
 
-    int32_t x = scanline->left_end_point_x;
-    int32_t w = scanline->width;
-    int32_t width = static_cast<int32_t>(this->window_width_);
+    this->lights_[this->light_count_++] = light;
+    return true;
+}
 
-    for (; w > 0; x++, w--)
+void Device::ClearLights()
+{
+    this->light_count_ = 0;
+}
+
+bool Device::IsBoxOutsideFrustum(const float* box_min, const float* box_max) const
+{
+    // 八个角的裁剪码按位与，某一位仍然是1说明所有的角都在同一个裁剪面之外
+    uint32_t outside = 0xFFFFFFFF;
+
+    for (uint32_t corner = 0; corner < 8 && outside != 0; ++corner)
     {
-        if (x >= 0 && x < width) // 只绘制在屏幕内扫描线部分
-        {
-            float rhw = scanline->interpolated_point.rhw;
+        T3DVector4 p, c;
+        p.x = (corner & 1) ? box_max[0] : box_min[0];
+        p.y = (corner & 2) ? box_max[1] : box_min[1];
+        p.z = (corner & 4) ? box_max[2] : box_min[2];
+        p.w = 1.0f;
+        this->transform_.Apply(&c, &p);
+        outside &= this->transform_.CheckCVV(&c);
+    }
 
-            if (rhw >= zbuffer[x]) // 比较Z缓冲区值，只有大于当前zbuffer值，即比当前像素点靠近镜头的像素点会写入到fb
-            {
-                float w = 1.0f / rhw;
-                zbuffer[x] = rhw;
+    return outside != 0;
+}
 
-                if (render_state_ & RENDER_STATE_COLOR)
-                {
-                    uint32_t R = static_cast<uint32_t>(scanline->interpolated_point.color.r * w * 255.0f);
-                    uint32_t G = static_cast<uint32_t>(scanline->interpolated_point.color.g * w * 255.0f);
-                    uint32_t B = static_cast<uint32_t>(scanline->interpolated_point.color.b * w * 255.0f);
-                    R = Clamp<uint32_t>(R, 0, 255);
-                    G = Clamp<uint32_t>(G, 0, 255);
-                    B = Clamp<uint32_t>(B, 0, 255);
-                    fb[x] = 0xFF000000 | (R << 16) | (G << 8) | (B);
-                }
+void Device::DrawMeshFile(const MeshFile* mesh, uint32_t lod_index)
+{
+    TINY3D_TRACE_SCOPE("draw_mesh_file");
 
-                if (render_state_ & RENDER_STATE_TEXTURE)
-                {
-                    float u = scanline->interpolated_point.tc.u * w;
-                    float v = scanline->interpolated_point.tc.v * w;
-                    uint32_t cc = GetTexel(u, v);
-                    fb[x] = 0xFF000000 | cc;
-                }
-            }
+    if (mesh->lod_count() == 0)
+        return;
+
+    const MeshFileLod& lod = mesh->lods()[std::min(lod_index, mesh->lod_count() - 1)];
+    const MeshFileMeshlet* meshlets = mesh->meshlets() + lod.first_meshlet;
+    const uint32_t* indices = mesh->indices();
+    const uint8_t* triangle_flags = mesh->triangle_flags();
+    uint32_t vertex_count = mesh->vertex_count();
+    uint32_t triangle_count = lod.index_count / 3;
+    TINY3D_PROFILE_COUNT(PROFILE_COUNTER_TRIANGLES_SUBMITTED, triangle_count);
+    // MeshFile::Open已经拒绝了越界的索引
+    assert(T3DMeshIndicesInRange(indices + lod.first_index, lod.index_count, vertex_count));
+
+    FrameArena* arena = frame_arena();
+    uint32_t* visible = arena->AllocateArray<uint32_t>(lod.meshlet_count);
+    uint32_t visible_count = 0;
+    uint8_t* inside = arena->AllocateArray<uint8_t>(vertex_count);
+
+    {
+        TINY3D_PROFILE_SCOPE(PROFILE_STAGE_CLIP_CULL);
+
+        for (uint32_t m = 0; m < lod.meshlet_count; ++m)
+        {
+            if (IsBoxOutsideFrustum(meshlets[m].bounds_min, meshlets[m].bounds_max))
+                TINY3D_PROFILE_COUNT(PROFILE_COUNTER_TRIANGLES_CULLED, meshlets[m].triangle_count);
+            else
+                visible[visible_count++] = m;
         }
 
-        // 从左腰边的插值点开始，每循环一次递加一次【插值步】，然后进行渲染写入操作
-        T3DVertexAdd(&scanline->interpolated_point, &scanline->interpolated_step);
+        // inside先用来标记可见的meshlet引用了哪些顶点，没有被引用的顶点不读取也不变换
+        std::memset(inside, 0, vertex_count);
 
-        if (x >= width)
-            break;
+        for (uint32_t k = 0; k < visible_count; ++k)
+        {
+            const MeshFileMeshlet& meshlet = meshlets[visible[k]];
+            const uint32_t* index = indices + meshlet.first_index;
+
+            for (uint32_t i = 0; i < meshlet.triangle_count * 3; ++i)
+                inside[index[i]] = 1;
+        }
     }
-}
 
-// 主渲染函数，把一个梯形分解成若干条扫描线，然后绘制
-// 扫描线
-void Device::RenderTrapezoid(Trapezoid* trap)
-{
-    scanline_t scanline;
-    int32_t j;
-    int32_t top = static_cast<int32_t>(trap->top() + 0.5f);           // 拿到梯形的顶边和底边Y坐标
-    int32_t bottom = static_cast<int32_t>(trap->bottom() + 0.5f);
-    int32_t wnd_h = static_cast<int32_t>(window_height_);
+    if (visible_count == 0)
+        return;
 
-    for (j = top; j < bottom; j++)
-    {
-        if (j >= 0 && j < wnd_h) // 不能超出屏幕
+    // 顶点直接从映射区域中的SoA流读取
+    const float* x = mesh->stream<float>(MESH_STREAM_POSITION_X);
+    const float* y = mesh->stream<float>(MESH_STREAM_POSITION_Y);
+    const float* z = mesh->stream<float>(MESH_STREAM_POSITION_Z);
+    const uint32_t* color = mesh->stream<uint32_t>(MESH_STREAM_COLOR);
+    const uint16_t* u = mesh->stream<uint16_t>(MESH_STREAM_TEXCOORD_U);
+    const uint16_t* v = mesh->stream<uint16_t>(MESH_STREAM_TEXCOORD_V);
+    T3DVertex* cache = arena->AllocateClippedVertices(vertex_count);
+
+    ParallelFor(vertex_count, kVerticesPerJob, [&](uint32_t begin, uint32_t end)
         {
-            trap->CalculateEdgeInterpolatedPoint(static_cast<float>(j) + 0.5f);
+            TINY3D_PROFILE_SCOPE(PROFILE_STAGE_VERTEX_TRANSFORM);
 
-            // 算出插值点的梯形，接下来要算出扫描线
-            trap->InitializeScanline(&scanline, j);
+            for (uint32_t i = begin; i < end; ++i)
+            {
+                if (inside[i] == 0)
+                    continue;
+
+                T3DPackedVertex packed = { x[i], y[i], z[i], color[i], u[i], v[i] };
+                T3DVertex vertex;
+                T3DVertexUnpack(&vertex, &packed);
+                inside[i] = TransformVertex(&cache[i], &vertex) ? 1 : 0;
+            }
+        });
+
+    uint32_t* accepted = arena->AllocateArray<uint32_t>(triangle_count);
+    uint32_t accepted_count = 0;
 
-            // 到了这一步，算出了每条扫描线的【插值步】数据，可以绘制每一条扫描线
-            DrawScanline(&scanline);
+    {
+        TINY3D_PROFILE_SCOPE(PROFILE_STAGE_CLIP_CULL);
+
+        for (uint32_t k = 0; k < visible_count; ++k)
+        {
+            const MeshFileMeshlet& meshlet = meshlets[visible[k]];
+            accepted_count = CullTriangles(cache, inside, indices, triangle_flags, meshlet.first_index, meshlet.triangle_count,
+                accepted, accepted_count);
         }
+    }
 
-        if (j >= wnd_h)
-            break;
+    for (uint32_t k = 0; k < accepted_count; ++k)
+    {
+        const uint32_t* triangle = &indices[accepted[k]];
+        SetupTriangle(&cache[triangle[0]], &cache[triangle[1]], &cache[triangle[2]]);
     }
 }
 
-// 根据 render_state 绘制原始三角形
-void Device::DrawPrimitive(const T3DVertex* v1, const T3DVertex* v2, const T3DVertex* v3)
+uint32_t Device::SelectMeshLod(const MeshFile* mesh, float max_pixel_error) const
 {
-    T3DVector4 p1, p2, p3, c1, c2, c3;
-    int render_state = this->render_state_;
+    const MeshFileHeader* header = mesh->header();
+    const MeshFileLod* lods = mesh->lods();
 
-    // 把传递进来的顶点，乘以WVP矩阵，变换到裁剪空间
-    this->transform_.Apply(&c1, &v1->pos);
-    this->transform_.Apply(&c2, &v2->pos);
-    this->transform_.Apply(&c3, &v3->pos);
+    if (header->lod_count <= 1)
+        return 0;
 
+    // 世界矩阵的最大缩放，行向量约定下是前三行的最大长度
+    const T3DMatrix4X4& world = this->transform_.world_matrix();
+    float scale = 0.0f;
 
-    // 裁剪，注意此处可以完善为具体判断几个点在 cvv内以及同cvv相交平面的坐标比例
-    // 进行进一步精细裁剪，将一个分解为几个完全处在 cvv内的三角形
-    if (this->transform_.CheckCVV(&c1) != 0)
-        return;
-    if (this->transform_.CheckCVV(&c2) != 0)
-        return;
-    if (this->transform_.CheckCVV(&c3) != 0)
-        return;
+    for (uint32_t row = 0; row < 3; ++row)
+    {
+        float length = std::sqrt(world.m[row][0] * world.m[row][0] + world.m[row][1] * world.m[row][1] + world.m[row][2] * world.m[row][2]);
+        scale = std::max(scale, length);
+    }
+
+    // 包围球上离摄影机最近的点的深度，裁剪空间的w就是观察空间的z
+    T3DVector4 center, c;
+    center.x = header->bounding_sphere[0];
+    center.y = header->bounding_sphere[1];
+    center.z = header->bounding_sphere[2];
+    center.w = 1.0f;
+    this->transform_.Apply(&c, &center);
+    float depth = c.w - header->bounding_sphere[3] * scale;
+
+    if (depth <= 0.0f)
+        return 0;
+
+    // 观察空间中一个单位在屏幕上的像素数
+    float pixels_per_unit = this->transform_.projection_matrix().m[1][1] * static_cast<float>(this->window_height_) * 0.5f / depth;
+    uint32_t selected = 0;
+
+    for (uint32_t i = 1; i < header->lod_count; ++i)
+    {
+        if (lods[i].error * scale * pixels_per_unit <= max_pixel_error)
+            selected = i;
+    }
+
+    return selected;
+}
+
+void Device::SetupTriangle(const T3DVertex* t1, const T3DVertex* t2, const T3DVertex* t3, uint32_t flat_color)
+{
+    uint32_t render_state = this->render_state_;
+
+    // 固定颜色只在按颜色绘制时有效，纹理和像素着色器都会覆盖它
+    if (!(render_state & RENDER_STATE_COLOR) || this->pixel_shader_rasterizer_ != nullptr ||
+        ((render_state & RENDER_STATE_TEXTURE) && this->texture_ != nullptr))
+    {
+        flat_color = 0;
+    }
+    else if (flat_color == 0)
+    {
+        // 三个顶点换算出来的颜色相同时，插值出来的颜色也处处相同，不必再逐像素插值颜色
+        uint32_t color = PackVertexColor(t1);
 
-    // 把裁剪空间归一化到齐次的NDC空间
-    this->transform_.Homogenize(&p1, &c1);
-    this->transform_.Homogenize(&p2, &c2);
-    this->transform_.Homogenize(&p3, &c3);
+        if (PackVertexColor(t2) == color && PackVertexColor(t3) == color)
+            flat_color = color;
+    }
 
-    // 纹理或者色彩绘制
-    if (render_state & (RENDER_STATE_TEXTURE | RENDER_STATE_COLOR))
+    // 纹理或者色彩绘制，设置了像素着色器时总是绘制
+    if ((render_state & (RENDER_STATE_TEXTURE | RENDER_STATE_COLOR)) || this->pixel_shader_rasterizer_ != nullptr)
     {
-        T3DVertex t1 = *v1, t2 = *v2, t3 = *v3;
         std::array<Trapezoid, 2> traps;
         int n;
 
-        t1.pos = p1;
-        t2.pos = p2;
-        t3.pos = p3;
-        t1.pos.w = c1.w;
-        t2.pos.w = c2.w;
-        t3.pos.w = c3.w;
+        if (this->raster_mode_ != RASTER_MODE_IMMEDIATE)
+        {
+            // 拆分和记录都算在一次设置里，和立即模式的计数保持一致
+            TINY3D_PROFILE_SCOPE(PROFILE_STAGE_SETUP);
+
+            // 拆分三角形为0-2个梯形，并且返回可用梯形数量
+            n = Trapezoid::SplitTriangleIntoTrapezoids(traps, t1, t2, t3);
+
+            // 多线程模式下先记录到帧内存池里，由FlushDeferredRaster统一光栅化
+            for (int i = 0; i < n; ++i)
+            {
+                if (deferred_bins_tail_ == nullptr || deferred_bins_tail_->count == deferred_bins_tail_->capacity)
+                {
+                    FrameArena* arena = frame_arena();
+                    TrapezoidBin* bin = arena->AllocateArray<TrapezoidBin>(1);
+                    bin->items = arena->AllocateBinnedTriangles(kTrapezoidsPerBin);
+                    bin->count = 0;
+                    bin->capacity = kTrapezoidsPerBin;
+                    bin->next = nullptr;
+
+                    if (deferred_bins_tail_ != nullptr)
+                        deferred_bins_tail_->next = bin;
+                    else
+                        deferred_bins_ = bin;
+
+                    deferred_bins_tail_ = bin;
+                }
 
-        T3DVertexRHWInit(&t1); // 重新对t1，t2，t3的纹理映射坐标和颜色值做透视除
-        T3DVertexRHWInit(&t2);
-        T3DVertexRHWInit(&t3); 
+                DeferredTrapezoid& item = deferred_bins_tail_->items[deferred_bins_tail_->count++];
+                ++deferred_trapezoid_count_;
+                item.trapezoid = traps[i];
+                item.render_state = render_state;
+                item.texture = this->texture_;
+                item.rasterizer = this->pixel_shader_rasterizer_;
+                item.shader = this->pixel_shader_;
+                item.flat_color = flat_color;
+            }
+        }
+        else
+        {
+            {
+                TINY3D_PROFILE_SCOPE(PROFILE_STAGE_SETUP);
+                n = Trapezoid::SplitTriangleIntoTrapezoids(traps, t1, t2, t3);
+            }
 
-        // 拆分三角形为0-2个梯形，并且返回可用梯形数量
-        n = Trapezoid::SplitTriangleIntoTrapezoids(traps, &t1, &t2, &t3);
+            TINY3D_PROFILE_SCOPE(PROFILE_STAGE_RASTER);
+            RasterRowSet rows = { RASTER_MODE_IMMEDIATE, 0, 1, 1, 0, static_cast<int32_t>(window_height_) };
 
-        if (n >= 1)
-            RenderTrapezoid(&traps[0]);
-        if (n >= 2)
-            RenderTrapezoid(&traps[1]);
+            for (int i = 0; i < n; ++i)
+            {
+                DeferredTrapezoid item = { traps[i], render_state, this->texture_, this->pixel_shader_rasterizer_, this->pixel_shader_, flat_color };
+                RenderDeferredTrapezoid(item, rows);
+            }
+        }
     }
 
     if (render_state & RENDER_STATE_WIREFRAME) // 线框绘制
     {
-        uint32_t p1x = static_cast<uint32_t>(p1.x);
-        uint32_t p2x = static_cast<uint32_t>(p2.x);
-        uint32_t p3x = static_cast<uint32_t>(p3.x);
-        uint32_t p1y = static_cast<uint32_t>(p1.y);
-        uint32_t p2y = static_cast<uint32_t>(p2.y);
-        uint32_t p3y = static_cast<uint32_t>(p3.y);
-        DrawLine(p1x, p1y, p2x, p2y, this->foreground_color_);
-        DrawLine(p1x, p1y, p3x, p3y, this->foreground_color_);
-        DrawLine(p3x, p3y, p2x, p2y, this->foreground_color_);
+        uint32_t p1x = static_cast<uint32_t>(t1->pos.x);
+        uint32_t p2x = static_cast<uint32_t>(t2->pos.x);
+        uint32_t p3x = static_cast<uint32_t>(t3->pos.x);
+        uint32_t p1y = static_cast<uint32_t>(t1->pos.y);
+        uint32_t p2y = static_cast<uint32_t>(t2->pos.y);
+        uint32_t p3y = static_cast<uint32_t>(t3->pos.y);
+
+        if (this->raster_mode_ != RASTER_MODE_IMMEDIATE)
+        {
+            deferred_lines_.push_back({ p1x, p1y, p2x, p2y, this->foreground_color_, deferred_trapezoid_count_ });
+            deferred_lines_.push_back({ p1x, p1y, p3x, p3y, this->foreground_color_, deferred_trapezoid_count_ });
+            deferred_lines_.push_back({ p3x, p3y, p2x, p2y, this->foreground_color_, deferred_trapezoid_count_ });
+        }
+        else
+        {
+            TINY3D_PROFILE_SCOPE(PROFILE_STAGE_RASTER);
+            DrawLine(p1x, p1y, p2x, p2y, this->foreground_color_);
+            DrawLine(p1x, p1y, p3x, p3y, this->foreground_color_);
+            DrawLine(p3x, p3y, p2x, p2y, this->foreground_color_);
+        }
     }
 }
 
@@ -327,40 +1381,71 @@ void Device::ResetCamera(float x, float y, float z)
     this->transform_.Update();
 }
 
-void Device::InitTexture()
+TextureHandle Device::RegisterTexture(T3DTexture* texture)
+{
+    texture->max_u = static_cast<float>(texture->width - 1);
+    texture->max_v = static_cast<float>(texture->height - 1);
+    this->textures_.push_back(texture);
+    this->texture_ = texture;
+    return static_cast<TextureHandle>(this->textures_.size() - 1);
+}
+
+void Device::BindTexture(TextureHandle handle)
 {
-    this->texture_ = new uint32_t[texture_width_ * texture_height_];
+    this->texture_ = (handle < this->textures_.size()) ? this->textures_[handle] : nullptr;
+}
+
+TextureHandle Device::InitTexture(uint32_t width, uint32_t height)
+{
+    T3DTexture* texture = new T3DTexture();
+    texture->width = width;
+    texture->height = height;
+    texture->texels = new uint32_t[width * height];
 
-    for (uint32_t j = 0; j < texture_height_; j++)
+    for (uint32_t j = 0; j < height; j++)
     {
-        for (uint32_t i = 0; i < texture_width_; i++)
+        for (uint32_t i = 0; i < width; i++)
         {
             uint32_t x = i / 32;
             uint32_t y = j / 32;
-            this->texture_[j * texture_width_ + i] = ((x + y) & 1) ? 0xFFFFFFFF : 0xFF3FBCEF;
+            texture->texels[j * width + i] = ((x + y) & 1) ? 0xFFFFFFFF : 0xFF3FBCEF;
         }
     }
 
-    this->max_u_ = static_cast<float>(this->texture_width_ - 1);
-    this->max_v_ = static_cast<float>(this->texture_height_ - 1);
+    return RegisterTexture(texture);
 }
 
-void Device::CreateTextureFromFile(const char* file_path)
+T3DTexture* Device::DecodeTextureFile(const char* file_path, JobSystem* job_system)
 {
-    // 使用 SDL_image 库加载 PNG 或 JPG 图片
-    SDL_Surface* img_surface = IMG_Load(file_path);
+    // 烘焙过的纹理文件已经是引擎的纹素格式，只需要拷贝第0级
+    TextureFile texture_file;
 
-    if ( img_surface == nullptr )
+    if (texture_file.Open(file_path))
     {
-        IMG_Quit();
-        return;
+        const TextureFileHeader* header = texture_file.header();
+        bool tiled = header->tiled != 0;
+        // TextureFile::Open保证第0级的纹素个数放得进uint32_t
+        uint32_t texel_count = static_cast<uint32_t>(TextureFile::LevelTexelCount(header->width, header->height, tiled));
+        T3DTexture* texture = new T3DTexture();
+        texture->texels = new uint32_t[texel_count];
+        texture->width = header->width;
+        texture->height = header->height;
+        texture->tiles_per_row = TextureFile::TilesPerRow(header->width, tiled);
+        std::memcpy(texture->texels, texture_file.level(0), sizeof(uint32_t) * texel_count);
+        return texture;
     }
 
+    // 使用 SDL_image 库加载 PNG 或 JPG 图片。SDL_image由Tiny3DApp在启动时初始化、退出时关闭，
+    // 这里可能在资源监视线程上运行，不能调用IMG_Quit
+    SDL_Surface* img_surface = IMG_Load(file_path);
+
+    if ( img_surface == nullptr )
+        return nullptr;
+
     // 对 surface 进行读写操作
     SDL_LockSurface(img_surface);  // 锁定 surface 以进行直接像素访问
-    texture_width_ = static_cast<uint32_t>(img_surface->w);
-    texture_height_ = static_cast<uint32_t>(img_surface->h);
-    this->texture_ = new uint32_t[texture_width_ * texture_height_];
+    uint32_t texture_width = static_cast<uint32_t>(img_surface->w);
+    uint32_t texture_height = static_cast<uint32_t>(img_surface->h);
 
     uint32_t bytes_per_px = static_cast<uint32_t>(img_surface->format->BytesPerPixel);
     uint32_t r_shift = static_cast<uint32_t>(img_surface->format->Rshift);
@@ -375,13 +1460,14 @@ void Device::CreateTextureFromFile(const char* file_path)
 
     if (bytes_per_px != 3 && 4 != bytes_per_px)
     {
-        IMG_Quit();
         SDL_UnlockSurface(img_surface);
         SDL_FreeSurface(img_surface);
         throw Error("Only support 3 or 4 bytes per pixel image file", __FILE__, __LINE__);
-        return;
     }
 
+    // 格式检查通过之后再分配纹素，抛出异常时不会泄漏
+    uint32_t* texels = new uint32_t[texture_width * texture_height];
+
     if (3 == bytes_per_px)
     {
         uint8_t* pixels = reinterpret_cast<uint8_t*>(img_surface->pixels);
@@ -403,63 +1489,94 @@ void Device::CreateTextureFromFile(const char* file_path)
         }
         else 
         {
+            delete[] texels;
+            SDL_UnlockSurface(img_surface);
             SDL_FreeSurface(img_surface);
-            IMG_Quit();
             throw Error("不支持的颜色格式", __FILE__, __LINE__);
         }
 
-        for (uint32_t y = 0; y < texture_height_; ++y)
-        {
-            for (uint32_t x = 0; x < texture_width_; ++x)
+        // 像素格式转换按行分块并行
+        ParallelRows(job_system, texture_height, [&](uint32_t begin, uint32_t end)
             {
-                uint8_t* pixel = pixels + y * pitch + x * 3;
-                uint8_t r = pixel[r_idx];
-                uint8_t g = pixel[g_idx];
-                uint8_t b = pixel[b_idx];
-                uint32_t a32 = static_cast<uint32_t>(255) << 24;
-                uint32_t r32 = static_cast<uint32_t>(r) << 0;
-                uint32_t g32 = static_cast<uint32_t>(g) << 8;
-                uint32_t b32 = static_cast<uint32_t>(b) << 16;
-                this->texture_[y * texture_width_ + x] = a32 | r32 | g32 | b32;
-            }
-        }
+                for (uint32_t y = begin; y < end; ++y)
+                {
+                    for (uint32_t x = 0; x < texture_width; ++x)
+                    {
+                        uint8_t* pixel = pixels + y * pitch + x * 3;
+                        uint8_t r = pixel[r_idx];
+                        uint8_t g = pixel[g_idx];
+                        uint8_t b = pixel[b_idx];
+                        uint32_t a32 = static_cast<uint32_t>(255) << 24;
+                        uint32_t r32 = static_cast<uint32_t>(r) << 0;
+                        uint32_t g32 = static_cast<uint32_t>(g) << 8;
+                        uint32_t b32 = static_cast<uint32_t>(b) << 16;
+                        texels[y * texture_width + x] = a32 | r32 | g32 | b32;
+                    }
+                }
+            });
     }
     else  if (4 == bytes_per_px)
     {
         uint32_t* pixels = reinterpret_cast<uint32_t*>(img_surface->pixels);
-        uint32_t pixel;
-        uint8_t r, g, b, a;
-        uint32_t r32, g32, b32, a32;
 
-        for (uint32_t y = 0; y < texture_height_; ++y)
-        {
-            for (uint32_t x = 0; x < texture_width_; ++x)
+        ParallelRows(job_system, texture_height, [&](uint32_t begin, uint32_t end)
             {
-                pixel = pixels[y * texture_width_ + x];
-                SDL_GetRGBA(pixel, img_surface->format, &r, &g, &b, &a);
-                r32 = static_cast<uint32_t>(r) << 0;
-                g32 = static_cast<uint32_t>(g) << 8;
-                b32 = static_cast<uint32_t>(b) << 16;
-                a32 = static_cast<uint32_t>(255) << 24;
-                this->texture_[y * texture_width_ + x] = a32 | r32 | g32 | b32;
-            }
-        }
-    }
-    else
-    {
-        IMG_Quit();
-        SDL_UnlockSurface(img_surface);
-        SDL_FreeSurface(img_surface);
-        throw Error("Only support 3 or 4 bytes per pixel image file", __FILE__, __LINE__);
-        return;
+                uint32_t pixel;
+                uint8_t r, g, b, a;
+                uint32_t r32, g32, b32, a32;
+
+                for (uint32_t y = begin; y < end; ++y)
+                {
+                    for (uint32_t x = 0; x < texture_width; ++x)
+                    {
+                        pixel = pixels[y * texture_width + x];
+                        SDL_GetRGBA(pixel, img_surface->format, &r, &g, &b, &a);
+                        r32 = static_cast<uint32_t>(r) << 0;
+                        g32 = static_cast<uint32_t>(g) << 8;
+                        b32 = static_cast<uint32_t>(b) << 16;
+                        a32 = static_cast<uint32_t>(255) << 24;
+                        texels[y * texture_width + x] = a32 | r32 | g32 | b32;
+                    }
+                }
+            });
     }
 
-    IMG_Quit();
     SDL_UnlockSurface(img_surface);
     SDL_FreeSurface(img_surface);
 
-    this->max_u_ = static_cast<float>(this->texture_width_ - 1);
-    this->max_v_ = static_cast<float>(this->texture_height_ - 1);
+    T3DTexture* texture = new T3DTexture();
+    texture->texels = texels;
+    texture->width = texture_width;
+    texture->height = texture_height;
+    return texture;
+}
+
+TextureHandle Device::CreateTextureFromFile(const char* file_path)
+{
+    T3DTexture* texture = DecodeTextureFile(file_path, job_system_);
+    return (texture != nullptr) ? RegisterTexture(texture) : kInvalidTextureHandle;
+}
+
+bool Device::ReplaceTexture(TextureHandle handle, T3DTexture* texture)
+{
+    if (handle >= this->textures_.size())
+    {
+        delete[] texture->texels;
+        delete texture;
+        return false;
+    }
+
+    T3DTexture* old_texture = this->textures_[handle];
+    texture->max_u = static_cast<float>(texture->width - 1);
+    texture->max_v = static_cast<float>(texture->height - 1);
+    this->textures_[handle] = texture;
+
+    if (this->texture_ == old_texture)
+        this->texture_ = texture;
+
+    delete[] old_texture->texels;
+    delete old_texture;
+    return true;
 }
 
 void Device::DrawPlane(const T3DVertex* p1, const T3DVertex* p2, const T3DVertex* p3, const T3DVertex* p4)
@@ -479,10 +1596,124 @@ void Device::DrawBox(float theta, const T3DVertex* box_vertices)
     T3DMatrixMakeRotation(&m, -1.0f, -0.5f, 1.0f, theta);
     transform_.SetWorldMatrix(m);
     transform_.Update();
+    DrawBox(box_vertices);
+}
+
+void Device::DrawBox(const T3DVertex* box_vertices)
+{
     DrawPlane(&box_vertices[0], &box_vertices[1], &box_vertices[2], &box_vertices[3]);
     DrawPlane(&box_vertices[4], &box_vertices[5], &box_vertices[6], &box_vertices[7]);
     DrawPlane(&box_vertices[0], &box_vertices[4], &box_vertices[5], &box_vertices[1]);
     DrawPlane(&box_vertices[1], &box_vertices[5], &box_vertices[6], &box_vertices[2]);
     DrawPlane(&box_vertices[2], &box_vertices[6], &box_vertices[7], &box_vertices[3]);
     DrawPlane(&box_vertices[3], &box_vertices[7], &box_vertices[4], &box_vertices[0]);
-}
\ No newline at end of file
+}
+// 根据命令的世界矩阵算出物体原点在摄影机空间中的深度，生成64位排序键：
+// 最高位为半透明标记，使不透明命令全部排在前面；接着kCommandDepthBits位是量化后的深度，
+// 不透明命令由近及远，半透明命令取反后由远及近；第16到31位是纹理句柄。
+// 深度只分成有限的几段，同一段里的命令才会按纹理排在一起，减少纹理切换
+static uint64_t MakeCommandSortKey(const DrawCommand& command, const T3DMatrix4X4& world, const T3DMatrix4X4& view)
+{
+    T3DVector4 origin = { world.m[3][0], world.m[3][1], world.m[3][2], 1.0f };
+    T3DVector4 view_pos;
+    T3DMatrixApply(&view_pos, &origin, &view);
+
+    const uint32_t depth_mask = (1u << kCommandDepthBits) - 1;
+    float depth = Clamp((view_pos.z - kNearClip) / (kFarClip - kNearClip), 0.0f, 1.0f);
+    uint32_t depth_bucket = std::min(static_cast<uint32_t>(depth * static_cast<float>(depth_mask + 1)), depth_mask);
+
+    if (command.translucent)
+        depth_bucket = ~depth_bucket & depth_mask;
+
+    uint64_t key = command.translucent ? (1ULL << 63) : 0;
+    key |= static_cast<uint64_t>(depth_bucket) << 32;
+    key |= static_cast<uint64_t>(command.texture & 0xFFFF) << 16;
+    return key;
+}
+
+void Device::SubmitCommandBuffers(CommandBuffer* const* buffers, uint32_t count)
+{
+    TINY3D_TRACE_SCOPE("submit_command_buffers");
+    const T3DMatrix4X4& view = transform_.view_matrix();
+    uint32_t total = 0;
+
+    for (uint32_t i = 0; i < count; ++i)
+    {
+        total += buffers[i]->command_count();
+    }
+
+    // 命令包从帧内存池分配，EndFrame时回收
+    CommandSortEntry* entries = frame_arena()->AllocateCommandPackets(total);
+    uint32_t entry_count = 0;
+
+    for (uint32_t i = 0; i < count; ++i)
+    {
+        const CommandBuffer* buffer = buffers[i];
+
+        for (uint32_t j = 0; j < buffer->command_count(); ++j)
+        {
+            const DrawCommand& command = buffer->command(j);
+            uint64_t key = MakeCommandSortKey(command, buffer->matrix(command.matrix_index), view);
+            entries[entry_count++] = { key, i, j };
+        }
+    }
+
+    // 键相同时按缓冲区和命令的录制顺序排列，保证每一帧的回放顺序都是确定的
+    std::sort(entries, entries + entry_count,
+        [](const CommandSortEntry& a, const CommandSortEntry& b)
+        {
+            if (a.key != b.key)
+                return a.key < b.key;
+            if (a.buffer_index != b.buffer_index)
+                return a.buffer_index < b.buffer_index;
+            return a.command_index < b.command_index;
+        });
+
+    // 回放会改写世界矩阵、纹理和渲染状态，结束后恢复
+    T3DMatrix4X4 saved_world = transform_.world_matrix();
+    T3DTexture* saved_texture = texture_;
+    uint32_t saved_render_state = render_state_;
+    const T3DMatrix4X4* current_world = nullptr;
+
+    for (uint32_t k = 0; k < entry_count; ++k)
+    {
+        const CommandSortEntry& entry = entries[k];
+        const CommandBuffer* buffer = buffers[entry.buffer_index];
+        const DrawCommand& command = buffer->command(entry.command_index);
+        const T3DMatrix4X4* world = &buffer->matrix(command.matrix_index);
+
+        // 相邻的命令共用同一个矩阵时不必重新计算WVP矩阵
+        if (world != current_world)
+        {
+            transform_.SetWorldMatrix(*world);
+            transform_.Update();
+            current_world = world;
+        }
+
+        if (command.texture != kInvalidTextureHandle)
+            BindTexture(command.texture);
+        else
+            texture_ = saved_texture;
+
+        render_state_ = command.render_state;
+        const T3DVertex* v = buffer->vertices(command.vertex_offset);
+
+        switch (command.type)
+        {
+        case DRAW_COMMAND_PRIMITIVE:
+            DrawPrimitive(&v[0], &v[1], &v[2]);
+            break;
+        case DRAW_COMMAND_PLANE:
+            DrawPlane(&v[0], &v[1], &v[2], &v[3]);
+            break;
+        case DRAW_COMMAND_BOX:
+            DrawBox(v);
+            break;
+        }
+    }
+
+    transform_.SetWorldMatrix(saved_world);
+    transform_.Update();
+    texture_ = saved_texture;
+    render_state_ = saved_render_state;
+}
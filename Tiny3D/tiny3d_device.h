@@ -24,11 +24,21 @@ SOFTWARE.
 
 #pragma once
 
+#include <algorithm>
+#include <cassert>
 #include <cstdint>
+#include <vector>
 
 #include "tiny3d_transform.h"
 #include "tiny3d_geometry.h"
 #include "tiny3d_trapezoid.h"
+#include "tiny3d_job_system.h"
+#include "tiny3d_light.h"
+#include "tiny3d_texture.h"
+#include "tiny3d_frame_arena.h"
+#include "tiny3d_bitmap_font.h"
+#include "tiny3d_mesh.h"
+#include "tiny3d_mesh_file.h"
 
 //=====================================================================
 // 渲染设备
@@ -37,9 +47,104 @@ SOFTWARE.
 #define RENDER_STATE_WIREFRAME      1		// 渲染线框
 #define RENDER_STATE_TEXTURE        2		// 渲染纹理
 #define RENDER_STATE_COLOR          4		// 渲染颜色
+#define RENDER_STATE_OVERDRAW       8		// 统计每个像素的深度测试次数和通过次数
+#define RENDER_STATE_LIGHTING       16		// 用光源计算DrawMesh绘制的网格的顶点颜色，只在RENDER_STATE_COLOR下可见，纹素会直接覆盖光照结果
+#define RENDER_STATE_NO_DEPTH_TEST  32		// 不做深度测试也不写深度缓存，后画的覆盖先画的，用于界面叠加层和调试视图
 
+// 光栅化模式
+enum RasterMode
+{
+    RASTER_MODE_IMMEDIATE = 0,  // 单线程，三角形在DrawPrimitive里立即光栅化
+    RASTER_MODE_INTERLEAVED,    // 多线程，行组按 (y / granule) mod N 交错分配给N个线程
+    RASTER_MODE_BANDS           // 多线程，把屏幕切成N条连续的行带分配给N个线程
+};
+
+// 一个光栅化线程负责绘制的行集合。每个行组/行带的起始行在帧缓存中的地址都对齐到
+// cache line，不同线程写入的像素永远不会落在同一条cache line上
+struct RasterRowSet
+{
+    RasterMode mode;
+    int32_t index;          // 线程序号
+    int32_t count;          // 线程总数
+    int32_t granule;        // 交错模式下一个行组的行数
+    int32_t band_begin;     // 行带模式下的起始行
+    int32_t band_end;       // 行带模式下的结束行（不包含）
+};
+
+struct Device;
+struct VertexStreams;
+
+// 按像素着色器类型实例化的梯形光栅化函数，由Device::SetPixelShader选出，
+// 每个梯形调用一次，shader指向着色器对象
+typedef void (*ShadedTrapezoidRasterizer)(Device* device, const Trapezoid* trap, const RasterRowSet& rows,
+    uint32_t render_state, const T3DTexture* texture, const void* shader);
+
+// 延迟光栅化时记录下来的梯形，连同绘制它时的渲染状态、纹理和像素着色器
+struct DeferredTrapezoid
+{
+    Trapezoid trapezoid;
+    uint32_t render_state;
+    const T3DTexture* texture;
+    ShadedTrapezoidRasterizer rasterizer;   // 为空时使用固定功能的着色
+    const void* shader;
+    uint32_t flat_color;                    // 不为0时整个梯形用这个颜色填充，只做深度测试
+};
+
+// 一段由帧内存池分配的DeferredTrapezoid数组，多段之间用单链表串起来
+struct TrapezoidBin
+{
+    DeferredTrapezoid* items;
+    uint32_t count;
+    uint32_t capacity;
+    TrapezoidBin* next;
+};
+
+// 一个像素的深度复杂度统计
+struct OverdrawSample
+{
+    uint16_t tested;        // 做了深度测试的次数，即深度复杂度
+    uint16_t passed;        // 通过深度测试并写入的次数，即过度绘制
+};
+
+// 热力图显示的是哪一种计数
+enum OverdrawView
+{
+    OVERDRAW_VIEW_TESTED = 0,   // 深度复杂度
+    OVERDRAW_VIEW_PASSED        // 过度绘制
+};
+
+static const uint32_t kOverdrawHistogramBins = 16;
+
+// 整个画面的过度绘制统计。平均值只计算至少被测试过一次的像素
+struct OverdrawStats
+{
+    uint32_t covered_pixels;                        // 至少被测试过一次的像素数
+    double mean_tested;                             // 平均深度复杂度
+    double mean_passed;                             // 平均写入次数
+    uint32_t max_tested;
+    uint32_t max_passed;
+    uint64_t passed_histogram[kOverdrawHistogramBins];  // 写入次数的直方图，最后一格包含所有更大的值
+};
+
+class CommandBuffer;
+
+// SubmitCommandBuffers排序用的条目，记录排序键以及命令所在的缓冲区和位置
+struct CommandSortEntry
+{
+    uint64_t key;
+    uint32_t buffer_index;
+    uint32_t command_index;
+};
 
-struct Device 
+// 延迟光栅化时记录下来的线框线段
+struct DeferredLine
+{
+    uint32_t x1, y1, x2, y2;
+    uint32_t color;
+    uint32_t sequence;      // 记录这条线段之前已经记录了多少个梯形，用来保持和立即模式相同的绘制顺序
+};
+
+struct Device
 {
 public:
     Transform transform_;     // 坐标变换器
@@ -47,14 +152,28 @@ public:
     uint32_t window_height_;    // 窗口高度
     uint32_t* frame_buffer_;    // 像素缓存：framebuffer[y] 代表第 y行
     float* z_buffer_;           // 深度缓存：zbuffer[y] 为第 y行指针
-    uint32_t* texture_;         // 纹理：同样是每行索引
-    uint32_t texture_width_;    // 纹理宽度
-    uint32_t texture_height_;   // 纹理高度
-    float max_u_;               // 纹理最大宽度：tex_width - 1
-    float max_v_;               // 纹理最大高度：tex_height - 1
+    OverdrawSample* overdraw_buffer_;   // 深度复杂度缓存，只在RENDER_STATE_OVERDRAW打开时写入
+    BitmapFont* font_;          // DrawString使用的点阵字体，Initialize时创建
+    T3DTexture* texture_;       // 当前绑定的纹理
+    std::vector<T3DTexture*> textures_; // 纹理表，TextureHandle即为表的下标
     uint32_t render_state_;          // 渲染状态
     uint32_t background_color_; // 背景颜色
     uint32_t foreground_color_; // 线框颜色
+    JobSystem* job_system_;     // 任务系统，为空时所有工作都在调用线程上完成
+    RasterMode raster_mode_;    // 光栅化模式
+    uint32_t raster_thread_count_;  // 多线程光栅化时的线程数，0表示任务系统的线程数
+    TrapezoidBin* deferred_bins_;       // 等待FlushDeferredRaster绘制的梯形，链表头
+    TrapezoidBin* deferred_bins_tail_;  // 链表尾，新的梯形追加到这里
+    uint32_t deferred_trapezoid_count_; // 已经记录的梯形个数
+    std::vector<DeferredLine> deferred_lines_;             // 等待FlushDeferredRaster绘制的线段
+    std::vector<FrameArena*> frame_arenas_;                // 每个线程一个帧内存池，下标为JobSystem::CurrentThreadIndex
+    uint32_t frame_count_;              // 已经结束的帧数
+    uint64_t frame_allocation_mark_;    // 上一帧结束时的堆分配次数
+    const void* pixel_shader_;          // 当前的像素着色器，为空时使用固定功能的着色
+    ShadedTrapezoidRasterizer pixel_shader_rasterizer_;    // 为pixel_shader_的类型实例化的光栅化函数
+    T3DColor ambient_light_;            // 环境光
+    T3DLight lights_[kMaxLights];       // 打开的光源
+    uint32_t light_count_;
 
 public:
     inline uint32_t render_state() const
@@ -72,6 +191,43 @@ public:
         frame_buffer_ = reinterpret_cast<uint32_t*>(buffer);
     }
 
+    /**************************************************************************************
+    设置任务系统，同时为任务系统的每个线程准备一个帧内存池
+    @name: Device::set_job_system
+    @return: void
+    @param: JobSystem * job_system
+    *************************************************************************************/
+    void set_job_system(JobSystem* job_system);
+
+    /**************************************************************************************
+    返回当前线程的帧内存池。驱动设备的线程（非工作线程）使用0号内存池
+    @name: Device::frame_arena
+    @return: FrameArena*
+    *************************************************************************************/
+    inline FrameArena* frame_arena()
+    {
+        uint32_t index = JobSystem::CurrentThreadIndex();
+        assert(index < frame_arenas_.size());
+        return frame_arenas_[index];
+    }
+
+    /**************************************************************************************
+    把[0, count)切块后交给任务系统并行执行，没有任务系统时在当前线程执行
+    @name: Device::ParallelFor
+    @return: void
+    @param: uint32_t count
+    @param: uint32_t grain
+    @param: F && f 原型为 void(uint32_t begin, uint32_t end)
+    *************************************************************************************/
+    template<typename F>
+    inline void ParallelFor(uint32_t count, uint32_t grain, F&& f)
+    {
+        if (job_system_ != nullptr)
+            job_system_->ParallelFor(count, grain, f);
+        else
+            f(0, count);
+    }
+
     /**************************************************************************************
     设备初始化，fb为外部帧缓存，非 NULL 将引用外部帧缓存（每行 4字节对齐）
     @name: Device::Initialize
@@ -96,6 +252,37 @@ public:
     *************************************************************************************/
     void ResetZBuffer();
 
+    /**************************************************************************************
+    用指定颜色填充整个 Frame Buffer
+    @name: Device::ClearFrameBuffer
+    @return: void
+    @param: uint32_t color
+    *************************************************************************************/
+    void ClearFrameBuffer(uint32_t color);
+
+    /**************************************************************************************
+    把深度复杂度缓存清零，打开RENDER_STATE_OVERDRAW时每帧绘制之前调用
+    @name: Device::ClearOverdrawBuffer
+    @return: void
+    *************************************************************************************/
+    void ClearOverdrawBuffer();
+
+    /**************************************************************************************
+    按深度复杂度缓存给帧缓存染色，0次为原色，次数越多越偏红。在FlushDeferredRaster之后调用
+    @name: Device::ApplyOverdrawHeatmap
+    @return: void
+    @param: OverdrawView view
+    *************************************************************************************/
+    void ApplyOverdrawHeatmap(OverdrawView view);
+
+    /**************************************************************************************
+    统计深度复杂度缓存中的平均值、最大值以及写入次数的直方图
+    @name: Device::GatherOverdrawStats
+    @return: void
+    @param: OverdrawStats * stats
+    *************************************************************************************/
+    void GatherOverdrawStats(OverdrawStats* stats) const;
+
     /**************************************************************************************
     画点
     @name: Device::WritePixel
@@ -106,6 +293,17 @@ public:
     *************************************************************************************/
     void WritePixel(uint32_t x, uint32_t y, uint32_t color);
 
+    /**************************************************************************************
+    画点，只写入行集合内的行
+    @name: Device::WritePixel
+    @return: void
+    @param: uint32_t x
+    @param: uint32_t y
+    @param: uint32_t color
+    @param: const RasterRowSet & rows
+    *************************************************************************************/
+    void WritePixel(uint32_t x, uint32_t y, uint32_t color, const RasterRowSet& rows);
+
     /**************************************************************************************
     采用Bresenham算法绘制线段
     @name: Device::DrawLine
@@ -118,6 +316,44 @@ public:
     *************************************************************************************/
     void DrawLine(uint32_t x1, uint32_t y1, uint32_t x2, uint32_t y2, uint32_t c);
 
+    /**************************************************************************************
+    采用Bresenham算法绘制线段落在指定行集合内的像素，各线程画出的像素合起来和不分行时完全相同
+    @name: Device::DrawLine
+    @return: void
+    @param: uint32_t x1
+    @param: uint32_t y1
+    @param: uint32_t x2
+    @param: uint32_t y2
+    @param: uint32_t c
+    @param: const RasterRowSet & rows
+    *************************************************************************************/
+    void DrawLine(uint32_t x1, uint32_t y1, uint32_t x2, uint32_t y2, uint32_t c, const RasterRowSet& rows);
+
+    /**************************************************************************************
+    填充矩形，超出帧缓存的部分被裁掉。alpha小于255时和帧缓存中原有的颜色混合
+    @name: Device::FillRect
+    @return: void
+    @param: int32_t x 左上角
+    @param: int32_t y
+    @param: int32_t width
+    @param: int32_t height
+    @param: uint32_t color
+    @param: uint32_t alpha 0到255，255为不透明
+    *************************************************************************************/
+    void FillRect(int32_t x, int32_t y, int32_t width, int32_t height, uint32_t color, uint32_t alpha);
+
+    /**************************************************************************************
+    用点阵字体绘制文字，只写字形覆盖到的像素，超出帧缓存的部分被裁掉。文字中可以包含换行符
+    @name: Device::DrawString
+    @return: void
+    @param: int32_t x 第一个字符的左上角
+    @param: int32_t y
+    @param: const char * text
+    @param: uint32_t color
+    @param: uint32_t scale 每个点放大的倍数
+    *************************************************************************************/
+    void DrawString(int32_t x, int32_t y, const char* text, uint32_t color, uint32_t scale);
+
     /**************************************************************************************
     根据坐标读取纹理
     @name: Device::GetTexel
@@ -127,6 +363,16 @@ public:
     *************************************************************************************/
     uint32_t GetTexel(float u, float v);
 
+    /**************************************************************************************
+    从指定的纹理中根据坐标读取纹素
+    @name: Device::GetTexel
+    @return: uint32_t
+    @param: const T3DTexture * texture
+    @param: float u
+    @param: float v
+    *************************************************************************************/
+    uint32_t GetTexel(const T3DTexture* texture, float u, float v);
+
     /**************************************************************************************
     绘制扫描线
     @name: Device::DrawScanline
@@ -135,13 +381,159 @@ public:
     *************************************************************************************/
     void DrawScanline(scanline_t* scanline);
 
+    /**************************************************************************************
+    按指定的渲染状态绘制扫描线
+    @name: Device::DrawScanline
+    @return: void
+    @param: scanline_t * scanline
+    @param: uint32_t render_state
+    @param: const T3DTexture * texture
+    *************************************************************************************/
+    void DrawScanline(scanline_t* scanline, uint32_t render_state, const T3DTexture* texture);
+
     /**************************************************************************************
     渲染梯形
     @name: Device::RenderTrapezoid
     @return: void
-    @param: Trapezoid * trap
+    @param: const Trapezoid * trap
+    *************************************************************************************/
+    void RenderTrapezoid(const Trapezoid* trap);
+
+    /**************************************************************************************
+    只渲染梯形落在指定行集合内的扫描线
+    @name: Device::RenderTrapezoid
+    @return: void
+    @param: const Trapezoid * trap
+    @param: const RasterRowSet & rows
+    @param: uint32_t render_state
+    @param: const T3DTexture * texture
+    *************************************************************************************/
+    void RenderTrapezoid(const Trapezoid* trap, const RasterRowSet& rows, uint32_t render_state, const T3DTexture* texture);
+
+    /**************************************************************************************
+    用固定的颜色绘制扫描线，每个像素只插值1/w并做深度测试，一次比较和写入4个像素。
+    关闭深度测试时整段直接填充
+    @name: Device::DrawFlatScanline
+    @return: void
+    @param: scanline_t * scanline
+    @param: uint32_t color 帧缓存格式的颜色
+    @param: uint32_t render_state 只使用其中的RENDER_STATE_OVERDRAW和RENDER_STATE_NO_DEPTH_TEST
+    *************************************************************************************/
+    void DrawFlatScanline(scanline_t* scanline, uint32_t color, uint32_t render_state);
+
+    /**************************************************************************************
+    用固定的颜色渲染梯形落在指定行集合内的扫描线
+    @name: Device::RenderFlatTrapezoid
+    @return: void
+    @param: const Trapezoid * trap
+    @param: const RasterRowSet & rows
+    @param: uint32_t render_state
+    @param: uint32_t color
+    *************************************************************************************/
+    void RenderFlatTrapezoid(const Trapezoid* trap, const RasterRowSet& rows, uint32_t render_state, uint32_t color);
+
+    /**************************************************************************************
+    按记录下来的状态选择像素着色器、固定颜色或者固定功能的着色，渲染梯形落在指定行集合内的扫描线
+    @name: Device::RenderDeferredTrapezoid
+    @return: void
+    @param: const DeferredTrapezoid & item
+    @param: const RasterRowSet & rows
+    *************************************************************************************/
+    void RenderDeferredTrapezoid(const DeferredTrapezoid& item, const RasterRowSet& rows);
+
+    /**************************************************************************************
+    设置像素着色器，之后绘制的三角形都由它着色，直到ClearPixelShader。着色器对象必须存活到
+    FlushDeferredRaster之后。定义在tiny3d_pixel_shader.h中，调用处需要包含该文件
+    @name: Device::SetPixelShader
+    @return: void
+    @param: const Shader * shader
+    *************************************************************************************/
+    template<typename Shader>
+    void SetPixelShader(const Shader* shader);
+
+    /**************************************************************************************
+    取消像素着色器，恢复按渲染状态做固定功能的着色
+    @name: Device::ClearPixelShader
+    @return: void
+    *************************************************************************************/
+    void ClearPixelShader();
+
+    /**************************************************************************************
+    用像素着色器绘制扫描线，只对着色器声明的插值量做插值。定义在tiny3d_pixel_shader.h中
+    @name: Device::DrawShadedScanline
+    @return: void
+    @param: scanline_t * scanline
+    @param: const Shader & shader
+    @param: uint32_t render_state 只使用其中的RENDER_STATE_OVERDRAW
+    @param: const T3DTexture * texture
+    *************************************************************************************/
+    template<typename Shader>
+    void DrawShadedScanline(scanline_t* scanline, const Shader& shader, uint32_t render_state, const T3DTexture* texture);
+
+    /**************************************************************************************
+    用像素着色器渲染梯形落在指定行集合内的扫描线，实例化之后即为ShadedTrapezoidRasterizer。
+    定义在tiny3d_pixel_shader.h中
+    @name: Device::RenderShadedTrapezoid
+    @return: void
+    @param: Device * device
+    @param: const Trapezoid * trap
+    @param: const RasterRowSet & rows
+    @param: uint32_t render_state
+    @param: const T3DTexture * texture
+    @param: const void * shader 指向Shader类型的对象
+    *************************************************************************************/
+    template<typename Shader>
+    static void RenderShadedTrapezoid(Device* device, const Trapezoid* trap, const RasterRowSet& rows,
+        uint32_t render_state, const T3DTexture* texture, const void* shader);
+
+    /**************************************************************************************
+    把梯形落在指定行集合内的每一行初始化成扫描线，交给fn绘制
+    @name: Device::ForEachScanline
+    @return: uint32_t 扫描线的条数
+    @param: const Trapezoid * trap
+    @param: const RasterRowSet & rows
+    @param: F && fn 形如 void (scanline_t*)
+    *************************************************************************************/
+    template<typename F>
+    uint32_t ForEachScanline(const Trapezoid* trap, const RasterRowSet& rows, F&& fn) const;
+
+    /**************************************************************************************
+    采用Bresenham算法遍历线段上的每个像素，交给plot绘制。不做任何裁剪
+    @name: Device::ForEachLinePixel
+    @return: void
+    @param: uint32_t x1
+    @param: uint32_t y1
+    @param: uint32_t x2
+    @param: uint32_t y2
+    @param: F && plot 形如 void (uint32_t x, uint32_t y)
+    *************************************************************************************/
+    template<typename F>
+    static void ForEachLinePixel(uint32_t x1, uint32_t y1, uint32_t x2, uint32_t y2, F&& plot);
+
+    /**************************************************************************************
+    设置光栅化模式，多线程模式下DrawPrimitive只做三角形设置，光栅化推迟到FlushDeferredRaster
+    @name: Device::SetRasterMode
+    @return: void
+    @param: RasterMode mode
+    @param: uint32_t thread_count 光栅化线程数，0表示使用任务系统的全部线程
+    *************************************************************************************/
+    void SetRasterMode(RasterMode mode, uint32_t thread_count);
+
+    /**************************************************************************************
+    多线程光栅化记录下来的梯形。每个线程遍历完整的梯形列表，只绘制自己负责的行，
+    因此不需要对frame_buffer_和z_buffer_加锁，绘制结果也和单线程完全一致
+    @name: Device::FlushDeferredRaster
+    @return: void
+    *************************************************************************************/
+    void FlushDeferredRaster();
+
+    /**************************************************************************************
+    一帧结束，回收所有线程的帧内存池。调用之前必须先FlushDeferredRaster。
+    调试版本会检查稳定运行之后每一帧是否还有堆分配
+    @name: Device::EndFrame
+    @return: void
     *************************************************************************************/
-    void RenderTrapezoid(Trapezoid* trap);
+    void EndFrame();
 
     /**************************************************************************************
     根据 render_state 绘制原始三角形
@@ -153,6 +545,74 @@ public:
     *************************************************************************************/
     void DrawPrimitive(const T3DVertex* v1, const T3DVertex* v2, const T3DVertex* v3);
 
+    /**************************************************************************************
+    绘制索引三角形列表。所有顶点先并行变换到帧内存池中的变换后顶点缓存，每个顶点只变换
+    一次，三角形设置时梯形的腰边直接引用缓存中的顶点
+    @name: Device::DrawIndexedPrimitives
+    @return: void
+    @param: const T3DPackedVertex * vertices
+    @param: uint32_t vertex_count
+    @param: const uint32_t * indices 每三个索引构成一个三角形，必须都小于vertex_count，调试版本会断言
+    @param: uint32_t index_count
+    @param: const uint8_t * triangle_flags 每个三角形的POLY_*标志，没有POLY_FLAG_2SIDED的三角形
+            做背面剔除。为空时所有三角形都按双面绘制
+    *************************************************************************************/
+    void DrawIndexedPrimitives(const T3DPackedVertex* vertices, uint32_t vertex_count, const uint32_t* indices, uint32_t index_count,
+        const uint8_t* triangle_flags = nullptr);
+
+    /**************************************************************************************
+    用当前的世界矩阵绘制网格
+    @name: Device::DrawMesh
+    @return: void
+    @param: const T3DMesh * mesh
+    *************************************************************************************/
+    void DrawMesh(const T3DMesh* mesh);
+
+    /**************************************************************************************
+    用顶点着色器绘制索引三角形列表，顶点每SIMD_WIDTH个一批并行着色，之后的剔除和三角形
+    设置和DrawIndexedPrimitives相同。定义在tiny3d_vertex_shader.h中
+    @name: Device::DrawShadedPrimitives
+    @return: void
+    @param: const VertexStreams & streams
+    @param: uint32_t vertex_count
+    @param: const uint32_t * indices 必须都小于vertex_count，调试版本会断言
+    @param: uint32_t index_count
+    @param: const uint8_t * triangle_flags
+    @param: const Shader & shader
+    *************************************************************************************/
+    template<typename Shader>
+    void DrawShadedPrimitives(const VertexStreams& streams, uint32_t vertex_count, const uint32_t* indices, uint32_t index_count,
+        const uint8_t* triangle_flags, const Shader& shader);
+
+    /**************************************************************************************
+    用顶点着色器和当前的世界矩阵绘制网格。定义在tiny3d_vertex_shader.h中
+    @name: Device::DrawMesh
+    @return: void
+    @param: const T3DMesh * mesh
+    @param: const Shader & shader
+    *************************************************************************************/
+    template<typename Shader>
+    void DrawMesh(const T3DMesh* mesh, const Shader& shader);
+
+    /**************************************************************************************
+    用当前的世界矩阵直接绘制映射在内存中的网格文件的一级LOD。先用meshlet的包围盒做视锥剔除，
+    只有留下来的meshlet引用的顶点才会被读取和变换
+    @name: Device::DrawMeshFile
+    @return: void
+    @param: const MeshFile * mesh
+    @param: uint32_t lod 超出范围时使用最粗的一级
+    *************************************************************************************/
+    void DrawMeshFile(const MeshFile* mesh, uint32_t lod);
+
+    /**************************************************************************************
+    按当前的变换估计各级LOD的误差投影到屏幕上的像素数，返回误差不超过max_pixel_error的最粗一级
+    @name: Device::SelectMeshLod
+    @return: uint32_t
+    @param: const MeshFile * mesh
+    @param: float max_pixel_error
+    *************************************************************************************/
+    uint32_t SelectMeshLod(const MeshFile* mesh, float max_pixel_error) const;
+
     /**************************************************************************************
     
     @name: Device::ResetCamera
@@ -164,19 +624,72 @@ public:
     void ResetCamera(float x, float y, float z);
 
     /**************************************************************************************
-    
+    生成一张棋盘格纹理，加入纹理表并绑定
     @name: Device::InitTexture
-    @return: void
+    @return: TextureHandle
+    @param: uint32_t width
+    @param: uint32_t height
     *************************************************************************************/
-    void InitTexture();
+    TextureHandle InitTexture(uint32_t width, uint32_t height);
 
     /**************************************************************************************
-    
+    从图片文件创建纹理，加入纹理表并绑定。文件无法加载时返回kInvalidTextureHandle
     @name: Device::CreateTextureFromFile
-    @return: void
+    @return: TextureHandle
     @param: const char * file_path
     *************************************************************************************/
-    void CreateTextureFromFile(const char* file_path);
+    TextureHandle CreateTextureFromFile(const char* file_path);
+
+    /**************************************************************************************
+    从图片文件或者烘焙过的纹理文件解码出纹理，不加入纹理表。不访问设备的状态，可以在后台线程调用。
+    文件无法加载时返回nullptr，图片格式不支持时抛出Error
+    @name: Device::DecodeTextureFile
+    @return: T3DTexture* 调用者负责交给RegisterTexture或者ReplaceTexture
+    @param: const char * file_path
+    @param: JobSystem * job_system 转换像素格式时使用，为nullptr时在当前线程转换
+    *************************************************************************************/
+    static T3DTexture* DecodeTextureFile(const char* file_path, JobSystem* job_system);
+
+    /**************************************************************************************
+    用新的纹理替换纹理表中的一项，句柄保持不变，旧的纹理被释放。延迟光栅化的梯形引用着纹理，
+    只能在两帧之间调用，即FlushDeferredRaster之后、下一次绘制之前
+    @name: Device::ReplaceTexture
+    @return: bool 句柄无效时返回false，texture同样被释放
+    @param: TextureHandle handle
+    @param: T3DTexture * texture
+    *************************************************************************************/
+    bool ReplaceTexture(TextureHandle handle, T3DTexture* texture);
+
+    /**************************************************************************************
+    绑定纹理，之后绘制的图元都使用这张纹理
+    @name: Device::BindTexture
+    @return: void
+    @param: TextureHandle handle
+    *************************************************************************************/
+    void BindTexture(TextureHandle handle);
+
+    /**************************************************************************************
+    设置环境光
+    @name: Device::SetAmbientLight
+    @return: void
+    @param: const T3DColor & color
+    *************************************************************************************/
+    void SetAmbientLight(const T3DColor& color);
+
+    /**************************************************************************************
+    打开一个光源，RENDER_STATE_LIGHTING打开时DrawMesh用它计算网格的颜色
+    @name: Device::AddLight
+    @return: bool 已经打开了kMaxLights个光源时返回false
+    @param: const T3DLight & light
+    *************************************************************************************/
+    bool AddLight(const T3DLight& light);
+
+    /**************************************************************************************
+    关闭所有光源，环境光不变
+    @name: Device::ClearLights
+    @return: void
+    *************************************************************************************/
+    void ClearLights();
 
     /**************************************************************************************
     
@@ -197,5 +710,256 @@ public:
     @param: const vertex_t * box_vertices
     *************************************************************************************/
     void DrawBox(float theta, const T3DVertex* box_vertices);
+
+    /**************************************************************************************
+    使用当前的世界矩阵绘制立方体
+    @name: Device::DrawBox
+    @return: void
+    @param: const vertex_t * box_vertices 立方体的8个顶点
+    *************************************************************************************/
+    void DrawBox(const T3DVertex* box_vertices);
+
+    /**************************************************************************************
+    把若干个命令缓冲区中录制的绘制命令合并排序后回放。不透明的命令按由近及远、
+    再按纹理排序，半透明的命令排在最后并由远及近绘制
+    @name: Device::SubmitCommandBuffers
+    @return: void
+    @param: CommandBuffer * const * buffers
+    @param: uint32_t count
+    *************************************************************************************/
+    void SubmitCommandBuffers(CommandBuffer* const* buffers, uint32_t count);
+
+private:
+    /**************************************************************************************
+    把顶点变换到屏幕空间，并做好透视校正插值的准备
+    @name: Device::TransformVertex
+    @return: bool 顶点在CVV之外时返回false
+    @param: T3DVertex * transformed 变换后的顶点
+    @param: const T3DVertex * vertex
+    *************************************************************************************/
+    bool TransformVertex(T3DVertex* transformed, const T3DVertex* vertex) const;
+
+    /**************************************************************************************
+    模型空间的包围盒是否整个在视锥的某一个裁剪面之外
+    @name: Device::IsBoxOutsideFrustum
+    @return: bool
+    @param: const float * box_min
+    @param: const float * box_max
+    *************************************************************************************/
+    bool IsBoxOutsideFrustum(const float* box_min, const float* box_max) const;
+
+    /**************************************************************************************
+    对索引数组中[first_index, first_index + triangle_count * 3)范围内的三角形做CVV剔除和背面剔除，
+    把留下来的三角形在索引数组中的位置追加到accepted
+    @name: Device::CullTriangles
+    @return: uint32_t 追加之后accepted中的个数
+    @param: const T3DVertex * cache 变换后顶点缓存
+    @param: const uint8_t * inside 每个顶点是否在CVV之内
+    @param: const uint32_t * indices
+    @param: const uint8_t * triangle_flags 和indices中的三角形一一对应，可以为空
+    @param: uint32_t first_index
+    @param: uint32_t triangle_count
+    @param: uint32_t * accepted
+    @param: uint32_t accepted_count
+    *************************************************************************************/
+    static uint32_t CullTriangles(const T3DVertex* cache, const uint8_t* inside, const uint32_t* indices, const uint8_t* triangle_flags,
+        uint32_t first_index, uint32_t triangle_count, uint32_t* accepted, uint32_t accepted_count);
+
+    /**************************************************************************************
+    对变换后的三角形做设置：拆分成梯形后立即光栅化或者记录下来，以及绘制线框。
+    延迟光栅化时梯形引用着这三个顶点，它们必须存活到FlushDeferredRaster之后
+    @name: Device::SetupTriangle
+    @return: void
+    @param: const T3DVertex * t1
+    @param: const T3DVertex * t2
+    @param: const T3DVertex * t3
+    @param: uint32_t flat_color 三角形的颜色处处相同时为帧缓存格式的颜色，为0时由三个顶点的颜色判断
+    *************************************************************************************/
+    void SetupTriangle(const T3DVertex* t1, const T3DVertex* t2, const T3DVertex* t3, uint32_t flat_color = 0);
+
+    /**************************************************************************************
+    按光源计算网格的颜色并绘制。POLY_SHADE_MODE_GOURAUD和POLY_SHADE_MODE_PHONG的三角形
+    插值逐顶点的光照，POLY_SHADE_MODE_FLAT的三角形每个面计算一次光照并用固定颜色填充，
+    POLY_SHADE_MODE_CONSTANT的三角形不受光照影响。网格没有法线时都按平面着色
+    @name: Device::DrawLitMesh
+    @return: void
+    @param: const T3DMesh * mesh
+    *************************************************************************************/
+    void DrawLitMesh(const T3DMesh* mesh);
+
+    /**************************************************************************************
+    对变换后顶点缓存上的索引三角形列表做剔除，再逐个设置留下来的三角形
+    @name: Device::SetupIndexedTriangles
+    @return: void
+    @param: const T3DVertex * cache
+    @param: const uint8_t * inside
+    @param: const uint32_t * indices
+    @param: uint32_t triangle_count
+    @param: const uint8_t * triangle_flags 可以为空
+    *************************************************************************************/
+    void SetupIndexedTriangles(const T3DVertex* cache, const uint8_t* inside, const uint32_t* indices, uint32_t triangle_count,
+        const uint8_t* triangle_flags);
+
+    /**************************************************************************************
+    把纹理加入纹理表并绑定
+    @name: Device::RegisterTexture
+    @return: TextureHandle
+    @param: T3DTexture * texture
+    *************************************************************************************/
+    TextureHandle RegisterTexture(T3DTexture* texture);
 };
 
+template<typename F>
+uint32_t Device::ForEachScanline(const Trapezoid* trap, const RasterRowSet& rows, F&& fn) const
+{
+    scanline_t scanline;
+    T3DVertex left_point, right_point; // 左右腰边的插值点
+    uint32_t scanline_count = 0;
+    int32_t top = static_cast<int32_t>(trap->top() + 0.5f);           // 拿到梯形的顶边和底边Y坐标
+    int32_t bottom = static_cast<int32_t>(trap->bottom() + 0.5f);
+    int32_t wnd_h = static_cast<int32_t>(window_height_);
+
+    // 不能超出屏幕，行带模式下也不能超出本线程负责的行带
+    top = std::max(top, 0);
+    bottom = std::min(bottom, wnd_h);
+
+    if (rows.mode != RASTER_MODE_INTERLEAVED)
+    {
+        top = std::max(top, rows.band_begin);
+        bottom = std::min(bottom, rows.band_end);
+    }
+
+    int32_t j = top;
+
+    while (j < bottom)
+    {
+        if (rows.mode == RASTER_MODE_INTERLEAVED)
+        {
+            // 当前行所在的行组不归本线程负责时，直接跳到下一个归本线程负责的行组
+            int32_t group = j / rows.granule;
+            int32_t owner = group % rows.count;
+
+            if (owner != rows.index)
+            {
+                j = (group + (rows.index - owner + rows.count) % rows.count) * rows.granule;
+                continue;
+            }
+        }
+
+        trap->CalculateEdgeInterpolatedPoint(static_cast<float>(j) + 0.5f, &left_point, &right_point);
+
+        // 算出插值点的梯形，接下来要算出扫描线
+        Trapezoid::InitializeScanline(&scanline, j, &left_point, &right_point);
+
+        // 到了这一步，算出了每条扫描线的【插值步】数据，可以绘制每一条扫描线
+        fn(&scanline);
+        ++scanline_count;
+        ++j;
+    }
+
+    return scanline_count;
+}
+
+template<typename F>
+void Device::ForEachLinePixel(uint32_t x1, uint32_t y1, uint32_t x2, uint32_t y2, F&& plot)
+{
+    uint32_t x, y, rem = 0;
+
+    // 首先检查 x1 == x2 && y1 == y2，即起点和终点重合的情况。这种情况下，仅需在 x1, y1
+    // 位置调用 plot 即可。
+    if (x1 == x2 && y1 == y2)
+    {
+        plot(x1, y1);
+    }
+    else if (x1 == x2) // o	如果 x1 == x2，说明线段垂直
+    {
+        // 通过检查 y1 <= y2 来确定绘制的方向（向上或向下）
+        int32_t inc = (y1 <= y2) ? 1 : -1;
+
+        for (y = y1; y != y2; y += inc)
+        {
+            // 从 y1行递增或递减到y2行，每次在x1列调用 plot
+            plot(x1, y);
+        }
+
+        plot(x2, y2); // 最后，在x2,y2位置再调用一次plot以确保终点被绘制
+    }
+    else if (y1 == y2) // 如果 y1 == y2，说明线段水平
+    {
+        // 如果 y1 == y2，说明线段水平。同样，通过检查 x1 <= x2 来确定绘制方向（向左或向右），
+        // 然后在y1行从x1列到x2列逐步绘制。最后，调用 plot(x2, y2) 绘制终点。
+        int32_t inc = (x1 <= x2) ? 1 : -1;
+
+        for (x = x1; x != x2; x += inc)
+        {
+            plot(x, y1);
+        }
+
+        plot(x2, y2); // 最后，在x2,y2位置再调用一次plot以确保终点被绘制
+    }
+    else
+    {
+        // 如果线段既不是水平线也不是垂直线，将根据 dx（水平距离）和 dy（垂直距离）来选择绘制主方向
+
+        uint32_t dx = (x1 < x2) ? x2 - x1 : x1 - x2; // 水平方向距离 
+        uint32_t dy = (y1 < y2) ? y2 - y1 : y1 - y2; // 垂直方向距离 
+
+        if (dx >= dy) // 如果 dx >= dy，说明水平距离较大，则在 x 方向上逐步绘制
+        {
+            if (x2 < x1)
+            {
+                std::swap(x1, x2);
+                std::swap(y1, y2);
+                //x = x1, y = y1, x1 = x2, y1 = y2, x2 = x, y2 = y;
+            }
+
+            // 程序从 x1 到 x2 逐步递增 x，并调用 plot 绘制每个像素。
+            // 变量 rem 用来记录累积的误差。当累积的误差 rem >= dx 时，次方向 
+            // y 会递增或递减一次，并更新 rem -= dx 来重置误差。
+            for (x = x1, y = y1; x <= x2; x++)
+            {
+                plot(x, y);
+                rem += dy;
+
+                // 从 x1 开始，每次绘制(x, y) 处的像素，并增加 rem += dy。
+                // 当 rem >= dx 时，说明需要调整 y 方向的坐标，此时将 y 递增或递减一次，并 rem -= dx。
+                if (rem >= dx)
+                {
+                    rem -= dx;
+                    y += (y2 >= y1) ? 1 : -1;
+                    plot(x, y);
+                }
+            }
+
+            plot(x2, y2);
+        }
+        else // 如果 dx < dy，说明垂直距离较大，则在y方向上逐步绘制
+        {
+            if (y2 < y1)
+            {
+                std::swap(x1, x2);
+                std::swap(y1, y2);
+                //x = x1, y = y1, x1 = x2, y1 = y2, x2 = x, y2 = y;
+            }
+
+            // 程序从 y1 到 y2 逐步递增 y，并在(x, y) 处绘制像素。
+            // 变量 rem 记录误差。当 rem >= dy 时，水平方向 x 会递增或递减一次，随后 rem -= dy 来重置误差。
+            for (x = x1, y = y1; y <= y2; y++)
+            {
+                plot(x, y);
+                rem += dx;
+
+                // 从 y1 开始，每次绘制(x, y) 处的像素，并增加 rem += dx。
+                // 当 rem >= dy 时，调整 x 方向的坐标，递增或递减一次 x 并 rem -= dy。
+                if (rem >= dy)
+                {
+                    rem -= dy;
+                    x += (x2 >= x1) ? 1 : -1;
+                    plot(x, y);
+                }
+            }
+
+            plot(x2, y2);
+        }
+    }
+}
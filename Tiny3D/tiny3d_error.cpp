@@ -124,6 +124,11 @@ SOFTWARE.
         ErrorMessageBox(title_, output);
     }
 
+    std::string Error::Message() const
+    {
+        return StringConvertor::UTF16LEtoUTF8(AssembleOutput().c_str());
+    }
+
     void Error::Notify() const
     {
 #if defined(WIN32) || defined(_WIN32)
@@ -82,6 +82,13 @@ public:
      *************************************************************************************/
     virtual void Prompt() const;
 
+    /**************************************************************************************
+     返回UTF-8编码的错误消息，不弹出对话框，供命令行程序输出
+     * @name: Message
+     * @return: std::string
+     *************************************************************************************/
+    std::string Message() const;
+
 protected:
     /**************************************************************************************
      组装错误消息,返回错误消息字符串
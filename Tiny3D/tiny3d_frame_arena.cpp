@@ -0,0 +1,197 @@
+﻿/*********************************************************************************************
+MIT License
+
+Copyright (c) 2024 kumakoko www.xionggf.com
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*********************************************************************************************/
+#include <atomic>
+#include <cassert>
+#include <cstdlib>
+#include <new>
+
+#include "tiny3d_frame_arena.h"
+#include "tiny3d_aligned_class.h"
+#include "tiny3d_device.h"
+
+// 内存块的对齐值，同时也是单次分配支持的最大对齐值
+static const size_t kBlockAlignment = 64;
+
+#if defined(TINY3D_COUNT_ALLOCATIONS)
+
+static std::atomic<uint64_t> g_heap_allocation_count(0);
+
+static inline void CountHeapAllocation()
+{
+    g_heap_allocation_count.fetch_add(1, std::memory_order_relaxed);
+}
+
+uint64_t HeapAllocationCount()
+{
+    return g_heap_allocation_count.load(std::memory_order_relaxed);
+}
+
+// 替换全局的operator new/delete以统计分配次数。数组版本和nothrow版本的默认实现都会
+// 转调这里的版本，不需要另外替换
+void* operator new(std::size_t size)
+{
+    CountHeapAllocation();
+    void* ptr = std::malloc(size != 0 ? size : 1);
+
+    if (ptr == nullptr)
+        throw std::bad_alloc();
+
+    return ptr;
+}
+
+void operator delete(void* ptr) noexcept
+{
+    std::free(ptr);
+}
+
+void operator delete(void* ptr, std::size_t) noexcept
+{
+    std::free(ptr);
+}
+
+void* operator new(std::size_t size, std::align_val_t alignment)
+{
+    CountHeapAllocation();
+    return AlignedMalloc(size != 0 ? size : 1, static_cast<std::size_t>(alignment));
+}
+
+void operator delete(void* ptr, std::align_val_t) noexcept
+{
+    AlignedFree(ptr);
+}
+
+void operator delete(void* ptr, std::size_t, std::align_val_t) noexcept
+{
+    AlignedFree(ptr);
+}
+
+#else
+
+static inline void CountHeapAllocation()
+{
+}
+
+uint64_t HeapAllocationCount()
+{
+    return 0;
+}
+
+#endif
+
+FrameArena::FrameArena(size_t block_size) :
+    block_size_(block_size),
+    offset_(0),
+    retired_bytes_(0)
+{
+    AddBlock(block_size_);
+}
+
+FrameArena::~FrameArena()
+{
+    ReleaseBlocks();
+}
+
+void* FrameArena::Allocate(size_t size, size_t alignment)
+{
+    assert(alignment <= kBlockAlignment && (alignment & (alignment - 1)) == 0);
+    Block& block = blocks_.back();
+    size_t aligned_offset = (offset_ + alignment - 1) & ~(alignment - 1);
+
+    if (aligned_offset + size > block.size)
+    {
+        // 当前块放不下，追加新块。块的起始地址按kBlockAlignment对齐，新块从头开始分配即可
+        retired_bytes_ += offset_;
+        AddBlock(size);
+        aligned_offset = 0;
+    }
+
+    void* ptr = blocks_.back().memory + aligned_offset;
+    offset_ = aligned_offset + size;
+    return ptr;
+}
+
+DeferredTrapezoid* FrameArena::AllocateBinnedTriangles(uint32_t count)
+{
+    return AllocateArray<DeferredTrapezoid>(count);
+}
+
+T3DVertex* FrameArena::AllocateClippedVertices(uint32_t count)
+{
+    return AllocateArray<T3DVertex>(count);
+}
+
+CommandSortEntry* FrameArena::AllocateCommandPackets(uint32_t count)
+{
+    return AllocateArray<CommandSortEntry>(count);
+}
+
+void FrameArena::Reset()
+{
+    if (blocks_.size() > 1)
+    {
+        // 本帧用了不止一块内存，合并成一块足够大的，下一帧就不需要再追加了
+        size_t total = capacity();
+        ReleaseBlocks();
+        AddBlock(total);
+    }
+
+    offset_ = 0;
+    retired_bytes_ = 0;
+}
+
+size_t FrameArena::used_bytes() const
+{
+    return retired_bytes_ + offset_;
+}
+
+size_t FrameArena::capacity() const
+{
+    size_t total = 0;
+
+    for (const Block& block : blocks_)
+    {
+        total += block.size;
+    }
+
+    return total;
+}
+
+void FrameArena::AddBlock(size_t min_size)
+{
+    size_t size = min_size > block_size_ ? min_size : block_size_;
+    CountHeapAllocation();
+    Block block = { static_cast<uint8_t*>(AlignedMalloc(size, kBlockAlignment)), size };
+    blocks_.push_back(block);
+    offset_ = 0;
+}
+
+void FrameArena::ReleaseBlocks()
+{
+    for (const Block& block : blocks_)
+    {
+        AlignedFree(block.memory);
+    }
+
+    blocks_.clear();
+}
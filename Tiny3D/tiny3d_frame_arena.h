@@ -0,0 +1,173 @@
+﻿/*********************************************************************************************
+MIT License
+
+Copyright (c) 2024 kumakoko www.xionggf.com
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*********************************************************************************************/
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <type_traits>
+#include <vector>
+
+//=====================================================================
+// 帧内存池
+//=====================================================================
+
+// 调试版本统计堆分配的次数，用来确认稳定运行时每帧不再分配堆内存
+#if defined(_DEBUG) && !defined(TINY3D_COUNT_ALLOCATIONS)
+#define TINY3D_COUNT_ALLOCATIONS
+#endif
+
+struct T3DVertex;
+struct DeferredTrapezoid;
+struct CommandSortEntry;
+
+/**************************************************************************************
+返回程序启动以来经由operator new和帧内存池发生的堆分配次数，未定义
+TINY3D_COUNT_ALLOCATIONS时总是返回0
+@name: HeapAllocationCount
+@return: uint64_t
+*************************************************************************************/
+uint64_t HeapAllocationCount();
+
+// 线性（bump）分配器，分配只是移动偏移量，不支持单独释放，在帧末调用Reset整体回收。
+// 一帧内用量超过当前容量时追加新的内存块，Reset时把所有内存块合并成一块，
+// 所以经过最初几帧之后，每帧都只在同一块内存里分配
+class FrameArena
+{
+public:
+    static const size_t kDefaultBlockSize = 256 * 1024;
+
+    /**************************************************************************************
+    构造函数
+    @name: FrameArena::FrameArena
+    @return:
+    @param: size_t block_size 初始内存块的大小
+    *************************************************************************************/
+    explicit FrameArena(size_t block_size = kDefaultBlockSize);
+
+    /**************************************************************************************
+    析构函数
+    @name: FrameArena::~FrameArena
+    @return:
+    *************************************************************************************/
+    ~FrameArena();
+
+    FrameArena(const FrameArena&) = delete;
+    FrameArena& operator=(const FrameArena&) = delete;
+
+    /**************************************************************************************
+    分配一段未初始化的内存，在下一次Reset之前一直有效
+    @name: FrameArena::Allocate
+    @return: void*
+    @param: size_t size
+    @param: size_t alignment 必须是2的幂
+    *************************************************************************************/
+    void* Allocate(size_t size, size_t alignment);
+
+    /**************************************************************************************
+    分配count个T类型的对象。不会调用构造和析构函数，T必须可以平凡析构
+    @name: FrameArena::AllocateArray
+    @return: T*
+    @param: uint32_t count
+    *************************************************************************************/
+    template<typename T>
+    inline T* AllocateArray(uint32_t count)
+    {
+        static_assert(std::is_trivially_destructible<T>::value, "FrameArena never runs destructors");
+        return static_cast<T*>(Allocate(sizeof(T) * count, alignof(T)));
+    }
+
+    /**************************************************************************************
+    分配等待光栅化的分箱三角形（梯形）
+    @name: FrameArena::AllocateBinnedTriangles
+    @return: DeferredTrapezoid*
+    @param: uint32_t count
+    *************************************************************************************/
+    DeferredTrapezoid* AllocateBinnedTriangles(uint32_t count);
+
+    /**************************************************************************************
+    分配裁剪时生成的顶点
+    @name: FrameArena::AllocateClippedVertices
+    @return: T3DVertex*
+    @param: uint32_t count
+    *************************************************************************************/
+    T3DVertex* AllocateClippedVertices(uint32_t count);
+
+    /**************************************************************************************
+    分配提交命令缓冲区时用于排序回放的命令包
+    @name: FrameArena::AllocateCommandPackets
+    @return: CommandSortEntry*
+    @param: uint32_t count
+    *************************************************************************************/
+    CommandSortEntry* AllocateCommandPackets(uint32_t count);
+
+    /**************************************************************************************
+    回收本帧分配的全部内存。之前返回的指针全部失效
+    @name: FrameArena::Reset
+    @return: void
+    *************************************************************************************/
+    void Reset();
+
+    /**************************************************************************************
+    本帧已经分配出去的字节数
+    @name: FrameArena::used_bytes
+    @return: size_t
+    *************************************************************************************/
+    size_t used_bytes() const;
+
+    /**************************************************************************************
+    所有内存块的总字节数
+    @name: FrameArena::capacity
+    @return: size_t
+    *************************************************************************************/
+    size_t capacity() const;
+
+private:
+    struct Block
+    {
+        uint8_t* memory;
+        size_t size;
+    };
+
+    /**************************************************************************************
+    追加一块至少能容纳min_size字节的内存块
+    @name: FrameArena::AddBlock
+    @return: void
+    @param: size_t min_size
+    *************************************************************************************/
+    void AddBlock(size_t min_size);
+
+    /**************************************************************************************
+    释放所有内存块
+    @name: FrameArena::ReleaseBlocks
+    @return: void
+    *************************************************************************************/
+    void ReleaseBlocks();
+
+private:
+    std::vector<Block> blocks_;     // 内存块，最后一块是当前正在分配的块
+    size_t block_size_;             // 新内存块的最小大小
+    size_t offset_;                 // 当前块中已经分配的字节数
+    size_t retired_bytes_;          // 本帧之前的块里已经分配的字节数
+};
@@ -53,4 +53,34 @@ void T3DVertexAdd(T3DVertex* y, const T3DVertex* x)
     y->color.r += x->color.r;
     y->color.g += x->color.g;
     y->color.b += x->color.b;
-}
\ No newline at end of file
+}
+// 把顶点压缩成打包格式，颜色和纹理坐标会被截断到[0, 1]
+void T3DVertexPack(T3DPackedVertex* y, const T3DVertex* x)
+{
+    y->x = x->pos.x;
+    y->y = x->pos.y;
+    y->z = x->pos.z;
+    uint32_t r = static_cast<uint32_t>(Clamp(x->color.r, 0.0f, 1.0f) * 255.0f + 0.5f);
+    uint32_t g = static_cast<uint32_t>(Clamp(x->color.g, 0.0f, 1.0f) * 255.0f + 0.5f);
+    uint32_t b = static_cast<uint32_t>(Clamp(x->color.b, 0.0f, 1.0f) * 255.0f + 0.5f);
+    y->color = r | (g << 8) | (b << 16) | 0xFF000000;
+    y->u = static_cast<uint16_t>(Clamp(x->tc.u, 0.0f, 1.0f) * 65535.0f + 0.5f);
+    y->v = static_cast<uint16_t>(Clamp(x->tc.v, 0.0f, 1.0f) * 65535.0f + 0.5f);
+}
+
+// 把打包格式的顶点展开，w和rhw都置为1
+void T3DVertexUnpack(T3DVertex* y, const T3DPackedVertex* x)
+{
+    const float inv_255 = 1.0f / 255.0f;
+    const float inv_65535 = 1.0f / 65535.0f;
+    y->pos.x = x->x;
+    y->pos.y = x->y;
+    y->pos.z = x->z;
+    y->pos.w = 1.0f;
+    y->tc.u = static_cast<float>(x->u) * inv_65535;
+    y->tc.v = static_cast<float>(x->v) * inv_65535;
+    y->color.r = static_cast<float>(x->color & 0xFF) * inv_255;
+    y->color.g = static_cast<float>((x->color >> 8) & 0xFF) * inv_255;
+    y->color.b = static_cast<float>((x->color >> 16) & 0xFF) * inv_255;
+    y->rhw = 1.0f;
+}
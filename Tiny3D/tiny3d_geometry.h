@@ -24,6 +24,7 @@ SOFTWARE.
 
 #pragma once
 
+#include <cstdint>
 #include "tiny3d_vector.h"
 
 //=====================================================================
@@ -40,6 +41,10 @@ struct T3DTextureCoord
     float u, v;
 };
 
+// 着色器声明的插值量，即T3DVertex中除位置以外的属性
+#define VARYING_COLOR               0x1     // 顶点颜色
+#define VARYING_TEXCOORD            0x2     // 纹理坐标
+
 struct T3DVertex
 {
     T3DVector4 pos;
@@ -48,11 +53,19 @@ struct T3DVertex
     float rhw;
 };
 
+// 打包的输入顶点格式：颜色为RGBA8，纹理坐标为16位定点数，共20字节，T3DVertex则是40字节（MSVC上T3DVector4按16字节对齐，是48字节）
+struct T3DPackedVertex
+{
+    float x, y, z;
+    uint32_t color;     // 从低到高依次为R、G、B、A各8位
+    uint16_t u, v;      // 纹理坐标，[0, 65535]映射到[0, 1]
+};
+
+// 梯形的腰边，只引用变换后顶点缓存中的两个端点，不拷贝顶点
 struct edge_t
 {
-    T3DVertex interpolated_point;  // 给了插值比例值后，根据端点12和插值比例值所算出来的插值位置点
-    T3DVertex v1; // 边的端点1
-    T3DVertex v2; // 边的端点2
+    const T3DVertex* v1; // 边的端点1
+    const T3DVertex* v2; // 边的端点2
 };
 
 
@@ -62,4 +75,8 @@ void T3DVertexInterpolate(T3DVertex* y, const T3DVertex* x1, const T3DVertex* x2
 
 void T3DVertexDivision(T3DVertex* step, const T3DVertex* x1, const T3DVertex* x2, float w);
 
-void T3DVertexAdd(T3DVertex* y, const T3DVertex* x);
\ No newline at end of file
+void T3DVertexAdd(T3DVertex* y, const T3DVertex* x);
+
+void T3DVertexPack(T3DPackedVertex* y, const T3DVertex* x);
+
+void T3DVertexUnpack(T3DVertex* y, const T3DPackedVertex* x);
\ No newline at end of file
@@ -0,0 +1,407 @@
+﻿/*********************************************************************************************
+MIT License
+
+Copyright (c) 2024 kumakoko www.xionggf.com
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*********************************************************************************************/
+#include <string>
+
+#include "tiny3d_job_system.h"
+#include "tiny3d_trace.h"
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define TINY3D_CPU_RELAX() _mm_pause()
+#else
+#define TINY3D_CPU_RELAX() std::this_thread::yield()
+#endif
+
+namespace
+{
+    // 当前线程所属的任务系统以及在其中的编号，非工作线程编号为0
+    thread_local JobSystem* t_owner_job_system = nullptr;
+    thread_local uint32_t t_thread_index = 0;
+}
+
+//=====================================================================
+// Chase-Lev 可窃取双端队列
+//=====================================================================
+
+JobSystem::WorkStealingDeque::WorkStealingDeque() : top_(0), bottom_(0)
+{
+}
+
+bool JobSystem::WorkStealingDeque::Push(const Job& job)
+{
+    int64_t b = bottom_.load(std::memory_order_relaxed);
+    int64_t t = top_.load(std::memory_order_acquire);
+
+    if (b - t >= kCapacity)
+        return false;
+
+    jobs_[b & (kCapacity - 1)] = job;
+    std::atomic_thread_fence(std::memory_order_release);
+    bottom_.store(b + 1, std::memory_order_relaxed);
+    return true;
+}
+
+bool JobSystem::WorkStealingDeque::Pop(Job& job)
+{
+    int64_t b = bottom_.load(std::memory_order_relaxed) - 1;
+    bottom_.store(b, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    int64_t t = top_.load(std::memory_order_relaxed);
+
+    if (t > b)
+    {
+        // 队列是空的
+        bottom_.store(b + 1, std::memory_order_relaxed);
+        return false;
+    }
+
+    job = jobs_[b & (kCapacity - 1)];
+
+    if (t == b)
+    {
+        // 只剩最后一个任务，需要和窃取者竞争
+        bool won = top_.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed);
+        bottom_.store(b + 1, std::memory_order_relaxed);
+        return won;
+    }
+
+    return true;
+}
+
+bool JobSystem::WorkStealingDeque::Steal(Job& job)
+{
+    int64_t t = top_.load(std::memory_order_acquire);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    int64_t b = bottom_.load(std::memory_order_acquire);
+
+    if (t >= b)
+        return false;
+
+    job = jobs_[t & (kCapacity - 1)];
+    return top_.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed);
+}
+
+//=====================================================================
+// 全局注入队列，基于序号的有界MPMC环形队列
+//=====================================================================
+
+JobSystem::InjectionQueue::InjectionQueue() : enqueue_pos_(0), dequeue_pos_(0)
+{
+    for (uint32_t i = 0; i < kCapacity; ++i)
+    {
+        cells_[i].sequence.store(i, std::memory_order_relaxed);
+    }
+}
+
+bool JobSystem::InjectionQueue::Push(const Job& job)
+{
+    Cell* cell;
+    uint32_t pos = enqueue_pos_.load(std::memory_order_relaxed);
+
+    for (;;)
+    {
+        cell = &cells_[pos & (kCapacity - 1)];
+        uint32_t seq = cell->sequence.load(std::memory_order_acquire);
+        int32_t diff = static_cast<int32_t>(seq) - static_cast<int32_t>(pos);
+
+        if (diff == 0)
+        {
+            if (enqueue_pos_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                break;
+        }
+        else if (diff < 0)
+        {
+            return false; // 队列满
+        }
+        else
+        {
+            pos = enqueue_pos_.load(std::memory_order_relaxed);
+        }
+    }
+
+    cell->job = job;
+    cell->sequence.store(pos + 1, std::memory_order_release);
+    return true;
+}
+
+bool JobSystem::InjectionQueue::Pop(Job& job)
+{
+    Cell* cell;
+    uint32_t pos = dequeue_pos_.load(std::memory_order_relaxed);
+
+    for (;;)
+    {
+        cell = &cells_[pos & (kCapacity - 1)];
+        uint32_t seq = cell->sequence.load(std::memory_order_acquire);
+        int32_t diff = static_cast<int32_t>(seq) - static_cast<int32_t>(pos + 1);
+
+        if (diff == 0)
+        {
+            if (dequeue_pos_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                break;
+        }
+        else if (diff < 0)
+        {
+            return false; // 队列空
+        }
+        else
+        {
+            pos = dequeue_pos_.load(std::memory_order_relaxed);
+        }
+    }
+
+    job = cell->job;
+    cell->sequence.store(pos + kCapacity, std::memory_order_release);
+    return true;
+}
+
+//=====================================================================
+// 任务系统
+//=====================================================================
+
+JobSystem::JobSystem() :
+    injection_queue_(nullptr),
+    running_(false),
+    sleeping_count_(0),
+    wake_epoch_(0)
+{
+}
+
+JobSystem::~JobSystem()
+{
+    Shutdown();
+}
+
+void JobSystem::Initialize(uint32_t worker_count)
+{
+    if (worker_count == 0)
+    {
+        uint32_t hardware_threads = std::thread::hardware_concurrency();
+        worker_count = hardware_threads > 1 ? hardware_threads - 1 : 0;
+    }
+
+    injection_queue_ = new InjectionQueue();
+    deques_.resize(worker_count + 1, nullptr);
+
+    for (uint32_t i = 1; i <= worker_count; ++i)
+    {
+        deques_[i] = new WorkStealingDeque();
+    }
+
+    running_.store(true);
+
+    for (uint32_t i = 1; i <= worker_count; ++i)
+    {
+        workers_.emplace_back(&JobSystem::WorkerMain, this, i);
+    }
+}
+
+void JobSystem::Shutdown()
+{
+    if (injection_queue_ == nullptr)
+        return;
+
+    {
+        std::lock_guard<std::mutex> lock(park_mutex_);
+        running_.store(false);
+    }
+
+    park_condition_.notify_all();
+
+    for (std::thread& worker : workers_)
+    {
+        worker.join();
+    }
+
+    workers_.clear();
+
+    for (WorkStealingDeque* deque : deques_)
+    {
+        delete deque;
+    }
+
+    deques_.clear();
+    delete injection_queue_;
+    injection_queue_ = nullptr;
+}
+
+uint32_t JobSystem::CurrentThreadIndex()
+{
+    return t_thread_index;
+}
+
+void JobSystem::Submit(Job* jobs, uint32_t count)
+{
+    uint32_t index = (t_owner_job_system == this) ? t_thread_index : 0;
+
+    // 先把计数器加上去，防止任务在入队后立即执行完导致计数器提前归零
+    for (uint32_t i = 0; i < count; ++i)
+    {
+        if (jobs[i].counter != nullptr)
+            jobs[i].counter->pending_.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    for (uint32_t i = 0; i < count; ++i)
+    {
+        bool queued = (index != 0) ? deques_[index]->Push(jobs[i]) : injection_queue_->Push(jobs[i]);
+
+        // 队列满时直接在当前线程执行，保证提交永远不会失败
+        if (!queued)
+            Execute(jobs[i]);
+    }
+
+    WakeWorkers();
+}
+
+void JobSystem::Wait(JobCounter* counter)
+{
+    TINY3D_TRACE_SCOPE("wait");
+    uint32_t index = (t_owner_job_system == this) ? t_thread_index : 0;
+    uint32_t spin = 0;
+
+    while (!counter->IsDone())
+    {
+        Job job;
+
+        if (FindJob(index, job))
+        {
+            // 非工作线程共用注入队列，取到的可能是别的线程提交的任务。比如流水线模式下主线程
+            // 呈现时不能去执行渲染线程的光栅化任务，否则呈现要等渲染。这样的任务放回队列交给工作线程
+            if (index != 0 || job.counter == counter)
+            {
+                Execute(job);
+                spin = 0;
+                continue;
+            }
+
+            if (!injection_queue_->Push(job))
+                Execute(job);
+
+            WakeWorkers();
+        }
+
+        if (++spin < kSpinIterations)
+        {
+            TINY3D_CPU_RELAX();
+        }
+        else
+        {
+            // 剩下的任务正被其他线程执行，让出时间片
+            std::this_thread::yield();
+        }
+    }
+}
+
+bool JobSystem::FindJob(uint32_t thread_index, Job& job)
+{
+    if (thread_index != 0 && deques_[thread_index]->Pop(job))
+        return true;
+
+    if (injection_queue_->Pop(job))
+        return true;
+
+    // 从其他工作线程的队列顶部窃取任务，起点错开以减少竞争
+    uint32_t deque_count = static_cast<uint32_t>(deques_.size());
+
+    for (uint32_t i = 1; i < deque_count; ++i)
+    {
+        uint32_t victim = (thread_index + i) % deque_count;
+
+        if (victim != 0 && victim != thread_index && deques_[victim]->Steal(job))
+            return true;
+    }
+
+    return false;
+}
+
+void JobSystem::Execute(const Job& job)
+{
+    TINY3D_TRACE_SCOPE("job");
+    job.function(job.data, job.begin, job.end);
+
+    if (job.counter != nullptr)
+        job.counter->pending_.fetch_sub(1, std::memory_order_release);
+}
+
+void JobSystem::WakeWorkers()
+{
+    wake_epoch_.fetch_add(1);
+
+    if (sleeping_count_.load() > 0)
+    {
+        std::lock_guard<std::mutex> lock(park_mutex_);
+        park_condition_.notify_all();
+    }
+}
+
+void JobSystem::WorkerMain(uint32_t index)
+{
+    t_owner_job_system = this;
+    t_thread_index = index;
+    TINY3D_TRACE_THREAD_NAME(("job_worker_" + std::to_string(index)).c_str());
+
+    while (running_.load(std::memory_order_relaxed))
+    {
+        Job job;
+
+        if (FindJob(index, job))
+        {
+            Execute(job);
+            continue;
+        }
+
+        // 先自旋一小段时间，新一帧的任务通常会很快到来，这样唤醒延迟只有几微秒
+        bool found = false;
+
+        for (uint32_t i = 0; i < kSpinIterations && !found; ++i)
+        {
+            TINY3D_CPU_RELAX();
+            found = FindJob(index, job);
+        }
+
+        if (found)
+        {
+            Execute(job);
+            continue;
+        }
+
+        // 自旋期间没有等到任务，挂起等待。先记下唤醒纪元再检查一次队列，
+        // 任何在此之后的提交都会改变纪元，因此不会丢失唤醒
+        uint32_t epoch = wake_epoch_.load();
+
+        if (FindJob(index, job))
+        {
+            Execute(job);
+            continue;
+        }
+
+        std::unique_lock<std::mutex> lock(park_mutex_);
+        sleeping_count_.fetch_add(1);
+        park_condition_.wait(lock, [this, epoch]()
+            {
+                return !running_.load() || wake_epoch_.load() != epoch;
+            });
+        sleeping_count_.fetch_sub(1);
+    }
+}
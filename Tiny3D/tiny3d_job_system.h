@@ -0,0 +1,247 @@
+﻿/*********************************************************************************************
+MIT License
+
+Copyright (c) 2024 kumakoko www.xionggf.com
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*********************************************************************************************/
+
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+//=====================================================================
+// 任务调度系统：每个工作线程一个可窃取的双端队列，外部线程提交的任务
+// 放入全局注入队列。空闲的工作线程先自旋一小段时间，再挂起等待唤醒
+//=====================================================================
+
+class JobSystem;
+
+// 任务函数，处理[begin, end)范围内的元素
+typedef void (*JobFunction)(void* data, uint32_t begin, uint32_t end);
+
+// 依赖计数器，每个关联的任务完成时减一，减到0表示这一批任务全部完成
+class JobCounter
+{
+public:
+    JobCounter() : pending_(0)
+    {
+    }
+
+    inline bool IsDone() const
+    {
+        return pending_.load(std::memory_order_acquire) == 0;
+    }
+
+private:
+    friend class JobSystem;
+    std::atomic<int32_t> pending_;
+};
+
+struct Job
+{
+    JobFunction function;   // 任务函数
+    void* data;             // 传给任务函数的用户数据
+    uint32_t begin;         // 处理范围的起点
+    uint32_t end;           // 处理范围的终点（不包含）
+    JobCounter* counter;    // 完成时需要递减的计数器，可以为空
+};
+
+class JobSystem
+{
+public:
+    JobSystem();
+
+    ~JobSystem();
+
+    /**************************************************************************************
+    创建工作线程
+    @name: JobSystem::Initialize
+    @return: void
+    @param: uint32_t worker_count 工作线程个数，为0时取硬件线程数减一
+    *************************************************************************************/
+    void Initialize(uint32_t worker_count);
+
+    /**************************************************************************************
+    唤醒并结束所有的工作线程
+    @name: JobSystem::Shutdown
+    @return: void
+    *************************************************************************************/
+    void Shutdown();
+
+    /**************************************************************************************
+    提交一批任务。在工作线程里提交的任务放入本线程的队列，其他线程提交的放入全局注入队列
+    @name: JobSystem::Submit
+    @return: void
+    @param: Job * jobs
+    @param: uint32_t count
+    *************************************************************************************/
+    void Submit(Job* jobs, uint32_t count);
+
+    /**************************************************************************************
+    等待计数器归零，等待期间当前线程也会帮忙执行任务。工作线程可以执行任何任务，
+    非工作线程只执行关联到counter的任务，不会被别的线程提交的任务拖住
+    @name: JobSystem::Wait
+    @return: void
+    @param: JobCounter * counter
+    *************************************************************************************/
+    void Wait(JobCounter* counter);
+
+    /**************************************************************************************
+    把[0, count)按grain大小切块并行执行，f的原型为 void(uint32_t begin, uint32_t end)。
+    函数返回时所有的块都已经执行完毕
+    @name: JobSystem::ParallelFor
+    @return: void
+    @param: uint32_t count
+    @param: uint32_t grain
+    @param: F && f
+    *************************************************************************************/
+    template<typename F>
+    void ParallelFor(uint32_t count, uint32_t grain, F&& f);
+
+    /**************************************************************************************
+    工作线程个数，不包含调用ParallelFor的线程
+    @name: JobSystem::worker_count
+    @return: uint32_t
+    *************************************************************************************/
+    inline uint32_t worker_count() const
+    {
+        return static_cast<uint32_t>(workers_.size());
+    }
+
+    /**************************************************************************************
+    当前线程的编号，工作线程为 1..worker_count，其他线程为 0
+    @name: JobSystem::CurrentThreadIndex
+    @return: uint32_t
+    *************************************************************************************/
+    static uint32_t CurrentThreadIndex();
+
+private:
+    // Chase-Lev 可窃取双端队列，所有者从底部压入弹出，其他线程从顶部窃取
+    class WorkStealingDeque
+    {
+    public:
+        static const int64_t kCapacity = 4096;
+
+        WorkStealingDeque();
+        bool Push(const Job& job);
+        bool Pop(Job& job);
+        bool Steal(Job& job);
+
+    private:
+        std::atomic<int64_t> top_;
+        char top_padding_[64 - sizeof(std::atomic<int64_t>)];
+        std::atomic<int64_t> bottom_;
+        char bottom_padding_[64 - sizeof(std::atomic<int64_t>)];
+        Job jobs_[kCapacity];
+    };
+
+    // 有界多生产者多消费者队列，作为全局注入队列
+    class InjectionQueue
+    {
+    public:
+        static const uint32_t kCapacity = 4096;
+
+        InjectionQueue();
+        bool Push(const Job& job);
+        bool Pop(Job& job);
+
+    private:
+        struct Cell
+        {
+            std::atomic<uint32_t> sequence;
+            Job job;
+        };
+
+        Cell cells_[kCapacity];
+        std::atomic<uint32_t> enqueue_pos_;
+        char enqueue_padding_[64 - sizeof(std::atomic<uint32_t>)];
+        std::atomic<uint32_t> dequeue_pos_;
+    };
+
+    void WorkerMain(uint32_t index);
+    bool FindJob(uint32_t thread_index, Job& job);
+    void Execute(const Job& job);
+    void WakeWorkers();
+
+    template<typename F>
+    static void ParallelForTrampoline(void* data, uint32_t begin, uint32_t end)
+    {
+        (*static_cast<F*>(data))(begin, end);
+    }
+
+    static const uint32_t kSpinIterations = 4096;   // 挂起前的自旋次数
+    static const uint32_t kMaxBatchJobs = 256;      // ParallelFor一次最多切出的块数
+
+    std::vector<std::thread> workers_;
+    std::vector<WorkStealingDeque*> deques_;        // 下标0不使用，对应非工作线程
+    InjectionQueue* injection_queue_;
+    std::atomic<bool> running_;
+    std::atomic<uint32_t> sleeping_count_;
+    std::atomic<uint32_t> wake_epoch_;
+    std::mutex park_mutex_;
+    std::condition_variable park_condition_;
+};
+
+template<typename F>
+void JobSystem::ParallelFor(uint32_t count, uint32_t grain, F&& f)
+{
+    typedef typename std::remove_reference<F>::type Functor;
+
+    if (count == 0)
+        return;
+
+    if (grain == 0)
+        grain = 1;
+
+    uint32_t chunk_count = (count + grain - 1) / grain;
+
+    // 没有工作线程或者只有一块时直接在当前线程执行
+    if (workers_.empty() || chunk_count == 1)
+    {
+        f(0, count);
+        return;
+    }
+
+    // 块太多时放大粒度，保证任务数组可以放在栈上，不需要动态分配
+    if (chunk_count > kMaxBatchJobs)
+    {
+        grain = (count + kMaxBatchJobs - 1) / kMaxBatchJobs;
+        chunk_count = (count + grain - 1) / grain;
+    }
+
+    Job jobs[kMaxBatchJobs];
+    JobCounter counter;
+
+    for (uint32_t i = 0; i < chunk_count; ++i)
+    {
+        uint32_t begin = i * grain;
+        uint32_t end = (begin + grain < count) ? begin + grain : count;
+        jobs[i] = { &JobSystem::ParallelForTrampoline<Functor>, const_cast<void*>(static_cast<const void*>(&f)), begin, end, &counter };
+    }
+
+    Submit(jobs, chunk_count);
+    Wait(&counter);
+}
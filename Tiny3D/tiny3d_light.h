@@ -0,0 +1,103 @@
+﻿/*********************************************************************************************
+MIT License
+
+Copyright (c) 2024 kumakoko www.xionggf.com
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*********************************************************************************************/
+
+#pragma once
+
+#include <cstdint>
+
+#include "tiny3d_geometry.h"
+#include "tiny3d_simd.h"
+
+//=====================================================================
+// 光源
+//=====================================================================
+
+static const uint32_t kMaxLights = 8;   // 设备上最多同时打开的光源个数
+
+enum LightType
+{
+    LIGHT_DIRECTIONAL = 0,  // 方向光，没有衰减
+    LIGHT_POINT             // 点光源，按距离衰减
+};
+
+struct T3DLight
+{
+    LightType type;
+    T3DColor color;
+    T3DVector4 direction;   // 方向光：世界空间中光线传播的方向，单位向量
+    T3DVector4 position;    // 点光源：世界空间中的位置
+    float attenuation[3];   // 点光源的衰减，强度乘以 1 / (a0 + a1 * d + a2 * d * d)。分母小于1e-6时按1e-6计算，
+                            // 零初始化的T3DLight不会除以0，但会亮到饱和，一般至少要把a0设为1
+};
+
+/**************************************************************************************
+计算一批SIMD_WIDTH个点受到的漫反射光照：环境光加上各个光源的 max(N・L, 0) 乘以衰减
+@name: EvaluateLights
+@return: void
+@param: SimdFloat * y 光照的r、g、b
+@param: const SimdFloat * position 世界空间中的位置，只有点光源用到
+@param: const SimdFloat * normal 世界空间中的单位法线
+@param: const T3DLight * lights
+@param: uint32_t light_count
+@param: const T3DColor & ambient 环境光
+*************************************************************************************/
+inline void EvaluateLights(SimdFloat* y, const SimdFloat* position, const SimdFloat* normal, const T3DLight* lights, uint32_t light_count,
+    const T3DColor& ambient)
+{
+    SimdFloat zero = SimdFloat::Splat(0.0f);
+    y[0] = SimdFloat::Splat(ambient.r);
+    y[1] = SimdFloat::Splat(ambient.g);
+    y[2] = SimdFloat::Splat(ambient.b);
+
+    for (uint32_t i = 0; i < light_count; ++i)
+    {
+        const T3DLight& light = lights[i];
+        SimdFloat intensity;
+
+        if (light.type == LIGHT_DIRECTIONAL)
+        {
+            // 光线传播方向的反方向才是指向光源的方向
+            intensity = zero - (normal[0] * SimdFloat::Splat(light.direction.x) + normal[1] * SimdFloat::Splat(light.direction.y) +
+                normal[2] * SimdFloat::Splat(light.direction.z));
+        }
+        else
+        {
+            SimdFloat lx = SimdFloat::Splat(light.position.x) - position[0];
+            SimdFloat ly = SimdFloat::Splat(light.position.y) - position[1];
+            SimdFloat lz = SimdFloat::Splat(light.position.z) - position[2];
+            SimdFloat distance = SimdMax(SimdSqrt(lx * lx + ly * ly + lz * lz), SimdFloat::Splat(1e-20f));
+            SimdFloat attenuation = SimdFloat::Splat(light.attenuation[0]) + SimdFloat::Splat(light.attenuation[1]) * distance +
+                SimdFloat::Splat(light.attenuation[2]) * distance * distance;
+
+            // 衰减系数全为0时分母是0，除出来的inf/NaN最后转换成整数颜色是未定义行为
+            attenuation = SimdMax(attenuation, SimdFloat::Splat(1e-6f));
+            intensity = (normal[0] * lx + normal[1] * ly + normal[2] * lz) / (distance * attenuation);
+        }
+
+        intensity = SimdMax(intensity, zero);
+        y[0] += intensity * SimdFloat::Splat(light.color.r);
+        y[1] += intensity * SimdFloat::Splat(light.color.g);
+        y[2] += intensity * SimdFloat::Splat(light.color.b);
+    }
+}
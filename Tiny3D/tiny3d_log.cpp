@@ -1,16 +1,271 @@
+﻿/*********************************************************************************************
+MIT License
+
+Copyright (c) 2024 kumakoko www.xionggf.com
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*********************************************************************************************/
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <mutex>
+#include <thread>
+
 #include "tiny3d_log.h"
 
-void Log::Error(const char* string, ...)
+namespace
 {
+    // 基于序号的有界MPSC环形队列，和任务系统的注入队列是同一种结构
+    struct LogCell
+    {
+        std::atomic<uint32_t> sequence;
+        LogRecord record;
+    };
+
+    const uint32_t kQueueCapacity = 4096;                   // 必须是2的幂
+    const std::chrono::milliseconds kDrainInterval(5);
+
+    struct LogState
+    {
+        LogCell cells[kQueueCapacity];
+        alignas(64) std::atomic<uint32_t> enqueue_pos{ 0 };
+        alignas(64) uint32_t dequeue_pos = 0;              // 只有后台线程访问
+        std::atomic<uint64_t> dropped{ 0 };
+        std::atomic<int> level{ LOG_LEVEL_INFO };
+        std::atomic<uint32_t> next_thread_id{ 0 };
+        uint64_t origin_ns = 0;
+
+        std::mutex writer_mutex;                            // 保护下面的成员
+        std::condition_variable writer_condition;
+        std::thread writer;
+        std::atomic<bool> writer_started{ false };
+        bool writer_running = false;
+        std::FILE* file = nullptr;
+        bool owns_file = false;
+
+        LogState()
+        {
+            for (uint32_t i = 0; i < kQueueCapacity; ++i)
+            {
+                cells[i].sequence.store(i, std::memory_order_relaxed);
+            }
+
+            origin_ns = static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now().time_since_epoch()).count());
+        }
+    };
+
+    LogState& State()
+    {
+        static LogState* state = new LogState();
+        return *state;
+    }
+
+    // 保证进程退出时后台线程被停止，剩下的日志被写出
+    struct LogStateGuard
+    {
+        ~LogStateGuard()
+        {
+            Log::Shutdown();
+        }
+    } g_log_state_guard;
+
+    thread_local uint32_t t_log_thread_id = 0;
+
+    const char* const kLevelNames[LOG_LEVEL_OFF] = { "INFO", "WARN", "ERROR" };
+
+    // 把队列里已经提交的记录格式化后写出，只在后台线程或者Shutdown中调用
+    void DrainQueue(LogState& state, fmt::memory_buffer& out)
+    {
+        out.clear();
 
+        for (;;)
+        {
+            LogCell& cell = state.cells[state.dequeue_pos & (kQueueCapacity - 1)];
+            uint32_t seq = cell.sequence.load(std::memory_order_acquire);
+
+            if (static_cast<int32_t>(seq - (state.dequeue_pos + 1)) < 0)
+                break;
+
+            const LogRecord& record = cell.record;
+            double seconds = static_cast<double>(record.timestamp_ns - state.origin_ns) / 1e9;
+            fmt::format_to(std::back_inserter(out), "[{:12.6f}] [{}] [T{}] ", seconds, kLevelNames[record.level], record.thread_id);
+            record.formatter(out, fmt::string_view(record.format, record.format_size), record.payload);
+            out.push_back('\n');
+
+            cell.sequence.store(state.dequeue_pos + kQueueCapacity, std::memory_order_release);
+            ++state.dequeue_pos;
+        }
+
+        uint64_t dropped = state.dropped.exchange(0, std::memory_order_relaxed);
+
+        if (dropped > 0)
+            fmt::format_to(std::back_inserter(out), "[log] {} messages dropped, queue was full\n", dropped);
+
+        if (out.size() == 0)
+            return;
+
+        std::lock_guard<std::mutex> lock(state.writer_mutex);
+        std::FILE* file = state.file != nullptr ? state.file : stderr;
+        std::fwrite(out.data(), 1, out.size(), file);
+        std::fflush(file);
+    }
+
+    void WriterMain(LogState* state)
+    {
+        fmt::memory_buffer out;
+        std::unique_lock<std::mutex> lock(state->writer_mutex);
+
+        while (state->writer_running)
+        {
+            state->writer_condition.wait_for(lock, kDrainInterval);
+            lock.unlock();
+            DrainQueue(*state, out);
+            lock.lock();
+        }
+    }
 }
 
-void Log::Info(const char* string, ...)
+void Log::Start(const char* path)
 {
+    LogState& state = State();
+    std::lock_guard<std::mutex> lock(state.writer_mutex);
+
+    if (path != nullptr)
+    {
+        std::FILE* file = std::fopen(path, "wb");
+
+        if (file != nullptr)
+        {
+            if (state.owns_file)
+                std::fclose(state.file);
 
+            state.file = file;
+            state.owns_file = true;
+        }
+    }
+
+    if (!state.writer_running)
+    {
+        state.writer_running = true;
+        state.writer = std::thread(WriterMain, &state);
+        state.writer_started.store(true, std::memory_order_release);
+    }
 }
 
-void Log::Warn(const char* string, ...)
+void Log::Shutdown()
 {
+    LogState& state = State();
+
+    {
+        std::lock_guard<std::mutex> lock(state.writer_mutex);
+
+        if (!state.writer_running)
+            return;
 
-}
\ No newline at end of file
+        state.writer_running = false;
+    }
+
+    state.writer_condition.notify_all();
+    state.writer.join();
+
+    fmt::memory_buffer out;
+    DrainQueue(state, out);
+
+    std::lock_guard<std::mutex> lock(state.writer_mutex);
+
+    if (state.owns_file)
+        std::fclose(state.file);
+
+    state.file = nullptr;
+    state.owns_file = false;
+    state.writer_started.store(false, std::memory_order_release);
+}
+
+void Log::SetLevel(LogLevel level)
+{
+    State().level.store(level, std::memory_order_relaxed);
+}
+
+bool Log::IsEnabled(LogLevel level)
+{
+    return level >= State().level.load(std::memory_order_relaxed);
+}
+
+void Log::FormatPreformatted(fmt::memory_buffer& out, fmt::string_view, const uint8_t* payload)
+{
+    uint32_t length;
+    std::memcpy(&length, payload, sizeof(length));
+    out.append(reinterpret_cast<const char*>(payload + sizeof(length)), reinterpret_cast<const char*>(payload + sizeof(length)) + length);
+}
+
+LogRecord* Log::BeginRecord(LogLevel level)
+{
+    LogState& state = State();
+
+    if (level < state.level.load(std::memory_order_relaxed))
+        return nullptr;
+
+    if (!state.writer_started.load(std::memory_order_acquire))
+        Start(nullptr);
+
+    if (t_log_thread_id == 0)
+        t_log_thread_id = state.next_thread_id.fetch_add(1, std::memory_order_relaxed) + 1;
+
+    LogCell* cell;
+    uint32_t pos = state.enqueue_pos.load(std::memory_order_relaxed);
+
+    for (;;)
+    {
+        cell = &state.cells[pos & (kQueueCapacity - 1)];
+        uint32_t seq = cell->sequence.load(std::memory_order_acquire);
+        int32_t diff = static_cast<int32_t>(seq) - static_cast<int32_t>(pos);
+
+        if (diff == 0)
+        {
+            if (state.enqueue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                break;
+        }
+        else if (diff < 0)
+        {
+            // 队列满，宁可丢日志也不能阻塞调用线程
+            state.dropped.fetch_add(1, std::memory_order_relaxed);
+            return nullptr;
+        }
+        else
+        {
+            pos = state.enqueue_pos.load(std::memory_order_relaxed);
+        }
+    }
+
+    LogRecord* record = &cell->record;
+    record->timestamp_ns = static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count());
+    record->thread_id = t_log_thread_id;
+    record->level = level;
+    record->position = pos;
+    return record;
+}
+
+void Log::EndRecord(LogRecord* record)
+{
+    LogCell& cell = State().cells[record->position & (kQueueCapacity - 1)];
+    cell.sequence.store(record->position + 1, std::memory_order_release);
+}
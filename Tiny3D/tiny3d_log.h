@@ -24,10 +24,278 @@ SOFTWARE.
 
 #pragma once
 
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <tuple>
+#include <type_traits>
+
+#include "fmt/format.h"
+
+//=====================================================================
+// 异步日志
+//=====================================================================
+
+// 日志级别，低于当前级别的日志被丢弃
+enum LogLevel
+{
+    LOG_LEVEL_INFO = 0,
+    LOG_LEVEL_WARN,
+    LOG_LEVEL_ERROR,
+    LOG_LEVEL_OFF
+};
+
+// 编译期的最低日志级别，低于它的日志调用展开为空。发布版本默认只保留警告和错误
+#if !defined(TINY3D_LOG_MIN_LEVEL)
+#if defined(_DEBUG)
+#define TINY3D_LOG_MIN_LEVEL 0
+#else
+#define TINY3D_LOG_MIN_LEVEL 1
+#endif
+#endif
+
+// 一条日志记录。调用线程只把格式串指针和参数的二进制拷贝写进记录，
+// 格式化和写文件都由后台线程完成
+struct LogRecord
+{
+    static const uint32_t kPayloadSize = 192;
+
+    // 后台线程调用的格式化函数，由参数类型实例化而来
+    typedef void (*Formatter)(fmt::memory_buffer& out, fmt::string_view format, const uint8_t* payload);
+
+    uint64_t timestamp_ns;          // steady_clock的纳秒数
+    uint32_t thread_id;             // 日志线程编号，从1开始
+    LogLevel level;
+    uint32_t position;              // 在环形队列中的位置
+    const char* format;             // 格式串，必须是字符串常量
+    uint32_t format_size;
+    Formatter formatter;
+    uint8_t payload[kPayloadSize];  // 参数的二进制拷贝
+};
+
+// 参数的编解码。算术类型按值拷贝，字符串把内容拷贝进记录，
+// 避免后台线程格式化时字符串已经失效
+template<typename T, typename Enable = void>
+struct LogArgCodec
+{
+    static_assert(sizeof(T) == 0, "Log only accepts arithmetic and string arguments");
+};
+
+template<typename T>
+struct LogArgCodec<T, std::enable_if_t<std::is_arithmetic_v<T>>>
+{
+    typedef T Decoded;
+
+    static inline size_t Size(const T&)
+    {
+        return sizeof(T);
+    }
+
+    static inline uint8_t* Encode(uint8_t* dst, const T& value)
+    {
+        std::memcpy(dst, &value, sizeof(T));
+        return dst + sizeof(T);
+    }
+
+    static inline Decoded Decode(const uint8_t*& src)
+    {
+        T value;
+        std::memcpy(&value, src, sizeof(T));
+        src += sizeof(T);
+        return value;
+    }
+};
+
+struct LogStringCodec
+{
+    typedef fmt::string_view Decoded;
+
+    static inline size_t Size(std::string_view value)
+    {
+        return sizeof(uint32_t) + value.size();
+    }
+
+    static inline uint8_t* Encode(uint8_t* dst, std::string_view value)
+    {
+        uint32_t length = static_cast<uint32_t>(value.size());
+        std::memcpy(dst, &length, sizeof(length));
+        std::memcpy(dst + sizeof(length), value.data(), length);
+        return dst + sizeof(length) + length;
+    }
+
+    static inline Decoded Decode(const uint8_t*& src)
+    {
+        uint32_t length;
+        std::memcpy(&length, src, sizeof(length));
+        Decoded value(reinterpret_cast<const char*>(src + sizeof(length)), length);
+        src += sizeof(length) + length;
+        return value;
+    }
+};
+
+template<> struct LogArgCodec<const char*> : LogStringCodec {};
+template<> struct LogArgCodec<char*> : LogStringCodec {};
+template<> struct LogArgCodec<std::string> : LogStringCodec {};
+template<> struct LogArgCodec<std::string_view> : LogStringCodec {};
+
 class Log
 {
 public:
-    static void Info(const char* string, ...);
-    static void Warn(const char* string, ...);
-    static void Error(const char* string, ...);
-};
\ No newline at end of file
+    /**************************************************************************************
+    启动后台写日志的线程。没有调用时，第一条日志会以标准错误输出为目标自动启动
+    @name: Log::Start
+    @return: void
+    @param: const char * path 日志文件路径，为nullptr时写到标准错误输出
+    *************************************************************************************/
+    static void Start(const char* path);
+
+    /**************************************************************************************
+    把队列里剩余的日志全部写出，然后停止后台线程并关闭日志文件
+    @name: Log::Shutdown
+    @return: void
+    *************************************************************************************/
+    static void Shutdown();
+
+    /**************************************************************************************
+    设置运行期的最低日志级别
+    @name: Log::SetLevel
+    @return: void
+    @param: LogLevel level
+    *************************************************************************************/
+    static void SetLevel(LogLevel level);
+
+    /**************************************************************************************
+    指定级别的日志在运行期是否会被记录
+    @name: Log::IsEnabled
+    @return: bool
+    @param: LogLevel level
+    *************************************************************************************/
+    static bool IsEnabled(LogLevel level);
+
+    /**************************************************************************************
+    记录一条信息日志，格式串使用fmt的语法。调用线程不会格式化也不会做任何I/O，
+    队列满时直接丢弃这条日志
+    @name: Log::Info
+    @return: void
+    @param: fmt::format_string<Args...> format
+    @param: Args && ... args
+    *************************************************************************************/
+    template<typename... Args>
+    static inline void Info(fmt::format_string<Args...> format, Args&&... args)
+    {
+#if TINY3D_LOG_MIN_LEVEL <= 0
+        Write(LOG_LEVEL_INFO, format, std::forward<Args>(args)...);
+#else
+        (void)format;
+        ((void)args, ...);
+#endif
+    }
+
+    /**************************************************************************************
+    记录一条警告日志
+    @name: Log::Warn
+    @return: void
+    @param: fmt::format_string<Args...> format
+    @param: Args && ... args
+    *************************************************************************************/
+    template<typename... Args>
+    static inline void Warn(fmt::format_string<Args...> format, Args&&... args)
+    {
+#if TINY3D_LOG_MIN_LEVEL <= 1
+        Write(LOG_LEVEL_WARN, format, std::forward<Args>(args)...);
+#else
+        (void)format;
+        ((void)args, ...);
+#endif
+    }
+
+    /**************************************************************************************
+    记录一条错误日志
+    @name: Log::Error
+    @return: void
+    @param: fmt::format_string<Args...> format
+    @param: Args && ... args
+    *************************************************************************************/
+    template<typename... Args>
+    static inline void Error(fmt::format_string<Args...> format, Args&&... args)
+    {
+#if TINY3D_LOG_MIN_LEVEL <= 2
+        Write(LOG_LEVEL_ERROR, format, std::forward<Args>(args)...);
+#else
+        (void)format;
+        ((void)args, ...);
+#endif
+    }
+
+private:
+    template<typename... Args>
+    static void Write(LogLevel level, fmt::format_string<Args...> format, Args&&... args);
+
+    template<typename... T>
+    static void FormatRecord(fmt::memory_buffer& out, fmt::string_view format, const uint8_t* payload);
+
+    static void FormatPreformatted(fmt::memory_buffer& out, fmt::string_view format, const uint8_t* payload);
+
+    /**************************************************************************************
+    在环形队列中占用一个空闲的记录，队列满或者级别被过滤掉时返回nullptr
+    @name: Log::BeginRecord
+    @return: LogRecord*
+    @param: LogLevel level
+    *************************************************************************************/
+    static LogRecord* BeginRecord(LogLevel level);
+
+    /**************************************************************************************
+    记录填写完毕，交给后台线程
+    @name: Log::EndRecord
+    @return: void
+    @param: LogRecord * record
+    *************************************************************************************/
+    static void EndRecord(LogRecord* record);
+};
+
+template<typename... Args>
+void Log::Write(LogLevel level, fmt::format_string<Args...> format, Args&&... args)
+{
+    LogRecord* record = BeginRecord(level);
+
+    if (record == nullptr)
+        return;
+
+    fmt::string_view format_view = format.get();
+    size_t size = (static_cast<size_t>(0) + ... + LogArgCodec<std::decay_t<Args>>::Size(args));
+
+    if (size <= LogRecord::kPayloadSize)
+    {
+        uint8_t* dst = record->payload;
+        ((dst = LogArgCodec<std::decay_t<Args>>::Encode(dst, args)), ...);
+        record->formatter = &Log::FormatRecord<std::decay_t<Args>...>;
+    }
+    else
+    {
+        // 参数太长放不进记录，只好在调用线程格式化并截断
+        const uint32_t capacity = LogRecord::kPayloadSize - sizeof(uint32_t);
+        char* text = reinterpret_cast<char*>(record->payload + sizeof(uint32_t));
+        uint32_t length = static_cast<uint32_t>(fmt::format_to_n(text, capacity, format, std::forward<Args>(args)...).size);
+        length = length < capacity ? length : capacity;
+        std::memcpy(record->payload, &length, sizeof(length));
+        record->formatter = &Log::FormatPreformatted;
+    }
+
+    record->format = format_view.data();
+    record->format_size = static_cast<uint32_t>(format_view.size());
+    EndRecord(record);
+}
+
+template<typename... T>
+void Log::FormatRecord(fmt::memory_buffer& out, fmt::string_view format, const uint8_t* payload)
+{
+    // 花括号初始化保证参数按从左到右的顺序解码
+    std::tuple<typename LogArgCodec<T>::Decoded...> values{ LogArgCodec<T>::Decode(payload)... };
+    std::apply([&](auto&... value)
+        {
+            fmt::vformat_to(std::back_inserter(out), format, fmt::make_format_args(value...));
+        }, values);
+    (void)payload;
+}
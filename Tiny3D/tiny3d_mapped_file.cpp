@@ -0,0 +1,177 @@
+﻿/*********************************************************************************************
+MIT License
+
+Copyright (c) 2024 kumakoko www.xionggf.com
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*********************************************************************************************/
+#if defined(_WIN32)
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "tiny3d_mapped_file.h"
+
+MappedFile::MappedFile() :
+    data_(nullptr),
+    size_(0),
+    modify_time_(0),
+    is_open_(false)
+#if defined(_WIN32)
+    , file_handle_(INVALID_HANDLE_VALUE),
+    mapping_handle_(nullptr)
+#endif
+{
+}
+
+MappedFile::~MappedFile()
+{
+    Close();
+}
+
+#if defined(_WIN32)
+
+bool MappedFile::Open(const char* file_path)
+{
+    Close();
+
+    HANDLE file = CreateFileA(file_path, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+        FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+
+    if (file == INVALID_HANDLE_VALUE)
+        return false;
+
+    LARGE_INTEGER size;
+    FILETIME write_time;
+
+    if (!GetFileSizeEx(file, &size) || !GetFileTime(file, nullptr, nullptr, &write_time))
+    {
+        CloseHandle(file);
+        return false;
+    }
+
+    HANDLE mapping = nullptr;
+    const void* view = nullptr;
+
+    // 空文件不能创建映射
+    if (size.QuadPart > 0)
+    {
+        mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        view = (mapping != nullptr) ? MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0) : nullptr;
+
+        if (view == nullptr)
+        {
+            if (mapping != nullptr)
+                CloseHandle(mapping);
+
+            CloseHandle(file);
+            return false;
+        }
+    }
+
+    file_handle_ = file;
+    mapping_handle_ = mapping;
+    data_ = static_cast<const char*>(view);
+    size_ = static_cast<size_t>(size.QuadPart);
+    modify_time_ = (static_cast<uint64_t>(write_time.dwHighDateTime) << 32) | write_time.dwLowDateTime;
+    is_open_ = true;
+    return true;
+}
+
+void MappedFile::Close()
+{
+    if (data_ != nullptr)
+        UnmapViewOfFile(data_);
+
+    if (mapping_handle_ != nullptr)
+        CloseHandle(mapping_handle_);
+
+    if (file_handle_ != INVALID_HANDLE_VALUE)
+        CloseHandle(file_handle_);
+
+    data_ = nullptr;
+    size_ = 0;
+    modify_time_ = 0;
+    is_open_ = false;
+    file_handle_ = INVALID_HANDLE_VALUE;
+    mapping_handle_ = nullptr;
+}
+
+#else
+
+bool MappedFile::Open(const char* file_path)
+{
+    Close();
+
+    int fd = open(file_path, O_RDONLY);
+
+    if (fd < 0)
+        return false;
+
+    struct stat status;
+
+    if (fstat(fd, &status) != 0)
+    {
+        close(fd);
+        return false;
+    }
+
+    void* view = nullptr;
+
+    // 空文件不能映射；映射建立之后文件描述符就可以关闭了
+    if (status.st_size > 0)
+    {
+        view = mmap(nullptr, static_cast<size_t>(status.st_size), PROT_READ, MAP_SHARED, fd, 0);
+
+        if (view == MAP_FAILED)
+        {
+            close(fd);
+            return false;
+        }
+
+        madvise(view, static_cast<size_t>(status.st_size), MADV_SEQUENTIAL);
+    }
+
+    close(fd);
+    data_ = static_cast<const char*>(view);
+    size_ = static_cast<size_t>(status.st_size);
+    modify_time_ = static_cast<uint64_t>(status.st_mtime) * 1000000000ull;
+#if defined(__linux__)
+    modify_time_ += static_cast<uint64_t>(status.st_mtim.tv_nsec);
+#endif
+    is_open_ = true;
+    return true;
+}
+
+void MappedFile::Close()
+{
+    if (data_ != nullptr)
+        munmap(const_cast<char*>(data_), size_);
+
+    data_ = nullptr;
+    size_ = 0;
+    modify_time_ = 0;
+    is_open_ = false;
+}
+
+#endif
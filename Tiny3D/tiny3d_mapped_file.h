@@ -0,0 +1,104 @@
+﻿/*********************************************************************************************
+MIT License
+
+Copyright (c) 2024 kumakoko www.xionggf.com
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*********************************************************************************************/
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+//=====================================================================
+// 只读内存映射文件
+//=====================================================================
+
+// 把整个文件以只读方式映射到进程的地址空间，内容按需由缺页中断从页缓存读入，
+// 不需要先把整个文件拷贝到堆上。映射的内容不以'\0'结尾
+class MappedFile
+{
+public:
+    MappedFile();
+    ~MappedFile();
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    /**************************************************************************************
+    打开并映射文件，之前映射的文件会先被关闭。文件不存在或者无法映射时返回false
+    @name: MappedFile::Open
+    @return: bool
+    @param: const char * file_path
+    *************************************************************************************/
+    bool Open(const char* file_path);
+
+    /**************************************************************************************
+    解除映射并关闭文件
+    @name: MappedFile::Close
+    @return: void
+    *************************************************************************************/
+    void Close();
+
+    /**************************************************************************************
+    映射区域的首地址，空文件返回nullptr
+    @name: MappedFile::data
+    @return: const char*
+    *************************************************************************************/
+    inline const char* data() const
+    {
+        return data_;
+    }
+
+    /**************************************************************************************
+    文件的字节数
+    @name: MappedFile::size
+    @return: size_t
+    *************************************************************************************/
+    inline size_t size() const
+    {
+        return size_;
+    }
+
+    /**************************************************************************************
+    文件的最后修改时间，单位和起点由平台决定，只用来判断文件是否被修改过
+    @name: MappedFile::modify_time
+    @return: uint64_t
+    *************************************************************************************/
+    inline uint64_t modify_time() const
+    {
+        return modify_time_;
+    }
+
+    inline bool is_open() const
+    {
+        return is_open_;
+    }
+
+private:
+    const char* data_;
+    size_t size_;
+    uint64_t modify_time_;
+    bool is_open_;
+#if defined(_WIN32)
+    void* file_handle_;
+    void* mapping_handle_;
+#endif
+};
@@ -0,0 +1,84 @@
+﻿/*********************************************************************************************
+MIT License
+
+Copyright (c) 2024 kumakoko www.xionggf.com
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*********************************************************************************************/
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "tiny3d_geometry.h"
+
+//=====================================================================
+// 索引网格
+//=====================================================================
+
+// 三角形的绘制标志，由模型文件中的多边形属性转换而来，每个三角形一个字节
+#define POLY_FLAG_2SIDED            0x01    // 双面，不做背面剔除
+#define POLY_SHADE_MODE_MASK        0x06    // 着色方式
+#define POLY_SHADE_MODE_CONSTANT    0x00    // 固定颜色，不受光照影响
+#define POLY_SHADE_MODE_FLAT        0x02    // 每个三角形计算一次光照
+#define POLY_SHADE_MODE_GOURAUD     0x04    // 逐顶点计算光照，颜色在三角形内插值
+#define POLY_SHADE_MODE_PHONG       0x06    // 逐像素计算光照，目前按POLY_SHADE_MODE_GOURAUD绘制
+
+// 可以直接交给Device::DrawIndexedPrimitives绘制的网格
+struct T3DMesh
+{
+    std::string name;
+    std::vector<T3DPackedVertex> vertices;
+    std::vector<uint32_t> indices;          // 每三个索引构成一个三角形
+    std::vector<uint8_t> triangle_flags;    // 每个三角形的POLY_*标志
+    std::vector<T3DVector4> normals;        // 和vertices一一对应的法线，模型没有法线时为空
+};
+
+/**************************************************************************************
+检查所有索引都小于顶点数。加载器保证读出的网格满足这个条件，绘制函数只在调试版本里断言
+@name: T3DMeshIndicesInRange
+@return: bool
+@param: const uint32_t * indices
+@param: size_t index_count
+@param: size_t vertex_count
+*************************************************************************************/
+inline bool T3DMeshIndicesInRange(const uint32_t* indices, size_t index_count, size_t vertex_count)
+{
+    for (size_t i = 0; i < index_count; ++i)
+    {
+        if (indices[i] >= vertex_count)
+            return false;
+    }
+
+    return true;
+}
+
+/**************************************************************************************
+取网格的三角形标志传给绘制函数。标志个数和三角形个数对不上时返回nullptr，按没有标志处理，
+避免按三角形下标读越界
+@name: T3DMeshTriangleFlags
+@return: const uint8_t*
+@param: const T3DMesh * mesh
+*************************************************************************************/
+inline const uint8_t* T3DMeshTriangleFlags(const T3DMesh* mesh)
+{
+    return (mesh->triangle_flags.size() == mesh->indices.size() / 3) ? mesh->triangle_flags.data() : nullptr;
+}
@@ -0,0 +1,501 @@
+﻿/*********************************************************************************************
+MIT License
+
+Copyright (c) 2024 kumakoko www.xionggf.com
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*********************************************************************************************/
+#include <cstdio>
+#include <cstring>
+#include <cmath>
+#include <cfloat>
+#include <algorithm>
+#include <filesystem>
+#include <string>
+#include <system_error>
+#include <unordered_map>
+#include <vector>
+
+#include "tiny3d_mesh_file.h"
+
+namespace
+{
+    const uint32_t kMeshFileMagic = 0x4D443354;         // "T3DM"
+    const uint32_t kMeshFileVersion = 2;                // 版本1是ObjLoader早期只存打包顶点的缓存格式
+    const uint32_t kLodBaseResolution = 64;             // 第1级LOD的聚类网格沿最长轴的格子数，之后每级减半
+    const float kLodMinReduction = 0.85f;               // 三角形数减少不到15%的LOD不值得保存
+
+    // 数据流中每个元素的字节数以及元素个数
+    // 文件头里的计数来自文件，按64位计算，32位平台上也不会溢出
+    uint64_t StreamSize(const MeshFileHeader& header, uint32_t stream)
+    {
+        uint64_t vertex_count = header.vertex_count;
+
+        switch (stream)
+        {
+        case MESH_STREAM_POSITION_X:
+        case MESH_STREAM_POSITION_Y:
+        case MESH_STREAM_POSITION_Z:
+            return sizeof(float) * vertex_count;
+        case MESH_STREAM_COLOR:
+            return sizeof(uint32_t) * vertex_count;
+        case MESH_STREAM_TEXCOORD_U:
+        case MESH_STREAM_TEXCOORD_V:
+            return sizeof(uint16_t) * vertex_count;
+        case MESH_STREAM_NORMAL_X:
+        case MESH_STREAM_NORMAL_Y:
+        case MESH_STREAM_NORMAL_Z:
+            return header.has_normals ? sizeof(float) * vertex_count : 0;
+        case MESH_STREAM_INDEX:
+            return sizeof(uint32_t) * static_cast<uint64_t>(header.index_count);
+        case MESH_STREAM_TRIANGLE_FLAGS:
+            return header.index_count / 3;
+        case MESH_STREAM_MESHLET:
+            return sizeof(MeshFileMeshlet) * static_cast<uint64_t>(header.meshlet_count);
+        case MESH_STREAM_LOD:
+            return sizeof(MeshFileLod) * static_cast<uint64_t>(header.lod_count);
+        case MESH_STREAM_NAME:
+            return header.name_length;
+        default:
+            return 0;
+        }
+    }
+
+    inline uint64_t AlignStream(uint64_t offset)
+    {
+        return (offset + MESH_FILE_STREAM_ALIGNMENT - 1) & ~static_cast<uint64_t>(MESH_FILE_STREAM_ALIGNMENT - 1);
+    }
+
+    // 用顶点聚类生成一级LOD：把包围盒划分成边长为cell的格子，同一个格子里的顶点合并到
+    // 其中第一个顶点上，退化的三角形丢掉。代表顶点是原有的顶点，所以各级LOD可以共用顶点流
+    void ClusterLod(const T3DMesh& mesh, const float* bounds_min, float cell, uint32_t resolution,
+        std::vector<uint32_t>* indices, std::vector<uint8_t>* flags)
+    {
+        std::unordered_map<uint64_t, uint32_t> representatives;
+        std::vector<uint32_t> remap(mesh.vertices.size());
+        uint64_t side = resolution + 1;
+
+        for (size_t i = 0; i < mesh.vertices.size(); ++i)
+        {
+            const T3DPackedVertex& vertex = mesh.vertices[i];
+            uint64_t x = std::min<uint64_t>(static_cast<uint64_t>((vertex.x - bounds_min[0]) / cell), resolution);
+            uint64_t y = std::min<uint64_t>(static_cast<uint64_t>((vertex.y - bounds_min[1]) / cell), resolution);
+            uint64_t z = std::min<uint64_t>(static_cast<uint64_t>((vertex.z - bounds_min[2]) / cell), resolution);
+            remap[i] = representatives.emplace(x + side * (y + side * z), static_cast<uint32_t>(i)).first->second;
+        }
+
+        indices->clear();
+        flags->clear();
+
+        for (size_t i = 0; i + 2 < mesh.indices.size(); i += 3)
+        {
+            uint32_t a = remap[mesh.indices[i]];
+            uint32_t b = remap[mesh.indices[i + 1]];
+            uint32_t c = remap[mesh.indices[i + 2]];
+
+            if (a == b || b == c || a == c)
+                continue;
+
+            indices->push_back(a);
+            indices->push_back(b);
+            indices->push_back(c);
+            flags->push_back(mesh.triangle_flags.empty() ? 0 : mesh.triangle_flags[i / 3]);
+        }
+    }
+
+    // 按索引顺序贪心地把三角形装进meshlet，顶点数或三角形数到达上限时开始新的meshlet
+    void BuildMeshlets(const T3DMesh& mesh, const std::vector<uint32_t>& indices, uint32_t first_index,
+        std::vector<MeshFileMeshlet>* meshlets)
+    {
+        std::vector<uint32_t> stamp(mesh.vertices.size(), UINT32_MAX);
+        uint32_t meshlet_id = 0;
+        uint32_t vertex_count = 0;
+        MeshFileMeshlet current = {};
+
+        for (uint32_t i = 0; i + 2 < indices.size(); i += 3)
+        {
+            uint32_t new_vertices = 0;
+
+            for (uint32_t k = 0; k < 3; ++k)
+                new_vertices += (stamp[indices[i + k]] != meshlet_id) ? 1 : 0;
+
+            if (current.triangle_count > 0 && (vertex_count + new_vertices > MESH_FILE_MESHLET_MAX_VERTICES ||
+                current.triangle_count == MESH_FILE_MESHLET_MAX_TRIANGLES))
+            {
+                meshlets->push_back(current);
+                current.triangle_count = 0;
+                vertex_count = 0;
+                ++meshlet_id;
+            }
+
+            if (current.triangle_count == 0)
+            {
+                current.first_index = first_index + i;
+                const T3DPackedVertex& vertex = mesh.vertices[indices[i]];
+                current.bounds_min[0] = current.bounds_max[0] = vertex.x;
+                current.bounds_min[1] = current.bounds_max[1] = vertex.y;
+                current.bounds_min[2] = current.bounds_max[2] = vertex.z;
+            }
+
+            for (uint32_t k = 0; k < 3; ++k)
+            {
+                uint32_t index = indices[i + k];
+
+                if (stamp[index] != meshlet_id)
+                {
+                    stamp[index] = meshlet_id;
+                    ++vertex_count;
+                }
+
+                const T3DPackedVertex& vertex = mesh.vertices[index];
+                const float position[3] = { vertex.x, vertex.y, vertex.z };
+
+                for (uint32_t axis = 0; axis < 3; ++axis)
+                {
+                    current.bounds_min[axis] = std::min(current.bounds_min[axis], position[axis]);
+                    current.bounds_max[axis] = std::max(current.bounds_max[axis], position[axis]);
+                }
+            }
+
+            ++current.triangle_count;
+        }
+
+        if (current.triangle_count > 0)
+            meshlets->push_back(current);
+    }
+
+    // 把一段数据写到对齐的偏移处，中间用0填充
+    bool WriteStream(FILE* file, uint64_t* position, uint64_t offset, const void* data, size_t size)
+    {
+        static const char kZeros[MESH_FILE_STREAM_ALIGNMENT] = {};
+
+        if (size == 0)
+            return true;
+
+        size_t padding = static_cast<size_t>(offset - *position);
+
+        if (padding > 0 && std::fwrite(kZeros, 1, padding, file) != padding)
+            return false;
+
+        *position = offset + size;
+        return std::fwrite(data, 1, size, file) == size;
+    }
+}
+
+MeshFile::MeshFile() : header_(nullptr)
+{
+}
+
+bool MeshFile::Open(const char* file_path)
+{
+    Close();
+
+    if (!file_.Open(file_path) || file_.size() < sizeof(MeshFileHeader))
+    {
+        file_.Close();
+        return false;
+    }
+
+    const MeshFileHeader* header = reinterpret_cast<const MeshFileHeader*>(file_.data());
+    bool valid = header->magic == kMeshFileMagic && header->version == kMeshFileVersion &&
+        header->file_size == file_.size() && header->index_count % 3 == 0 &&
+        (header->lod_count > 0 || header->index_count == 0) && header->lod_count <= MESH_FILE_MAX_LODS;
+
+    // 名字流的大小就是name_length，和其他流一起检查
+    for (uint32_t i = 0; valid && i < MESH_STREAM_COUNT; ++i)
+    {
+        uint64_t offset = header->stream_offsets[i];
+        uint64_t size = StreamSize(*header, i);
+
+        if (size == 0)
+        {
+            valid = (offset == 0);
+        }
+        else
+        {
+            // 写成减法的形式，偏移或者大小接近2^64时offset + size会回绕
+            valid = offset >= sizeof(MeshFileHeader) && offset % MESH_FILE_STREAM_ALIGNMENT == 0 &&
+                size <= file_.size() && offset <= file_.size() - size;
+        }
+    }
+
+    header_ = header;
+
+    // LOD和meshlet表很小，逐项检查它们引用的范围
+    for (uint32_t i = 0; valid && i < header->lod_count; ++i)
+    {
+        const MeshFileLod& lod = lods()[i];
+        valid = lod.index_count % 3 == 0 && static_cast<uint64_t>(lod.first_index) + lod.index_count <= header->index_count &&
+            static_cast<uint64_t>(lod.first_meshlet) + lod.meshlet_count <= header->meshlet_count;
+    }
+
+    for (uint32_t i = 0; valid && i < header->meshlet_count; ++i)
+    {
+        const MeshFileMeshlet& meshlet = meshlets()[i];
+        valid = meshlet.first_index % 3 == 0 &&
+            meshlet.first_index + static_cast<uint64_t>(meshlet.triangle_count) * 3 <= header->index_count;
+    }
+
+    // 映射区域的内容不可信，越界的索引会让绘制时按顶点数分配的数组写越界
+    if (valid)
+        valid = T3DMeshIndicesInRange(indices(), header->index_count, header->vertex_count);
+
+    if (!valid)
+        Close();
+
+    return valid;
+}
+
+void MeshFile::Close()
+{
+    header_ = nullptr;
+    file_.Close();
+}
+
+void MeshFile::CopyTo(T3DMesh* mesh) const
+{
+    uint32_t vertex_count = header_->vertex_count;
+    const float* x = stream<float>(MESH_STREAM_POSITION_X);
+    const float* y = stream<float>(MESH_STREAM_POSITION_Y);
+    const float* z = stream<float>(MESH_STREAM_POSITION_Z);
+    const uint32_t* color = stream<uint32_t>(MESH_STREAM_COLOR);
+    const uint16_t* u = stream<uint16_t>(MESH_STREAM_TEXCOORD_U);
+    const uint16_t* v = stream<uint16_t>(MESH_STREAM_TEXCOORD_V);
+
+    mesh->name.assign(stream<char>(MESH_STREAM_NAME), header_->name_length);
+    mesh->vertices.resize(vertex_count);
+
+    for (uint32_t i = 0; i < vertex_count; ++i)
+        mesh->vertices[i] = { x[i], y[i], z[i], color[i], u[i], v[i] };
+
+    mesh->normals.clear();
+
+    if (header_->has_normals)
+    {
+        const float* nx = stream<float>(MESH_STREAM_NORMAL_X);
+        const float* ny = stream<float>(MESH_STREAM_NORMAL_Y);
+        const float* nz = stream<float>(MESH_STREAM_NORMAL_Z);
+        mesh->normals.resize(vertex_count);
+
+        for (uint32_t i = 0; i < vertex_count; ++i)
+        {
+            mesh->normals[i].x = nx[i];
+            mesh->normals[i].y = ny[i];
+            mesh->normals[i].z = nz[i];
+            mesh->normals[i].w = 0.0f;
+        }
+    }
+
+    mesh->indices.clear();
+    mesh->triangle_flags.clear();
+
+    if (header_->lod_count > 0)
+    {
+        const MeshFileLod& lod = lods()[0];
+        const uint32_t* indices = this->indices() + lod.first_index;
+        const uint8_t* flags = triangle_flags() + lod.first_index / 3;
+        mesh->indices.assign(indices, indices + lod.index_count);
+        mesh->triangle_flags.assign(flags, flags + lod.index_count / 3);
+    }
+}
+
+bool MeshFile::Write(const char* file_path, const T3DMesh& mesh, uint64_t source_size, uint64_t source_time)
+{
+    MeshFileHeader header = {};
+    header.magic = kMeshFileMagic;
+    header.version = kMeshFileVersion;
+    header.source_size = source_size;
+    header.source_time = source_time;
+    header.vertex_count = static_cast<uint32_t>(mesh.vertices.size());
+    header.has_normals = (!mesh.normals.empty() && mesh.normals.size() == mesh.vertices.size()) ? 1 : 0;
+    header.name_length = static_cast<uint32_t>(mesh.name.size());
+
+    // 包围盒和包围球
+    for (uint32_t axis = 0; axis < 3; ++axis)
+    {
+        header.bounds_min[axis] = mesh.vertices.empty() ? 0.0f : FLT_MAX;
+        header.bounds_max[axis] = mesh.vertices.empty() ? 0.0f : -FLT_MAX;
+    }
+
+    for (const T3DPackedVertex& vertex : mesh.vertices)
+    {
+        const float position[3] = { vertex.x, vertex.y, vertex.z };
+
+        for (uint32_t axis = 0; axis < 3; ++axis)
+        {
+            header.bounds_min[axis] = std::min(header.bounds_min[axis], position[axis]);
+            header.bounds_max[axis] = std::max(header.bounds_max[axis], position[axis]);
+        }
+    }
+
+    float radius_squared = 0.0f;
+
+    for (uint32_t axis = 0; axis < 3; ++axis)
+        header.bounding_sphere[axis] = (header.bounds_min[axis] + header.bounds_max[axis]) * 0.5f;
+
+    for (const T3DPackedVertex& vertex : mesh.vertices)
+    {
+        float dx = vertex.x - header.bounding_sphere[0];
+        float dy = vertex.y - header.bounding_sphere[1];
+        float dz = vertex.z - header.bounding_sphere[2];
+        radius_squared = std::max(radius_squared, dx * dx + dy * dy + dz * dz);
+    }
+
+    header.bounding_sphere[3] = std::sqrt(radius_squared);
+
+    // LOD链：第0级是原始网格，之后逐级加粗聚类网格，直到没有三角形剩下
+    std::vector<uint32_t> indices;
+    std::vector<uint8_t> flags;
+    std::vector<MeshFileLod> lods;
+    std::vector<MeshFileMeshlet> meshlets;
+    std::vector<uint32_t> lod_indices(mesh.indices.begin(), mesh.indices.end() - mesh.indices.size() % 3);
+    std::vector<uint8_t> lod_flags(lod_indices.size() / 3, 0);
+    std::copy_n(mesh.triangle_flags.begin(), std::min(mesh.triangle_flags.size(), lod_flags.size()), lod_flags.begin());
+
+    float extent = 0.0f;
+
+    for (uint32_t axis = 0; axis < 3; ++axis)
+        extent = std::max(extent, header.bounds_max[axis] - header.bounds_min[axis]);
+
+    float error = 0.0f;
+
+    for (uint32_t resolution = kLodBaseResolution; !lod_indices.empty(); resolution /= 2)
+    {
+        MeshFileLod lod = {};
+        lod.first_index = static_cast<uint32_t>(indices.size());
+        lod.index_count = static_cast<uint32_t>(lod_indices.size());
+        lod.first_meshlet = static_cast<uint32_t>(meshlets.size());
+        lod.error = error;
+        BuildMeshlets(mesh, lod_indices, lod.first_index, &meshlets);
+        lod.meshlet_count = static_cast<uint32_t>(meshlets.size()) - lod.first_meshlet;
+        indices.insert(indices.end(), lod_indices.begin(), lod_indices.end());
+        flags.insert(flags.end(), lod_flags.begin(), lod_flags.end());
+        lods.push_back(lod);
+
+        if (lods.size() == MESH_FILE_MAX_LODS || extent <= 0.0f)
+            break;
+
+        // 找到下一个三角形足够少的聚类分辨率
+        size_t previous_count = lod_indices.size();
+
+        for (; resolution >= 2; resolution /= 2)
+        {
+            float cell = extent / static_cast<float>(resolution);
+            ClusterLod(mesh, header.bounds_min, cell, resolution, &lod_indices, &lod_flags);
+            error = cell * 1.7320508f;
+
+            if (lod_indices.size() <= previous_count * kLodMinReduction)
+                break;
+        }
+
+        if (resolution < 2)
+            break;
+    }
+
+    header.index_count = static_cast<uint32_t>(indices.size());
+    header.meshlet_count = static_cast<uint32_t>(meshlets.size());
+    header.lod_count = static_cast<uint32_t>(lods.size());
+
+    // 打包顶点拆成SoA的流
+    uint32_t vertex_count = header.vertex_count;
+    std::vector<float> px(vertex_count), py(vertex_count), pz(vertex_count);
+    std::vector<uint32_t> colors(vertex_count);
+    std::vector<uint16_t> us(vertex_count), vs(vertex_count);
+    std::vector<float> nx, ny, nz;
+
+    for (uint32_t i = 0; i < vertex_count; ++i)
+    {
+        const T3DPackedVertex& vertex = mesh.vertices[i];
+        px[i] = vertex.x;
+        py[i] = vertex.y;
+        pz[i] = vertex.z;
+        colors[i] = vertex.color;
+        us[i] = vertex.u;
+        vs[i] = vertex.v;
+    }
+
+    if (header.has_normals)
+    {
+        nx.resize(vertex_count);
+        ny.resize(vertex_count);
+        nz.resize(vertex_count);
+
+        for (uint32_t i = 0; i < vertex_count; ++i)
+        {
+            nx[i] = mesh.normals[i].x;
+            ny[i] = mesh.normals[i].y;
+            nz[i] = mesh.normals[i].z;
+        }
+    }
+
+    const void* stream_data[MESH_STREAM_COUNT] =
+    {
+        px.data(), py.data(), pz.data(), colors.data(), us.data(), vs.data(), nx.data(), ny.data(), nz.data(),
+        indices.data(), flags.data(), meshlets.data(), lods.data(), mesh.name.data()
+    };
+
+    uint64_t offset = AlignStream(sizeof(MeshFileHeader));
+
+    for (uint32_t i = 0; i < MESH_STREAM_COUNT; ++i)
+    {
+        uint64_t size = StreamSize(header, i);
+        header.stream_offsets[i] = (size > 0) ? offset : 0;
+        offset = (size > 0) ? AlignStream(offset + size) : offset;
+    }
+
+    header.file_size = 0;
+
+    for (uint32_t i = 0; i < MESH_STREAM_COUNT; ++i)
+    {
+        if (header.stream_offsets[i] != 0)
+            header.file_size = header.stream_offsets[i] + StreamSize(header, i);
+    }
+
+    header.file_size = std::max<uint64_t>(header.file_size, sizeof(MeshFileHeader));
+
+    // 目标文件可能还被别的MeshFile映射着（比如热重载），直接截断重写会让映射方读到写了一半的数据甚至收到SIGBUS。
+    // 所以先写临时文件再改名覆盖，已经映射的旧文件内容保持不变
+    std::string temp_path = std::string(file_path) + ".tmp";
+    FILE* file = std::fopen(temp_path.c_str(), "wb");
+
+    if (file == nullptr)
+        return false;
+
+    uint64_t position = sizeof(MeshFileHeader);
+    bool ok = std::fwrite(&header, sizeof(header), 1, file) == 1;
+
+    for (uint32_t i = 0; ok && i < MESH_STREAM_COUNT; ++i)
+        ok = WriteStream(file, &position, header.stream_offsets[i], stream_data[i], static_cast<size_t>(StreamSize(header, i)));
+
+    ok = (std::fflush(file) == 0) && ok;
+    ok = (std::fclose(file) == 0) && ok;
+
+    if (ok)
+    {
+        std::error_code error;
+        std::filesystem::rename(temp_path, file_path, error);
+        ok = !error;
+    }
+
+    // 没写完或者改名失败的临时文件删掉，不留下垃圾文件
+    if (!ok)
+        std::remove(temp_path.c_str());
+
+    return ok;
+}
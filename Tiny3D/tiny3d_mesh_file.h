@@ -0,0 +1,200 @@
+﻿/*********************************************************************************************
+MIT License
+
+Copyright (c) 2024 kumakoko www.xionggf.com
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*********************************************************************************************/
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include "tiny3d_mapped_file.h"
+#include "tiny3d_mesh.h"
+
+//=====================================================================
+// 二进制网格文件
+//=====================================================================
+
+// 文件开头是MeshFileHeader，后面是按64字节对齐的各个数据流。顶点按属性拆成SoA的流，
+// 所有LOD共用同一份顶点，各LOD的索引依次拼接在同一个索引流里。文件映射到内存之后，
+// Device::DrawMeshFile直接读取映射区域，不需要解析也不需要拷贝，多个进程打开同一个
+// 文件时共享操作系统的页缓存
+#define MESH_FILE_MAX_LODS              4
+#define MESH_FILE_MESHLET_MAX_VERTICES  64      // 一个meshlet最多引用的顶点数
+#define MESH_FILE_MESHLET_MAX_TRIANGLES 124     // 一个meshlet最多包含的三角形数
+#define MESH_FILE_STREAM_ALIGNMENT      64
+
+enum MeshStream
+{
+    MESH_STREAM_POSITION_X = 0,     // float
+    MESH_STREAM_POSITION_Y,         // float
+    MESH_STREAM_POSITION_Z,         // float
+    MESH_STREAM_COLOR,              // uint32_t，从低到高依次为R、G、B、A
+    MESH_STREAM_TEXCOORD_U,         // uint16_t，[0, 65535]映射到[0, 1]
+    MESH_STREAM_TEXCOORD_V,         // uint16_t
+    MESH_STREAM_NORMAL_X,           // float，网格没有法线时不存在
+    MESH_STREAM_NORMAL_Y,           // float
+    MESH_STREAM_NORMAL_Z,           // float
+    MESH_STREAM_INDEX,              // uint32_t，所有LOD的索引
+    MESH_STREAM_TRIANGLE_FLAGS,     // uint8_t，和索引流中的三角形一一对应的POLY_*标志
+    MESH_STREAM_MESHLET,            // MeshFileMeshlet
+    MESH_STREAM_LOD,                // MeshFileLod
+    MESH_STREAM_NAME,               // char，不以'\0'结尾
+    MESH_STREAM_COUNT
+};
+
+// 一组相邻的三角形，带有自己的包围盒，可以整体做视锥剔除
+struct MeshFileMeshlet
+{
+    uint32_t first_index;           // 在索引流中的起点
+    uint32_t triangle_count;
+    float bounds_min[3];
+    float bounds_max[3];
+};
+
+// LOD链中的一级，第0级是原始网格，之后每一级的三角形都更少
+struct MeshFileLod
+{
+    uint32_t first_index;           // 在索引流中的起点
+    uint32_t index_count;
+    uint32_t first_meshlet;         // 在meshlet流中的起点
+    uint32_t meshlet_count;
+    float error;                    // 和原始网格相比顶点的最大偏移，模型空间的单位
+    uint32_t reserved;
+};
+
+struct MeshFileHeader
+{
+    uint32_t magic;
+    uint32_t version;
+    uint64_t file_size;
+    uint64_t source_size;           // 生成这个文件的源文件的大小和修改时间，没有源文件时为0
+    uint64_t source_time;
+    uint32_t vertex_count;
+    uint32_t index_count;           // 所有LOD的索引总数
+    uint32_t meshlet_count;         // 所有LOD的meshlet总数
+    uint32_t lod_count;
+    uint32_t has_normals;
+    uint32_t name_length;
+    float bounds_min[3];            // 模型空间的包围盒
+    float bounds_max[3];
+    float bounding_sphere[4];       // 球心和半径
+    uint64_t stream_offsets[MESH_STREAM_COUNT];     // 各数据流在文件中的偏移，不存在的流为0
+};
+
+class MeshFile
+{
+public:
+    MeshFile();
+
+    /**************************************************************************************
+    映射网格文件并检查文件头。文件不存在、版本不对、各数据流越界或者有索引不小于顶点数时返回false。
+    绘制时直接用索引去访问按顶点数分配的数组，所以索引流在这里逐个检查一遍
+    @name: MeshFile::Open
+    @return: bool
+    @param: const char * file_path
+    *************************************************************************************/
+    bool Open(const char* file_path);
+
+    /**************************************************************************************
+    解除映射，之前返回的指针全部失效
+    @name: MeshFile::Close
+    @return: void
+    *************************************************************************************/
+    void Close();
+
+    /**************************************************************************************
+    把第0级LOD拷贝成可以修改的T3DMesh
+    @name: MeshFile::CopyTo
+    @return: void
+    @param: T3DMesh * mesh
+    *************************************************************************************/
+    void CopyTo(T3DMesh* mesh) const;
+
+    /**************************************************************************************
+    生成LOD链和meshlet表，把网格写成网格文件
+    @name: MeshFile::Write
+    @return: bool 写文件失败时返回false
+    @param: const char * file_path
+    @param: const T3DMesh & mesh
+    @param: uint64_t source_size 源文件的大小，记录在文件头中供调用者判断文件是否过期
+    @param: uint64_t source_time 源文件的修改时间
+    *************************************************************************************/
+    static bool Write(const char* file_path, const T3DMesh& mesh, uint64_t source_size, uint64_t source_time);
+
+    /**************************************************************************************
+    返回数据流的首地址，流不存在时返回nullptr
+    @name: MeshFile::stream
+    @return: const T*
+    @param: MeshStream stream
+    *************************************************************************************/
+    template<typename T>
+    inline const T* stream(MeshStream stream) const
+    {
+        uint64_t offset = header_->stream_offsets[stream];
+        return (offset != 0) ? reinterpret_cast<const T*>(file_.data() + offset) : nullptr;
+    }
+
+    inline bool is_open() const
+    {
+        return header_ != nullptr;
+    }
+
+    inline const MeshFileHeader* header() const
+    {
+        return header_;
+    }
+
+    inline uint32_t vertex_count() const
+    {
+        return header_->vertex_count;
+    }
+
+    inline uint32_t lod_count() const
+    {
+        return header_->lod_count;
+    }
+
+    inline const MeshFileLod* lods() const
+    {
+        return stream<MeshFileLod>(MESH_STREAM_LOD);
+    }
+
+    inline const MeshFileMeshlet* meshlets() const
+    {
+        return stream<MeshFileMeshlet>(MESH_STREAM_MESHLET);
+    }
+
+    inline const uint32_t* indices() const
+    {
+        return stream<uint32_t>(MESH_STREAM_INDEX);
+    }
+
+    inline const uint8_t* triangle_flags() const
+    {
+        return stream<uint8_t>(MESH_STREAM_TRIANGLE_FLAGS);
+    }
+
+private:
+    MappedFile file_;
+    const MeshFileHeader* header_;  // 指向映射区域，没有打开文件时为nullptr
+};
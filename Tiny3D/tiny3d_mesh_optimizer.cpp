@@ -0,0 +1,390 @@
+﻿/*********************************************************************************************
+MIT License
+
+Copyright (c) 2024 kumakoko www.xionggf.com
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*********************************************************************************************/
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+#include "tiny3d_mesh_optimizer.h"
+
+namespace
+{
+    const uint32_t kNoVertex = UINT32_MAX;
+    const float kOverdrawAcmrThreshold = 1.05f;     // 切簇后允许的ACMR相对Tipsify结果的倍数
+
+    // 用时间戳模拟FIFO缓存：顶点进入缓存时记下当时的时间，时间只在未命中时前进，
+    // 之后cache_size次未命中以内顶点都还在缓存里
+    struct FifoCache
+    {
+        std::vector<uint32_t> stamps;
+        uint32_t time;
+        uint32_t size;
+
+        FifoCache(uint32_t vertex_count, uint32_t cache_size) : stamps(vertex_count, 0), time(cache_size + 1), size(cache_size)
+        {
+        }
+
+        // 返回是否未命中
+        inline bool Access(uint32_t vertex)
+        {
+            if (time - stamps[vertex] <= size)
+                return false;
+
+            stamps[vertex] = time++;
+            return true;
+        }
+
+        // 清空缓存，之后的访问全部未命中
+        inline void Flush()
+        {
+            time += size + 1;
+        }
+    };
+
+    // 三角形的面积加权法线和重心，法线的长度是面积的两倍。模型按逆时针为正面，法线朝外
+    void TriangleFrame(const T3DMesh& mesh, uint32_t triangle, float normal[3], float centroid[3])
+    {
+        const T3DPackedVertex& a = mesh.vertices[mesh.indices[triangle * 3 + 0]];
+        const T3DPackedVertex& b = mesh.vertices[mesh.indices[triangle * 3 + 1]];
+        const T3DPackedVertex& c = mesh.vertices[mesh.indices[triangle * 3 + 2]];
+        float u[3] = { b.x - a.x, b.y - a.y, b.z - a.z };
+        float v[3] = { c.x - a.x, c.y - a.y, c.z - a.z };
+        normal[0] = u[1] * v[2] - u[2] * v[1];
+        normal[1] = u[2] * v[0] - u[0] * v[2];
+        normal[2] = u[0] * v[1] - u[1] * v[0];
+        centroid[0] = (a.x + b.x + c.x) / 3.0f;
+        centroid[1] = (a.y + b.y + c.y) / 3.0f;
+        centroid[2] = (a.z + b.z + c.z) / 3.0f;
+    }
+
+    // Tipsify（Sander等，2007）。以一个顶点为扇心输出它周围所有还没输出的三角形，然后在刚输出的
+    // 三角形的顶点中挑一个仍在缓存里、剩余三角形又不会把它挤出缓存的顶点作为下一个扇心；
+    // 没有合适的顶点时回溯到最近输出过的顶点，都不行再按编号找，这些位置就是硬边界
+    void Tipsify(const T3DMesh& mesh, uint32_t cache_size, std::vector<uint32_t>* order, std::vector<uint8_t>* hard_boundaries)
+    {
+        uint32_t vertex_count = static_cast<uint32_t>(mesh.vertices.size());
+        uint32_t triangle_count = static_cast<uint32_t>(mesh.indices.size() / 3);
+
+        // 顶点到三角形的邻接表，按CSR格式存放
+        std::vector<uint32_t> offsets(vertex_count + 1, 0);
+
+        for (uint32_t index : mesh.indices)
+        {
+            ++offsets[index + 1];
+        }
+
+        for (uint32_t v = 0; v < vertex_count; ++v)
+        {
+            offsets[v + 1] += offsets[v];
+        }
+
+        std::vector<uint32_t> adjacency(mesh.indices.size());
+        std::vector<uint32_t> fill(offsets.begin(), offsets.end() - 1);
+
+        for (uint32_t i = 0; i < mesh.indices.size(); ++i)
+        {
+            adjacency[fill[mesh.indices[i]]++] = i / 3;
+        }
+
+        std::vector<uint32_t> live(vertex_count);
+
+        for (uint32_t v = 0; v < vertex_count; ++v)
+        {
+            live[v] = offsets[v + 1] - offsets[v];
+        }
+
+        std::vector<uint32_t> stamps(vertex_count, 0);
+        std::vector<uint8_t> emitted(triangle_count, 0);
+        std::vector<uint32_t> dead_end;
+        std::vector<uint32_t> candidates;
+        uint32_t time = cache_size + 1;
+        uint32_t scan = 0;
+        uint32_t fanning = mesh.indices[0];
+
+        order->clear();
+        order->reserve(triangle_count);
+        hard_boundaries->assign(triangle_count, 0);
+        dead_end.reserve(mesh.indices.size());
+
+        while (fanning != kNoVertex)
+        {
+            candidates.clear();
+
+            for (uint32_t k = offsets[fanning]; k < offsets[fanning + 1]; ++k)
+            {
+                uint32_t triangle = adjacency[k];
+
+                if (emitted[triangle])
+                    continue;
+
+                emitted[triangle] = 1;
+                order->push_back(triangle);
+
+                for (uint32_t j = 0; j < 3; ++j)
+                {
+                    uint32_t v = mesh.indices[triangle * 3 + j];
+                    dead_end.push_back(v);
+                    candidates.push_back(v);
+                    --live[v];
+
+                    if (time - stamps[v] > cache_size)
+                        stamps[v] = time++;
+                }
+            }
+
+            // 优先选择在缓存里待得最久、但输出完剩余三角形之后仍不会被挤出缓存的顶点
+            uint32_t next = kNoVertex;
+            int32_t best_priority = -1;
+
+            for (uint32_t v : candidates)
+            {
+                if (live[v] == 0)
+                    continue;
+
+                int32_t priority = 0;
+
+                if (time - stamps[v] + 2 * live[v] <= cache_size)
+                    priority = static_cast<int32_t>(time - stamps[v]);
+
+                if (priority > best_priority)
+                {
+                    best_priority = priority;
+                    next = v;
+                }
+            }
+
+            if (next == kNoVertex)
+            {
+                while (!dead_end.empty() && next == kNoVertex)
+                {
+                    uint32_t v = dead_end.back();
+                    dead_end.pop_back();
+
+                    if (live[v] > 0)
+                        next = v;
+                }
+
+                while (next == kNoVertex && scan < vertex_count)
+                {
+                    if (live[scan] > 0)
+                        next = scan;
+
+                    ++scan;
+                }
+
+                if (order->size() < triangle_count)
+                    (*hard_boundaries)[order->size()] = 1;
+            }
+
+            fanning = next;
+        }
+    }
+}
+
+VertexCacheStats AnalyzeVertexCache(const T3DMesh& mesh, uint32_t cache_size)
+{
+    VertexCacheStats stats = { 0.0f, 0.0f };
+    FifoCache cache(static_cast<uint32_t>(mesh.vertices.size()), cache_size);
+    std::vector<uint8_t> referenced(mesh.vertices.size(), 0);
+    uint32_t misses = 0;
+    uint32_t referenced_count = 0;
+
+    for (uint32_t index : mesh.indices)
+    {
+        misses += cache.Access(index) ? 1 : 0;
+        referenced_count += referenced[index] ? 0 : 1;
+        referenced[index] = 1;
+    }
+
+    if (!mesh.indices.empty())
+    {
+        stats.acmr = static_cast<float>(misses) / static_cast<float>(mesh.indices.size() / 3);
+        stats.atvr = static_cast<float>(misses) / static_cast<float>(referenced_count);
+    }
+
+    return stats;
+}
+
+void OptimizeVertexCache(T3DMesh* mesh, uint32_t cache_size)
+{
+    uint32_t triangle_count = static_cast<uint32_t>(mesh->indices.size() / 3);
+
+    if (triangle_count == 0)
+        return;
+
+    std::vector<uint32_t> order;
+    std::vector<uint8_t> hard_boundaries;
+    Tipsify(*mesh, cache_size, &order, &hard_boundaries);
+
+    // 以Tipsify结果的ACMR为基准切簇。每一簇开始时清空缓存，簇被重新排序之后缓存状态不会延续，
+    // 这样估出的才是排序之后真实的ACMR
+    FifoCache cache(static_cast<uint32_t>(mesh->vertices.size()), cache_size);
+    uint32_t total_misses = 0;
+
+    for (uint32_t triangle : order)
+    {
+        for (uint32_t j = 0; j < 3; ++j)
+            total_misses += cache.Access(mesh->indices[triangle * 3 + j]) ? 1 : 0;
+    }
+
+    float target_acmr = kOverdrawAcmrThreshold * static_cast<float>(total_misses) / static_cast<float>(triangle_count);
+    std::vector<uint32_t> cluster_starts;
+    uint32_t cluster_misses = 0;
+    uint32_t cluster_size = 0;
+    cache.Flush();
+
+    for (uint32_t i = 0; i < triangle_count; ++i)
+    {
+        if (i == 0 || hard_boundaries[i] ||
+            static_cast<float>(cluster_misses) <= target_acmr * static_cast<float>(cluster_size))
+        {
+            cluster_starts.push_back(i);
+            cluster_misses = 0;
+            cluster_size = 0;
+            cache.Flush();
+        }
+
+        for (uint32_t j = 0; j < 3; ++j)
+            cluster_misses += cache.Access(mesh->indices[order[i] * 3 + j]) ? 1 : 0;
+
+        ++cluster_size;
+    }
+
+    cluster_starts.push_back(triangle_count);
+    uint32_t cluster_count = static_cast<uint32_t>(cluster_starts.size() - 1);
+
+    // 每一簇的面积加权重心和法线，以及整个模型的面积加权重心
+    std::vector<float> frames(cluster_count * 6, 0.0f);
+    float mesh_centroid[3] = { 0.0f, 0.0f, 0.0f };
+    float mesh_area = 0.0f;
+
+    for (uint32_t c = 0; c < cluster_count; ++c)
+    {
+        float* frame = &frames[c * 6];
+        float cluster_area = 0.0f;
+
+        for (uint32_t i = cluster_starts[c]; i < cluster_starts[c + 1]; ++i)
+        {
+            float normal[3];
+            float centroid[3];
+            TriangleFrame(*mesh, order[i], normal, centroid);
+            float area = std::sqrt(normal[0] * normal[0] + normal[1] * normal[1] + normal[2] * normal[2]);
+
+            for (uint32_t k = 0; k < 3; ++k)
+            {
+                frame[k] += normal[k];
+                frame[3 + k] += centroid[k] * area;
+                mesh_centroid[k] += centroid[k] * area;
+            }
+
+            cluster_area += area;
+        }
+
+        for (uint32_t k = 0; k < 3 && cluster_area > 0.0f; ++k)
+            frame[3 + k] /= cluster_area;
+
+        mesh_area += cluster_area;
+    }
+
+    for (uint32_t k = 0; k < 3 && mesh_area > 0.0f; ++k)
+        mesh_centroid[k] /= mesh_area;
+
+    // 簇的重心相对模型重心的偏移在簇法线上的投影越大，簇越朝外，越应该先画
+    std::vector<float> outwardness(cluster_count);
+    std::vector<uint32_t> cluster_order(cluster_count);
+
+    for (uint32_t c = 0; c < cluster_count; ++c)
+    {
+        const float* frame = &frames[c * 6];
+        float length = std::sqrt(frame[0] * frame[0] + frame[1] * frame[1] + frame[2] * frame[2]);
+        float dot = 0.0f;
+
+        for (uint32_t k = 0; k < 3; ++k)
+            dot += (frame[3 + k] - mesh_centroid[k]) * frame[k];
+
+        outwardness[c] = length > 0.0f ? dot / length : 0.0f;
+        cluster_order[c] = c;
+    }
+
+    std::stable_sort(cluster_order.begin(), cluster_order.end(), [&outwardness](uint32_t a, uint32_t b)
+        {
+            return outwardness[a] > outwardness[b];
+        });
+
+    std::vector<uint32_t> indices;
+    std::vector<uint8_t> triangle_flags;
+    bool has_flags = mesh->triangle_flags.size() == triangle_count;
+    indices.reserve(mesh->indices.size());
+
+    if (has_flags)
+        triangle_flags.reserve(triangle_count);
+
+    for (uint32_t c : cluster_order)
+    {
+        for (uint32_t i = cluster_starts[c]; i < cluster_starts[c + 1]; ++i)
+        {
+            uint32_t triangle = order[i];
+            indices.insert(indices.end(), mesh->indices.begin() + triangle * 3, mesh->indices.begin() + triangle * 3 + 3);
+
+            if (has_flags)
+                triangle_flags.push_back(mesh->triangle_flags[triangle]);
+        }
+    }
+
+    mesh->indices.swap(indices);
+
+    if (has_flags)
+        mesh->triangle_flags.swap(triangle_flags);
+}
+
+void OptimizeVertexFetch(T3DMesh* mesh)
+{
+    const uint32_t kUnused = UINT32_MAX;
+    std::vector<uint32_t> remap(mesh->vertices.size(), kUnused);
+    std::vector<T3DPackedVertex> vertices;
+    std::vector<T3DVector4> normals;
+    bool has_normals = mesh->normals.size() == mesh->vertices.size() && !mesh->normals.empty();
+    vertices.reserve(mesh->vertices.size());
+
+    if (has_normals)
+        normals.reserve(mesh->normals.size());
+
+    for (uint32_t& index : mesh->indices)
+    {
+        if (remap[index] == kUnused)
+        {
+            remap[index] = static_cast<uint32_t>(vertices.size());
+            vertices.push_back(mesh->vertices[index]);
+
+            if (has_normals)
+                normals.push_back(mesh->normals[index]);
+        }
+
+        index = remap[index];
+    }
+
+    mesh->vertices.swap(vertices);
+
+    if (has_normals)
+        mesh->normals.swap(normals);
+}
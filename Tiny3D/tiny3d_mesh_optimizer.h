@@ -0,0 +1,70 @@
+﻿/*********************************************************************************************
+MIT License
+
+Copyright (c) 2024 kumakoko www.xionggf.com
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*********************************************************************************************/
+
+#pragma once
+
+#include "tiny3d_mesh.h"
+
+//=====================================================================
+// 网格优化
+//=====================================================================
+
+// 估算顶点变换开销时模拟的顶点缓存大小
+static const uint32_t kVertexCacheSize = 16;
+
+// 按FIFO顶点缓存模拟出的变换开销
+struct VertexCacheStats
+{
+    float acmr;     // 平均每个三角形的缓存未命中次数，下限约为0.5
+    float atvr;     // 变换次数与被引用的顶点数之比，下限为1
+};
+
+/**************************************************************************************
+按索引顺序模拟大小为cache_size的FIFO顶点缓存，统计ACMR和ATVR
+@name: AnalyzeVertexCache
+@return: VertexCacheStats
+@param: const T3DMesh & mesh
+@param: uint32_t cache_size
+*************************************************************************************/
+VertexCacheStats AnalyzeVertexCache(const T3DMesh& mesh, uint32_t cache_size);
+
+/**************************************************************************************
+重排三角形：先用Tipsify算法按顶点缓存的局部性排序，再把结果切成若干簇，
+朝外的簇排在前面，先画的三角形更可能挡住后画的三角形，减少过度绘制。
+只在簇单独的ACMR不超过整体1.05倍的位置切开，排序不会明显损害缓存命中率。三角形标志随三角形一起重排
+@name: OptimizeVertexCache
+@return: void
+@param: T3DMesh * mesh
+@param: uint32_t cache_size
+*************************************************************************************/
+void OptimizeVertexCache(T3DMesh* mesh, uint32_t cache_size);
+
+/**************************************************************************************
+按顶点在索引数组中第一次被引用的顺序重排顶点并改写索引，没有被引用的顶点被删除。
+变换顶点时按顺序读取，三角形引用的顶点在内存中也尽量相邻。不改变三角形的顺序
+@name: OptimizeVertexFetch
+@return: void
+@param: T3DMesh * mesh
+*************************************************************************************/
+void OptimizeVertexFetch(T3DMesh* mesh);
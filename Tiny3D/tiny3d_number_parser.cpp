@@ -0,0 +1,148 @@
+﻿/*********************************************************************************************
+MIT License
+
+Copyright (c) 2024 kumakoko www.xionggf.com
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*********************************************************************************************/
+#include <cmath>
+
+#include "tiny3d_number_parser.h"
+
+namespace
+{
+    const double kPowersOf10[] =
+    {
+        1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+        1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+    };
+}
+
+bool ParseFloat(const char*& p, float* value)
+{
+    bool negative = false;
+
+    if (*p == '-' || *p == '+')
+    {
+        negative = (*p == '-');
+        ++p;
+    }
+
+    uint64_t mantissa = 0;
+    int32_t exponent = 0;
+    uint32_t digits = 0;
+
+    while (*p >= '0' && *p <= '9')
+    {
+        if (mantissa < 1000000000000000000ull)
+            mantissa = mantissa * 10 + static_cast<uint64_t>(*p - '0');
+        else
+            ++exponent;
+
+        ++p;
+        ++digits;
+    }
+
+    if (*p == '.')
+    {
+        ++p;
+
+        while (*p >= '0' && *p <= '9')
+        {
+            if (mantissa < 1000000000000000000ull)
+            {
+                mantissa = mantissa * 10 + static_cast<uint64_t>(*p - '0');
+                --exponent;
+            }
+
+            ++p;
+            ++digits;
+        }
+    }
+
+    if (digits == 0)
+        return false;
+
+    if (*p == 'e' || *p == 'E')
+    {
+        ++p;
+        bool negative_exponent = false;
+
+        if (*p == '-' || *p == '+')
+        {
+            negative_exponent = (*p == '-');
+            ++p;
+        }
+
+        if (*p < '0' || *p > '9')
+            return false;
+
+        int32_t e = 0;
+
+        while (*p >= '0' && *p <= '9')
+        {
+            if (e < 10000)
+                e = e * 10 + (*p - '0');
+
+            ++p;
+        }
+
+        exponent += negative_exponent ? -e : e;
+    }
+
+    double result = static_cast<double>(mantissa);
+
+    if (exponent < 0)
+        result = (exponent >= -22) ? result / kPowersOf10[-exponent] : result * std::pow(10.0, exponent);
+    else if (exponent > 0)
+        result = (exponent <= 22) ? result * kPowersOf10[exponent] : result * std::pow(10.0, exponent);
+
+    *value = static_cast<float>(negative ? -result : result);
+    return true;
+}
+
+bool ParseInt(const char*& p, int32_t* value)
+{
+    bool negative = false;
+
+    if (*p == '-' || *p == '+')
+    {
+        negative = (*p == '-');
+        ++p;
+    }
+
+    if (*p < '0' || *p > '9')
+        return false;
+
+    int64_t result = 0;
+
+    while (*p >= '0' && *p <= '9')
+    {
+        if (result <= INT32_MAX)
+            result = result * 10 + (*p - '0');
+
+        ++p;
+    }
+
+    if (result > INT32_MAX)
+        return false;
+
+    *value = static_cast<int32_t>(negative ? -result : result);
+    return true;
+}
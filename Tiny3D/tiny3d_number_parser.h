@@ -0,0 +1,52 @@
+﻿/*********************************************************************************************
+MIT License
+
+Copyright (c) 2024 kumakoko www.xionggf.com
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*********************************************************************************************/
+
+#pragma once
+
+#include <cstdint>
+
+//=====================================================================
+// 模型文本的数字解析
+//=====================================================================
+
+// 不依赖区域设置、不分配内存的数字解析，供各个模型加载器共用。调用者要保证数字后面
+// 跟着一个不属于数字的字符（比如'\0'或者'\n'）作为哨兵，解析时不检查边界
+
+/**************************************************************************************
+解析十进制浮点数，支持正负号、小数点和指数。有效数字超过19位时多出的部分只计入指数
+@name: ParseFloat
+@return: bool 成功时返回true，p移动到数字之后；失败时p的位置不确定
+@param: const char * & p
+@param: float * value
+*************************************************************************************/
+bool ParseFloat(const char*& p, float* value);
+
+/**************************************************************************************
+解析带可选正负号的十进制整数
+@name: ParseInt
+@return: bool 成功时返回true，p移动到数字之后；失败时p的位置不确定
+@param: const char * & p
+@param: int32_t * value
+*************************************************************************************/
+bool ParseInt(const char*& p, int32_t* value);
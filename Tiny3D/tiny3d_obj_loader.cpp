@@ -0,0 +1,608 @@
+﻿/*********************************************************************************************
+MIT License
+
+Copyright (c) 2024 kumakoko www.xionggf.com
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*********************************************************************************************/
+#include <cstdio>
+#include <cstring>
+#include <algorithm>
+#include <vector>
+
+#include "fmt/format.h"
+
+#include "tiny3d_obj_loader.h"
+#include "tiny3d_number_parser.h"
+#include "tiny3d_mapped_file.h"
+#include "tiny3d_mesh_file.h"
+#include "tiny3d_mesh_optimizer.h"
+#include "tiny3d_job_system.h"
+#include "tiny3d_error.h"
+#include "tiny3d_log.h"
+
+const char* const ObjLoader::kCacheExtension = ".t3dmesh";
+
+namespace
+{
+    const size_t kMinChunkBytes = 256 * 1024;           // 小于这个大小的文件不切块
+    const uint32_t kChunksPerThread = 4;                // 每个线程分到的块数，块多一些负载更均衡
+    const int32_t kMissingIndex = INT32_MIN;            // f语句中省略的vt或vn
+    const uint32_t kNoIndex = UINT32_MAX;
+
+    // 三角形的一个角，依次是位置、纹理坐标、法线的下标。正数下标已经转换成从0开始的绝对下标；
+    // 负数下标在所属块内还不知道绝对位置，先存成相对于块起点的下标，relative_mask对应的位置1
+    struct ObjCorner
+    {
+        int32_t index[3];
+        uint32_t relative_mask;
+    };
+
+    // 一个按行边界切出的块的解析结果
+    struct ObjChunk
+    {
+        ObjChunk(const char* chunk_begin, const char* chunk_end) :
+            begin(chunk_begin), end(chunk_end), error_at(nullptr), error(nullptr)
+        {
+        }
+
+        const char* begin;
+        const char* end;                // 紧跟在某个'\n'之后，块内每一行都以'\n'结尾
+        std::vector<float> positions;   // 每个位置3个float
+        std::vector<float> texcoords;   // 每个纹理坐标2个float
+        std::vector<float> normals;     // 每条法线3个float
+        std::vector<ObjCorner> corners; // 每三个角构成一个三角形
+        std::string name;               // 块内第一条o语句给出的名字
+        const char* error_at;           // 出错的位置，没有错误时为nullptr
+        const char* error;
+    };
+
+    inline void SkipBlank(const char*& p)
+    {
+        while (*p == ' ' || *p == '\t')
+            ++p;
+    }
+
+    inline bool IsLineEnd(char c)
+    {
+        return c == '\n' || c == '\r' || c == '#';
+    }
+
+    // 读取f语句中的一个下标并转换成ObjCorner中的形式，count是块内目前已有的元素个数
+    inline bool ReadIndex(const char*& p, uint32_t count, uint32_t slot, ObjCorner* corner)
+    {
+        int32_t value;
+
+        if (!ParseInt(p, &value) || value == 0)
+            return false;
+
+        if (value > 0)
+        {
+            corner->index[slot] = value - 1;
+        }
+        else
+        {
+            corner->index[slot] = static_cast<int32_t>(count) + value;
+            corner->relative_mask |= 1u << slot;
+        }
+
+        return true;
+    }
+
+    bool ReadFloats(const char*& p, float* values, uint32_t count)
+    {
+        for (uint32_t i = 0; i < count; ++i)
+        {
+            SkipBlank(p);
+
+            if (!ParseFloat(p, &values[i]))
+                return false;
+        }
+
+        return true;
+    }
+
+    void ParseChunk(ObjChunk* chunk)
+    {
+        const char* p = chunk->begin;
+        std::vector<ObjCorner> polygon;
+
+        while (p < chunk->end)
+        {
+            const char* line = p;
+            SkipBlank(p);
+            const char* error = nullptr;
+
+            if (p[0] == 'v' && (p[1] == ' ' || p[1] == '\t'))
+            {
+                float xyz[3];
+                p += 1;
+
+                if (ReadFloats(p, xyz, 3))
+                    chunk->positions.insert(chunk->positions.end(), xyz, xyz + 3);
+                else
+                    error = "expected 3 vertex coordinates";
+            }
+            else if (p[0] == 'v' && p[1] == 't' && (p[2] == ' ' || p[2] == '\t'))
+            {
+                float uv[2] = { 0.0f, 0.0f };
+                p += 2;
+
+                if (!ReadFloats(p, uv, 1))
+                    error = "expected texture coordinate";
+
+                SkipBlank(p);
+
+                if (error == nullptr && !IsLineEnd(*p) && !ParseFloat(p, &uv[1]))
+                    error = "expected texture coordinate";
+
+                chunk->texcoords.insert(chunk->texcoords.end(), uv, uv + 2);
+            }
+            else if (p[0] == 'v' && p[1] == 'n' && (p[2] == ' ' || p[2] == '\t'))
+            {
+                float xyz[3];
+                p += 2;
+
+                if (ReadFloats(p, xyz, 3))
+                    chunk->normals.insert(chunk->normals.end(), xyz, xyz + 3);
+                else
+                    error = "expected 3 normal coordinates";
+            }
+            else if (p[0] == 'f' && (p[1] == ' ' || p[1] == '\t'))
+            {
+                uint32_t position_count = static_cast<uint32_t>(chunk->positions.size() / 3);
+                uint32_t texcoord_count = static_cast<uint32_t>(chunk->texcoords.size() / 2);
+                uint32_t normal_count = static_cast<uint32_t>(chunk->normals.size() / 3);
+                polygon.clear();
+                p += 1;
+
+                for (;;)
+                {
+                    SkipBlank(p);
+
+                    if (IsLineEnd(*p))
+                        break;
+
+                    ObjCorner corner = { { kMissingIndex, kMissingIndex, kMissingIndex }, 0 };
+
+                    if (!ReadIndex(p, position_count, 0, &corner))
+                    {
+                        error = "expected face vertex index";
+                        break;
+                    }
+
+                    if (*p == '/')
+                    {
+                        ++p;
+
+                        if (*p != '/' && !ReadIndex(p, texcoord_count, 1, &corner))
+                        {
+                            error = "expected face texture coordinate index";
+                            break;
+                        }
+
+                        if (*p == '/')
+                        {
+                            ++p;
+
+                            if (!ReadIndex(p, normal_count, 2, &corner))
+                            {
+                                error = "expected face normal index";
+                                break;
+                            }
+                        }
+                    }
+
+                    polygon.push_back(corner);
+                }
+
+                if (error == nullptr && polygon.size() < 3)
+                    error = "face has fewer than 3 vertices";
+
+                if (error == nullptr)
+                {
+                    // 扇形拆分
+                    for (size_t k = 1; k + 1 < polygon.size(); ++k)
+                    {
+                        chunk->corners.push_back(polygon[0]);
+                        chunk->corners.push_back(polygon[k]);
+                        chunk->corners.push_back(polygon[k + 1]);
+                    }
+                }
+            }
+            else if (p[0] == 'o' && (p[1] == ' ' || p[1] == '\t') && chunk->name.empty())
+            {
+                p += 1;
+                SkipBlank(p);
+                const char* start = p;
+
+                while (!IsLineEnd(*p))
+                    ++p;
+
+                while (p > start && (p[-1] == ' ' || p[-1] == '\t'))
+                    --p;
+
+                chunk->name.assign(start, p);
+            }
+
+            if (error != nullptr)
+            {
+                chunk->error_at = line;
+                chunk->error = error;
+                return;
+            }
+
+            p = static_cast<const char*>(std::memchr(p, '\n', chunk->end - p)) + 1;
+        }
+    }
+
+    // (位置, 纹理坐标, 法线)三元组到输出顶点下标的开放寻址散列表
+    class VertexTupleMap
+    {
+    public:
+        explicit VertexTupleMap(uint32_t expected_count) : count_(0)
+        {
+            uint32_t capacity = 1024;
+
+            while (capacity < expected_count * 2)
+                capacity *= 2;
+
+            slots_.assign(capacity, Slot{ 0, 0, 0, kNoIndex });
+        }
+
+        // 返回三元组对应的顶点下标，三元组第一次出现时登记为next_value并把inserted置为true
+        uint32_t Insert(uint32_t p, uint32_t t, uint32_t n, uint32_t next_value, bool* inserted)
+        {
+            if ((count_ + 1) * 2 > slots_.size())
+                Grow();
+
+            size_t mask = slots_.size() - 1;
+            size_t i = Hash(p, t, n) & mask;
+
+            for (;;)
+            {
+                Slot& slot = slots_[i];
+
+                if (slot.value == kNoIndex)
+                {
+                    slot = Slot{ p, t, n, next_value };
+                    ++count_;
+                    *inserted = true;
+                    return next_value;
+                }
+
+                if (slot.p == p && slot.t == t && slot.n == n)
+                {
+                    *inserted = false;
+                    return slot.value;
+                }
+
+                i = (i + 1) & mask;
+            }
+        }
+
+    private:
+        struct Slot
+        {
+            uint32_t p, t, n;
+            uint32_t value;
+        };
+
+        static inline size_t Hash(uint32_t p, uint32_t t, uint32_t n)
+        {
+            uint64_t h = p * 0x9E3779B97F4A7C15ull;
+            h ^= (t + 0x632BE59Bull) * 0xC2B2AE3D27D4EB4Full;
+            h ^= (n + 0x85EBCA77ull) * 0x165667B19E3779F9ull;
+            return static_cast<size_t>(h ^ (h >> 29));
+        }
+
+        void Grow()
+        {
+            std::vector<Slot> old_slots(slots_.size() * 2, Slot{ 0, 0, 0, kNoIndex });
+            old_slots.swap(slots_);
+            size_t mask = slots_.size() - 1;
+
+            for (const Slot& slot : old_slots)
+            {
+                if (slot.value == kNoIndex)
+                    continue;
+
+                size_t i = Hash(slot.p, slot.t, slot.n) & mask;
+
+                while (slots_[i].value != kNoIndex)
+                    i = (i + 1) & mask;
+
+                slots_[i] = slot;
+            }
+        }
+
+        std::vector<Slot> slots_;
+        size_t count_;
+    };
+
+    inline uint32_t ResolveIndex(const ObjCorner& corner, uint32_t slot, uint32_t base)
+    {
+        int32_t index = corner.index[slot];
+
+        if (index == kMissingIndex)
+            return kNoIndex;
+
+        // 负数转成无符号数之后一定越界，由调用者统一检查
+        return (corner.relative_mask & (1u << slot)) ? base + static_cast<uint32_t>(index) : static_cast<uint32_t>(index);
+    }
+
+    inline uint16_t PackTexcoord(float value)
+    {
+        value = std::min(std::max(value, 0.0f), 1.0f);
+        return static_cast<uint16_t>(value * 65535.0f + 0.5f);
+    }
+
+    std::string CacheFilePath(const char* file_path)
+    {
+        return std::string(file_path) + ObjLoader::kCacheExtension;
+    }
+
+    // 文件名去掉目录和扩展名，作为没有o语句的模型的名字
+    std::string FileStem(const char* file_path)
+    {
+        std::string stem(file_path);
+        size_t slash = stem.find_last_of("/\\");
+
+        if (slash != std::string::npos)
+            stem.erase(0, slash + 1);
+
+        size_t dot = stem.find_last_of('.');
+
+        if (dot != std::string::npos && dot > 0)
+            stem.erase(dot);
+
+        return stem;
+    }
+
+    // 导入时优化一次，结果写进缓存文件，之后每次加载都直接得到优化过的顺序
+    void OptimizeImportedMesh(const char* file_path, T3DMesh* mesh)
+    {
+        VertexCacheStats before = AnalyzeVertexCache(*mesh, kVertexCacheSize);
+        OptimizeVertexCache(mesh, kVertexCacheSize);
+        OptimizeVertexFetch(mesh);
+        VertexCacheStats after = AnalyzeVertexCache(*mesh, kVertexCacheSize);
+        Log::Info("Optimized {}: ACMR {:.3f} -> {:.3f}, ATVR {:.3f} -> {:.3f}", file_path, before.acmr, after.acmr, before.atvr, after.atvr);
+    }
+}
+
+void ObjLoader::LoadFromFile(const char* file_path, T3DMesh* mesh, JobSystem* job_system)
+{
+    MappedFile source;
+
+    if (!source.Open(file_path))
+        throw Error(fmt::format("Cannot open OBJ file {}", file_path));
+
+    std::string cache_path = CacheFilePath(file_path);
+
+    if (ReadCache(cache_path, source.size(), source.modify_time(), mesh))
+        return;
+
+    LoadFromMemory(source.data(), source.size(), mesh, job_system);
+
+    if (mesh->name.empty())
+        mesh->name = FileStem(file_path);
+
+    OptimizeImportedMesh(file_path, mesh);
+    WriteCache(cache_path, source.size(), source.modify_time(), *mesh);
+}
+
+void ObjLoader::LoadMeshFile(const char* file_path, MeshFile* mesh_file, JobSystem* job_system)
+{
+    MappedFile source;
+
+    if (!source.Open(file_path))
+        throw Error(fmt::format("Cannot open OBJ file {}", file_path));
+
+    std::string cache_path = CacheFilePath(file_path);
+
+    if (mesh_file->Open(cache_path.c_str()) && mesh_file->header()->source_size == source.size() &&
+        mesh_file->header()->source_time == source.modify_time())
+        return;
+
+    mesh_file->Close();
+    T3DMesh mesh;
+    LoadFromMemory(source.data(), source.size(), &mesh, job_system);
+
+    if (mesh.name.empty())
+        mesh.name = FileStem(file_path);
+
+    OptimizeImportedMesh(file_path, &mesh);
+
+    if (!MeshFile::Write(cache_path.c_str(), mesh, source.size(), source.modify_time()) || !mesh_file->Open(cache_path.c_str()))
+        throw Error(fmt::format("Cannot write mesh file {}", cache_path));
+}
+
+void ObjLoader::LoadFromMemory(const char* data, size_t size, T3DMesh* mesh, JobSystem* job_system)
+{
+    // 块内的数字解析以'\n'作为哨兵，所以块只包含完整的行。最后一行没有'\n'时拷贝出来补上一个
+    size_t body_size = size;
+
+    while (body_size > 0 && data[body_size - 1] != '\n')
+        --body_size;
+
+    std::string tail(data + body_size, data + size);
+    tail.push_back('\n');
+
+    uint32_t thread_count = (job_system != nullptr) ? job_system->worker_count() + 1 : 1;
+    size_t chunk_count = std::min<size_t>(body_size / kMinChunkBytes, thread_count * kChunksPerThread);
+    chunk_count = std::max<size_t>(chunk_count, 1);
+
+    std::vector<ObjChunk> chunks;
+    chunks.reserve(chunk_count + 1);
+    const char* chunk_begin = data;
+    const char* body_end = data + body_size;
+
+    for (size_t i = 1; i <= chunk_count && chunk_begin < body_end; ++i)
+    {
+        const char* chunk_end = body_end;
+
+        if (i < chunk_count)
+        {
+            // 把均分点推到下一个行首
+            const char* split = std::max(data + body_size * i / chunk_count, chunk_begin);
+            chunk_end = static_cast<const char*>(std::memchr(split, '\n', body_end - split)) + 1;
+        }
+
+        chunks.push_back(ObjChunk{ chunk_begin, chunk_end });
+        chunk_begin = chunk_end;
+    }
+
+    if (size > body_size)
+        chunks.push_back(ObjChunk{ tail.data(), tail.data() + tail.size() });
+
+    uint32_t parse_count = static_cast<uint32_t>(chunks.size());
+    auto parse = [&chunks](uint32_t begin, uint32_t end)
+        {
+            for (uint32_t i = begin; i < end; ++i)
+                ParseChunk(&chunks[i]);
+        };
+
+    if (job_system != nullptr)
+        job_system->ParallelFor(parse_count, 1, parse);
+    else
+        parse(0, parse_count);
+
+    // 按块的顺序报告第一个错误，行号要数出前面所有块的行数
+    for (const ObjChunk& chunk : chunks)
+    {
+        if (chunk.error_at == nullptr)
+            continue;
+
+        size_t line = 1;
+
+        for (const ObjChunk& previous : chunks)
+        {
+            const char* end = (&previous == &chunk) ? chunk.error_at : previous.end;
+            line += std::count(previous.begin, end, '\n');
+
+            if (&previous == &chunk)
+                break;
+        }
+
+        throw Error(fmt::format("OBJ parse error at line {}: {}", line, chunk.error));
+    }
+
+    // 每个块的元素在全局数组中的起点
+    std::vector<uint32_t> position_base(chunks.size()), texcoord_base(chunks.size()), normal_base(chunks.size());
+    std::vector<float> positions, texcoords, normals;
+    size_t corner_count = 0;
+    mesh->name.clear();
+
+    for (size_t i = 0; i < chunks.size(); ++i)
+    {
+        position_base[i] = static_cast<uint32_t>(positions.size() / 3);
+        texcoord_base[i] = static_cast<uint32_t>(texcoords.size() / 2);
+        normal_base[i] = static_cast<uint32_t>(normals.size() / 3);
+        positions.insert(positions.end(), chunks[i].positions.begin(), chunks[i].positions.end());
+        texcoords.insert(texcoords.end(), chunks[i].texcoords.begin(), chunks[i].texcoords.end());
+        normals.insert(normals.end(), chunks[i].normals.begin(), chunks[i].normals.end());
+        corner_count += chunks[i].corners.size();
+
+        if (mesh->name.empty())
+            mesh->name = chunks[i].name;
+    }
+
+    uint32_t position_count = static_cast<uint32_t>(positions.size() / 3);
+    uint32_t texcoord_count = static_cast<uint32_t>(texcoords.size() / 2);
+    uint32_t normal_count = static_cast<uint32_t>(normals.size() / 3);
+
+    mesh->vertices.clear();
+    mesh->indices.clear();
+    mesh->triangle_flags.clear();
+    mesh->normals.clear();
+    mesh->vertices.reserve(position_count);
+    mesh->indices.reserve(corner_count);
+    mesh->triangle_flags.reserve(corner_count / 3);
+
+    if (normal_count > 0)
+        mesh->normals.reserve(position_count);
+
+    // 按文件中的顺序给三元组编号，输出结果和切块方式无关
+    VertexTupleMap tuple_map(position_count);
+
+    for (size_t i = 0; i < chunks.size(); ++i)
+    {
+        const std::vector<ObjCorner>& corners = chunks[i].corners;
+
+        for (size_t k = 0; k < corners.size(); k += 3)
+        {
+            bool all_normals = true;
+
+            for (size_t c = k; c < k + 3; ++c)
+            {
+                uint32_t p = ResolveIndex(corners[c], 0, position_base[i]);
+                uint32_t t = ResolveIndex(corners[c], 1, texcoord_base[i]);
+                uint32_t n = ResolveIndex(corners[c], 2, normal_base[i]);
+
+                if (p >= position_count || (t != kNoIndex && t >= texcoord_count) || (n != kNoIndex && n >= normal_count))
+                    throw Error("OBJ face references a vertex, texture coordinate or normal that does not exist");
+
+                bool inserted;
+                uint32_t vertex = tuple_map.Insert(p, t, n, static_cast<uint32_t>(mesh->vertices.size()), &inserted);
+
+                if (inserted)
+                {
+                    const float* position = &positions[p * 3];
+                    uint16_t u = (t != kNoIndex) ? PackTexcoord(texcoords[t * 2]) : 0;
+                    // OBJ的纹理坐标原点在左下角，纹理的第0行在最上面
+                    uint16_t v = (t != kNoIndex) ? PackTexcoord(1.0f - texcoords[t * 2 + 1]) : 0;
+                    mesh->vertices.push_back({ position[0], position[1], position[2], 0xFFFFFFFF, u, v });
+
+                    if (normal_count > 0)
+                    {
+                        T3DVector4 normal;
+                        normal.x = (n != kNoIndex) ? normals[n * 3] : 0.0f;
+                        normal.y = (n != kNoIndex) ? normals[n * 3 + 1] : 0.0f;
+                        normal.z = (n != kNoIndex) ? normals[n * 3 + 2] : 0.0f;
+                        normal.w = 0.0f;
+                        mesh->normals.push_back(normal);
+                    }
+                }
+
+                all_normals = all_normals && (n != kNoIndex);
+                mesh->indices.push_back(vertex);
+            }
+
+            // 带法线的三角形逐顶点计算光照，否则用面法线
+            mesh->triangle_flags.push_back(all_normals ? POLY_SHADE_MODE_GOURAUD : POLY_SHADE_MODE_FLAT);
+        }
+    }
+}
+
+bool ObjLoader::ReadCache(const std::string& cache_path, uint64_t source_size, uint64_t source_time, T3DMesh* mesh)
+{
+    MeshFile cache;
+
+    if (!cache.Open(cache_path.c_str()) || cache.header()->source_size != source_size || cache.header()->source_time != source_time)
+        return false;
+
+    cache.CopyTo(mesh);
+    return true;
+}
+
+void ObjLoader::WriteCache(const std::string& cache_path, uint64_t source_size, uint64_t source_time, const T3DMesh& mesh)
+{
+    if (!MeshFile::Write(cache_path.c_str(), mesh, source_size, source_time))
+        Log::Warn("Cannot write mesh cache {}", cache_path);
+}
@@ -0,0 +1,105 @@
+﻿/*********************************************************************************************
+MIT License
+
+Copyright (c) 2024 kumakoko www.xionggf.com
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*********************************************************************************************/
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+#include "tiny3d_mesh.h"
+
+class JobSystem;
+class MeshFile;
+
+//=====================================================================
+// Wavefront OBJ模型文件
+//=====================================================================
+
+// 支持v、vt、vn和f四种语句，f的顶点可以写成v、v/vt、v//vn、v/vt/vn，下标可以是负数（相对下标），
+// 多于3个顶点的多边形按扇形拆分成三角形；o语句给出网格的名字，其余语句忽略。
+// 文件按行边界切成若干块并行解析，(位置, 纹理坐标, 法线)三元组去重后合成一个索引网格。
+// 解析结果按顶点缓存和过度绘制重排三角形、按首次引用的顺序重排顶点之后，以网格文件（MeshFile）
+// 的格式写入同目录下的缓存，源文件没有变化时下一次直接读取缓存
+class ObjLoader
+{
+public:
+    /**************************************************************************************
+    读取OBJ文件，优先使用file_path加上kCacheExtension的缓存文件。缓存记录了源文件的大小和
+    修改时间，两者一致时跳过解析；否则解析源文件并重新写出缓存。失败时抛出Error
+    @name: ObjLoader::LoadFromFile
+    @return: void
+    @param: const char * file_path
+    @param: T3DMesh * mesh
+    @param: JobSystem * job_system 为nullptr时在当前线程解析
+    *************************************************************************************/
+    static void LoadFromFile(const char* file_path, T3DMesh* mesh, JobSystem* job_system);
+
+    /**************************************************************************************
+    和LoadFromFile一样按需生成缓存，但是不拷贝成T3DMesh，而是把缓存的网格文件直接映射给
+    mesh_file，交给Device::DrawMeshFile绘制。失败时抛出Error
+    @name: ObjLoader::LoadMeshFile
+    @return: void
+    @param: const char * file_path
+    @param: MeshFile * mesh_file
+    @param: JobSystem * job_system 为nullptr时在当前线程解析
+    *************************************************************************************/
+    static void LoadMeshFile(const char* file_path, MeshFile* mesh_file, JobSystem* job_system);
+
+    /**************************************************************************************
+    解析内存中的OBJ文本，不读写缓存，失败时抛出Error
+    @name: ObjLoader::LoadFromMemory
+    @return: void
+    @param: const char * data
+    @param: size_t size
+    @param: T3DMesh * mesh
+    @param: JobSystem * job_system 为nullptr时在当前线程解析
+    *************************************************************************************/
+    static void LoadFromMemory(const char* data, size_t size, T3DMesh* mesh, JobSystem* job_system);
+
+    static const char* const kCacheExtension;
+
+private:
+    /**************************************************************************************
+    读取缓存文件，缓存不存在、版本不对或者和源文件不一致时返回false
+    @name: ObjLoader::ReadCache
+    @return: bool
+    @param: const std::string & cache_path
+    @param: uint64_t source_size
+    @param: uint64_t source_time
+    @param: T3DMesh * mesh
+    *************************************************************************************/
+    static bool ReadCache(const std::string& cache_path, uint64_t source_size, uint64_t source_time, T3DMesh* mesh);
+
+    /**************************************************************************************
+    写出缓存文件，失败时只记录一条警告
+    @name: ObjLoader::WriteCache
+    @return: void
+    @param: const std::string & cache_path
+    @param: uint64_t source_size
+    @param: uint64_t source_time
+    @param: const T3DMesh & mesh
+    *************************************************************************************/
+    static void WriteCache(const std::string& cache_path, uint64_t source_size, uint64_t source_time, const T3DMesh& mesh);
+};
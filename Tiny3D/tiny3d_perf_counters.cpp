@@ -0,0 +1,218 @@
+﻿/*********************************************************************************************
+MIT License
+
+Copyright (c) 2024 kumakoko www.xionggf.com
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*********************************************************************************************/
+#include "tiny3d_perf_counters.h"
+
+#if defined(__linux__)
+#include <cstring>
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#elif defined(_WIN32)
+#include <windows.h>
+#endif
+
+namespace
+{
+    const uint32_t kHardwareEventMask =
+        (1u << PERF_EVENT_CYCLES) | (1u << PERF_EVENT_INSTRUCTIONS) | (1u << PERF_EVENT_L1D_MISSES) |
+        (1u << PERF_EVENT_LLC_MISSES) | (1u << PERF_EVENT_BRANCH_MISSES);
+
+    const char* const kEventNames[PERF_EVENT_COUNT] =
+    {
+        "cycles",
+        "instructions",
+        "l1d_misses",
+        "llc_misses",
+        "branch_misses",
+        "task_clock_ns",
+        "page_faults",
+        "context_switches"
+    };
+
+#if defined(__linux__)
+    struct PerfEventConfig
+    {
+        uint32_t type;
+        uint64_t config;
+    };
+
+    const PerfEventConfig kEventConfigs[PERF_EVENT_COUNT] =
+    {
+        { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES },
+        { PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS },
+        { PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_L1D | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16) },
+        { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES },
+        { PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES },
+        { PERF_TYPE_SOFTWARE, PERF_COUNT_SW_TASK_CLOCK },
+        { PERF_TYPE_SOFTWARE, PERF_COUNT_SW_PAGE_FAULTS },
+        { PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CONTEXT_SWITCHES }
+    };
+
+    // 一个线程的计数器组。组内的事件同时启停，一次read就能读出全部的值
+    struct ThreadCounters
+    {
+        bool opened = false;
+        int leader = -1;
+        int fds[PERF_EVENT_COUNT];
+        uint32_t mask = 0;
+        uint32_t slots[PERF_EVENT_COUNT];   // 组内按打开顺序排列，slots[i]是第i个值对应的事件
+        uint32_t slot_count = 0;
+
+        void Open()
+        {
+            opened = true;
+
+            for (uint32_t i = 0; i < PERF_EVENT_COUNT; ++i)
+            {
+                perf_event_attr attr;
+                std::memset(&attr, 0, sizeof(attr));
+                attr.size = sizeof(attr);
+                attr.type = kEventConfigs[i].type;
+                attr.config = kEventConfigs[i].config;
+                attr.read_format = PERF_FORMAT_GROUP;
+                attr.disabled = (leader == -1) ? 1 : 0;
+                // 只统计用户态，perf_event_paranoid为2时普通用户也能打开
+                attr.exclude_kernel = 1;
+                attr.exclude_hv = 1;
+
+                // pid为0、cpu为-1表示跟随当前线程，不论它被调度到哪个CPU上
+                int fd = static_cast<int>(syscall(SYS_perf_event_open, &attr, 0, -1, leader, 0));
+                fds[i] = fd;
+
+                if (fd == -1)
+                    continue;
+
+                if (leader == -1)
+                    leader = fd;
+
+                mask |= 1u << i;
+                slots[slot_count++] = i;
+            }
+
+            if (leader != -1)
+            {
+                ioctl(leader, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+                ioctl(leader, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+            }
+        }
+
+        ~ThreadCounters()
+        {
+            if (!opened)
+                return;
+
+            for (uint32_t i = 0; i < PERF_EVENT_COUNT; ++i)
+            {
+                if (fds[i] != -1)
+                    close(fds[i]);
+            }
+        }
+    };
+
+    thread_local ThreadCounters t_counters;
+#endif
+}
+
+bool PerfCounters::Read(uint64_t values[PERF_EVENT_COUNT])
+{
+    for (uint32_t i = 0; i < PERF_EVENT_COUNT; ++i)
+    {
+        values[i] = 0;
+    }
+
+#if defined(__linux__)
+    if (!t_counters.opened)
+        t_counters.Open();
+
+    if (t_counters.leader == -1)
+        return false;
+
+    // PERF_FORMAT_GROUP的格式：事件个数，随后是每个事件的值
+    uint64_t buffer[PERF_EVENT_COUNT + 1];
+    ssize_t size = read(t_counters.leader, buffer, sizeof(buffer));
+
+    if (size < static_cast<ssize_t>(sizeof(uint64_t)))
+        return false;
+
+    uint64_t count = buffer[0] < t_counters.slot_count ? buffer[0] : t_counters.slot_count;
+
+    for (uint64_t i = 0; i < count; ++i)
+    {
+        values[t_counters.slots[i]] = buffer[i + 1];
+    }
+
+    return true;
+#elif defined(_WIN32)
+    ULONG64 cycles = 0;
+
+    if (!QueryThreadCycleTime(GetCurrentThread(), &cycles))
+        return false;
+
+    values[PERF_EVENT_CYCLES] = cycles;
+    return true;
+#else
+    return false;
+#endif
+}
+
+uint32_t PerfCounters::AvailableMask()
+{
+#if defined(__linux__)
+    if (!t_counters.opened)
+        t_counters.Open();
+
+    return t_counters.mask;
+#elif defined(_WIN32)
+    return 1u << PERF_EVENT_CYCLES;
+#else
+    return 0;
+#endif
+}
+
+PerfSource PerfCounters::SourceOf(uint32_t mask)
+{
+    if (mask & kHardwareEventMask)
+        return PERF_SOURCE_HARDWARE;
+
+    return mask != 0 ? PERF_SOURCE_SOFTWARE : PERF_SOURCE_NONE;
+}
+
+const char* PerfCounters::EventName(PerfEvent event)
+{
+    return kEventNames[event];
+}
+
+const char* PerfCounters::SourceName(PerfSource source)
+{
+    switch (source)
+    {
+    case PERF_SOURCE_HARDWARE:
+        return "hardware";
+    case PERF_SOURCE_SOFTWARE:
+        return "software";
+    default:
+        return "none";
+    }
+}
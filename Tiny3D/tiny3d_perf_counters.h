@@ -0,0 +1,98 @@
+﻿/*********************************************************************************************
+MIT License
+
+Copyright (c) 2024 kumakoko www.xionggf.com
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*********************************************************************************************/
+
+#pragma once
+
+#include <cstdint>
+
+//=====================================================================
+// 硬件性能计数器
+//=====================================================================
+
+// 能够采集的事件。硬件事件不可用时（虚拟机、权限不足、非Linux平台）退而采集软件事件
+enum PerfEvent
+{
+    PERF_EVENT_CYCLES = 0,          // CPU周期
+    PERF_EVENT_INSTRUCTIONS,        // 退休的指令数
+    PERF_EVENT_L1D_MISSES,          // L1数据缓存读缺失
+    PERF_EVENT_LLC_MISSES,          // 末级缓存缺失
+    PERF_EVENT_BRANCH_MISSES,       // 分支预测失败
+    PERF_EVENT_TASK_CLOCK,          // 软件事件：线程实际占用CPU的纳秒数
+    PERF_EVENT_PAGE_FAULTS,         // 软件事件：缺页
+    PERF_EVENT_CONTEXT_SWITCHES,    // 软件事件：上下文切换
+    PERF_EVENT_COUNT
+};
+
+// 计数器的来源
+enum PerfSource
+{
+    PERF_SOURCE_NONE = 0,           // 没有可用的计数器
+    PERF_SOURCE_HARDWARE,           // 至少有一个硬件事件可用
+    PERF_SOURCE_SOFTWARE            // 只有软件事件可用
+};
+
+// 每个线程各自打开一组计数器，只统计本线程在用户态的事件。Linux下通过perf_event_open，
+// 一次read系统调用读出整组计数器；Windows下只有通过QueryThreadCycleTime得到的周期数
+class PerfCounters
+{
+public:
+    /**************************************************************************************
+    读取当前线程的计数器，第一次调用时打开计数器。不可用的事件读出的值为0
+    @name: PerfCounters::Read
+    @return: bool 当前线程没有任何可用的计数器时返回false
+    @param: uint64_t values[PERF_EVENT_COUNT]
+    *************************************************************************************/
+    static bool Read(uint64_t values[PERF_EVENT_COUNT]);
+
+    /**************************************************************************************
+    当前线程可用的事件，第i位对应PerfEvent中的第i个事件
+    @name: PerfCounters::AvailableMask
+    @return: uint32_t
+    *************************************************************************************/
+    static uint32_t AvailableMask();
+
+    /**************************************************************************************
+    根据可用事件的掩码判断计数器的来源
+    @name: PerfCounters::SourceOf
+    @return: PerfSource
+    @param: uint32_t mask
+    *************************************************************************************/
+    static PerfSource SourceOf(uint32_t mask);
+
+    /**************************************************************************************
+    事件的名字
+    @name: PerfCounters::EventName
+    @return: const char*
+    @param: PerfEvent event
+    *************************************************************************************/
+    static const char* EventName(PerfEvent event);
+
+    /**************************************************************************************
+    计数器来源的名字
+    @name: PerfCounters::SourceName
+    @return: const char*
+    @param: PerfSource source
+    *************************************************************************************/
+    static const char* SourceName(PerfSource source);
+};
@@ -0,0 +1,159 @@
+﻿/*********************************************************************************************
+MIT License
+
+Copyright (c) 2024 kumakoko www.xionggf.com
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*********************************************************************************************/
+#include <algorithm>
+
+#include "fmt/format.h"
+
+#include "tiny3d_perf_hud.h"
+#include "tiny3d_profiler.h"
+
+namespace
+{
+    const uint32_t kTextScale = 2;
+    const int32_t kLineHeight = BitmapFont::kAdvanceY * kTextScale;
+    const int32_t kPanelX = 8;
+    const int32_t kPanelY = 8;
+    const int32_t kPadding = 8;
+    const int32_t kPanelWidth = 34 * BitmapFont::kAdvanceX * kTextScale + kPadding * 2;
+    const int32_t kGraphHeight = 48;
+    const float kGraphMaxMilliseconds = 50.0f;     // 曲线顶端对应的帧时间
+    const float kTargetMilliseconds = 1000.0f / 60.0f;
+
+    const uint32_t kPanelColor = 0xFF000000;
+    const uint32_t kPanelAlpha = 160;
+    const uint32_t kTextColor = 0xFFFFFFFF;
+    const uint32_t kDimTextColor = 0xFFA0A0A0;
+    const uint32_t kGoodColor = 0xFF40E040;
+    const uint32_t kSlowColor = 0xFFE0E040;
+    const uint32_t kBadColor = 0xFFE04040;
+    const uint32_t kGuideColor = 0xFF606060;
+    const uint32_t kTextBufferSize = 64;
+
+    // 格式化到栈上的缓冲，不产生堆分配
+    template <typename... Args>
+    void Print(Device* device, int32_t x, int32_t y, uint32_t color, fmt::format_string<Args...> format, Args&&... args)
+    {
+        char buffer[kTextBufferSize];
+        fmt::format_to_n_result<char*> result = fmt::format_to_n(buffer, kTextBufferSize - 1, format, std::forward<Args>(args)...);
+        *result.out = '\0';
+        device->DrawString(x, y, buffer, color, kTextScale);
+    }
+
+    uint32_t FrameTimeColor(float milliseconds)
+    {
+        if (milliseconds <= kTargetMilliseconds * 1.05f)
+            return kGoodColor;
+
+        return (milliseconds <= kTargetMilliseconds * 2.05f) ? kSlowColor : kBadColor;
+    }
+}
+
+PerfHud::PerfHud() : history_head_(0), history_count_(0), has_last_frame_(false)
+{
+    std::fill(frame_milliseconds_, frame_milliseconds_ + kHistorySize, 0.0f);
+}
+
+void PerfHud::Draw(Device* device)
+{
+    std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+
+    if (has_last_frame_)
+    {
+        frame_milliseconds_[history_head_] = std::chrono::duration<float, std::milli>(now - last_frame_).count();
+        history_head_ = (history_head_ + 1) % kHistorySize;
+        history_count_ = std::min(history_count_ + 1, kHistorySize);
+    }
+
+    has_last_frame_ = true;
+    last_frame_ = now;
+
+    float total_milliseconds = 0.0f;
+    float max_milliseconds = 0.0f;
+
+    for (uint32_t i = 0; i < history_count_; ++i)
+    {
+        total_milliseconds += frame_milliseconds_[i];
+        max_milliseconds = std::max(max_milliseconds, frame_milliseconds_[i]);
+    }
+
+    float mean_milliseconds = (history_count_ > 0) ? total_milliseconds / history_count_ : 0.0f;
+    float fps = (mean_milliseconds > 0.0f) ? 1000.0f / mean_milliseconds : 0.0f;
+
+    // 剖析数据来自上一个完整帧
+    ProfileSnapshot snapshot;
+    Profiler::Snapshot(&snapshot);
+
+    int32_t stage_lines = Profiler::IsEnabled() ? PROFILE_STAGE_COUNT - 1 : 1;
+    int32_t counter_lines = Profiler::IsEnabled() ? 2 : 0;
+    int32_t panel_height = kPadding * 2 + kLineHeight * (1 + stage_lines + counter_lines) + kGraphHeight + kPadding * 2;
+    device->FillRect(kPanelX, kPanelY, kPanelWidth, panel_height, kPanelColor, kPanelAlpha);
+
+    int32_t x = kPanelX + kPadding;
+    int32_t y = kPanelY + kPadding;
+    Print(device, x, y, FrameTimeColor(mean_milliseconds), "FPS {:5.1f}  {:6.2f} ms  max {:6.2f}", fps, mean_milliseconds, max_milliseconds);
+    y += kLineHeight + kPadding;
+
+    // 帧时间曲线，最新的一帧在最右边，两条参考线分别是60帧和30帧
+    int32_t graph_width = kPanelWidth - kPadding * 2;
+    int32_t bar_width = std::max<int32_t>(graph_width / static_cast<int32_t>(kHistorySize), 1);
+    int32_t graph_right = x + bar_width * static_cast<int32_t>(kHistorySize);
+    int32_t target_y = y + kGraphHeight - static_cast<int32_t>(kTargetMilliseconds / kGraphMaxMilliseconds * kGraphHeight);
+    int32_t half_target_y = y + kGraphHeight - static_cast<int32_t>(kTargetMilliseconds * 2.0f / kGraphMaxMilliseconds * kGraphHeight);
+    device->FillRect(x, target_y, graph_right - x, 1, kGuideColor, 255);
+    device->FillRect(x, half_target_y, graph_right - x, 1, kGuideColor, 255);
+
+    for (uint32_t i = 0; i < history_count_; ++i)
+    {
+        uint32_t index = (history_head_ + kHistorySize - history_count_ + i) % kHistorySize;
+        float milliseconds = frame_milliseconds_[index];
+        int32_t bar_height = static_cast<int32_t>(std::min(milliseconds / kGraphMaxMilliseconds, 1.0f) * kGraphHeight);
+        int32_t bar_x = graph_right - static_cast<int32_t>(history_count_ - i) * bar_width;
+        device->FillRect(bar_x, y + kGraphHeight - bar_height, bar_width, std::max(bar_height, 1), FrameTimeColor(milliseconds), 255);
+    }
+
+    y += kGraphHeight + kPadding;
+
+    if (!Profiler::IsEnabled())
+    {
+        Print(device, x, y, kDimTextColor, "profiler disabled");
+        return;
+    }
+
+    // 各阶段耗时，多线程阶段是各线程之和，子阶段缩进显示
+    for (int i = PROFILE_STAGE_FRAME + 1; i < PROFILE_STAGE_COUNT; ++i)
+    {
+        ProfileStage stage = static_cast<ProfileStage>(i);
+        bool child = Profiler::StageParent(stage) != PROFILE_STAGE_FRAME;
+        Print(device, x, y, kTextColor, "{}{:<{}}{:8.3f} ms", child ? "  " : "", Profiler::StageName(stage), child ? 16 : 18,
+            static_cast<double>(snapshot.stage_nanoseconds[i]) * 1e-6);
+        y += kLineHeight;
+    }
+
+    Print(device, x, y, kDimTextColor, "tris {} culled {}",
+        snapshot.counters[PROFILE_COUNTER_TRIANGLES_SUBMITTED],
+        snapshot.counters[PROFILE_COUNTER_TRIANGLES_CULLED] + snapshot.counters[PROFILE_COUNTER_TRIANGLES_CLIPPED]);
+    y += kLineHeight;
+    Print(device, x, y, kDimTextColor, "pixels {} / {}",
+        snapshot.counters[PROFILE_COUNTER_PIXELS_WRITTEN], snapshot.counters[PROFILE_COUNTER_PIXELS_TESTED]);
+}
@@ -0,0 +1,65 @@
+﻿/*********************************************************************************************
+MIT License
+
+Copyright (c) 2024 kumakoko www.xionggf.com
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*********************************************************************************************/
+
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+
+#include "tiny3d_device.h"
+
+//=====================================================================
+// 屏幕上的性能信息
+//=====================================================================
+
+// 在帧缓存的左上角叠加显示帧率、帧时间曲线、各阶段耗时和三角形、像素计数。
+// 直接画进当前帧，只改写面板覆盖的像素，不需要额外的全屏合成
+class PerfHud
+{
+public:
+    /**************************************************************************************
+    构造函数
+    @name: PerfHud::PerfHud
+    @return:
+    *************************************************************************************/
+    PerfHud();
+
+    /**************************************************************************************
+    记录距上一次调用的时间作为帧时间，并把面板画到设备当前的帧缓存上。
+    在FlushDeferredRaster之后、EndFrame之前调用，每帧一次
+    @name: PerfHud::Draw
+    @return: void
+    @param: Device * device
+    *************************************************************************************/
+    void Draw(Device* device);
+
+private:
+    static const uint32_t kHistorySize = 128;   // 帧时间曲线保留的帧数
+
+    float frame_milliseconds_[kHistorySize];    // 最近若干帧的帧时间，环形缓冲
+    uint32_t history_head_;                     // 下一帧写入的位置
+    uint32_t history_count_;                    // 已经记录的帧数，不超过kHistorySize
+    bool has_last_frame_;
+    std::chrono::steady_clock::time_point last_frame_;
+};
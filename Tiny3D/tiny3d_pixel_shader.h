@@ -0,0 +1,220 @@
+﻿/*********************************************************************************************
+MIT License
+
+Copyright (c) 2024 kumakoko www.xionggf.com
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*********************************************************************************************/
+
+#pragma once
+
+#include <cstdint>
+
+#include "tiny3d_device.h"
+#include "tiny3d_profiler.h"
+
+//=====================================================================
+// 可编程像素着色
+//=====================================================================
+
+// 传给像素着色器的输入，颜色和纹理坐标已经做过透视校正
+struct PixelInput
+{
+    int32_t x;                  // 像素在帧缓存中的坐标
+    int32_t y;
+    float rhw;                  // 1 / w，通过着色后写入深度缓存
+    T3DColor color;             // 只在声明了VARYING_COLOR时有效
+    T3DTextureCoord tc;         // 只在声明了VARYING_TEXCOORD时有效
+    const T3DTexture* texture;  // 绘制图元时绑定的纹理，可以为空
+};
+
+// 像素着色器是带有以下两个成员的类型，不需要从任何基类派生：
+//   static const uint32_t kVaryings;                           需要插值的量，VARYING_*的组合
+//   bool Shade(const PixelInput& input, uint32_t* color) const;  把颜色写到color，
+//                                                              返回false时丢弃这个像素
+// 光栅化函数按着色器类型实例化，Shade内联在扫描线循环里，每个像素没有虚函数调用。
+// 被丢弃的像素既不写帧缓存也不写深度缓存
+
+// 用插值的顶点颜色着色，结果和RENDER_STATE_COLOR相同
+struct VertexColorShader
+{
+    static const uint32_t kVaryings = VARYING_COLOR;
+
+    inline bool Shade(const PixelInput& input, uint32_t* color) const
+    {
+        uint32_t R = Clamp<uint32_t>(static_cast<uint32_t>(input.color.r * 255.0f), 0, 255);
+        uint32_t G = Clamp<uint32_t>(static_cast<uint32_t>(input.color.g * 255.0f), 0, 255);
+        uint32_t B = Clamp<uint32_t>(static_cast<uint32_t>(input.color.b * 255.0f), 0, 255);
+        *color = 0xFF000000 | (R << 16) | (G << 8) | (B);
+        return true;
+    }
+};
+
+// 用绑定的纹理着色，结果和RENDER_STATE_TEXTURE相同。没有绑定纹理时丢弃像素
+struct TextureShader
+{
+    static const uint32_t kVaryings = VARYING_TEXCOORD;
+
+    inline bool Shade(const PixelInput& input, uint32_t* color) const
+    {
+        if (input.texture == nullptr)
+            return false;
+
+        *color = 0xFF000000 | T3DTextureSample(input.texture, input.tc.u, input.tc.v);
+        return true;
+    }
+};
+
+// 镂空纹理：纹素的颜色等于关键色时丢弃像素，后面的图元可以透过这个像素显示出来
+struct ColorKeyShader
+{
+    static const uint32_t kVaryings = VARYING_TEXCOORD;
+    uint32_t key;               // 纹素格式的关键色，忽略alpha
+
+    inline bool Shade(const PixelInput& input, uint32_t* color) const
+    {
+        if (input.texture == nullptr)
+            return false;
+
+        uint32_t texel = T3DTextureSample(input.texture, input.tc.u, input.tc.v);
+
+        if ((texel & 0x00FFFFFF) == (key & 0x00FFFFFF))
+            return false;
+
+        *color = 0xFF000000 | texel;
+        return true;
+    }
+};
+
+template<typename Shader>
+void Device::SetPixelShader(const Shader* shader)
+{
+    this->pixel_shader_ = shader;
+    this->pixel_shader_rasterizer_ = &Device::RenderShadedTrapezoid<Shader>;
+}
+
+template<typename Shader>
+void Device::DrawShadedScanline(scanline_t* scanline, const Shader& shader, uint32_t render_state, const T3DTexture* texture)
+{
+    const bool interpolate_color = (Shader::kVaryings & VARYING_COLOR) != 0;
+    const bool interpolate_tc = (Shader::kVaryings & VARYING_TEXCOORD) != 0;
+    uint32_t pixels_tested = 0;
+    uint32_t pixels_written = 0;
+    bool count_overdraw = (render_state & RENDER_STATE_OVERDRAW) != 0;
+    bool depth_test = !(render_state & RENDER_STATE_NO_DEPTH_TEST);
+
+    uint32_t* fb = this->frame_buffer_ + this->window_width_ * scanline->y;
+    float* zbuffer = this->z_buffer_ + this->window_width_ * scanline->y;
+    OverdrawSample* overdraw = this->overdraw_buffer_ + this->window_width_ * scanline->y;
+
+    int32_t x = scanline->left_end_point_x;
+    int32_t w = scanline->width;
+    int32_t width = static_cast<int32_t>(this->window_width_);
+
+    // 只有1/w和声明过的插值量放在局部变量里逐像素递加，位置和其余的量不再更新
+    const T3DVertex& step = scanline->interpolated_step;
+    float rhw = scanline->interpolated_point.rhw;
+    T3DColor color = scanline->interpolated_point.color;
+    T3DTextureCoord tc = scanline->interpolated_point.tc;
+
+    PixelInput input;
+    input.y = scanline->y;
+    input.texture = texture;
+
+    for (; w > 0; x++, w--)
+    {
+        if (x >= 0 && x < width)
+        {
+            ++pixels_tested;
+
+            if (count_overdraw)
+                ++overdraw[x].tested;
+
+            if (!depth_test || rhw >= zbuffer[x])
+            {
+                float pixel_w = 1.0f / rhw;
+                input.x = x;
+                input.rhw = rhw;
+
+                if (interpolate_color)
+                {
+                    input.color.r = color.r * pixel_w;
+                    input.color.g = color.g * pixel_w;
+                    input.color.b = color.b * pixel_w;
+                }
+
+                if (interpolate_tc)
+                {
+                    input.tc.u = tc.u * pixel_w;
+                    input.tc.v = tc.v * pixel_w;
+                }
+
+                uint32_t c;
+
+                if (shader.Shade(input, &c))
+                {
+                    if (depth_test)
+                        zbuffer[x] = rhw;
+
+                    fb[x] = c;
+                    ++pixels_written;
+
+                    if (count_overdraw)
+                        ++overdraw[x].passed;
+                }
+            }
+        }
+
+        rhw += step.rhw;
+
+        if (interpolate_color)
+        {
+            color.r += step.color.r;
+            color.g += step.color.g;
+            color.b += step.color.b;
+        }
+
+        if (interpolate_tc)
+        {
+            tc.u += step.tc.u;
+            tc.v += step.tc.v;
+        }
+
+        if (x >= width)
+            break;
+    }
+
+    TINY3D_PROFILE_COUNT(PROFILE_COUNTER_PIXELS_TESTED, pixels_tested);
+    TINY3D_PROFILE_COUNT(PROFILE_COUNTER_PIXELS_WRITTEN, pixels_written);
+    TINY3D_PROFILE_COUNT(PROFILE_COUNTER_TEXEL_FETCHES, (texture != nullptr && interpolate_tc) ? pixels_written : 0);
+}
+
+template<typename Shader>
+void Device::RenderShadedTrapezoid(Device* device, const Trapezoid* trap, const RasterRowSet& rows,
+    uint32_t render_state, const T3DTexture* texture, const void* shader)
+{
+    TINY3D_PROFILE_SCOPE(PROFILE_STAGE_SHADING);
+    const Shader& typed_shader = *static_cast<const Shader*>(shader);
+    uint32_t scanline_count = device->ForEachScanline(trap, rows, [&](scanline_t* scanline)
+        {
+            device->DrawShadedScanline(scanline, typed_shader, render_state, texture);
+        });
+
+    TINY3D_PROFILE_COUNT(PROFILE_COUNTER_SCANLINES, scanline_count);
+}
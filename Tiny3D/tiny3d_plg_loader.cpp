@@ -0,0 +1,352 @@
+﻿/*********************************************************************************************
+MIT License
+
+Copyright (c) 2024 kumakoko www.xionggf.com
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*********************************************************************************************/
+#include <cmath>
+#include <cstdio>
+
+#include "fmt/format.h"
+
+#include "tiny3d_plg_loader.h"
+#include "tiny3d_number_parser.h"
+#include "tiny3d_error.h"
+
+namespace
+{
+    // 多边形属性字中的PLX标志
+    const uint32_t kPlxColorModeRgbFlag = 0x8000;   // 低12位是4.4.4格式的RGB颜色，否则低8位是调色板下标
+    const uint32_t kPlx2SidedFlag = 0x1000;
+    const uint32_t kPlxShadeModeMask = 0x6000;
+    const uint32_t kPlxShadeModeFlatFlag = 0x2000;
+    const uint32_t kPlxShadeModeGouraudFlag = 0x4000;
+    const uint32_t kPlxShadeModePhongFlag = 0x6000;
+
+    // 按行号报错的文本游标。文本末尾必须有一个'\0'作为哨兵，扫描时不需要每次检查边界
+    struct PlgCursor
+    {
+        const char* p;
+        uint32_t line;
+
+        // 跳过空白和注释
+        void SkipSpace()
+        {
+            for (;;)
+            {
+                char c = *p;
+
+                if (c == ' ' || c == '\t' || c == '\r')
+                {
+                    ++p;
+                }
+                else if (c == '\n')
+                {
+                    ++p;
+                    ++line;
+                }
+                else if (c == '#')
+                {
+                    while (*p != '\n' && *p != '\0')
+                        ++p;
+                }
+                else
+                {
+                    return;
+                }
+            }
+        }
+
+        [[noreturn]] void Fail(const char* what) const
+        {
+            throw Error(fmt::format("PLG parse error at line {}: {}", line, what));
+        }
+
+        // 十进制或者0x开头的十六进制无符号整数
+        uint32_t ReadUnsigned(const char* what)
+        {
+            SkipSpace();
+            uint32_t value = 0;
+            const char* start = p;
+
+            if (p[0] == '0' && (p[1] == 'x' || p[1] == 'X'))
+            {
+                p += 2;
+                start = p;
+
+                for (;;)
+                {
+                    char c = *p;
+                    uint32_t digit;
+
+                    if (c >= '0' && c <= '9')
+                        digit = c - '0';
+                    else if (c >= 'a' && c <= 'f')
+                        digit = c - 'a' + 10;
+                    else if (c >= 'A' && c <= 'F')
+                        digit = c - 'A' + 10;
+                    else
+                        break;
+
+                    value = value * 16 + digit;
+                    ++p;
+                }
+            }
+            else
+            {
+                while (*p >= '0' && *p <= '9')
+                {
+                    value = value * 10 + static_cast<uint32_t>(*p - '0');
+                    ++p;
+                }
+            }
+
+            if (p == start)
+                Fail(what);
+
+            return value;
+        }
+
+        float ReadFloat(const char* what)
+        {
+            SkipSpace();
+            float value;
+
+            if (!ParseFloat(p, &value))
+                Fail(what);
+
+            return value;
+        }
+
+        // 读取到下一个空白为止的一段文字
+        std::string ReadToken(const char* what)
+        {
+            SkipSpace();
+            const char* start = p;
+
+            while (*p != '\0' && *p != ' ' && *p != '\t' && *p != '\r' && *p != '\n' && *p != '#')
+                ++p;
+
+            if (p == start)
+                Fail(what);
+
+            return std::string(start, p);
+        }
+    };
+
+    // 把PLX属性字转换成打包顶点的颜色，R、G、B、A从低到高各8位
+    uint32_t PolygonColor(uint32_t attributes)
+    {
+        uint32_t r, g, b;
+
+        if (attributes & kPlxColorModeRgbFlag)
+        {
+            // 4.4.4格式，每个分量乘以17扩展到0-255
+            r = ((attributes >> 8) & 0xF) * 17;
+            g = ((attributes >> 4) & 0xF) * 17;
+            b = (attributes & 0xF) * 17;
+        }
+        else
+        {
+            // 没有随模型附带调色板，下标按3.3.2格式的RGB解释
+            uint32_t index = attributes & 0xFF;
+            r = ((index >> 5) & 0x7) * 255 / 7;
+            g = ((index >> 2) & 0x7) * 255 / 7;
+            b = (index & 0x3) * 255 / 3;
+        }
+
+        return r | (g << 8) | (b << 16) | 0xFF000000;
+    }
+
+    uint8_t PolygonFlags(uint32_t attributes)
+    {
+        uint8_t flags = (attributes & kPlx2SidedFlag) ? POLY_FLAG_2SIDED : 0;
+
+        switch (attributes & kPlxShadeModeMask)
+        {
+        case kPlxShadeModeFlatFlag:
+            flags |= POLY_SHADE_MODE_FLAT;
+            break;
+        case kPlxShadeModeGouraudFlag:
+            flags |= POLY_SHADE_MODE_GOURAUD;
+            break;
+        case kPlxShadeModePhongFlag:
+            flags |= POLY_SHADE_MODE_PHONG;
+            break;
+        default:
+            flags |= POLY_SHADE_MODE_CONSTANT;
+            break;
+        }
+
+        return flags;
+    }
+}
+
+void PlgLoader::LoadFromFile(const char* file_path, T3DMesh* mesh)
+{
+    FILE* file = std::fopen(file_path, "rb");
+
+    if (file == nullptr)
+        throw Error(fmt::format("Cannot open PLG file {}", file_path));
+
+    std::fseek(file, 0, SEEK_END);
+    long size = std::ftell(file);
+    std::fseek(file, 0, SEEK_SET);
+
+    if (size < 0)
+    {
+        std::fclose(file);
+        throw Error(fmt::format("Cannot read PLG file {}", file_path));
+    }
+
+    // 多分配一个字节放'\0'哨兵
+    std::vector<char> text(static_cast<size_t>(size) + 1);
+    size_t read = (size > 0) ? std::fread(text.data(), 1, static_cast<size_t>(size), file) : 0;
+    std::fclose(file);
+
+    if (read != static_cast<size_t>(size))
+        throw Error(fmt::format("Cannot read PLG file {}", file_path));
+
+    text[read] = '\0';
+    Parse(text.data(), mesh);
+}
+
+void PlgLoader::LoadFromMemory(const char* data, size_t size, T3DMesh* mesh)
+{
+    // 拷贝一份带'\0'哨兵的文本，游标就不需要检查边界
+    std::vector<char> text(size + 1);
+    std::copy(data, data + size, text.begin());
+    text[size] = '\0';
+    Parse(text.data(), mesh);
+}
+
+void PlgLoader::Parse(const char* text, T3DMesh* mesh)
+{
+    PlgCursor cursor = { text, 1 };
+    mesh->name = cursor.ReadToken("expected object name");
+    uint32_t vertex_count = cursor.ReadUnsigned("expected vertex count");
+    uint32_t polygon_count = cursor.ReadUnsigned("expected polygon count");
+
+    std::vector<T3DVector4> positions(vertex_count);
+
+    for (uint32_t i = 0; i < vertex_count; ++i)
+    {
+        positions[i].x = cursor.ReadFloat("expected vertex x");
+        positions[i].y = cursor.ReadFloat("expected vertex y");
+        positions[i].z = cursor.ReadFloat("expected vertex z");
+        positions[i].w = 1.0f;
+    }
+
+    mesh->vertices.clear();
+    mesh->indices.clear();
+    mesh->triangle_flags.clear();
+    mesh->normals.clear();
+    mesh->vertices.reserve(vertex_count);
+    mesh->indices.reserve(polygon_count * 3);
+    mesh->triangle_flags.reserve(polygon_count);
+
+    // 同一个源顶点按颜色拆成的输出顶点串成链表：first_output是链表头，next_output是后继
+    const uint32_t kNone = UINT32_MAX;
+    std::vector<uint32_t> first_output(vertex_count, kNone);
+    std::vector<uint32_t> next_output;
+    next_output.reserve(vertex_count);
+    std::vector<uint32_t> polygon;
+
+    for (uint32_t i = 0; i < polygon_count; ++i)
+    {
+        uint32_t attributes = cursor.ReadUnsigned("expected polygon attributes");
+        uint32_t count = cursor.ReadUnsigned("expected polygon vertex count");
+
+        if (count < 3)
+            cursor.Fail("polygon has fewer than 3 vertices");
+
+        uint32_t color = PolygonColor(attributes);
+        uint8_t flags = PolygonFlags(attributes);
+        polygon.clear();
+
+        for (uint32_t k = 0; k < count; ++k)
+        {
+            uint32_t source = cursor.ReadUnsigned("expected polygon vertex index");
+
+            if (source >= vertex_count)
+                cursor.Fail("polygon vertex index out of range");
+
+            uint32_t output = first_output[source];
+
+            while (output != kNone && mesh->vertices[output].color != color)
+                output = next_output[output];
+
+            if (output == kNone)
+            {
+                output = static_cast<uint32_t>(mesh->vertices.size());
+                const T3DVector4& position = positions[source];
+                mesh->vertices.push_back({ position.x, position.y, position.z, color, 0, 0 });
+                next_output.push_back(first_output[source]);
+                first_output[source] = output;
+            }
+
+            polygon.push_back(output);
+        }
+
+        // 扇形拆分
+        for (uint32_t k = 1; k + 1 < count; ++k)
+        {
+            mesh->indices.push_back(polygon[0]);
+            mesh->indices.push_back(polygon[k]);
+            mesh->indices.push_back(polygon[k + 1]);
+            mesh->triangle_flags.push_back(flags);
+        }
+    }
+
+    // PLG文件不带法线，用相邻三角形的法线按面积加权平均得到顶点法线，供光照使用
+    mesh->normals.assign(mesh->vertices.size(), T3DVector4{});
+
+    for (size_t i = 0; i < mesh->indices.size(); i += 3)
+    {
+        const T3DPackedVertex& v0 = mesh->vertices[mesh->indices[i]];
+        const T3DPackedVertex& v1 = mesh->vertices[mesh->indices[i + 1]];
+        const T3DPackedVertex& v2 = mesh->vertices[mesh->indices[i + 2]];
+        float e1x = v1.x - v0.x, e1y = v1.y - v0.y, e1z = v1.z - v0.z;
+        float e2x = v2.x - v0.x, e2y = v2.y - v0.y, e2z = v2.z - v0.z;
+        float nx = e1y * e2z - e1z * e2y;
+        float ny = e1z * e2x - e1x * e2z;
+        float nz = e1x * e2y - e1y * e2x;
+
+        for (size_t k = 0; k < 3; ++k)
+        {
+            T3DVector4& normal = mesh->normals[mesh->indices[i + k]];
+            normal.x += nx;
+            normal.y += ny;
+            normal.z += nz;
+        }
+    }
+
+    for (T3DVector4& normal : mesh->normals)
+    {
+        float length = std::sqrt(normal.x * normal.x + normal.y * normal.y + normal.z * normal.z);
+
+        if (length > 0.0f)
+        {
+            normal.x /= length;
+            normal.y /= length;
+            normal.z /= length;
+        }
+    }
+}
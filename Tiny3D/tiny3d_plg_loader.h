@@ -0,0 +1,70 @@
+﻿/*********************************************************************************************
+MIT License
+
+Copyright (c) 2024 kumakoko www.xionggf.com
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*********************************************************************************************/
+
+#pragma once
+
+#include <cstddef>
+
+#include "tiny3d_mesh.h"
+
+//=====================================================================
+// PLG/PLX模型文件
+//=====================================================================
+
+// PLG/PLX是文本格式：注释以#开头，然后依次是“名字 顶点数 多边形数”、顶点列表和多边形列表。
+// 多边形的格式是“属性字 顶点数 顶点下标...”，属性字中的PLX标志决定颜色模式、单双面和着色方式。
+// 多于3个顶点的多边形按扇形拆分成三角形；同一个顶点被不同颜色的多边形共用时会拆成多个顶点。
+// 文件中没有法线，顶点法线取相邻三角形法线的面积加权平均
+class PlgLoader
+{
+public:
+    /**************************************************************************************
+    读取并解析PLG/PLX文件，失败时抛出Error
+    @name: PlgLoader::LoadFromFile
+    @return: void
+    @param: const char * file_path
+    @param: T3DMesh * mesh
+    *************************************************************************************/
+    static void LoadFromFile(const char* file_path, T3DMesh* mesh);
+
+    /**************************************************************************************
+    解析内存中的PLG/PLX文本，只扫描一遍，失败时抛出Error
+    @name: PlgLoader::LoadFromMemory
+    @return: void
+    @param: const char * data
+    @param: size_t size
+    @param: T3DMesh * mesh
+    *************************************************************************************/
+    static void LoadFromMemory(const char* data, size_t size, T3DMesh* mesh);
+
+private:
+    /**************************************************************************************
+    解析以'\0'结尾的PLG/PLX文本
+    @name: PlgLoader::Parse
+    @return: void
+    @param: const char * text
+    @param: T3DMesh * mesh
+    *************************************************************************************/
+    static void Parse(const char* text, T3DMesh* mesh);
+};
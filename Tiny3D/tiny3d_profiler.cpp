@@ -0,0 +1,274 @@
+﻿/*********************************************************************************************
+MIT License
+
+Copyright (c) 2024 kumakoko www.xionggf.com
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*********************************************************************************************/
+#include <atomic>
+#include <mutex>
+
+#include "tiny3d_profiler.h"
+
+namespace
+{
+    // 最多可以同时拥有独立累加器的线程数，再多的线程共用最后一个累加器
+    const uint32_t kMaxProfileThreads = 64;
+
+    // 一个线程的累加值。只由拥有它的线程写入，用relaxed的读后写代替fetch_add，没有总线锁；
+    // 数值只增不减，EndFrame减去上一帧读到的值得到本帧的增量，所以不需要清零。
+    // 按cache line对齐，不同线程的累加器之间不会伪共享
+    struct alignas(64) ProfileAccumulator
+    {
+        std::atomic<uint64_t> stage_nanoseconds[PROFILE_STAGE_COUNT];
+        std::atomic<uint64_t> stage_calls[PROFILE_STAGE_COUNT];
+        std::atomic<uint64_t> counters[PROFILE_COUNTER_COUNT];
+        std::atomic<uint64_t> stage_events[PROFILE_STAGE_COUNT][PERF_EVENT_COUNT];
+        std::atomic<uint32_t> event_mask;
+        std::atomic<bool> in_use;
+    };
+
+    // 最后一个是多个线程共用的溢出累加器，只有它需要原子加
+    ProfileAccumulator g_accumulators[kMaxProfileThreads + 1];
+    std::atomic<uint32_t> g_accumulator_count(0);   // 曾经被占用过的独立累加器个数
+    std::atomic<bool> g_hardware_counters_enabled(false);
+
+    // 线程退出时归还累加器，累加值留在里面，由下一个占用它的线程接着累加
+    struct ThreadAccumulatorSlot
+    {
+        ProfileAccumulator* accumulator = nullptr;
+
+        ~ThreadAccumulatorSlot()
+        {
+            if (accumulator != nullptr && accumulator != &g_accumulators[kMaxProfileThreads])
+                accumulator->in_use.store(false, std::memory_order_release);
+        }
+    };
+
+    thread_local ThreadAccumulatorSlot t_accumulator_slot;
+
+    ProfileAccumulator* CurrentAccumulator()
+    {
+        ProfileAccumulator* accumulator = t_accumulator_slot.accumulator;
+
+        if (accumulator != nullptr)
+            return accumulator;
+
+        accumulator = &g_accumulators[kMaxProfileThreads];
+
+        for (uint32_t i = 0; i < kMaxProfileThreads; ++i)
+        {
+            bool expected = false;
+
+            if (g_accumulators[i].in_use.compare_exchange_strong(expected, true, std::memory_order_acquire))
+            {
+                accumulator = &g_accumulators[i];
+                uint32_t count = g_accumulator_count.load(std::memory_order_relaxed);
+
+                while (count < i + 1 && !g_accumulator_count.compare_exchange_weak(count, i + 1, std::memory_order_relaxed))
+                {
+                }
+
+                break;
+            }
+        }
+
+        t_accumulator_slot.accumulator = accumulator;
+        return accumulator;
+    }
+
+    inline void Accumulate(ProfileAccumulator* accumulator, std::atomic<uint64_t>& total, uint64_t value)
+    {
+        if (accumulator == &g_accumulators[kMaxProfileThreads])
+            total.fetch_add(value, std::memory_order_relaxed);
+        else
+            total.store(total.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+    }
+
+    // 最近一个完整帧的快照，以及上一次EndFrame时从每个累加器读到的值
+    std::mutex g_snapshot_mutex;
+    ProfileSnapshot g_snapshot = {};
+    ProfileSnapshot g_last_totals[kMaxProfileThreads + 1] = {};
+    uint64_t g_frame_index = 0;
+    std::chrono::steady_clock::time_point g_frame_start = std::chrono::steady_clock::now();
+
+    // 把一个累加器自上次读取以来的增量加到frame上
+    void GatherAccumulator(const ProfileAccumulator& accumulator, ProfileSnapshot* last, ProfileSnapshot* frame)
+    {
+        for (int i = 0; i < PROFILE_STAGE_COUNT; ++i)
+        {
+            uint64_t nanoseconds = accumulator.stage_nanoseconds[i].load(std::memory_order_relaxed);
+            uint64_t calls = accumulator.stage_calls[i].load(std::memory_order_relaxed);
+            frame->stage_nanoseconds[i] += nanoseconds - last->stage_nanoseconds[i];
+            frame->stage_calls[i] += calls - last->stage_calls[i];
+            last->stage_nanoseconds[i] = nanoseconds;
+            last->stage_calls[i] = calls;
+        }
+
+        for (int i = 0; i < PROFILE_COUNTER_COUNT; ++i)
+        {
+            uint64_t value = accumulator.counters[i].load(std::memory_order_relaxed);
+            frame->counters[i] += value - last->counters[i];
+            last->counters[i] = value;
+        }
+
+        bool has_events = false;
+
+        for (int i = 0; i < PROFILE_STAGE_COUNT; ++i)
+        {
+            for (int j = 0; j < PERF_EVENT_COUNT; ++j)
+            {
+                uint64_t value = accumulator.stage_events[i][j].load(std::memory_order_relaxed);
+                has_events = has_events || value != last->stage_events[i][j];
+                frame->stage_events[i][j] += value - last->stage_events[i][j];
+                last->stage_events[i][j] = value;
+            }
+        }
+
+        if (has_events)
+            frame->event_mask |= accumulator.event_mask.load(std::memory_order_relaxed);
+    }
+
+    const char* const kStageNames[PROFILE_STAGE_COUNT] =
+    {
+        "frame",
+        "event_poll",
+        "clear",
+        "vertex_transform",
+        "clip_cull",
+        "setup",
+        "raster",
+        "shading",
+        "present"
+    };
+
+    const ProfileStage kStageParents[PROFILE_STAGE_COUNT] =
+    {
+        PROFILE_STAGE_COUNT,
+        PROFILE_STAGE_FRAME,
+        PROFILE_STAGE_FRAME,
+        PROFILE_STAGE_FRAME,
+        PROFILE_STAGE_FRAME,
+        PROFILE_STAGE_FRAME,
+        PROFILE_STAGE_FRAME,
+        PROFILE_STAGE_RASTER,
+        PROFILE_STAGE_FRAME
+    };
+
+    const char* const kCounterNames[PROFILE_COUNTER_COUNT] =
+    {
+        "triangles_submitted",
+        "triangles_culled",
+        "triangles_clipped",
+        "scanlines",
+        "pixels_tested",
+        "pixels_written",
+        "texel_fetches"
+    };
+}
+
+void Profiler::EndFrame()
+{
+    std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+    std::lock_guard<std::mutex> lock(g_snapshot_mutex);
+    ProfileSnapshot frame = {};
+    frame.frame_index = g_frame_index++;
+
+    // 汇总各线程的累加器，最后是共用的溢出累加器
+    uint32_t count = g_accumulator_count.load(std::memory_order_relaxed);
+
+    for (uint32_t k = 0; k < count; ++k)
+    {
+        GatherAccumulator(g_accumulators[k], &g_last_totals[k], &frame);
+    }
+
+    GatherAccumulator(g_accumulators[kMaxProfileThreads], &g_last_totals[kMaxProfileThreads], &frame);
+
+    frame.stage_nanoseconds[PROFILE_STAGE_FRAME] = static_cast<uint64_t>(
+        std::chrono::duration_cast<std::chrono::nanoseconds>(now - g_frame_start).count());
+    frame.stage_calls[PROFILE_STAGE_FRAME] = 1;
+    g_frame_start = now;
+    g_snapshot = frame;
+}
+
+void Profiler::Snapshot(ProfileSnapshot* snapshot)
+{
+    std::lock_guard<std::mutex> lock(g_snapshot_mutex);
+    *snapshot = g_snapshot;
+}
+
+void Profiler::AddStageTime(ProfileStage stage, uint64_t nanoseconds)
+{
+    ProfileAccumulator* accumulator = CurrentAccumulator();
+    Accumulate(accumulator, accumulator->stage_nanoseconds[stage], nanoseconds);
+    Accumulate(accumulator, accumulator->stage_calls[stage], 1);
+}
+
+void Profiler::AddCounter(ProfileCounter counter, uint64_t value)
+{
+    ProfileAccumulator* accumulator = CurrentAccumulator();
+    Accumulate(accumulator, accumulator->counters[counter], value);
+}
+
+void Profiler::EnableHardwareCounters(bool enable)
+{
+    g_hardware_counters_enabled.store(enable, std::memory_order_relaxed);
+}
+
+bool Profiler::HardwareCountersEnabled()
+{
+    return g_hardware_counters_enabled.load(std::memory_order_relaxed);
+}
+
+void Profiler::AddStageEvents(ProfileStage stage, const uint64_t events[PERF_EVENT_COUNT], uint32_t mask)
+{
+    ProfileAccumulator* accumulator = CurrentAccumulator();
+
+    for (uint32_t i = 0; i < PERF_EVENT_COUNT; ++i)
+    {
+        if (mask & (1u << i))
+            Accumulate(accumulator, accumulator->stage_events[stage][i], events[i]);
+    }
+
+    accumulator->event_mask.fetch_or(mask, std::memory_order_relaxed);
+}
+
+const char* Profiler::StageName(ProfileStage stage)
+{
+    return kStageNames[stage];
+}
+
+ProfileStage Profiler::StageParent(ProfileStage stage)
+{
+    return kStageParents[stage];
+}
+
+const char* Profiler::CounterName(ProfileCounter counter)
+{
+    return kCounterNames[counter];
+}
+
+bool Profiler::IsEnabled()
+{
+#if defined(TINY3D_ENABLE_PROFILER)
+    return true;
+#else
+    return false;
+#endif
+}
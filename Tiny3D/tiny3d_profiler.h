@@ -0,0 +1,229 @@
+﻿/*********************************************************************************************
+MIT License
+
+Copyright (c) 2024 kumakoko www.xionggf.com
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*********************************************************************************************/
+
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+
+#include "tiny3d_perf_counters.h"
+
+//=====================================================================
+// 帧性能剖析器
+//=====================================================================
+
+// 调试版本默认打开剖析器；发布版本中所有剖析宏都展开为空，需要在线上采集数据时
+// 可以单独定义TINY3D_ENABLE_PROFILER
+#if defined(_DEBUG) && !defined(TINY3D_ENABLE_PROFILER)
+#define TINY3D_ENABLE_PROFILER
+#endif
+
+// 计时的阶段。阶段之间的父子关系由Profiler::StageParent给出，子阶段的时间包含在父阶段内
+enum ProfileStage
+{
+    PROFILE_STAGE_FRAME = 0,        // 整帧，两次Profiler::EndFrame之间的时间
+    PROFILE_STAGE_EVENT_POLL,       // SDL事件处理
+    PROFILE_STAGE_CLEAR,            // 清空颜色缓存和深度缓存
+    PROFILE_STAGE_VERTEX_TRANSFORM, // 顶点变换，包括CVV检查和透视除
+    PROFILE_STAGE_CLIP_CULL,        // 根据顶点的CVV检查结果剔除三角形
+    PROFILE_STAGE_SETUP,            // 三角形拆分成梯形以及分箱
+    PROFILE_STAGE_RASTER,           // 光栅化，立即模式下按三角形计时，延迟模式下按行带计时
+    PROFILE_STAGE_SHADING,          // 逐梯形计时的扫描线遍历、深度测试和着色，属于光栅化的子阶段
+    PROFILE_STAGE_PRESENT,          // 把画面呈现到窗口上
+    PROFILE_STAGE_COUNT
+};
+
+// 计数器
+enum ProfileCounter
+{
+    PROFILE_COUNTER_TRIANGLES_SUBMITTED = 0,    // 提交的三角形
+    PROFILE_COUNTER_TRIANGLES_CULLED,           // 三个顶点都在CVV之外而被剔除的三角形
+    PROFILE_COUNTER_TRIANGLES_CLIPPED,          // 和CVV相交的三角形，目前没有裁剪器，同样被丢弃
+    PROFILE_COUNTER_SCANLINES,                  // 绘制的扫描线
+    PROFILE_COUNTER_PIXELS_TESTED,              // 做了深度测试的像素
+    PROFILE_COUNTER_PIXELS_WRITTEN,             // 通过深度测试并写入的像素
+    PROFILE_COUNTER_TEXEL_FETCHES,              // 纹素读取
+    PROFILE_COUNTER_COUNT
+};
+
+// 一帧的剖析数据。多线程执行的阶段累加的是各线程的时间之和，可能超过整帧的时间
+struct ProfileSnapshot
+{
+    uint64_t frame_index;                                   // 帧序号
+    uint64_t stage_nanoseconds[PROFILE_STAGE_COUNT];        // 各阶段耗时，单位纳秒
+    uint64_t stage_calls[PROFILE_STAGE_COUNT];              // 各阶段的计时次数
+    uint64_t counters[PROFILE_COUNTER_COUNT];               // 各计数器的值
+    uint64_t stage_events[PROFILE_STAGE_COUNT][PERF_EVENT_COUNT];   // 各阶段的硬件计数器增量，整帧一行不统计
+    uint32_t event_mask;                                    // 本帧实际采集到的事件，为0表示没有打开硬件计数器
+};
+
+class Profiler
+{
+public:
+    /**************************************************************************************
+    结束当前帧并开始下一帧，当前帧的数据成为Snapshot返回的快照
+    @name: Profiler::EndFrame
+    @return: void
+    *************************************************************************************/
+    static void EndFrame();
+
+    /**************************************************************************************
+    取得最近一个完整帧的剖析数据，可以在任意线程调用
+    @name: Profiler::Snapshot
+    @return: void
+    @param: ProfileSnapshot * snapshot
+    *************************************************************************************/
+    static void Snapshot(ProfileSnapshot* snapshot);
+
+    /**************************************************************************************
+    累加一个阶段的耗时。每个线程累加到自己的累加器里，由EndFrame汇总，线程之间没有竞争
+    @name: Profiler::AddStageTime
+    @return: void
+    @param: ProfileStage stage
+    @param: uint64_t nanoseconds
+    *************************************************************************************/
+    static void AddStageTime(ProfileStage stage, uint64_t nanoseconds);
+
+    /**************************************************************************************
+    累加计数器
+    @name: Profiler::AddCounter
+    @return: void
+    @param: ProfileCounter counter
+    @param: uint64_t value
+    *************************************************************************************/
+    static void AddCounter(ProfileCounter counter, uint64_t value);
+
+    /**************************************************************************************
+    打开或关闭按阶段采集硬件计数器。打开后每个计时作用域的开始和结束各多一次系统调用，
+    默认关闭
+    @name: Profiler::EnableHardwareCounters
+    @return: void
+    @param: bool enable
+    *************************************************************************************/
+    static void EnableHardwareCounters(bool enable);
+
+    /**************************************************************************************
+    是否正在按阶段采集硬件计数器
+    @name: Profiler::HardwareCountersEnabled
+    @return: bool
+    *************************************************************************************/
+    static bool HardwareCountersEnabled();
+
+    /**************************************************************************************
+    累加一个阶段的硬件计数器增量
+    @name: Profiler::AddStageEvents
+    @return: void
+    @param: ProfileStage stage
+    @param: const uint64_t events[PERF_EVENT_COUNT]
+    @param: uint32_t mask 有效的事件
+    *************************************************************************************/
+    static void AddStageEvents(ProfileStage stage, const uint64_t events[PERF_EVENT_COUNT], uint32_t mask);
+
+    /**************************************************************************************
+    阶段的名字
+    @name: Profiler::StageName
+    @return: const char*
+    @param: ProfileStage stage
+    *************************************************************************************/
+    static const char* StageName(ProfileStage stage);
+
+    /**************************************************************************************
+    阶段的父阶段，PROFILE_STAGE_FRAME的父阶段是PROFILE_STAGE_COUNT
+    @name: Profiler::StageParent
+    @return: ProfileStage
+    @param: ProfileStage stage
+    *************************************************************************************/
+    static ProfileStage StageParent(ProfileStage stage);
+
+    /**************************************************************************************
+    计数器的名字
+    @name: Profiler::CounterName
+    @return: const char*
+    @param: ProfileCounter counter
+    *************************************************************************************/
+    static const char* CounterName(ProfileCounter counter);
+
+    /**************************************************************************************
+    剖析器是否被编译进来
+    @name: Profiler::IsEnabled
+    @return: bool
+    *************************************************************************************/
+    static bool IsEnabled();
+};
+
+// 在作用域内计时，析构时把耗时累加到指定阶段
+class ProfileScope
+{
+public:
+    explicit ProfileScope(ProfileStage stage) : stage_(stage), has_events_(false)
+    {
+        if (Profiler::HardwareCountersEnabled())
+            has_events_ = PerfCounters::Read(events_);
+
+        start_ = std::chrono::steady_clock::now();
+    }
+
+    ~ProfileScope()
+    {
+        std::chrono::steady_clock::duration elapsed = std::chrono::steady_clock::now() - start_;
+        Profiler::AddStageTime(stage_, static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count()));
+
+        if (has_events_)
+        {
+            uint64_t end_events[PERF_EVENT_COUNT];
+
+            if (PerfCounters::Read(end_events))
+            {
+                for (uint32_t i = 0; i < PERF_EVENT_COUNT; ++i)
+                {
+                    end_events[i] -= events_[i];
+                }
+
+                Profiler::AddStageEvents(stage_, end_events, PerfCounters::AvailableMask());
+            }
+        }
+    }
+
+    ProfileScope(const ProfileScope&) = delete;
+    ProfileScope& operator=(const ProfileScope&) = delete;
+
+private:
+    ProfileStage stage_;
+    bool has_events_;                       // 开始时是否读到了计数器
+    uint64_t events_[PERF_EVENT_COUNT];     // 开始时的计数器值
+    std::chrono::steady_clock::time_point start_;
+};
+
+#define TINY3D_PROFILE_CONCAT_IMPL(a, b) a##b
+#define TINY3D_PROFILE_CONCAT(a, b) TINY3D_PROFILE_CONCAT_IMPL(a, b)
+
+#if defined(TINY3D_ENABLE_PROFILER)
+#define TINY3D_PROFILE_SCOPE(stage) ProfileScope TINY3D_PROFILE_CONCAT(profile_scope_, __LINE__)(stage)
+#define TINY3D_PROFILE_COUNT(counter, value) Profiler::AddCounter(counter, static_cast<uint64_t>(value))
+#define TINY3D_PROFILE_END_FRAME() Profiler::EndFrame()
+#else
+#define TINY3D_PROFILE_SCOPE(stage) ((void)0)
+#define TINY3D_PROFILE_COUNT(counter, value) ((void)(value))
+#define TINY3D_PROFILE_END_FRAME() ((void)0)
+#endif
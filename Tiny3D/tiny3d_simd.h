@@ -0,0 +1,168 @@
+﻿/*********************************************************************************************
+MIT License
+
+Copyright (c) 2024 kumakoko www.xionggf.com
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*********************************************************************************************/
+
+#pragma once
+
+#include <cmath>
+#include <cstdint>
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__SSE2__)
+#define TINY3D_SIMD_SSE
+#include <emmintrin.h>
+#endif
+
+//=====================================================================
+// 4路单精度浮点SIMD，没有SSE的平台上逐个分量计算，结果相同
+//=====================================================================
+
+#define SIMD_WIDTH                  4
+
+struct SimdFloat
+{
+#if defined(TINY3D_SIMD_SSE)
+    __m128 v;
+#else
+    float v[SIMD_WIDTH];
+#endif
+
+    static inline SimdFloat Splat(float x)
+    {
+        SimdFloat r;
+#if defined(TINY3D_SIMD_SSE)
+        r.v = _mm_set1_ps(x);
+#else
+        for (uint32_t i = 0; i < SIMD_WIDTH; ++i)
+            r.v[i] = x;
+#endif
+        return r;
+    }
+
+    static inline SimdFloat Set(float x0, float x1, float x2, float x3)
+    {
+        SimdFloat r;
+#if defined(TINY3D_SIMD_SSE)
+        r.v = _mm_set_ps(x3, x2, x1, x0);
+#else
+        r.v[0] = x0;
+        r.v[1] = x1;
+        r.v[2] = x2;
+        r.v[3] = x3;
+#endif
+        return r;
+    }
+
+    // p不要求对齐
+    static inline SimdFloat Load(const float* p)
+    {
+        SimdFloat r;
+#if defined(TINY3D_SIMD_SSE)
+        r.v = _mm_loadu_ps(p);
+#else
+        for (uint32_t i = 0; i < SIMD_WIDTH; ++i)
+            r.v[i] = p[i];
+#endif
+        return r;
+    }
+
+    inline void Store(float* p) const
+    {
+#if defined(TINY3D_SIMD_SSE)
+        _mm_storeu_ps(p, v);
+#else
+        for (uint32_t i = 0; i < SIMD_WIDTH; ++i)
+            p[i] = v[i];
+#endif
+    }
+};
+
+#if defined(TINY3D_SIMD_SSE)
+#define TINY3D_SIMD_BINARY_OP(name, op, intrinsic)                      \
+    inline SimdFloat name(const SimdFloat& a, const SimdFloat& b)       \
+    {                                                                   \
+        SimdFloat r;                                                    \
+        r.v = intrinsic(a.v, b.v);                                      \
+        return r;                                                       \
+    }
+#else
+#define TINY3D_SIMD_BINARY_OP(name, op, intrinsic)                      \
+    inline SimdFloat name(const SimdFloat& a, const SimdFloat& b)       \
+    {                                                                   \
+        SimdFloat r;                                                    \
+        for (uint32_t i = 0; i < SIMD_WIDTH; ++i)                       \
+            r.v[i] = op(a.v[i], b.v[i]);                                \
+        return r;                                                       \
+    }
+#endif
+
+namespace simd_detail
+{
+    inline float Add(float a, float b) { return a + b; }
+    inline float Sub(float a, float b) { return a - b; }
+    inline float Mul(float a, float b) { return a * b; }
+    inline float Div(float a, float b) { return a / b; }
+    inline float Min(float a, float b) { return (a < b) ? a : b; }
+    inline float Max(float a, float b) { return (a > b) ? a : b; }
+}
+
+TINY3D_SIMD_BINARY_OP(operator+, simd_detail::Add, _mm_add_ps)
+TINY3D_SIMD_BINARY_OP(operator-, simd_detail::Sub, _mm_sub_ps)
+TINY3D_SIMD_BINARY_OP(operator*, simd_detail::Mul, _mm_mul_ps)
+TINY3D_SIMD_BINARY_OP(operator/, simd_detail::Div, _mm_div_ps)
+TINY3D_SIMD_BINARY_OP(SimdMin, simd_detail::Min, _mm_min_ps)
+TINY3D_SIMD_BINARY_OP(SimdMax, simd_detail::Max, _mm_max_ps)
+
+#undef TINY3D_SIMD_BINARY_OP
+
+inline SimdFloat& operator+=(SimdFloat& a, const SimdFloat& b)
+{
+    a = a + b;
+    return a;
+}
+
+inline SimdFloat SimdSqrt(const SimdFloat& a)
+{
+    SimdFloat r;
+#if defined(TINY3D_SIMD_SSE)
+    r.v = _mm_sqrt_ps(a.v);
+#else
+    for (uint32_t i = 0; i < SIMD_WIDTH; ++i)
+        r.v[i] = std::sqrt(a.v[i]);
+#endif
+    return r;
+}
+
+// 返回 a < b 的通道掩码，第i位对应第i个通道
+inline uint32_t SimdLessMask(const SimdFloat& a, const SimdFloat& b)
+{
+#if defined(TINY3D_SIMD_SSE)
+    return static_cast<uint32_t>(_mm_movemask_ps(_mm_cmplt_ps(a.v, b.v)));
+#else
+    uint32_t mask = 0;
+
+    for (uint32_t i = 0; i < SIMD_WIDTH; ++i)
+        mask |= (a.v[i] < b.v[i]) ? (1u << i) : 0u;
+
+    return mask;
+#endif
+}
@@ -0,0 +1,95 @@
+﻿/*********************************************************************************************
+MIT License
+
+Copyright (c) 2024 kumakoko www.xionggf.com
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*********************************************************************************************/
+
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+//=====================================================================
+// 单生产者单消费者无锁环形队列，用于在两个线程之间传递帧数据
+//=====================================================================
+
+template<typename T, std::size_t Capacity>
+class SpscQueue
+{
+    static_assert((Capacity & (Capacity - 1)) == 0, "Capacity must be power of two");
+public:
+    SpscQueue() : head_(0), tail_(0)
+    {
+    }
+
+    /**************************************************************************************
+    生产者线程调用，队列满时返回false
+    @name: SpscQueue::Push
+    @return: bool
+    @param: const T & item
+    *************************************************************************************/
+    bool Push(const T& item)
+    {
+        std::size_t tail = tail_.load(std::memory_order_relaxed);
+
+        if (tail - head_.load(std::memory_order_acquire) == Capacity)
+            return false;
+
+        items_[tail & (Capacity - 1)] = item;
+        tail_.store(tail + 1, std::memory_order_release);
+        return true;
+    }
+
+    /**************************************************************************************
+    消费者线程调用，队列空时返回false
+    @name: SpscQueue::Pop
+    @return: bool
+    @param: T & item
+    *************************************************************************************/
+    bool Pop(T& item)
+    {
+        std::size_t head = head_.load(std::memory_order_relaxed);
+
+        if (head == tail_.load(std::memory_order_acquire))
+            return false;
+
+        item = items_[head & (Capacity - 1)];
+        head_.store(head + 1, std::memory_order_release);
+        return true;
+    }
+
+    inline bool Empty() const
+    {
+        return head_.load(std::memory_order_acquire) == tail_.load(std::memory_order_acquire);
+    }
+
+private:
+    static const std::size_t kCacheLineSize = 64;
+
+    // 头尾索引分别由消费者和生产者写入，用填充字节把它们隔开到不同的cache line上避免伪共享。
+    // 这里不用alignas，免得抬高宿主类的对齐要求
+    std::atomic<std::size_t> head_;
+    char head_padding_[kCacheLineSize - sizeof(std::atomic<std::size_t>)];
+    std::atomic<std::size_t> tail_;
+    char tail_padding_[kCacheLineSize - sizeof(std::atomic<std::size_t>)];
+    T items_[Capacity];
+};
@@ -0,0 +1,77 @@
+﻿/*********************************************************************************************
+MIT License
+
+Copyright (c) 2024 kumakoko www.xionggf.com
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*********************************************************************************************/
+
+#pragma once
+
+#include <cstdint>
+
+#include "tiny3d_math.h"
+
+//=====================================================================
+// 纹理
+//=====================================================================
+
+// 纹理句柄，即纹理在设备纹理表中的下标
+typedef uint32_t TextureHandle;
+
+static const TextureHandle kInvalidTextureHandle = 0xFFFFFFFF;
+
+#define TEXTURE_TILE_SHIFT          2       // 分块存放时块的边长是 1 << TEXTURE_TILE_SHIFT
+#define TEXTURE_TILE_SIZE           (1 << TEXTURE_TILE_SHIFT)
+
+struct T3DTexture
+{
+    uint32_t* texels;   // 纹素，按行存放，或者按4x4的块存放
+    uint32_t width;     // 纹理宽度
+    uint32_t height;    // 纹理高度
+    float max_u;        // 纹理最大宽度：width - 1
+    float max_v;        // 纹理最大高度：height - 1
+    uint32_t tiles_per_row; // 按4x4的块存放时每行的块数，为0时纹素按行存放
+};
+
+/**************************************************************************************
+按最近点采样读取纹素，u、v为[0, 1]之间的纹理坐标，超出范围时取边缘的纹素
+@name: T3DTextureSample
+@return: uint32_t
+@param: const T3DTexture * texture
+@param: float u
+@param: float v
+*************************************************************************************/
+inline uint32_t T3DTextureSample(const T3DTexture* texture, float u, float v)
+{
+    u = u * texture->max_u;
+    v = v * texture->max_v;
+    int32_t x = static_cast<int32_t>(u + 0.5f);
+    int32_t y = static_cast<int32_t>(v + 0.5f);
+    x = Clamp<int32_t>(x, 0, texture->width - 1);
+    y = Clamp<int32_t>(y, 0, texture->height - 1);
+
+    if (texture->tiles_per_row == 0)
+        return texture->texels[y * texture->width + x];
+
+    // 块按行排列，块内的16个纹素也按行排列
+    uint32_t tile = (static_cast<uint32_t>(y) >> TEXTURE_TILE_SHIFT) * texture->tiles_per_row + (static_cast<uint32_t>(x) >> TEXTURE_TILE_SHIFT);
+    uint32_t texel = ((static_cast<uint32_t>(y) & (TEXTURE_TILE_SIZE - 1)) << TEXTURE_TILE_SHIFT) | (static_cast<uint32_t>(x) & (TEXTURE_TILE_SIZE - 1));
+    return texture->texels[(tile << (TEXTURE_TILE_SHIFT * 2)) | texel];
+}
@@ -0,0 +1,236 @@
+﻿/*********************************************************************************************
+MIT License
+
+Copyright (c) 2024 kumakoko www.xionggf.com
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*********************************************************************************************/
+#include <cstdio>
+#include <algorithm>
+#include <vector>
+
+#include "tiny3d_texture_file.h"
+
+namespace
+{
+    const uint32_t kTextureFileMagic = 0x58443354;      // "T3DX"
+    const uint32_t kTextureFileVersion = 1;
+    const uint64_t kLevelAlignment = 64;
+
+    inline uint64_t AlignLevel(uint64_t offset)
+    {
+        return (offset + kLevelAlignment - 1) & ~(kLevelAlignment - 1);
+    }
+
+    // 2x2的盒式滤波，四个通道分别取平均。奇数宽高时最后一列、最后一行重复使用
+    void Downsample(const uint32_t* source, uint32_t width, uint32_t height, uint32_t* target)
+    {
+        uint32_t target_width = std::max(width >> 1, 1u);
+        uint32_t target_height = std::max(height >> 1, 1u);
+
+        for (uint32_t y = 0; y < target_height; ++y)
+        {
+            uint32_t y0 = std::min(y * 2, height - 1);
+            uint32_t y1 = std::min(y * 2 + 1, height - 1);
+
+            for (uint32_t x = 0; x < target_width; ++x)
+            {
+                uint32_t x0 = std::min(x * 2, width - 1);
+                uint32_t x1 = std::min(x * 2 + 1, width - 1);
+                uint32_t a = source[y0 * width + x0];
+                uint32_t b = source[y0 * width + x1];
+                uint32_t c = source[y1 * width + x0];
+                uint32_t d = source[y1 * width + x1];
+                uint32_t texel = 0;
+
+                for (uint32_t shift = 0; shift < 32; shift += 8)
+                {
+                    uint32_t sum = ((a >> shift) & 0xFF) + ((b >> shift) & 0xFF) + ((c >> shift) & 0xFF) + ((d >> shift) & 0xFF);
+                    texel |= ((sum + 2) >> 2) << shift;
+                }
+
+                target[y * target_width + x] = texel;
+            }
+        }
+    }
+
+    // 按行存放的纹素重排成4x4的块，块和块内的纹素都按行排列
+    void Tile(const uint32_t* source, uint32_t width, uint32_t height, uint32_t* target)
+    {
+        uint32_t tiles_per_row = TextureFile::TilesPerRow(width, true);
+        uint32_t tile_rows = (height + TEXTURE_TILE_SIZE - 1) >> TEXTURE_TILE_SHIFT;
+
+        for (uint32_t tile_y = 0; tile_y < tile_rows; ++tile_y)
+        {
+            for (uint32_t tile_x = 0; tile_x < tiles_per_row; ++tile_x)
+            {
+                uint32_t* tile = target + (tile_y * tiles_per_row + tile_x) * TEXTURE_TILE_SIZE * TEXTURE_TILE_SIZE;
+
+                for (uint32_t j = 0; j < TEXTURE_TILE_SIZE; ++j)
+                {
+                    uint32_t y = std::min((tile_y << TEXTURE_TILE_SHIFT) + j, height - 1);
+
+                    for (uint32_t i = 0; i < TEXTURE_TILE_SIZE; ++i)
+                    {
+                        uint32_t x = std::min((tile_x << TEXTURE_TILE_SHIFT) + i, width - 1);
+                        tile[(j << TEXTURE_TILE_SHIFT) + i] = source[y * width + x];
+                    }
+                }
+            }
+        }
+    }
+}
+
+TextureFile::TextureFile() : header_(nullptr)
+{
+}
+
+uint64_t TextureFile::LevelTexelCount(uint32_t width, uint32_t height, bool tiled)
+{
+    if (!tiled)
+        return static_cast<uint64_t>(width) * height;
+
+    uint64_t tiles_per_row = (static_cast<uint64_t>(width) + TEXTURE_TILE_SIZE - 1) >> TEXTURE_TILE_SHIFT;
+    uint64_t tile_rows = (static_cast<uint64_t>(height) + TEXTURE_TILE_SIZE - 1) >> TEXTURE_TILE_SHIFT;
+    return tiles_per_row * tile_rows * TEXTURE_TILE_SIZE * TEXTURE_TILE_SIZE;
+}
+
+bool TextureFile::Open(const char* file_path)
+{
+    Close();
+
+    if (!file_.Open(file_path) || file_.size() < sizeof(TextureFileHeader))
+    {
+        file_.Close();
+        return false;
+    }
+
+    const TextureFileHeader* header = reinterpret_cast<const TextureFileHeader*>(file_.data());
+    bool valid = header->magic == kTextureFileMagic && header->version == kTextureFileVersion &&
+        header->file_size == file_.size() && header->width > 0 && header->height > 0 &&
+        header->level_count > 0 && header->level_count <= TEXTURE_FILE_MAX_LEVELS;
+
+    // T3DTexture用32位的下标访问纹素，第0级的纹素个数必须放得进uint32_t，之后各级只会更小
+    valid = valid && LevelTexelCount(header->width, header->height, header->tiled != 0) <= UINT32_MAX;
+
+    for (uint32_t i = 0; valid && i < header->level_count; ++i)
+    {
+        uint32_t width = std::max(header->width >> i, 1u);
+        uint32_t height = std::max(header->height >> i, 1u);
+        uint64_t size = sizeof(uint32_t) * LevelTexelCount(width, height, header->tiled != 0);
+        uint64_t offset = header->level_offsets[i];
+
+        // 写成减法的形式，偏移接近2^64时offset + size会回绕
+        valid = offset >= sizeof(TextureFileHeader) && offset % kLevelAlignment == 0 &&
+            size <= file_.size() && offset <= file_.size() - size;
+    }
+
+    if (!valid)
+    {
+        file_.Close();
+        return false;
+    }
+
+    header_ = header;
+    return true;
+}
+
+void TextureFile::Close()
+{
+    header_ = nullptr;
+    file_.Close();
+}
+
+bool TextureFile::Write(const char* file_path, const uint32_t* texels, uint32_t width, uint32_t height, bool tiled)
+{
+    if (width == 0 || height == 0)
+        return false;
+
+    // 一直缩小到1x1，超过TEXTURE_FILE_MAX_LEVELS级的部分不保存
+    std::vector<std::vector<uint32_t>> levels;
+    levels.emplace_back(texels, texels + width * height);
+    uint32_t level_width = width;
+    uint32_t level_height = height;
+
+    while ((level_width > 1 || level_height > 1) && levels.size() < TEXTURE_FILE_MAX_LEVELS)
+    {
+        std::vector<uint32_t> next(std::max(level_width >> 1, 1u) * std::max(level_height >> 1, 1u));
+        Downsample(levels.back().data(), level_width, level_height, next.data());
+        levels.push_back(std::move(next));
+        level_width = std::max(level_width >> 1, 1u);
+        level_height = std::max(level_height >> 1, 1u);
+    }
+
+    TextureFileHeader header = {};
+    header.magic = kTextureFileMagic;
+    header.version = kTextureFileVersion;
+    header.width = width;
+    header.height = height;
+    header.level_count = static_cast<uint32_t>(levels.size());
+    header.tiled = tiled ? 1 : 0;
+
+    uint64_t offset = AlignLevel(sizeof(TextureFileHeader));
+
+    for (uint32_t i = 0; i < header.level_count; ++i)
+    {
+        uint32_t w = std::max(width >> i, 1u);
+        uint32_t h = std::max(height >> i, 1u);
+        header.level_offsets[i] = offset;
+        offset += sizeof(uint32_t) * LevelTexelCount(w, h, tiled);
+        header.file_size = offset;
+        offset = AlignLevel(offset);
+    }
+
+    FILE* file = std::fopen(file_path, "wb");
+
+    if (file == nullptr)
+        return false;
+
+    static const char kZeros[kLevelAlignment] = {};
+    uint64_t position = sizeof(TextureFileHeader);
+    bool ok = std::fwrite(&header, sizeof(header), 1, file) == 1;
+    std::vector<uint32_t> tiled_texels;
+
+    for (uint32_t i = 0; ok && i < header.level_count; ++i)
+    {
+        uint32_t w = std::max(width >> i, 1u);
+        uint32_t h = std::max(height >> i, 1u);
+        const uint32_t* data = levels[i].data();
+        size_t count = static_cast<size_t>(LevelTexelCount(w, h, tiled));
+
+        if (tiled)
+        {
+            tiled_texels.resize(count);
+            Tile(data, w, h, tiled_texels.data());
+            data = tiled_texels.data();
+        }
+
+        size_t padding = static_cast<size_t>(header.level_offsets[i] - position);
+        ok = (padding == 0 || std::fwrite(kZeros, 1, padding, file) == padding) &&
+            std::fwrite(data, sizeof(uint32_t), count, file) == count;
+        position = header.level_offsets[i] + sizeof(uint32_t) * count;
+    }
+
+    ok = (std::fclose(file) == 0) && ok;
+
+    if (!ok)
+        std::remove(file_path);
+
+    return ok;
+}
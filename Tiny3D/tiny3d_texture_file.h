@@ -0,0 +1,131 @@
+﻿/*********************************************************************************************
+MIT License
+
+Copyright (c) 2024 kumakoko www.xionggf.com
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*********************************************************************************************/
+
+#pragma once
+
+#include <cstdint>
+
+#include "tiny3d_mapped_file.h"
+#include "tiny3d_texture.h"
+
+//=====================================================================
+// 烘焙过的纹理文件
+//=====================================================================
+
+// 文件开头是TextureFileHeader，后面是按64字节对齐的各级mipmap。纹素已经是引擎的格式
+// （从低到高依次为R、G、B、A各8位），加载时不需要解码也不需要转换格式。
+// 分块存放时每个4x4的块正好是一条64字节的缓存行，纹理被旋转之后沿任意方向采样都能
+// 命中同一条缓存行；宽高不是4的倍数时块的边缘用最后一行、最后一列的纹素填充
+#define TEXTURE_FILE_MAX_LEVELS     16
+
+struct TextureFileHeader
+{
+    uint32_t magic;
+    uint32_t version;
+    uint64_t file_size;
+    uint32_t width;                 // 第0级的宽高
+    uint32_t height;
+    uint32_t level_count;
+    uint32_t tiled;                 // 为1时纹素按4x4的块存放
+    uint64_t level_offsets[TEXTURE_FILE_MAX_LEVELS];
+};
+
+class TextureFile
+{
+public:
+    TextureFile();
+
+    /**************************************************************************************
+    映射纹理文件并检查文件头，文件不存在或者不是纹理文件时返回false
+    @name: TextureFile::Open
+    @return: bool
+    @param: const char * file_path
+    *************************************************************************************/
+    bool Open(const char* file_path);
+
+    /**************************************************************************************
+    解除映射，之前返回的指针全部失效
+    @name: TextureFile::Close
+    @return: void
+    *************************************************************************************/
+    void Close();
+
+    /**************************************************************************************
+    生成完整的mipmap链并写成纹理文件
+    @name: TextureFile::Write
+    @return: bool 写文件失败时返回false
+    @param: const char * file_path
+    @param: const uint32_t * texels 按行存放的第0级纹素
+    @param: uint32_t width
+    @param: uint32_t height
+    @param: bool tiled 是否按4x4的块存放
+    *************************************************************************************/
+    static bool Write(const char* file_path, const uint32_t* texels, uint32_t width, uint32_t height, bool tiled);
+
+    /**************************************************************************************
+    一级mipmap占用的纹素个数，分块存放时包含填充的纹素。按64位计算，宽高来自文件头时不会回绕
+    @name: TextureFile::LevelTexelCount
+    @return: uint64_t
+    @param: uint32_t width 这一级的宽
+    @param: uint32_t height 这一级的高
+    @param: bool tiled
+    *************************************************************************************/
+    static uint64_t LevelTexelCount(uint32_t width, uint32_t height, bool tiled);
+
+    /**************************************************************************************
+    分块存放时每行的块数，按行存放时返回0，和T3DTexture::tiles_per_row的约定一致
+    @name: TextureFile::TilesPerRow
+    @return: uint32_t
+    @param: uint32_t width
+    @param: bool tiled
+    *************************************************************************************/
+    static inline uint32_t TilesPerRow(uint32_t width, bool tiled)
+    {
+        return tiled ? (width + TEXTURE_TILE_SIZE - 1) >> TEXTURE_TILE_SHIFT : 0;
+    }
+
+    inline const TextureFileHeader* header() const
+    {
+        return header_;
+    }
+
+    inline const uint32_t* level(uint32_t index) const
+    {
+        return reinterpret_cast<const uint32_t*>(file_.data() + header_->level_offsets[index]);
+    }
+
+    inline uint32_t level_width(uint32_t index) const
+    {
+        return (header_->width >> index) > 0 ? header_->width >> index : 1;
+    }
+
+    inline uint32_t level_height(uint32_t index) const
+    {
+        return (header_->height >> index) > 0 ? header_->height >> index : 1;
+    }
+
+private:
+    MappedFile file_;
+    const TextureFileHeader* header_;   // 指向映射区域，没有打开文件时为nullptr
+};
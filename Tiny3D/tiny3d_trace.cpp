@@ -0,0 +1,249 @@
+﻿/*********************************************************************************************
+MIT License
+
+Copyright (c) 2024 kumakoko www.xionggf.com
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*********************************************************************************************/
+#include <atomic>
+#include <condition_variable>
+#include <cstdio>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "fmt/format.h"
+
+#include "tiny3d_log.h"
+#include "tiny3d_trace.h"
+
+namespace
+{
+    struct TraceEvent
+    {
+        const char* name;
+        uint64_t begin_ns;
+        uint64_t end_ns;
+    };
+
+    // 单生产者单消费者的环形缓冲区，生产者是所属线程，消费者是刷新线程
+    struct TraceThreadBuffer
+    {
+        static const uint32_t kCapacity = 16384;   // 必须是2的幂
+
+        uint32_t thread_id = 0;
+        std::string thread_name;
+        std::atomic<uint64_t> write_pos{ 0 };
+        char write_padding[64];
+        std::atomic<uint64_t> read_pos{ 0 };
+        std::atomic<uint64_t> dropped{ 0 };
+        TraceEvent events[kCapacity];
+    };
+
+    const std::chrono::milliseconds kFlushInterval(20);
+
+    // 线程缓冲区在第一次使用时注册，之后一直保留到进程结束，
+    // 这样线程退出后刷新线程仍然可以安全地读它
+    std::mutex g_registry_mutex;
+    std::vector<TraceThreadBuffer*> g_buffers;
+    thread_local TraceThreadBuffer* t_buffer = nullptr;
+
+    std::atomic<bool> g_recording(false);
+    uint64_t g_origin_ns = 0;
+    std::FILE* g_file = nullptr;
+    bool g_first_event = true;
+
+    std::thread g_flush_thread;
+    std::mutex g_flush_mutex;
+    std::condition_variable g_flush_condition;
+    bool g_flush_running = false;
+
+    TraceThreadBuffer* CurrentThreadBuffer()
+    {
+        if (t_buffer == nullptr)
+        {
+            TraceThreadBuffer* buffer = new TraceThreadBuffer();
+            std::lock_guard<std::mutex> lock(g_registry_mutex);
+            buffer->thread_id = static_cast<uint32_t>(g_buffers.size()) + 1;
+            buffer->thread_name = fmt::format("thread_{}", buffer->thread_id);
+            g_buffers.push_back(buffer);
+            t_buffer = buffer;
+        }
+
+        return t_buffer;
+    }
+
+    void WriteEvent(fmt::memory_buffer& out, uint32_t thread_id, const TraceEvent& event)
+    {
+        // 录制开始之前就已经开始的事件直接丢弃
+        if (event.begin_ns < g_origin_ns)
+            return;
+
+        double ts = static_cast<double>(event.begin_ns - g_origin_ns) / 1000.0;
+        double dur = static_cast<double>(event.end_ns - event.begin_ns) / 1000.0;
+        fmt::format_to(std::back_inserter(out), "{}{{\"name\":\"{}\",\"ph\":\"X\",\"pid\":1,\"tid\":{},\"ts\":{:.3f},\"dur\":{:.3f}}}",
+            g_first_event ? "\n" : ",\n", event.name, thread_id, ts, dur);
+        g_first_event = false;
+    }
+
+    // 取出所有线程缓冲区中已经写完的事件并写入文件，只在刷新线程中调用
+    void DrainBuffers()
+    {
+        std::vector<TraceThreadBuffer*> buffers;
+
+        {
+            std::lock_guard<std::mutex> lock(g_registry_mutex);
+            buffers = g_buffers;
+        }
+
+        fmt::memory_buffer out;
+
+        for (TraceThreadBuffer* buffer : buffers)
+        {
+            uint64_t read = buffer->read_pos.load(std::memory_order_relaxed);
+            uint64_t write = buffer->write_pos.load(std::memory_order_acquire);
+
+            for (; read != write; ++read)
+            {
+                WriteEvent(out, buffer->thread_id, buffer->events[read & (TraceThreadBuffer::kCapacity - 1)]);
+            }
+
+            buffer->read_pos.store(read, std::memory_order_release);
+        }
+
+        if (out.size() > 0)
+            std::fwrite(out.data(), 1, out.size(), g_file);
+    }
+
+    void FlushThreadMain()
+    {
+        TraceRecorder::SetThreadName("trace_flush");
+        std::unique_lock<std::mutex> lock(g_flush_mutex);
+
+        while (g_flush_running)
+        {
+            g_flush_condition.wait_for(lock, kFlushInterval);
+            lock.unlock();
+            DrainBuffers();
+            lock.lock();
+        }
+
+        lock.unlock();
+        DrainBuffers();
+    }
+}
+
+bool TraceRecorder::Start(const char* path)
+{
+    if (g_file != nullptr)
+        return false;
+
+    g_file = std::fopen(path, "wb");
+
+    if (g_file == nullptr)
+        return false;
+
+    std::fputs("{\"displayTimeUnit\":\"ms\",\"traceEvents\":[", g_file);
+    g_first_event = true;
+    g_origin_ns = Now();
+
+    // 上一次录制停止之后残留的事件不属于这一次，跳过它们
+    {
+        std::lock_guard<std::mutex> lock(g_registry_mutex);
+
+        for (TraceThreadBuffer* buffer : g_buffers)
+        {
+            buffer->read_pos.store(buffer->write_pos.load(std::memory_order_acquire), std::memory_order_release);
+            buffer->dropped.store(0, std::memory_order_relaxed);
+        }
+    }
+
+    g_flush_running = true;
+    g_flush_thread = std::thread(FlushThreadMain);
+    g_recording.store(true, std::memory_order_release);
+    return true;
+}
+
+void TraceRecorder::Stop()
+{
+    if (g_file == nullptr)
+        return;
+
+    g_recording.store(false, std::memory_order_release);
+
+    {
+        std::lock_guard<std::mutex> lock(g_flush_mutex);
+        g_flush_running = false;
+    }
+
+    g_flush_condition.notify_all();
+    g_flush_thread.join();
+
+    // 线程名以元数据事件的形式写在最后
+    uint64_t dropped = 0;
+    fmt::memory_buffer out;
+
+    {
+        std::lock_guard<std::mutex> lock(g_registry_mutex);
+
+        for (TraceThreadBuffer* buffer : g_buffers)
+        {
+            fmt::format_to(std::back_inserter(out), "{}{{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":{},\"args\":{{\"name\":\"{}\"}}}}",
+                g_first_event ? "\n" : ",\n", buffer->thread_id, buffer->thread_name);
+            g_first_event = false;
+            dropped += buffer->dropped.load(std::memory_order_relaxed);
+        }
+    }
+
+    out.append(std::string_view("\n]}\n"));
+    std::fwrite(out.data(), 1, out.size(), g_file);
+    std::fclose(g_file);
+    g_file = nullptr;
+
+    if (dropped > 0)
+        Log::Warn("Trace ring buffers overflowed, {} events dropped", dropped);
+}
+
+bool TraceRecorder::IsRecording()
+{
+    return g_recording.load(std::memory_order_relaxed);
+}
+
+void TraceRecorder::SetThreadName(const char* name)
+{
+    TraceThreadBuffer* buffer = CurrentThreadBuffer();
+    std::lock_guard<std::mutex> lock(g_registry_mutex);
+    buffer->thread_name = name;
+}
+
+void TraceRecorder::Record(const char* name, uint64_t begin_ns, uint64_t end_ns)
+{
+    TraceThreadBuffer* buffer = CurrentThreadBuffer();
+    uint64_t write = buffer->write_pos.load(std::memory_order_relaxed);
+
+    if (write - buffer->read_pos.load(std::memory_order_acquire) >= TraceThreadBuffer::kCapacity)
+    {
+        buffer->dropped.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+
+    buffer->events[write & (TraceThreadBuffer::kCapacity - 1)] = { name, begin_ns, end_ns };
+    buffer->write_pos.store(write + 1, std::memory_order_release);
+}
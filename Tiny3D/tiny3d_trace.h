@@ -0,0 +1,146 @@
+﻿/*********************************************************************************************
+MIT License
+
+Copyright (c) 2024 kumakoko www.xionggf.com
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*********************************************************************************************/
+
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+
+#include "tiny3d_profiler.h"
+
+//=====================================================================
+// Chrome trace_event 时间线导出
+//=====================================================================
+
+// 时间线和帧剖析器共用TINY3D_ENABLE_PROFILER开关。每个线程把事件写到自己的无锁环形
+// 缓冲区里，后台的刷新线程定期把它们取出来写成Chrome trace_event格式的JSON文件，
+// 可以直接用Perfetto或chrome://tracing打开，用来观察各光栅化线程的负载是否均衡
+class TraceRecorder
+{
+public:
+    /**************************************************************************************
+    开始录制时间线，启动后台刷新线程。已经在录制时返回false
+    @name: TraceRecorder::Start
+    @return: bool 文件无法创建时返回false
+    @param: const char * path 输出的JSON文件路径
+    *************************************************************************************/
+    static bool Start(const char* path);
+
+    /**************************************************************************************
+    停止录制，等待刷新线程把剩余的事件写完并关闭文件
+    @name: TraceRecorder::Stop
+    @return: void
+    *************************************************************************************/
+    static void Stop();
+
+    /**************************************************************************************
+    是否正在录制
+    @name: TraceRecorder::IsRecording
+    @return: bool
+    *************************************************************************************/
+    static bool IsRecording();
+
+    /**************************************************************************************
+    设置当前线程在时间线上显示的名字，不在录制时也可以调用
+    @name: TraceRecorder::SetThreadName
+    @return: void
+    @param: const char * name
+    *************************************************************************************/
+    static void SetThreadName(const char* name);
+
+    /**************************************************************************************
+    把一个已经结束的事件写入当前线程的环形缓冲区，缓冲区满时丢弃该事件
+    @name: TraceRecorder::Record
+    @return: void
+    @param: const char * name 事件名，必须是生命期足够长的字符串常量
+    @param: uint64_t begin_ns 开始时刻，steady_clock的纳秒数
+    @param: uint64_t end_ns 结束时刻，steady_clock的纳秒数
+    *************************************************************************************/
+    static void Record(const char* name, uint64_t begin_ns, uint64_t end_ns);
+
+    /**************************************************************************************
+    当前时刻，steady_clock的纳秒数
+    @name: TraceRecorder::Now
+    @return: uint64_t
+    *************************************************************************************/
+    static inline uint64_t Now()
+    {
+        return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count());
+    }
+};
+
+// 在作用域内记录一个时间线事件。没有在录制时只多一次原子读
+class TraceScope
+{
+public:
+    explicit TraceScope(const char* name) : name_(name), begin_(TraceRecorder::IsRecording() ? TraceRecorder::Now() : 0)
+    {
+    }
+
+    ~TraceScope()
+    {
+        if (begin_ != 0)
+            TraceRecorder::Record(name_, begin_, TraceRecorder::Now());
+    }
+
+    TraceScope(const TraceScope&) = delete;
+    TraceScope& operator=(const TraceScope&) = delete;
+
+private:
+    const char* name_;
+    uint64_t begin_;
+};
+
+// 跨越多次循环的等待区间，例如轮询队列时反复让出时间片的那段时间。
+// 第一次调用Begin时开始计时，调用End时记录一个事件
+class TraceSpan
+{
+public:
+    inline void Begin()
+    {
+        if (begin_ == 0 && TraceRecorder::IsRecording())
+            begin_ = TraceRecorder::Now();
+    }
+
+    inline void End(const char* name)
+    {
+        if (begin_ != 0)
+        {
+            TraceRecorder::Record(name, begin_, TraceRecorder::Now());
+            begin_ = 0;
+        }
+    }
+
+private:
+    uint64_t begin_ = 0;
+};
+
+#if defined(TINY3D_ENABLE_PROFILER)
+#define TINY3D_TRACE_SCOPE(name) TraceScope TINY3D_PROFILE_CONCAT(trace_scope_, __LINE__)(name)
+#define TINY3D_TRACE_THREAD_NAME(name) TraceRecorder::SetThreadName(name)
+#else
+#define TINY3D_TRACE_SCOPE(name) ((void)0)
+#define TINY3D_TRACE_THREAD_NAME(name) ((void)(name))
+#endif
@@ -88,4 +88,24 @@ public:
     {
         world_matrix_ = m;
     }
+
+    inline const T3DMatrix4X4& world_matrix() const
+    {
+        return world_matrix_;
+    }
+
+    inline const T3DMatrix4X4& view_matrix() const
+    {
+        return view_matrix_;
+    }
+
+    inline const T3DMatrix4X4& projection_matrix() const
+    {
+        return projection_matrix_;
+    }
+
+    inline const T3DMatrix4X4& wvp_matrix() const
+    {
+        return wvp_matrix_;
+    }
 };
\ No newline at end of file
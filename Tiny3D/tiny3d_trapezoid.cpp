@@ -55,10 +55,10 @@ int Trapezoid::SplitTriangleIntoTrapezoids(std::array<Trapezoid, 2>& trap, const
 
         trap[0].set_top(p1->pos.y);    // 梯形的顶边Y值为p1
         trap[0].set_bottom(p3->pos.y); // 梯形的底边Y值为p1
-        trap[0].left().v1 = *p1;      // 梯形的左腰边上顶点为p1,下顶点为p3
-        trap[0].left().v2 = *p3;
-        trap[0].right().v1 = *p2;     // 梯形的右腰边上顶点为p2，下顶点为p3
-        trap[0].right().v2 = *p3;
+        trap[0].left().v1 = p1;      // 梯形的左腰边上顶点为p1,下顶点为p3
+        trap[0].left().v2 = p3;
+        trap[0].right().v1 = p2;     // 梯形的右腰边上顶点为p2，下顶点为p3
+        trap[0].right().v2 = p3;
         return trap[0].top() < trap[0].bottom() ? 1 : 0;
     }
 
@@ -83,10 +83,10 @@ int Trapezoid::SplitTriangleIntoTrapezoids(std::array<Trapezoid, 2>& trap, const
 
         trap[0].set_top(p1->pos.y);
         trap[0].set_bottom(p3->pos.y);
-        trap[0].left().v1 = *p1;
-        trap[0].left().v2 = *p2;
-        trap[0].right().v1 = *p1;
-        trap[0].right().v2 = *p3;
+        trap[0].left().v1 = p1;
+        trap[0].left().v2 = p2;
+        trap[0].right().v1 = p1;
+        trap[0].right().v2 = p3;
         return (trap[0].top() < trap[0].bottom()) ? 1 : 0;
     }
 
@@ -103,62 +103,62 @@ int Trapezoid::SplitTriangleIntoTrapezoids(std::array<Trapezoid, 2>& trap, const
 
     if (x <= p3->pos.x) // triangle left
     {
-        trap[0].left().v1 = *p1;
-        trap[0].left().v2 = *p2;
-        trap[0].right().v1 = *p1;
-        trap[0].right().v2 = *p3;
-        trap[1].left().v1 = *p2;
-        trap[1].left().v2 = *p3;
-        trap[1].right().v1 = *p1;
-        trap[1].right().v2 = *p3;
+        trap[0].left().v1 = p1;
+        trap[0].left().v2 = p2;
+        trap[0].right().v1 = p1;
+        trap[0].right().v2 = p3;
+        trap[1].left().v1 = p2;
+        trap[1].left().v2 = p3;
+        trap[1].right().v1 = p1;
+        trap[1].right().v2 = p3;
     }
     else  // triangle right
     {
-        trap[0].left().v1 = *p1;
-        trap[0].left().v2 = *p3;
-        trap[0].right().v1 = *p1;
-        trap[0].right().v2 = *p2;
-        trap[1].left().v1 = *p1;
-        trap[1].left().v2 = *p3;
-        trap[1].right().v1 = *p2;
-        trap[1].right().v2 = *p3;
+        trap[0].left().v1 = p1;
+        trap[0].left().v2 = p3;
+        trap[0].right().v1 = p1;
+        trap[0].right().v2 = p2;
+        trap[1].left().v1 = p1;
+        trap[1].left().v2 = p3;
+        trap[1].right().v1 = p2;
+        trap[1].right().v2 = p3;
     }
 
     return 2;
 }
 
 // 按照 Y 坐标计算出左右两条边纵坐标等于 Y 的顶点
-void Trapezoid::CalculateEdgeInterpolatedPoint(float y)
+void Trapezoid::CalculateEdgeInterpolatedPoint(float y, T3DVertex* left_point, T3DVertex* right_point) const
 {
     // 算出左右腰边的Y值差
-    float s1 = this->left().v2.pos.y - this->left().v1.pos.y;
-    float s2 = this->right().v2.pos.y - this->right().v1.pos.y;
+    float s1 = this->left().v2->pos.y - this->left().v1->pos.y;
+    float s2 = this->right().v2->pos.y - this->right().v1->pos.y;
 
     // 根据传递进来的y值，和左右腰边的Y值差，算出插值比例
-    float t1 = (y - this->left().v1.pos.y) / s1;
-    float t2 = (y - this->right().v1.pos.y) / s2;
+    float t1 = (y - this->left().v1->pos.y) / s1;
+    float t2 = (y - this->right().v1->pos.y) / s2;
     
     // 算出，根据左右腰边两个端点的值，算出左右腰边的插值点的纹理坐标，颜色值
-    T3DVertexInterpolate(&this->left().interpolated_point, &this->left().v1, &this->left().v2, t1);
-    T3DVertexInterpolate(&this->right().interpolated_point, &this->right().v1, &this->right().v2, t2);
+    T3DVertexInterpolate(left_point, this->left().v1, this->left().v2, t1);
+    T3DVertexInterpolate(right_point, this->right().v1, this->right().v2, t2);
 }
 
 // 根据左右两边的端点，初始化计算出扫描线的起点和步长
-void Trapezoid::InitializeScanline(scanline_t* scanline, int y)
+void Trapezoid::InitializeScanline(scanline_t* scanline, int y, const T3DVertex* left_point, const T3DVertex* right_point)
 {
     // 根据算出来的梯形腰边的插值位置点，算出扫描线
     // 梯形的右腰边插值点x值，减去左腰边插值点x值，就是当下扫描线的长度
-    float width = this->right().interpolated_point.pos.x - this->left().interpolated_point.pos.x;
+    float width = right_point->pos.x - left_point->pos.x;
 
-    scanline->left_end_point_x = static_cast<int>(this->left().interpolated_point.pos.x + 0.5f); // 扫描线的左端点的x
+    scanline->left_end_point_x = static_cast<int>(left_point->pos.x + 0.5f); // 扫描线的左端点的x
     scanline->y = y; //扫描线的Y值，扫描线肯定平行于屏幕水平边
-    scanline->width = static_cast<int32_t>(this->right().interpolated_point.pos.x + 0.5f) - scanline->left_end_point_x;
+    scanline->width = static_cast<int32_t>(right_point->pos.x + 0.5f) - scanline->left_end_point_x;
 
-    scanline->interpolated_point = this->left().interpolated_point;
+    scanline->interpolated_point = *left_point;
 
-    if (this->left().interpolated_point.pos.x >= this->right().interpolated_point.pos.x)
+    if (left_point->pos.x >= right_point->pos.x)
         scanline->width = 0;
 
     // 根据左腰右腰插值点和扫描线宽度，算出每一个“插值步”的position，color，uv的值
-    T3DVertexDivision(&scanline->interpolated_step, &this->left().interpolated_point, &this->right().interpolated_point, width);
+    T3DVertexDivision(&scanline->interpolated_step, left_point, right_point, width);
 }
\ No newline at end of file
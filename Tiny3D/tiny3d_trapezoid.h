@@ -105,21 +105,26 @@ public:
 
     // 按照 Y 坐标计算出左右两条边纵坐标等于 Y 的顶点
     /**************************************************************************************
-    根据给定的y值，计算出本梯形的两条腰边的
+    根据给定的y值，计算出本梯形的两条腰边的插值点。插值点由调用者保存，梯形本身
+    不会被修改，多个线程可以同时光栅化同一个梯形
     @name: trapezoid_t::CalculateEdgeInterpolatedPoint
     @return: void
     @param: float y
+    @param: T3DVertex * left_point 左腰边的插值点
+    @param: T3DVertex * right_point 右腰边的插值点
     *************************************************************************************/
-    void CalculateEdgeInterpolatedPoint(float y);
+    void CalculateEdgeInterpolatedPoint(float y, T3DVertex* left_point, T3DVertex* right_point) const;
 
     /**************************************************************************************
-    根据左右两边的端点，初始化计算出扫描线的起点和步长
+    根据左右两边的插值点，初始化计算出扫描线的起点和步长
     @name: trapezoid_t::InitializeScanline
     @return: void
     @param: scanline_t * scanline
     @param: int y
+    @param: const T3DVertex * left_point
+    @param: const T3DVertex * right_point
     *************************************************************************************/
-    void InitializeScanline(scanline_t* scanline, int y);
+    static void InitializeScanline(scanline_t* scanline, int y, const T3DVertex* left_point, const T3DVertex* right_point);
 private:
     float top_;
     float bottom_;
@@ -0,0 +1,224 @@
+﻿/*********************************************************************************************
+MIT License
+
+Copyright (c) 2024 kumakoko www.xionggf.com
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*********************************************************************************************/
+#include <algorithm>
+
+#include "tiny3d_vertex_shader.h"
+
+namespace
+{
+    template<typename T>
+    inline const T& StreamElement(const VertexStream& stream, uint32_t i)
+    {
+        return *reinterpret_cast<const T*>(static_cast<const uint8_t*>(stream.data) + static_cast<size_t>(stream.stride) * i);
+    }
+
+    inline VertexStream MakeStream(const void* data, uint32_t stride)
+    {
+        VertexStream stream = { data, stride };
+        return stream;
+    }
+
+    // 读取一个float分量流，紧密排列的整批顶点直接一次读入
+    SimdFloat LoadFloatStream(const VertexStream& stream, uint32_t first, uint32_t count)
+    {
+        if (count == SIMD_WIDTH && stream.stride == sizeof(float))
+            return SimdFloat::Load(&StreamElement<float>(stream, first));
+
+        float lanes[SIMD_WIDTH];
+
+        for (uint32_t k = 0; k < SIMD_WIDTH; ++k)
+            lanes[k] = StreamElement<float>(stream, first + std::min(k, count - 1));
+
+        return SimdFloat::Load(lanes);
+    }
+}
+
+VertexStreams MakeVertexStreams(const T3DMesh* mesh)
+{
+    VertexStreams streams = {};
+    const T3DPackedVertex* vertices = mesh->vertices.data();
+    uint32_t stride = sizeof(T3DPackedVertex);
+    streams.position[0] = MakeStream(&vertices->x, stride);
+    streams.position[1] = MakeStream(&vertices->y, stride);
+    streams.position[2] = MakeStream(&vertices->z, stride);
+    streams.color = MakeStream(&vertices->color, stride);
+    streams.texcoord[0] = MakeStream(&vertices->u, stride);
+    streams.texcoord[1] = MakeStream(&vertices->v, stride);
+
+    if (!mesh->normals.empty())
+    {
+        const T3DVector4* normals = mesh->normals.data();
+        streams.normal[0] = MakeStream(&normals->x, sizeof(T3DVector4));
+        streams.normal[1] = MakeStream(&normals->y, sizeof(T3DVector4));
+        streams.normal[2] = MakeStream(&normals->z, sizeof(T3DVector4));
+    }
+
+    return streams;
+}
+
+VertexStreams MakeVertexStreams(const MeshFile* mesh)
+{
+    VertexStreams streams = {};
+    streams.position[0] = MakeStream(mesh->stream<float>(MESH_STREAM_POSITION_X), sizeof(float));
+    streams.position[1] = MakeStream(mesh->stream<float>(MESH_STREAM_POSITION_Y), sizeof(float));
+    streams.position[2] = MakeStream(mesh->stream<float>(MESH_STREAM_POSITION_Z), sizeof(float));
+    streams.color = MakeStream(mesh->stream<uint32_t>(MESH_STREAM_COLOR), sizeof(uint32_t));
+    streams.texcoord[0] = MakeStream(mesh->stream<uint16_t>(MESH_STREAM_TEXCOORD_U), sizeof(uint16_t));
+    streams.texcoord[1] = MakeStream(mesh->stream<uint16_t>(MESH_STREAM_TEXCOORD_V), sizeof(uint16_t));
+
+    if (mesh->header()->has_normals)
+    {
+        streams.normal[0] = MakeStream(mesh->stream<float>(MESH_STREAM_NORMAL_X), sizeof(float));
+        streams.normal[1] = MakeStream(mesh->stream<float>(MESH_STREAM_NORMAL_Y), sizeof(float));
+        streams.normal[2] = MakeStream(mesh->stream<float>(MESH_STREAM_NORMAL_Z), sizeof(float));
+    }
+
+    return streams;
+}
+
+void LoadVertexBatch(const VertexStreams& streams, uint32_t first, uint32_t count, uint32_t attributes, VertexBatchInput* input)
+{
+    for (uint32_t c = 0; c < 3; ++c)
+        input->position[c] = LoadFloatStream(streams.position[c], first, count);
+
+    if (attributes & VERTEX_ATTRIBUTE_NORMAL)
+    {
+        for (uint32_t c = 0; c < 3; ++c)
+            input->normal[c] = (streams.normal[c].data != nullptr) ? LoadFloatStream(streams.normal[c], first, count) : SimdFloat::Splat(0.0f);
+    }
+
+    // 颜色和纹理坐标的换算和T3DVertexUnpack相同
+    if (attributes & VERTEX_ATTRIBUTE_COLOR)
+    {
+        if (streams.color.data != nullptr)
+        {
+            const float inv_255 = 1.0f / 255.0f;
+            float r[SIMD_WIDTH], g[SIMD_WIDTH], b[SIMD_WIDTH];
+
+            for (uint32_t k = 0; k < SIMD_WIDTH; ++k)
+            {
+                uint32_t color = StreamElement<uint32_t>(streams.color, first + std::min(k, count - 1));
+                r[k] = static_cast<float>(color & 0xFF) * inv_255;
+                g[k] = static_cast<float>((color >> 8) & 0xFF) * inv_255;
+                b[k] = static_cast<float>((color >> 16) & 0xFF) * inv_255;
+            }
+
+            input->color[0] = SimdFloat::Load(r);
+            input->color[1] = SimdFloat::Load(g);
+            input->color[2] = SimdFloat::Load(b);
+        }
+        else
+        {
+            input->color[0] = input->color[1] = input->color[2] = SimdFloat::Splat(1.0f);
+        }
+    }
+
+    if (attributes & VERTEX_ATTRIBUTE_TEXCOORD)
+    {
+        const float inv_65535 = 1.0f / 65535.0f;
+
+        for (uint32_t c = 0; c < 2; ++c)
+        {
+            if (streams.texcoord[c].data == nullptr)
+            {
+                input->texcoord[c] = SimdFloat::Splat(0.0f);
+                continue;
+            }
+
+            float lanes[SIMD_WIDTH];
+
+            for (uint32_t k = 0; k < SIMD_WIDTH; ++k)
+                lanes[k] = static_cast<float>(StreamElement<uint16_t>(streams.texcoord[c], first + std::min(k, count - 1))) * inv_65535;
+
+            input->texcoord[c] = SimdFloat::Load(lanes);
+        }
+    }
+
+    if (attributes & VERTEX_ATTRIBUTE_SKIN)
+    {
+        bool any_present = false;
+
+        for (uint32_t i = 0; i < kMaxBoneInfluences; ++i)
+        {
+            bool present = streams.bone_index[i].data != nullptr && streams.bone_weight[i].data != nullptr;
+            any_present = any_present || present;
+
+            for (uint32_t k = 0; k < SIMD_WIDTH; ++k)
+                input->bone_index[i][k] = present ? StreamElement<uint8_t>(streams.bone_index[i], first + std::min(k, count - 1)) : 0;
+
+            input->bone_weight[i] = present ? LoadFloatStream(streams.bone_weight[i], first, count) : SimdFloat::Splat(0.0f);
+        }
+
+        // 没有蒙皮数据的网格当作刚性绑定在第0块骨骼上，而不是让权重全为0把顶点都缩到原点
+        if (!any_present)
+            input->bone_weight[0] = SimdFloat::Splat(1.0f);
+    }
+}
+
+void FinishVertexBatch(const VertexBatchOutput& output, uint32_t count, float screen_width, float screen_height,
+    T3DVertex* vertices, uint8_t* inside)
+{
+    const SimdFloat& x = output.position[0];
+    const SimdFloat& y = output.position[1];
+    const SimdFloat& z = output.position[2];
+    const SimdFloat& w = output.position[3];
+    SimdFloat zero = SimdFloat::Splat(0.0f);
+    SimdFloat one = SimdFloat::Splat(1.0f);
+    SimdFloat half = SimdFloat::Splat(0.5f);
+    SimdFloat neg_w = zero - w;
+
+    // 和Transform::CheckCVV相同的六个裁剪面，任意一个通道在某个面之外就不在CVV之内
+    uint32_t outside = SimdLessMask(z, zero) | SimdLessMask(w, z) | SimdLessMask(x, neg_w) |
+        SimdLessMask(w, x) | SimdLessMask(y, neg_w) | SimdLessMask(w, y);
+
+    // 和Transform::Homogenize、T3DVertexRHWInit相同的运算顺序，结果逐位一致
+    SimdFloat rhw = one / w;
+    float lanes[10][SIMD_WIDTH];
+    ((x * rhw + one) * SimdFloat::Splat(screen_width) * half).Store(lanes[0]);
+    ((one - y * rhw) * SimdFloat::Splat(screen_height) * half).Store(lanes[1]);
+    (z * rhw).Store(lanes[2]);
+    w.Store(lanes[3]);
+    (output.texcoord[0] * rhw).Store(lanes[4]);
+    (output.texcoord[1] * rhw).Store(lanes[5]);
+    (output.color[0] * rhw).Store(lanes[6]);
+    (output.color[1] * rhw).Store(lanes[7]);
+    (output.color[2] * rhw).Store(lanes[8]);
+    rhw.Store(lanes[9]);
+
+    for (uint32_t k = 0; k < count; ++k)
+    {
+        T3DVertex& vertex = vertices[k];
+        vertex.pos.x = lanes[0][k];
+        vertex.pos.y = lanes[1][k];
+        vertex.pos.z = lanes[2][k];
+        vertex.pos.w = lanes[3][k];
+        vertex.tc.u = lanes[4][k];
+        vertex.tc.v = lanes[5][k];
+        vertex.color.r = lanes[6][k];
+        vertex.color.g = lanes[7][k];
+        vertex.color.b = lanes[8][k];
+        vertex.rhw = lanes[9][k];
+        inside[k] = ((outside >> k) & 1) ? 0 : 1;
+    }
+}
@@ -0,0 +1,331 @@
+﻿/*********************************************************************************************
+MIT License
+
+Copyright (c) 2024 kumakoko www.xionggf.com
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*********************************************************************************************/
+
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+
+#include "tiny3d_device.h"
+#include "tiny3d_light.h"
+#include "tiny3d_profiler.h"
+#include "tiny3d_simd.h"
+
+//=====================================================================
+// 可编程顶点着色，每次处理SIMD_WIDTH个顶点，顶点属性按SoA放在SIMD寄存器里
+//=====================================================================
+
+// 顶点着色器读取的输入属性，位置总是读取
+#define VERTEX_ATTRIBUTE_NORMAL     0x1     // 法线
+#define VERTEX_ATTRIBUTE_COLOR      0x2     // 顶点颜色
+#define VERTEX_ATTRIBUTE_TEXCOORD   0x4     // 纹理坐标
+#define VERTEX_ATTRIBUTE_SKIN       0x8     // 骨骼索引和权重
+
+static const uint32_t kMaxBoneInfluences = 4;   // 每个顶点最多受几块骨骼影响
+static const uint32_t kVertexBatchesPerJob = 64;
+
+// 一个顶点属性分量的数据流，第i个顶点的分量位于 data + stride * i
+struct VertexStream
+{
+    const void* data;
+    uint32_t stride;            // 字节数
+};
+
+// 顶点着色器的输入，既可以描述T3DPackedVertex这样交错存放的顶点，也可以描述MeshFile的SoA流。
+// 不存在的流data为空
+struct VertexStreams
+{
+    VertexStream position[3];                       // float
+    VertexStream normal[3];                         // float
+    VertexStream color;                             // uint32_t，从低到高依次为R、G、B、A
+    VertexStream texcoord[2];                       // uint16_t，[0, 65535]映射到[0, 1]
+    VertexStream bone_index[kMaxBoneInfluences];    // uint8_t
+    VertexStream bone_weight[kMaxBoneInfluences];   // float
+};
+
+// 一批顶点的输入。没有在kAttributes中声明的属性不会读取，内容未定义
+struct VertexBatchInput
+{
+    SimdFloat position[3];
+    SimdFloat normal[3];        // 没有法线流时为0
+    SimdFloat color[3];         // 没有颜色流时为白色
+    SimdFloat texcoord[2];      // 没有纹理坐标流时为0
+    uint32_t bone_index[kMaxBoneInfluences][SIMD_WIDTH];
+    SimdFloat bone_weight[kMaxBoneInfluences];      // 没有权重流的那一项为0。一个骨骼流都没有时整个顶点以权重1绑定到第0块骨骼
+};
+
+// 一批顶点的输出。没有在kVaryings中声明的插值量由输入原样传递
+struct VertexBatchOutput
+{
+    SimdFloat position[4];      // 裁剪空间坐标
+    SimdFloat color[3];
+    SimdFloat texcoord[2];
+};
+
+// 所有顶点共用的常量
+struct VertexShaderConstants
+{
+    const T3DMatrix4X4* world;  // 世界矩阵
+    const T3DMatrix4X4* wvp;    // world * view * projection
+};
+
+// 顶点着色器是带有以下成员的类型，不需要从任何基类派生：
+//   static const uint32_t kAttributes;     读取的输入属性，VERTEX_ATTRIBUTE_*的组合
+//   static const uint32_t kVaryings;       写出的插值量，VARYING_*的组合
+//   void Shade(const VertexBatchInput& input, const VertexShaderConstants& constants, VertexBatchOutput* output) const;
+//     必须写出裁剪空间坐标以及kVaryings中声明的插值量
+// DrawShadedPrimitives按着色器类型实例化，Shade内联在批处理循环里
+
+/**************************************************************************************
+用T3DMesh的顶点和法线描述顶点着色器的输入，T3DMesh没有骨骼数据，骨骼流为空
+@name: MakeVertexStreams
+@return: VertexStreams
+@param: const T3DMesh * mesh
+*************************************************************************************/
+VertexStreams MakeVertexStreams(const T3DMesh* mesh);
+
+/**************************************************************************************
+用MeshFile的SoA数据流描述顶点着色器的输入
+@name: MakeVertexStreams
+@return: VertexStreams
+@param: const MeshFile * mesh
+*************************************************************************************/
+VertexStreams MakeVertexStreams(const MeshFile* mesh);
+
+/**************************************************************************************
+读取从first开始的count个顶点，count小于SIMD_WIDTH时空出的通道重复最后一个顶点
+@name: LoadVertexBatch
+@return: void
+@param: const VertexStreams & streams
+@param: uint32_t first
+@param: uint32_t count
+@param: uint32_t attributes 要读取的属性，VERTEX_ATTRIBUTE_*的组合
+@param: VertexBatchInput * input
+*************************************************************************************/
+void LoadVertexBatch(const VertexStreams& streams, uint32_t first, uint32_t count, uint32_t attributes, VertexBatchInput* input);
+
+/**************************************************************************************
+对一批顶点做CVV检查、透视除和视口变换，把前count个通道写到变换后顶点缓存，
+结果和Device::TransformVertex相同
+@name: FinishVertexBatch
+@return: void
+@param: const VertexBatchOutput & output
+@param: uint32_t count
+@param: float screen_width
+@param: float screen_height
+@param: T3DVertex * vertices
+@param: uint8_t * inside 每个顶点是否在CVV之内
+*************************************************************************************/
+void FinishVertexBatch(const VertexBatchOutput& output, uint32_t count, float screen_width, float screen_height,
+    T3DVertex* vertices, uint8_t* inside);
+
+// y = (x, y, z, 1) * m
+inline void TransformPoint(SimdFloat* y, const SimdFloat* x, const T3DMatrix4X4& m)
+{
+    for (uint32_t c = 0; c < 4; ++c)
+        y[c] = x[0] * SimdFloat::Splat(m.m[0][c]) + x[1] * SimdFloat::Splat(m.m[1][c]) + x[2] * SimdFloat::Splat(m.m[2][c]) + SimdFloat::Splat(m.m[3][c]);
+}
+
+// y = (x, y, z, 0) * m，只计算前三个分量
+inline void TransformDirection(SimdFloat* y, const SimdFloat* x, const T3DMatrix4X4& m)
+{
+    for (uint32_t c = 0; c < 3; ++c)
+        y[c] = x[0] * SimdFloat::Splat(m.m[0][c]) + x[1] * SimdFloat::Splat(m.m[1][c]) + x[2] * SimdFloat::Splat(m.m[2][c]);
+}
+
+inline void Normalize3(SimdFloat* v)
+{
+    SimdFloat length = SimdSqrt(v[0] * v[0] + v[1] * v[1] + v[2] * v[2]);
+    SimdFloat scale = SimdFloat::Splat(1.0f) / SimdMax(length, SimdFloat::Splat(1e-20f));
+    v[0] = v[0] * scale;
+    v[1] = v[1] * scale;
+    v[2] = v[2] * scale;
+}
+
+// 按骨骼索引和权重混合模型空间中的位置。每个通道引用的骨骼不同，
+// 先把各通道的骨骼矩阵转置成SoA再计算。骨骼索引来自网格数据，超出bone_count的索引按最后一块骨骼处理
+inline void SkinPosition(SimdFloat* y, const VertexBatchInput& input, const T3DMatrix4X4* bones, uint32_t bone_count)
+{
+    assert(bone_count > 0);
+    uint32_t last = bone_count - 1;
+    y[0] = y[1] = y[2] = SimdFloat::Splat(0.0f);
+
+    for (uint32_t k = 0; k < kMaxBoneInfluences; ++k)
+    {
+        const uint32_t* index = input.bone_index[k];
+        const T3DMatrix4X4& b0 = bones[std::min(index[0], last)];
+        const T3DMatrix4X4& b1 = bones[std::min(index[1], last)];
+        const T3DMatrix4X4& b2 = bones[std::min(index[2], last)];
+        const T3DMatrix4X4& b3 = bones[std::min(index[3], last)];
+        SimdFloat m[4][3];
+
+        for (uint32_t r = 0; r < 4; ++r)
+        {
+            for (uint32_t c = 0; c < 3; ++c)
+                m[r][c] = SimdFloat::Set(b0.m[r][c], b1.m[r][c], b2.m[r][c], b3.m[r][c]);
+        }
+
+        for (uint32_t c = 0; c < 3; ++c)
+        {
+            SimdFloat p = input.position[0] * m[0][c] + input.position[1] * m[1][c] + input.position[2] * m[2][c] + m[3][c];
+            y[c] += p * input.bone_weight[k];
+        }
+    }
+}
+
+// 只做WVP变换，和固定功能的顶点变换结果相同
+struct BasicVertexShader
+{
+    static const uint32_t kAttributes = 0;
+    static const uint32_t kVaryings = 0;
+
+    inline void Shade(const VertexBatchInput& input, const VertexShaderConstants& constants, VertexBatchOutput* output) const
+    {
+        TransformPoint(output->position, input.position, *constants.wvp);
+    }
+};
+
+// 骨骼蒙皮，bones是模型空间中的骨骼矩阵。MakeVertexStreams不填骨骼流，
+// 调用者要自己设置VertexStreams::bone_index和bone_weight，否则所有顶点都只跟随第0块骨骼
+struct SkinnedVertexShader
+{
+    static const uint32_t kAttributes = VERTEX_ATTRIBUTE_SKIN;
+    static const uint32_t kVaryings = 0;
+    const T3DMatrix4X4* bones;
+    uint32_t bone_count;        // bones中的矩阵个数，至少为1
+
+    inline void Shade(const VertexBatchInput& input, const VertexShaderConstants& constants, VertexBatchOutput* output) const
+    {
+        SimdFloat position[3];
+        SkinPosition(position, input, bones, bone_count);
+        TransformPoint(output->position, position, *constants.wvp);
+    }
+};
+
+// 逐顶点的漫反射光照，光照结果乘上顶点颜色。世界矩阵不能有非均匀缩放
+struct LitVertexShader
+{
+    static const uint32_t kAttributes = VERTEX_ATTRIBUTE_NORMAL | VERTEX_ATTRIBUTE_COLOR;
+    static const uint32_t kVaryings = VARYING_COLOR;
+    const T3DLight* lights;
+    uint32_t light_count;
+    T3DColor ambient;
+
+    inline void Shade(const VertexBatchInput& input, const VertexShaderConstants& constants, VertexBatchOutput* output) const
+    {
+        SimdFloat position[4], normal[3], light[3];
+        TransformPoint(output->position, input.position, *constants.wvp);
+        TransformPoint(position, input.position, *constants.world);
+        TransformDirection(normal, input.normal, *constants.world);
+        Normalize3(normal);
+        EvaluateLights(light, position, normal, lights, light_count, ambient);
+        output->color[0] = input.color[0] * light[0];
+        output->color[1] = input.color[1] * light[1];
+        output->color[2] = input.color[2] * light[2];
+    }
+};
+
+// 用模型空间中的两个平面生成纹理坐标：u = dot(position, plane_u) + plane_u.w，v同理
+struct TexGenVertexShader
+{
+    static const uint32_t kAttributes = 0;
+    static const uint32_t kVaryings = VARYING_TEXCOORD;
+    T3DVector4 plane_u;
+    T3DVector4 plane_v;
+
+    inline void Shade(const VertexBatchInput& input, const VertexShaderConstants& constants, VertexBatchOutput* output) const
+    {
+        TransformPoint(output->position, input.position, *constants.wvp);
+        output->texcoord[0] = input.position[0] * SimdFloat::Splat(plane_u.x) + input.position[1] * SimdFloat::Splat(plane_u.y) +
+            input.position[2] * SimdFloat::Splat(plane_u.z) + SimdFloat::Splat(plane_u.w);
+        output->texcoord[1] = input.position[0] * SimdFloat::Splat(plane_v.x) + input.position[1] * SimdFloat::Splat(plane_v.y) +
+            input.position[2] * SimdFloat::Splat(plane_v.z) + SimdFloat::Splat(plane_v.w);
+    }
+};
+
+template<typename Shader>
+void Device::DrawShadedPrimitives(const VertexStreams& streams, uint32_t vertex_count, const uint32_t* indices, uint32_t index_count,
+    const uint8_t* triangle_flags, const Shader& shader)
+{
+    assert(T3DMeshIndicesInRange(indices, index_count, vertex_count));
+    uint32_t triangle_count = index_count / 3;
+    TINY3D_PROFILE_COUNT(PROFILE_COUNTER_TRIANGLES_SUBMITTED, triangle_count);
+
+    FrameArena* arena = frame_arena();
+    T3DVertex* cache = arena->AllocateClippedVertices(vertex_count);
+    uint8_t* inside = arena->AllocateArray<uint8_t>(vertex_count);
+    VertexShaderConstants constants = { &this->transform_.world_matrix(), &this->transform_.wvp_matrix() };
+    float screen_width = static_cast<float>(this->window_width_);
+    float screen_height = static_cast<float>(this->window_height_);
+
+    // 着色器没有写出的插值量要从输入传递过去，所以也要读取
+    uint32_t attributes = Shader::kAttributes;
+
+    if (!(Shader::kVaryings & VARYING_COLOR))
+        attributes |= VERTEX_ATTRIBUTE_COLOR;
+
+    if (!(Shader::kVaryings & VARYING_TEXCOORD))
+        attributes |= VERTEX_ATTRIBUTE_TEXCOORD;
+
+    uint32_t batch_count = (vertex_count + SIMD_WIDTH - 1) / SIMD_WIDTH;
+
+    ParallelFor(batch_count, kVertexBatchesPerJob, [&](uint32_t begin, uint32_t end)
+        {
+            TINY3D_PROFILE_SCOPE(PROFILE_STAGE_VERTEX_TRANSFORM);
+
+            for (uint32_t b = begin; b < end; ++b)
+            {
+                uint32_t first = b * SIMD_WIDTH;
+                uint32_t count = std::min<uint32_t>(SIMD_WIDTH, vertex_count - first);
+                VertexBatchInput input;
+                VertexBatchOutput output;
+                LoadVertexBatch(streams, first, count, attributes, &input);
+                shader.Shade(input, constants, &output);
+
+                if (!(Shader::kVaryings & VARYING_COLOR))
+                {
+                    output.color[0] = input.color[0];
+                    output.color[1] = input.color[1];
+                    output.color[2] = input.color[2];
+                }
+
+                if (!(Shader::kVaryings & VARYING_TEXCOORD))
+                {
+                    output.texcoord[0] = input.texcoord[0];
+                    output.texcoord[1] = input.texcoord[1];
+                }
+
+                FinishVertexBatch(output, count, screen_width, screen_height, cache + first, inside + first);
+            }
+        });
+
+    SetupIndexedTriangles(cache, inside, indices, triangle_count, triangle_flags);
+}
+
+template<typename Shader>
+void Device::DrawMesh(const T3DMesh* mesh, const Shader& shader)
+{
+    DrawShadedPrimitives(MakeVertexStreams(mesh), static_cast<uint32_t>(mesh->vertices.size()),
+        mesh->indices.data(), static_cast<uint32_t>(mesh->indices.size()), T3DMeshTriangleFlags(mesh), shader);
+}
@@ -0,0 +1,516 @@
+﻿/*********************************************************************************************
+MIT License
+
+Copyright (c) 2024 kumakoko www.xionggf.com
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*********************************************************************************************/
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <cstdlib>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "fmt/format.h"
+
+#include "tiny3d_aligned_class.h"
+#include "tiny3d_device.h"
+#include "tiny3d_job_system.h"
+#include "tiny3d_log.h"
+#include "tiny3d_pixel_shader.h"
+#include "tiny3d_profiler.h"
+#include "tiny3d_trace.h"
+#include "tiny3d_bench.h"
+
+// 无窗口的基准测试程序。按固定分辨率绘制固定场景，把每个场景的吞吐量、各阶段每像素耗时和
+// 帧时间分位数以JSON格式输出，用于比较不同构建和不同CPU型号的性能。
+//
+// 用法：Tiny3DBench [--scene 名字] [--frames N] [--warmup N] [--threads N]
+//                   [--raster-mode immediate|interleaved|bands] [--output 文件]
+//                   [--trace 文件] [--hw-counters] [--pixel-shader] [--vertex-shader]
+//       Tiny3DBench --golden 目录 [--update-golden] [--tolerance N] [--max-slowdown 倍数]
+//                   [--scene 名字] [--frames N] [--warmup N] [--threads N]
+//       Tiny3DBench --micro [--kernel 名字] [--elements N] [--frames N] [--warmup N] [--output 文件]
+
+const char* RasterModeName(RasterMode mode)
+{
+    switch (mode)
+    {
+    case RASTER_MODE_INTERLEAVED:
+        return "interleaved";
+    case RASTER_MODE_BANDS:
+        return "bands";
+    default:
+        return "immediate";
+    }
+}
+
+// 最近秩法求分位数，sorted必须已经排好序。秩从1开始，p * n向上取整后落在[1, n]之内
+uint64_t Percentile(const std::vector<uint64_t>& sorted, double p)
+{
+    if (sorted.empty())
+        return 0;
+
+    size_t rank = static_cast<size_t>(p * static_cast<double>(sorted.size()) + 0.999999);
+    rank = std::max<size_t>(rank, 1);
+    return sorted[std::min(rank, sorted.size()) - 1];
+}
+
+void RunScene(BenchScene* scene, JobSystem* job_system, const BenchOptions& options, BenchResult& result)
+{
+    uint32_t width = scene->width();
+    uint32_t height = scene->height();
+    uint32_t* frame_buffer = static_cast<uint32_t*>(AlignedMalloc(sizeof(uint32_t) * width * height, 64));
+    VertexColorShader vertex_color_shader;
+    TextureShader texture_shader;
+
+    Device device;
+    device.Initialize(width, height);
+    device.set_job_system(job_system);
+    device.SetRasterMode(options.raster_mode, 0);
+    device.SetFrameBufer(reinterpret_cast<uint8_t*>(frame_buffer));
+    scene->set_vertex_shader(options.vertex_shader);
+    scene->Setup(&device);
+
+    // 按场景的渲染状态换上结果相同的像素着色器，线框场景不受影响
+    if (options.pixel_shader && device.pixel_shader_ == nullptr)
+    {
+        if (device.render_state() & RENDER_STATE_TEXTURE)
+            device.SetPixelShader(&texture_shader);
+        else if (device.render_state() & RENDER_STATE_COLOR)
+            device.SetPixelShader(&vertex_color_shader);
+    }
+
+    result.scene = scene;
+    result.frame_nanoseconds.reserve(options.frames);
+    std::memset(result.stage_nanoseconds, 0, sizeof(result.stage_nanoseconds));
+    std::memset(result.counters, 0, sizeof(result.counters));
+    std::memset(result.stage_events, 0, sizeof(result.stage_events));
+    result.event_mask = 0;
+
+    // 丢弃Setup期间累加的剖析数据
+    Profiler::EndFrame();
+
+    for (uint32_t frame = 0; frame < options.warmup + options.frames; ++frame)
+    {
+        TINY3D_TRACE_SCOPE(scene->name());
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+        device.ClearFrameBuffer(device.background_color_);
+        device.ResetZBuffer();
+        scene->Render(&device, frame);
+        device.FlushDeferredRaster();
+        device.EndFrame();
+
+        std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now();
+        Profiler::EndFrame();
+
+        if (frame == 0)
+            result.first_frame.assign(frame_buffer, frame_buffer + width * height);
+
+        if (frame < options.warmup)
+            continue;
+
+        result.frame_nanoseconds.push_back(static_cast<uint64_t>(
+            std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count()));
+
+        ProfileSnapshot snapshot;
+        Profiler::Snapshot(&snapshot);
+
+        for (int i = 0; i < PROFILE_STAGE_COUNT; ++i)
+        {
+            result.stage_nanoseconds[i] += snapshot.stage_nanoseconds[i];
+        }
+
+        for (int i = 0; i < PROFILE_COUNTER_COUNT; ++i)
+        {
+            result.counters[i] += snapshot.counters[i];
+        }
+
+        for (int i = 0; i < PROFILE_STAGE_COUNT; ++i)
+        {
+            for (int j = 0; j < PERF_EVENT_COUNT; ++j)
+            {
+                result.stage_events[i][j] += snapshot.stage_events[i][j];
+            }
+        }
+
+        result.event_mask |= snapshot.event_mask;
+    }
+
+    device.Destroy();
+    AlignedFree(frame_buffer);
+}
+
+namespace
+{
+    bool ParseOptions(int argc, char* argv[], BenchOptions& options)
+    {
+        options.frames = 200;
+        options.warmup = 20;
+        options.threads = 0;
+        options.raster_mode = RASTER_MODE_INTERLEAVED;
+        options.update_golden = false;
+        options.tolerance = 2;
+        options.max_slowdown = 1.15;
+        options.micro = false;
+        options.micro_elements = 65536;
+        options.hardware_counters = false;
+        options.pixel_shader = false;
+        options.vertex_shader = false;
+
+        for (int i = 1; i < argc; ++i)
+        {
+            const char* arg = argv[i];
+            const char* value = (i + 1 < argc) ? argv[i + 1] : nullptr;
+
+            // 不带参数值的开关
+            if (std::strcmp(arg, "--update-golden") == 0)
+            {
+                options.update_golden = true;
+                continue;
+            }
+
+            if (std::strcmp(arg, "--micro") == 0)
+            {
+                options.micro = true;
+                continue;
+            }
+
+            if (std::strcmp(arg, "--hw-counters") == 0)
+            {
+                options.hardware_counters = true;
+                continue;
+            }
+
+            if (std::strcmp(arg, "--pixel-shader") == 0)
+            {
+                options.pixel_shader = true;
+                continue;
+            }
+
+            if (std::strcmp(arg, "--vertex-shader") == 0)
+            {
+                options.vertex_shader = true;
+                continue;
+            }
+
+            if (value == nullptr)
+            {
+                fmt::print(stderr, "missing value for {}\n", arg);
+                return false;
+            }
+
+            if (std::strcmp(arg, "--scene") == 0)
+                options.scene = value;
+            else if (std::strcmp(arg, "--frames") == 0)
+                options.frames = static_cast<uint32_t>(std::strtoul(value, nullptr, 10));
+            else if (std::strcmp(arg, "--warmup") == 0)
+                options.warmup = static_cast<uint32_t>(std::strtoul(value, nullptr, 10));
+            else if (std::strcmp(arg, "--threads") == 0)
+                options.threads = static_cast<uint32_t>(std::strtoul(value, nullptr, 10));
+            else if (std::strcmp(arg, "--output") == 0)
+                options.output = value;
+            else if (std::strcmp(arg, "--trace") == 0)
+                options.trace = value;
+            else if (std::strcmp(arg, "--golden") == 0)
+                options.golden_dir = value;
+            else if (std::strcmp(arg, "--tolerance") == 0)
+                options.tolerance = static_cast<uint32_t>(std::strtoul(value, nullptr, 10));
+            else if (std::strcmp(arg, "--max-slowdown") == 0)
+                options.max_slowdown = std::strtod(value, nullptr);
+            else if (std::strcmp(arg, "--kernel") == 0)
+                options.kernel = value;
+            else if (std::strcmp(arg, "--elements") == 0)
+                options.micro_elements = static_cast<uint32_t>(std::strtoul(value, nullptr, 10));
+            else if (std::strcmp(arg, "--raster-mode") == 0)
+            {
+                if (std::strcmp(value, "immediate") == 0)
+                    options.raster_mode = RASTER_MODE_IMMEDIATE;
+                else if (std::strcmp(value, "interleaved") == 0)
+                    options.raster_mode = RASTER_MODE_INTERLEAVED;
+                else if (std::strcmp(value, "bands") == 0)
+                    options.raster_mode = RASTER_MODE_BANDS;
+                else
+                {
+                    fmt::print(stderr, "unknown raster mode {}\n", value);
+                    return false;
+                }
+            }
+            else
+            {
+                fmt::print(stderr, "unknown option {}\n", arg);
+                return false;
+            }
+
+            ++i;
+        }
+
+        if (options.frames == 0)
+        {
+            fmt::print(stderr, "--frames must be greater than 0\n");
+            return false;
+        }
+
+        if (options.micro_elements == 0)
+        {
+            fmt::print(stderr, "--elements must be greater than 0\n");
+            return false;
+        }
+
+        return true;
+    }
+
+    bool WriteOutput(const std::string& output, const std::string& json)
+    {
+        if (output.empty())
+        {
+            fmt::print("{}", json);
+            return true;
+        }
+
+        FILE* file = std::fopen(output.c_str(), "wb");
+
+        if (file == nullptr)
+        {
+            fmt::print(stderr, "cannot open {}\n", output);
+            return false;
+        }
+
+        std::fwrite(json.data(), 1, json.size(), file);
+        std::fclose(file);
+        return true;
+    }
+
+    std::string FormatResult(const BenchResult& result)
+    {
+        const BenchScene* scene = result.scene;
+        std::vector<uint64_t> sorted = result.frame_nanoseconds;
+        std::sort(sorted.begin(), sorted.end());
+
+        double total_seconds = 0.0;
+
+        for (uint64_t ns : sorted)
+        {
+            total_seconds += static_cast<double>(ns) * 1e-9;
+        }
+
+        double frame_count = static_cast<double>(sorted.size());
+        double screen_pixels = static_cast<double>(scene->width()) * scene->height() * frame_count;
+        double triangles = static_cast<double>(result.counters[PROFILE_COUNTER_TRIANGLES_SUBMITTED]);
+        double pixels_written = static_cast<double>(result.counters[PROFILE_COUNTER_PIXELS_WRITTEN]);
+
+        // 各阶段的耗时按屏幕像素数归一化。多线程阶段累加的是所有线程的时间
+        std::string stages;
+
+        for (int i = 0; i < PROFILE_STAGE_COUNT; ++i)
+        {
+            stages += fmt::format("{}\"{}\": {:.4f}", i == 0 ? "" : ", ", Profiler::StageName(static_cast<ProfileStage>(i)),
+                static_cast<double>(result.stage_nanoseconds[i]) / screen_pixels);
+        }
+
+        std::string counters;
+
+        for (int i = 0; i < PROFILE_COUNTER_COUNT; ++i)
+        {
+            counters += fmt::format("{}\"{}\": {:.1f}", i == 0 ? "" : ", ", Profiler::CounterName(static_cast<ProfileCounter>(i)),
+                static_cast<double>(result.counters[i]) / frame_count);
+        }
+
+        // 硬件计数器同样按屏幕像素数归一化，同时给出每个阶段的IPC
+        std::string events;
+
+        if (result.event_mask != 0)
+        {
+            std::string event_stages;
+
+            for (int i = 0; i < PROFILE_STAGE_COUNT; ++i)
+            {
+                if (i == PROFILE_STAGE_FRAME || result.stage_events[i][PERF_EVENT_TASK_CLOCK] + result.stage_events[i][PERF_EVENT_CYCLES] == 0)
+                    continue;
+
+                const uint64_t* stage_events = result.stage_events[i];
+                std::string values;
+
+                if ((result.event_mask & (1u << PERF_EVENT_CYCLES)) && (result.event_mask & (1u << PERF_EVENT_INSTRUCTIONS)) &&
+                    stage_events[PERF_EVENT_CYCLES] != 0)
+                {
+                    values = fmt::format("\"ipc\": {:.3f}", static_cast<double>(stage_events[PERF_EVENT_INSTRUCTIONS]) /
+                        static_cast<double>(stage_events[PERF_EVENT_CYCLES]));
+                }
+
+                for (int j = 0; j < PERF_EVENT_COUNT; ++j)
+                {
+                    if ((result.event_mask & (1u << j)) == 0)
+                        continue;
+
+                    values += fmt::format("{}\"{}_per_pixel\": {:.4f}", values.empty() ? "" : ", ",
+                        PerfCounters::EventName(static_cast<PerfEvent>(j)), static_cast<double>(stage_events[j]) / screen_pixels);
+                }
+
+                event_stages += fmt::format("{}        \"{}\": {{ {} }}", event_stages.empty() ? "" : ",\n",
+                    Profiler::StageName(static_cast<ProfileStage>(i)), values);
+            }
+
+            events = fmt::format(
+                ",\n"
+                "      \"hardware_counters\": {{\n"
+                "        \"source\": \"{}\",\n"
+                "{}\n"
+                "      }}",
+                PerfCounters::SourceName(PerfCounters::SourceOf(result.event_mask)), event_stages);
+        }
+
+        return fmt::format(
+            "    {{\n"
+            "      \"name\": \"{}\",\n"
+            "      \"width\": {},\n"
+            "      \"height\": {},\n"
+            "      \"frames\": {},\n"
+            "      \"triangles_per_second\": {:.1f},\n"
+            "      \"mpixels_per_second\": {:.3f},\n"
+            "      \"frame_time_ms\": {{ \"mean\": {:.4f}, \"p50\": {:.4f}, \"p99\": {:.4f} }},\n"
+            "      \"ns_per_pixel\": {{ {} }},\n"
+            "      \"counters_per_frame\": {{ {} }}{}\n"
+            "    }}",
+            scene->name(), scene->width(), scene->height(), sorted.size(),
+            triangles / total_seconds,
+            pixels_written / total_seconds * 1e-6,
+            total_seconds * 1e3 / frame_count,
+            static_cast<double>(Percentile(sorted, 0.50)) * 1e-6,
+            static_cast<double>(Percentile(sorted, 0.99)) * 1e-6,
+            stages, counters, events);
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    BenchOptions options;
+
+    if (!ParseOptions(argc, argv, options))
+        return 1;
+
+    // 微基准测试是单线程的，不需要任务系统和场景
+    if (options.micro)
+    {
+        std::string json = RunMicroBenchmarks(options);
+        int exit_code = 0;
+
+        if (json.empty())
+        {
+            fmt::print(stderr, "unknown kernel {}\n", options.kernel);
+            exit_code = 1;
+        }
+        else if (!WriteOutput(options.output, json))
+        {
+            exit_code = 1;
+        }
+
+        Log::Shutdown();
+        return exit_code;
+    }
+
+    TINY3D_TRACE_THREAD_NAME("main");
+    Profiler::EnableHardwareCounters(options.hardware_counters);
+    JobSystem job_system;
+    job_system.Initialize(options.threads);
+
+    if (!options.trace.empty() && !TraceRecorder::Start(options.trace.c_str()))
+    {
+        fmt::print(stderr, "cannot open {}\n", options.trace);
+        return 1;
+    }
+
+    std::vector<BenchScene*> scenes;
+    CreateBenchScenes(scenes);
+
+    if (!options.golden_dir.empty())
+    {
+        int exit_code = RunGoldenTests(options, &job_system, scenes);
+
+        for (BenchScene* scene : scenes)
+        {
+            delete scene;
+        }
+
+        TraceRecorder::Stop();
+        job_system.Shutdown();
+        Log::Shutdown();
+        return exit_code;
+    }
+
+    std::vector<BenchResult> results;
+
+    for (BenchScene* scene : scenes)
+    {
+        if (!options.scene.empty() && options.scene != scene->name())
+            continue;
+
+        results.emplace_back();
+        RunScene(scene, &job_system, options, results.back());
+    }
+
+    TraceRecorder::Stop();
+
+    if (results.empty())
+    {
+        fmt::print(stderr, "unknown scene {}\n", options.scene);
+        return 1;
+    }
+
+#if defined(_DEBUG)
+    const char* build = "debug";
+#else
+    const char* build = "release";
+#endif
+
+    std::string json = fmt::format(
+        "{{\n"
+        "  \"build\": \"{}\",\n"
+        "  \"hardware_threads\": {},\n"
+        "  \"worker_threads\": {},\n"
+        "  \"raster_mode\": \"{}\",\n"
+        "  \"profiler\": {},\n"
+        "  \"scenes\": [\n",
+        build, std::thread::hardware_concurrency(), job_system.worker_count(),
+        RasterModeName(options.raster_mode), Profiler::IsEnabled() ? "true" : "false");
+
+    for (size_t i = 0; i < results.size(); ++i)
+    {
+        json += FormatResult(results[i]);
+        json += (i + 1 < results.size()) ? ",\n" : "\n";
+    }
+
+    json += "  ]\n}\n";
+
+    if (!WriteOutput(options.output, json))
+        return 1;
+
+    for (BenchScene* scene : scenes)
+    {
+        delete scene;
+    }
+
+    job_system.Shutdown();
+    Log::Shutdown();
+    return 0;
+}
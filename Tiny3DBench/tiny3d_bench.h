@@ -0,0 +1,119 @@
+﻿/*********************************************************************************************
+MIT License
+
+Copyright (c) 2024 kumakoko www.xionggf.com
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*********************************************************************************************/
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "tiny3d_device.h"
+#include "tiny3d_job_system.h"
+#include "tiny3d_profiler.h"
+#include "tiny3d_bench_scene.h"
+
+//=====================================================================
+// 基准测试程序的公共部分
+//=====================================================================
+
+struct BenchOptions
+{
+    std::string scene;          // 只运行指定的场景，为空时运行全部场景
+    uint32_t frames;            // 计入统计的帧数
+    uint32_t warmup;            // 统计之前先绘制的帧数
+    uint32_t threads;           // 工作线程数，0表示硬件线程数-1
+    RasterMode raster_mode;     // 光栅化模式
+    std::string output;         // 输出文件，为空时输出到标准输出
+    std::string trace;          // 时间线文件，为空时不录制
+    std::string golden_dir;     // 参考图像和性能基线所在的目录，不为空时进入回归测试模式
+    bool update_golden;         // 回归测试模式下重新生成参考图像和性能基线
+    uint32_t tolerance;         // 回归测试时每个像素每个通道允许的最大误差
+    double max_slowdown;        // 回归测试时帧时间中位数相对基线允许的最大倍数
+    bool micro;                 // 运行数学函数的微基准测试而不是场景
+    std::string kernel;         // 微基准测试只运行指定的函数，为空时运行全部函数
+    uint32_t micro_elements;    // 微基准测试每次调用处理的元素个数
+    bool hardware_counters;     // 按阶段采集硬件计数器
+    bool pixel_shader;          // 用功能相同的内置像素着色器代替固定功能着色，只对Setup之后没有设置着色器的场景生效
+    bool vertex_shader;         // 绘制网格的场景改用BasicVertexShader代替固定功能的顶点变换
+};
+
+// 一个场景的测试结果
+struct BenchResult
+{
+    const BenchScene* scene;
+    std::vector<uint64_t> frame_nanoseconds;                // 每帧的耗时
+    uint64_t stage_nanoseconds[PROFILE_STAGE_COUNT];        // 各阶段累计耗时
+    uint64_t counters[PROFILE_COUNTER_COUNT];               // 各计数器累计值
+    std::vector<uint32_t> first_frame;                      // 第0帧的画面，用于和参考图像比较
+    uint64_t stage_events[PROFILE_STAGE_COUNT][PERF_EVENT_COUNT];   // 各阶段累计的硬件计数器增量
+    uint32_t event_mask;                                    // 采集到的事件
+};
+
+/**************************************************************************************
+光栅化模式的名字，同时也是命令行中--raster-mode参数的取值
+@name: RasterModeName
+@return: const char*
+@param: RasterMode mode
+*************************************************************************************/
+const char* RasterModeName(RasterMode mode);
+
+/**************************************************************************************
+最近秩法求分位数
+@name: Percentile
+@return: uint64_t sorted为空时返回0
+@param: const std::vector<uint64_t> & sorted 必须已经排好序
+@param: double p 0到1之间
+*************************************************************************************/
+uint64_t Percentile(const std::vector<uint64_t>& sorted, double p);
+
+/**************************************************************************************
+按options中的帧数和光栅化模式绘制一个场景，并收集计时、剖析数据和第0帧的画面
+@name: RunScene
+@return: void
+@param: BenchScene * scene
+@param: JobSystem * job_system
+@param: const BenchOptions & options
+@param: BenchResult & result
+*************************************************************************************/
+void RunScene(BenchScene* scene, JobSystem* job_system, const BenchOptions& options, BenchResult& result);
+
+/**************************************************************************************
+回归测试：每个场景在每种光栅化模式下分别用固定功能管线和内置着色器绘制一遍，画面和参考图像
+逐像素比较，帧时间和性能基线比较。任何一项不通过时返回非0
+@name: RunGoldenTests
+@return: int 进程的退出码
+@param: const BenchOptions & options
+@param: JobSystem * job_system
+@param: const std::vector<BenchScene * > & scenes
+*************************************************************************************/
+int RunGoldenTests(const BenchOptions& options, JobSystem* job_system, const std::vector<BenchScene*>& scenes);
+
+/**************************************************************************************
+数学函数的微基准测试：矩阵乘法、向量乘矩阵、单位化、叉乘、CVV检查、透视除法和顶点插值，
+每个函数分别测试引擎实现、标量、SSE、AVX2和批量实现，输出每元素周期数和相对标量实现的误差
+@name: RunMicroBenchmarks
+@return: std::string JSON格式的结果，没有匹配的函数时为空
+@param: const BenchOptions & options
+*************************************************************************************/
+std::string RunMicroBenchmarks(const BenchOptions& options);
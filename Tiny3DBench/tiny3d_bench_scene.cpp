@@ -0,0 +1,489 @@
+﻿/*********************************************************************************************
+MIT License
+
+Copyright (c) 2024 kumakoko www.xionggf.com
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*********************************************************************************************/
+#include <array>
+#include <cmath>
+
+#include "tiny3d_bench_scene.h"
+#include "tiny3d_job_system.h"
+#include "tiny3d_pixel_shader.h"
+#include "tiny3d_vertex_shader.h"
+
+namespace
+{
+    // 与Tiny3DApp相同的立方体
+    const std::array<T3DVertex, 8> kBoxMesh =
+    { {
+        { {  1, -1,  1, 1 }, { 0, 0 }, { 1.0f, 0.2f, 0.2f }, 1 },
+        { { -1, -1,  1, 1 }, { 0, 1 }, { 0.2f, 1.0f, 0.2f }, 1 },
+        { { -1,  1,  1, 1 }, { 1, 1 }, { 0.2f, 0.2f, 1.0f }, 1 },
+        { {  1,  1,  1, 1 }, { 1, 0 }, { 1.0f, 0.2f, 1.0f }, 1 },
+        { {  1, -1, -1, 1 }, { 0, 0 }, { 1.0f, 1.0f, 0.2f }, 1 },
+        { { -1, -1, -1, 1 }, { 0, 1 }, { 0.2f, 1.0f, 1.0f }, 1 },
+        { { -1,  1, -1, 1 }, { 1, 1 }, { 1.0f, 0.3f, 0.3f }, 1 },
+        { {  1,  1, -1, 1 }, { 1, 0 }, { 0.2f, 1.0f, 0.3f }, 1 }
+    } };
+
+    // 摄影机位于(kCameraDistance, 0, 0)看向原点，z轴朝上。屏幕的x方向对应世界的-y方向，
+    // 屏幕的y方向对应世界的z方向。视野为90度，所以距离摄影机d处的画面半高为d
+    const float kCameraDistance = 3.5f;
+
+    // 平面略小于画面，保证顶点都落在CVV之内
+    const float kScreenFitScale = 0.99f;
+
+    /**************************************************************************************
+    生成一个正对摄影机的平面的四个顶点，平面中心在世界坐标原点朝摄影机方向偏移offset处
+    @name: MakeFacingQuad
+    @return: void
+    @param: T3DVertex * quad
+    @param: float offset 向摄影机方向的偏移
+    @param: float center_u 平面中心在屏幕上的横向位置，-1到1
+    @param: float center_v 平面中心在屏幕上的纵向位置，-1到1
+    @param: float half_u 平面横向的半宽，占画面半宽的比例
+    @param: float half_v 平面纵向的半高，占画面半高的比例
+    @param: float aspect
+    @param: const T3DColor & color
+    *************************************************************************************/
+    void MakeFacingQuad(T3DVertex* quad, float offset, float center_u, float center_v, float half_u, float half_v, float aspect, const T3DColor& color)
+    {
+        float depth = kCameraDistance - offset;
+        float screen_half_h = depth * kScreenFitScale;
+        float screen_half_w = screen_half_h * aspect;
+        float cy = -center_u * screen_half_w;
+        float cz = center_v * screen_half_h;
+        float hy = half_u * screen_half_w;
+        float hz = half_v * screen_half_h;
+
+        quad[0] = { { offset, cy + hy, cz + hz, 1 }, { 0, 0 }, color, 1 };
+        quad[1] = { { offset, cy + hy, cz - hz, 1 }, { 0, 1 }, color, 1 };
+        quad[2] = { { offset, cy - hy, cz - hz, 1 }, { 1, 1 }, color, 1 };
+        quad[3] = { { offset, cy - hy, cz + hz, 1 }, { 1, 0 }, color, 1 };
+    }
+
+    //=====================================================================
+    // box：应用程序里旋转的立方体
+    //=====================================================================
+    class BoxScene : public BenchScene
+    {
+    public:
+        const char* name() const override { return "box"; }
+        uint32_t width() const override { return 1024; }
+        uint32_t height() const override { return 768; }
+
+        void Setup(Device* device) override
+        {
+            device->ResetCamera(kCameraDistance, 0, 0);
+            device->InitTexture(256, 256);
+            device->set_render_state(RENDER_STATE_TEXTURE);
+        }
+
+        void Render(Device* device, uint32_t frame) override
+        {
+            device->DrawBox(static_cast<float>(frame) * 0.01f, kBoxMesh.data());
+        }
+    };
+
+    //=====================================================================
+    // cube_field：10000个小立方体，多线程录制到命令缓冲区后排序提交
+    //=====================================================================
+    class CubeFieldScene : public BenchScene
+    {
+    public:
+        static const uint32_t kGridSize = 100;
+        static const uint32_t kRowsPerChunk = 4;
+        static_assert(kGridSize % kRowsPerChunk == 0, "kGridSize must be a multiple of kRowsPerChunk");
+
+        ~CubeFieldScene()
+        {
+            for (CommandBuffer* buffer : buffers_)
+            {
+                delete buffer;
+            }
+        }
+
+        const char* name() const override { return "cube_field"; }
+        uint32_t width() const override { return 1280; }
+        uint32_t height() const override { return 720; }
+
+        void Setup(Device* device) override
+        {
+            device->ResetCamera(9.0f, 0, 7.0f);
+            device->set_render_state(RENDER_STATE_COLOR);
+
+            // 每个行块一个命令缓冲区，一个行块只由一个任务录制，录制时不需要同步。
+            // 缓冲区按行块而不是按线程分配，命令的顺序和任务的调度无关，每次运行的画面都相同
+            for (uint32_t i = 0; i < kGridSize / kRowsPerChunk; ++i)
+            {
+                buffers_.push_back(new CommandBuffer());
+            }
+        }
+
+        void Render(Device* device, uint32_t frame) override
+        {
+            for (CommandBuffer* buffer : buffers_)
+            {
+                buffer->Reset();
+                buffer->SetRenderState(RENDER_STATE_COLOR);
+            }
+
+            float theta = static_cast<float>(frame) * 0.02f;
+
+            device->ParallelFor(kGridSize, kRowsPerChunk, [this, theta](uint32_t begin, uint32_t end)
+                {
+                    T3DMatrix4X4 scale, rotation, translation, m;
+                    T3DMatrixMakeScaling(&scale, 0.03f, 0.03f, 0.03f);
+
+                    for (uint32_t row = begin; row < end; ++row)
+                    {
+                        CommandBuffer* buffer = buffers_[row / kRowsPerChunk];
+
+                        for (uint32_t col = 0; col < kGridSize; ++col)
+                        {
+                            float x = (static_cast<float>(row) - kGridSize * 0.5f) * 0.1f;
+                            float y = (static_cast<float>(col) - kGridSize * 0.5f) * 0.1f;
+                            T3DMatrixMakeRotation(&rotation, 0.3f, 0.5f, 1.0f, theta + static_cast<float>(row * kGridSize + col) * 0.1f);
+                            T3DMatrixMakeTranslation(&translation, x, y, 0.0f);
+                            T3DMatrixMultiply(&m, &scale, &rotation);
+                            T3DMatrixMultiply(&m, &m, &translation);
+                            buffer->SetWorldMatrix(m);
+                            buffer->DrawBox(kBoxMesh.data());
+                        }
+                    }
+                });
+
+            device->SubmitCommandBuffers(buffers_.data(), static_cast<uint32_t>(buffers_.size()));
+        }
+
+    private:
+        std::vector<CommandBuffer*> buffers_;
+    };
+
+    //=====================================================================
+    // fill_rate：四层铺满全屏的平面，由远及近绘制，每层都通过深度测试
+    //=====================================================================
+    class FillRateScene : public BenchScene
+    {
+    public:
+        static const uint32_t kLayerCount = 4;
+
+        const char* name() const override { return "fill_rate"; }
+        uint32_t width() const override { return 1920; }
+        uint32_t height() const override { return 1080; }
+
+        void Setup(Device* device) override
+        {
+            device->ResetCamera(kCameraDistance, 0, 0);
+            device->set_render_state(RENDER_STATE_COLOR);
+            float aspect = static_cast<float>(width()) / static_cast<float>(height());
+
+            for (uint32_t i = 0; i < kLayerCount; ++i)
+            {
+                float k = static_cast<float>(i) / kLayerCount;
+                T3DColor color = { 1.0f - k, 0.5f, k };
+                MakeFacingQuad(&quads_[i * 4], static_cast<float>(i) * 0.5f, 0, 0, 1, 1, aspect, color);
+            }
+        }
+
+        void Render(Device* device, uint32_t /*frame*/) override
+        {
+            T3DMatrix4X4 identity;
+            T3DMatrixIdentity(&identity);
+            device->transform_.SetWorldMatrix(identity);
+            device->transform_.Update();
+
+            for (uint32_t i = 0; i < kLayerCount; ++i)
+            {
+                const T3DVertex* q = &quads_[i * 4];
+                device->DrawPlane(&q[0], &q[1], &q[2], &q[3]);
+            }
+        }
+
+    private:
+        std::array<T3DVertex, kLayerCount * 4> quads_;
+    };
+
+    //=====================================================================
+    // minified_texture：把2048x2048的纹理贴到大量很小的平面上，纹素访问跨度很大
+    //=====================================================================
+    class MinifiedTextureScene : public BenchScene
+    {
+    public:
+        static const uint32_t kColumns = 48;
+        static const uint32_t kRows = 27;
+
+        const char* name() const override { return "minified_texture"; }
+        uint32_t width() const override { return 1280; }
+        uint32_t height() const override { return 720; }
+
+        void Setup(Device* device) override
+        {
+            device->ResetCamera(kCameraDistance, 0, 0);
+            device->InitTexture(2048, 2048);
+            device->set_render_state(RENDER_STATE_TEXTURE);
+            float aspect = static_cast<float>(width()) / static_cast<float>(height());
+            T3DColor white = { 1, 1, 1 };
+            quads_.resize(kColumns * kRows * 4);
+
+            for (uint32_t r = 0; r < kRows; ++r)
+            {
+                for (uint32_t c = 0; c < kColumns; ++c)
+                {
+                    float u = (static_cast<float>(c) + 0.5f) / kColumns * 2.0f - 1.0f;
+                    float v = (static_cast<float>(r) + 0.5f) / kRows * 2.0f - 1.0f;
+                    MakeFacingQuad(&quads_[(r * kColumns + c) * 4], 0, u, v, 0.9f / kColumns, 0.9f / kRows, aspect, white);
+                }
+            }
+        }
+
+        void Render(Device* device, uint32_t /*frame*/) override
+        {
+            T3DMatrix4X4 identity;
+            T3DMatrixIdentity(&identity);
+            device->transform_.SetWorldMatrix(identity);
+            device->transform_.Update();
+
+            for (size_t i = 0; i < quads_.size(); i += 4)
+            {
+                device->DrawPlane(&quads_[i], &quads_[i + 1], &quads_[i + 2], &quads_[i + 3]);
+            }
+        }
+
+    private:
+        std::vector<T3DVertex> quads_;
+    };
+
+    //=====================================================================
+    // mesh：旋转的圆环网格，用DrawMesh绘制，可以切换成DrawMesh加BasicVertexShader
+    //=====================================================================
+    class MeshScene : public BenchScene
+    {
+    public:
+        static const uint32_t kRingSegments = 96;
+        static const uint32_t kTubeSegments = 48;
+
+        const char* name() const override { return "mesh"; }
+        uint32_t width() const override { return 1280; }
+        uint32_t height() const override { return 720; }
+
+        void Setup(Device* device) override
+        {
+            device->ResetCamera(kCameraDistance, 0, 0);
+            device->set_render_state(RENDER_STATE_COLOR);
+
+            const float kPi = 3.14159265f;
+            const float ring_radius = 1.2f;
+            const float tube_radius = 0.5f;
+            mesh_.name = "torus";
+
+            for (uint32_t i = 0; i < kRingSegments; ++i)
+            {
+                float phi = 2.0f * kPi * static_cast<float>(i) / kRingSegments;
+
+                for (uint32_t j = 0; j < kTubeSegments; ++j)
+                {
+                    float theta = 2.0f * kPi * static_cast<float>(j) / kTubeSegments;
+                    float distance = ring_radius + tube_radius * std::cos(theta);
+                    T3DPackedVertex vertex;
+                    vertex.x = tube_radius * std::sin(theta);
+                    vertex.y = distance * std::cos(phi);
+                    vertex.z = distance * std::sin(phi);
+                    vertex.color = 0xFF000000 | ((i * 255 / kRingSegments) << 0) | ((j * 255 / kTubeSegments) << 8) | (0x80 << 16);
+                    vertex.u = static_cast<uint16_t>(i * 65535 / kRingSegments);
+                    vertex.v = static_cast<uint16_t>(j * 65535 / kTubeSegments);
+                    mesh_.vertices.push_back(vertex);
+                }
+            }
+
+            for (uint32_t i = 0; i < kRingSegments; ++i)
+            {
+                for (uint32_t j = 0; j < kTubeSegments; ++j)
+                {
+                    uint32_t i0 = i * kTubeSegments + j;
+                    uint32_t i1 = i * kTubeSegments + (j + 1) % kTubeSegments;
+                    uint32_t i2 = ((i + 1) % kRingSegments) * kTubeSegments + j;
+                    uint32_t i3 = ((i + 1) % kRingSegments) * kTubeSegments + (j + 1) % kTubeSegments;
+                    mesh_.indices.insert(mesh_.indices.end(), { i0, i2, i3, i3, i1, i0 });
+                }
+            }
+        }
+
+        void Render(Device* device, uint32_t frame) override
+        {
+            T3DMatrix4X4 world;
+            T3DMatrixMakeRotation(&world, -1.0f, -0.5f, 1.0f, static_cast<float>(frame) * 0.01f + 0.7f);
+            device->transform_.SetWorldMatrix(world);
+            device->transform_.Update();
+
+            if (vertex_shader_)
+                device->DrawMesh(&mesh_, BasicVertexShader());
+            else
+                device->DrawMesh(&mesh_);
+        }
+
+    private:
+        T3DMesh mesh_;
+    };
+
+    //=====================================================================
+    // color_key：全屏的底板前面放一排镂空纹理的平面，纹理中的白格被丢弃，透出后面的底板
+    //=====================================================================
+    class ColorKeyScene : public BenchScene
+    {
+    public:
+        static const uint32_t kColumns = 4;
+        static const uint32_t kRows = 3;
+
+        const char* name() const override { return "color_key"; }
+        uint32_t width() const override { return 1280; }
+        uint32_t height() const override { return 720; }
+
+        void Setup(Device* device) override
+        {
+            device->ResetCamera(kCameraDistance, 0, 0);
+            device->InitTexture(256, 256);
+            float aspect = static_cast<float>(width()) / static_cast<float>(height());
+            T3DColor backdrop_color = { 0.9f, 0.4f, 0.1f };
+            T3DColor white = { 1, 1, 1 };
+            MakeFacingQuad(backdrop_.data(), 0, 0, 0, 1, 1, aspect, backdrop_color);
+            quads_.resize(kColumns * kRows * 4);
+
+            for (uint32_t r = 0; r < kRows; ++r)
+            {
+                for (uint32_t c = 0; c < kColumns; ++c)
+                {
+                    float u = (static_cast<float>(c) + 0.5f) / kColumns * 2.0f - 1.0f;
+                    float v = (static_cast<float>(r) + 0.5f) / kRows * 2.0f - 1.0f;
+                    MakeFacingQuad(&quads_[(r * kColumns + c) * 4], 0.5f, u, v, 0.8f / kColumns, 0.8f / kRows, aspect, white);
+                }
+            }
+
+            // InitTexture生成的棋盘格由白格和蓝格组成
+            color_key_.key = 0xFFFFFFFF;
+        }
+
+        // 这个场景自己切换像素着色器：底板用固定功能着色，前面的平面用ColorKeyShader
+        void Render(Device* device, uint32_t /*frame*/) override
+        {
+            T3DMatrix4X4 identity;
+            T3DMatrixIdentity(&identity);
+            device->transform_.SetWorldMatrix(identity);
+            device->transform_.Update();
+
+            device->set_render_state(RENDER_STATE_COLOR);
+            device->ClearPixelShader();
+            device->DrawPlane(&backdrop_[0], &backdrop_[1], &backdrop_[2], &backdrop_[3]);
+
+            device->set_render_state(RENDER_STATE_TEXTURE);
+            device->SetPixelShader(&color_key_);
+
+            for (size_t i = 0; i < quads_.size(); i += 4)
+            {
+                device->DrawPlane(&quads_[i], &quads_[i + 1], &quads_[i + 2], &quads_[i + 3]);
+            }
+        }
+
+    private:
+        std::array<T3DVertex, 4> backdrop_;
+        std::vector<T3DVertex> quads_;
+        ColorKeyShader color_key_;      // 必须存活到FlushDeferredRaster之后
+    };
+
+    //=====================================================================
+    // wireframe：256x256格的网格，只绘制线框
+    //=====================================================================
+    class WireframeScene : public BenchScene
+    {
+    public:
+        static const uint32_t kCells = 256;
+
+        const char* name() const override { return "wireframe"; }
+        uint32_t width() const override { return 1280; }
+        uint32_t height() const override { return 720; }
+
+        void Setup(Device* device) override
+        {
+            device->ResetCamera(kCameraDistance, 0, 0);
+            device->set_render_state(RENDER_STATE_WIREFRAME);
+            float aspect = static_cast<float>(width()) / static_cast<float>(height());
+            T3DColor white = { 1, 1, 1 };
+            T3DVertex corners[4];
+            MakeFacingQuad(corners, 0, 0, 0, 1, 1, aspect, white);
+
+            // 在平面的四个角之间插值出网格顶点
+            uint32_t side = kCells + 1;
+            vertices_.resize(side * side);
+
+            for (uint32_t r = 0; r < side; ++r)
+            {
+                for (uint32_t c = 0; c < side; ++c)
+                {
+                    float s = static_cast<float>(c) / kCells;
+                    float t = static_cast<float>(r) / kCells;
+                    T3DVertex v = corners[0];
+                    v.pos.y = corners[0].pos.y + (corners[3].pos.y - corners[0].pos.y) * s;
+                    v.pos.z = corners[0].pos.z + (corners[1].pos.z - corners[0].pos.z) * t;
+                    v.tc.u = s;
+                    v.tc.v = t;
+                    T3DVertexPack(&vertices_[r * side + c], &v);
+                }
+            }
+
+            for (uint32_t r = 0; r < kCells; ++r)
+            {
+                for (uint32_t c = 0; c < kCells; ++c)
+                {
+                    uint32_t i0 = r * side + c;
+                    uint32_t i1 = i0 + 1;
+                    uint32_t i2 = i0 + side;
+                    uint32_t i3 = i2 + 1;
+                    indices_.insert(indices_.end(), { i0, i2, i3, i3, i1, i0 });
+                }
+            }
+        }
+
+        void Render(Device* device, uint32_t /*frame*/) override
+        {
+            T3DMatrix4X4 identity;
+            T3DMatrixIdentity(&identity);
+            device->transform_.SetWorldMatrix(identity);
+            device->transform_.Update();
+            device->DrawIndexedPrimitives(vertices_.data(), static_cast<uint32_t>(vertices_.size()),
+                indices_.data(), static_cast<uint32_t>(indices_.size()));
+        }
+
+    private:
+        std::vector<T3DPackedVertex> vertices_;
+        std::vector<uint32_t> indices_;
+    };
+}
+
+void CreateBenchScenes(std::vector<BenchScene*>& scenes)
+{
+    scenes.push_back(new BoxScene());
+    scenes.push_back(new CubeFieldScene());
+    scenes.push_back(new FillRateScene());
+    scenes.push_back(new MinifiedTextureScene());
+    scenes.push_back(new MeshScene());
+    scenes.push_back(new ColorKeyScene());
+    scenes.push_back(new WireframeScene());
+}
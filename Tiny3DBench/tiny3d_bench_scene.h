@@ -0,0 +1,104 @@
+﻿/*********************************************************************************************
+MIT License
+
+Copyright (c) 2024 kumakoko www.xionggf.com
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*********************************************************************************************/
+
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "tiny3d_device.h"
+#include "tiny3d_command_buffer.h"
+
+//=====================================================================
+// 基准测试场景
+//=====================================================================
+
+// 基准测试场景的基类。场景的分辨率固定，每一帧的内容只由帧序号决定，
+// 不依赖计时和随机数，因此每次运行绘制的内容都完全相同
+class BenchScene
+{
+public:
+    BenchScene() : vertex_shader_(false) {}
+    virtual ~BenchScene() {}
+
+    /**************************************************************************************
+    让场景里绘制网格的调用改用BasicVertexShader，画面必须和固定功能的顶点变换相同。在Setup之前调用
+    @name: BenchScene::set_vertex_shader
+    @return: void
+    @param: bool enable
+    *************************************************************************************/
+    inline void set_vertex_shader(bool enable)
+    {
+        vertex_shader_ = enable;
+    }
+
+    /**************************************************************************************
+    场景的名字，同时也是命令行中--scene参数的取值
+    @name: BenchScene::name
+    @return: const char*
+    *************************************************************************************/
+    virtual const char* name() const = 0;
+
+    /**************************************************************************************
+    场景的渲染宽度
+    @name: BenchScene::width
+    @return: uint32_t
+    *************************************************************************************/
+    virtual uint32_t width() const = 0;
+
+    /**************************************************************************************
+    场景的渲染高度
+    @name: BenchScene::height
+    @return: uint32_t
+    *************************************************************************************/
+    virtual uint32_t height() const = 0;
+
+    /**************************************************************************************
+    创建纹理、几何体等资源，设置摄影机，在设备初始化之后、第一帧之前调用一次
+    @name: BenchScene::Setup
+    @return: void
+    @param: Device * device
+    *************************************************************************************/
+    virtual void Setup(Device* device) = 0;
+
+    /**************************************************************************************
+    绘制第frame帧，调用之前设备已经清空了帧缓存和深度缓存
+    @name: BenchScene::Render
+    @return: void
+    @param: Device * device
+    @param: uint32_t frame
+    *************************************************************************************/
+    virtual void Render(Device* device, uint32_t frame) = 0;
+
+protected:
+    bool vertex_shader_;        // 绘制网格时使用BasicVertexShader
+};
+
+/**************************************************************************************
+创建全部基准测试场景，由调用者负责delete
+@name: CreateBenchScenes
+@return: void
+@param: std::vector<BenchScene *> & scenes
+*************************************************************************************/
+void CreateBenchScenes(std::vector<BenchScene*>& scenes);
@@ -0,0 +1,301 @@
+﻿/*********************************************************************************************
+MIT License
+
+Copyright (c) 2024 kumakoko www.xionggf.com
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*********************************************************************************************/
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "fmt/format.h"
+
+#include "tiny3d_bench.h"
+
+// 回归测试模式。参考图像由参考光栅化路径（单线程立即模式、固定功能着色）生成，
+// 其他光栅化模式必须画出同样的画面；性能基线则每个变体各记一份。
+// _shader变体用内置的像素着色器和BasicVertexShader代替固定功能管线。固定功能管线对颜色
+// 处处相同的三角形直接填充打包好的顶点颜色，VertexColorShader则要插值c*rhw再乘回1/rhw，
+// 可能差1个LSB，所以这些变体和其他变体一样按--tolerance比较。
+//
+// 目录下的文件：
+//   <场景名>.ppm                    参考图像，二进制PPM
+//   <场景名>_<变体>_diff.ppm        比较失败时输出的差异图，超出容差的像素标红
+//   baseline.txt                    每行一条 "场景名 变体 帧时间中位数(毫秒)"
+
+namespace
+{
+    struct GoldenVariant
+    {
+        RasterMode raster_mode;
+        bool shaders;           // 用内置的像素着色器和顶点着色器代替固定功能管线
+    };
+
+    const GoldenVariant kGoldenVariants[] =
+    {
+        { RASTER_MODE_IMMEDIATE, false },
+        { RASTER_MODE_INTERLEAVED, false },
+        { RASTER_MODE_BANDS, false },
+        { RASTER_MODE_IMMEDIATE, true },
+        { RASTER_MODE_INTERLEAVED, true },
+        { RASTER_MODE_BANDS, true }
+    };
+
+    const char* const kBaselineFileName = "baseline.txt";
+
+    bool WritePPM(const std::string& path, const uint32_t* pixels, uint32_t width, uint32_t height)
+    {
+        FILE* file = std::fopen(path.c_str(), "wb");
+
+        if (file == nullptr)
+            return false;
+
+        std::vector<uint8_t> rgb(static_cast<size_t>(width) * height * 3);
+
+        for (size_t i = 0; i < static_cast<size_t>(width) * height; ++i)
+        {
+            rgb[i * 3 + 0] = static_cast<uint8_t>(pixels[i] >> 16);
+            rgb[i * 3 + 1] = static_cast<uint8_t>(pixels[i] >> 8);
+            rgb[i * 3 + 2] = static_cast<uint8_t>(pixels[i]);
+        }
+
+        fmt::print(file, "P6\n{} {}\n255\n", width, height);
+        bool written = std::fwrite(rgb.data(), 1, rgb.size(), file) == rgb.size();
+        std::fclose(file);
+        return written;
+    }
+
+    bool ReadPPM(const std::string& path, std::vector<uint32_t>& pixels, uint32_t& width, uint32_t& height)
+    {
+        FILE* file = std::fopen(path.c_str(), "rb");
+
+        if (file == nullptr)
+            return false;
+
+        unsigned int w = 0, h = 0, max_value = 0;
+        bool valid = std::fscanf(file, "P6 %u %u %u", &w, &h, &max_value) == 3 && max_value == 255 && std::fgetc(file) != EOF;
+        std::vector<uint8_t> rgb(static_cast<size_t>(w) * h * 3);
+        valid = valid && std::fread(rgb.data(), 1, rgb.size(), file) == rgb.size();
+        std::fclose(file);
+
+        if (!valid)
+            return false;
+
+        width = w;
+        height = h;
+        pixels.resize(static_cast<size_t>(w) * h);
+
+        for (size_t i = 0; i < pixels.size(); ++i)
+        {
+            pixels[i] = 0xFF000000 | (rgb[i * 3 + 0] << 16) | (rgb[i * 3 + 1] << 8) | rgb[i * 3 + 2];
+        }
+
+        return true;
+    }
+
+    std::map<std::string, double> ReadBaseline(const std::string& path)
+    {
+        std::map<std::string, double> baseline;
+        FILE* file = std::fopen(path.c_str(), "rb");
+
+        if (file == nullptr)
+            return baseline;
+
+        char scene[128];
+        char variant[32];
+        double milliseconds;
+
+        while (std::fscanf(file, "%127s %31s %lf", scene, variant, &milliseconds) == 3)
+        {
+            baseline[fmt::format("{} {}", scene, variant)] = milliseconds;
+        }
+
+        std::fclose(file);
+        return baseline;
+    }
+
+    // 逐像素比较，返回超出容差的像素数，同时生成差异图
+    uint32_t CompareImages(const std::vector<uint32_t>& image, const std::vector<uint32_t>& reference, uint32_t tolerance,
+        uint32_t& max_difference, std::vector<uint32_t>& diff)
+    {
+        uint32_t bad_pixels = 0;
+        max_difference = 0;
+        diff.resize(image.size());
+
+        for (size_t i = 0; i < image.size(); ++i)
+        {
+            uint32_t difference = 0;
+
+            for (uint32_t shift = 0; shift < 24; shift += 8)
+            {
+                int32_t a = static_cast<int32_t>((image[i] >> shift) & 0xFF);
+                int32_t b = static_cast<int32_t>((reference[i] >> shift) & 0xFF);
+                difference = std::max(difference, static_cast<uint32_t>(std::abs(a - b)));
+            }
+
+            max_difference = std::max(max_difference, difference);
+
+            if (difference > tolerance)
+            {
+                ++bad_pixels;
+                diff[i] = 0xFFFF0000;
+            }
+            else
+            {
+                // 通过的像素显示为变暗的灰度，便于看出失败像素的位置
+                uint32_t gray = (((reference[i] >> 16) & 0xFF) + ((reference[i] >> 8) & 0xFF) + (reference[i] & 0xFF)) / 12;
+                diff[i] = 0xFF000000 | (gray << 16) | (gray << 8) | gray;
+            }
+        }
+
+        return bad_pixels;
+    }
+}
+
+int RunGoldenTests(const BenchOptions& options, JobSystem* job_system, const std::vector<BenchScene*>& scenes)
+{
+    std::string baseline_path = fmt::format("{}/{}", options.golden_dir, kBaselineFileName);
+    std::map<std::string, double> baseline = ReadBaseline(baseline_path);
+    std::string new_baseline;
+    uint32_t failures = 0;
+    uint32_t checks = 0;
+
+    for (BenchScene* scene : scenes)
+    {
+        if (!options.scene.empty() && options.scene != scene->name())
+            continue;
+
+        std::string image_path = fmt::format("{}/{}.ppm", options.golden_dir, scene->name());
+        std::vector<uint32_t> reference;
+        uint32_t reference_width = 0;
+        uint32_t reference_height = 0;
+        bool has_reference = !options.update_golden && ReadPPM(image_path, reference, reference_width, reference_height);
+
+        if (has_reference && (reference_width != scene->width() || reference_height != scene->height()))
+        {
+            fmt::print("FAIL {} reference image is {}x{}, scene renders {}x{}\n", scene->name(),
+                reference_width, reference_height, scene->width(), scene->height());
+            ++failures;
+            continue;
+        }
+
+        for (const GoldenVariant& variant : kGoldenVariants)
+        {
+            BenchOptions variant_options = options;
+            variant_options.raster_mode = variant.raster_mode;
+            variant_options.pixel_shader = variant.shaders;
+            variant_options.vertex_shader = variant.shaders;
+            BenchResult result;
+            RunScene(scene, job_system, variant_options, result);
+
+            std::vector<uint64_t> sorted = result.frame_nanoseconds;
+            std::sort(sorted.begin(), sorted.end());
+            double median_ms = static_cast<double>(Percentile(sorted, 0.50)) * 1e-6;
+            std::string variant_name = fmt::format("{}{}", RasterModeName(variant.raster_mode), variant.shaders ? "_shader" : "");
+            std::string key = fmt::format("{} {}", scene->name(), variant_name);
+            new_baseline += fmt::format("{} {:.4f}\n", key, median_ms);
+
+            if (options.update_golden)
+            {
+                // 参考图像只由参考光栅化路径生成
+                if (variant.raster_mode == RASTER_MODE_IMMEDIATE && !variant.shaders && !WritePPM(image_path, result.first_frame.data(), scene->width(), scene->height()))
+                {
+                    fmt::print("FAIL cannot write {}\n", image_path);
+                    ++failures;
+                }
+
+                fmt::print("UPDATE {} p50={:.3f}ms\n", key, median_ms);
+                continue;
+            }
+
+            // 画面
+            ++checks;
+
+            if (!has_reference)
+            {
+                fmt::print("FAIL {} image: missing reference {}\n", key, image_path);
+                ++failures;
+            }
+            else
+            {
+                uint32_t max_difference = 0;
+                std::vector<uint32_t> diff;
+                uint32_t bad_pixels = CompareImages(result.first_frame, reference, options.tolerance, max_difference, diff);
+
+                if (bad_pixels > 0)
+                {
+                    std::string diff_path = fmt::format("{}/{}_{}_diff.ppm", options.golden_dir, scene->name(), variant_name);
+                    WritePPM(diff_path, diff.data(), scene->width(), scene->height());
+                    fmt::print("FAIL {} image: {} pixels exceed tolerance {}, max difference {}, see {}\n",
+                        key, bad_pixels, options.tolerance, max_difference, diff_path);
+                    ++failures;
+                }
+                else
+                {
+                    fmt::print("PASS {} image: max difference {}\n", key, max_difference);
+                }
+            }
+
+            // 性能
+            std::map<std::string, double>::const_iterator it = baseline.find(key);
+
+            if (it == baseline.end())
+            {
+                fmt::print("SKIP {} timing: no baseline, p50={:.3f}ms\n", key, median_ms);
+                continue;
+            }
+
+            ++checks;
+            double ratio = median_ms / it->second;
+
+            if (ratio > options.max_slowdown)
+            {
+                fmt::print("FAIL {} timing: p50={:.3f}ms baseline={:.3f}ms ratio={:.3f} > {:.3f}\n",
+                    key, median_ms, it->second, ratio, options.max_slowdown);
+                ++failures;
+            }
+            else
+            {
+                fmt::print("PASS {} timing: p50={:.3f}ms baseline={:.3f}ms ratio={:.3f}\n", key, median_ms, it->second, ratio);
+            }
+        }
+    }
+
+    if (options.update_golden)
+    {
+        FILE* file = std::fopen(baseline_path.c_str(), "wb");
+
+        if (file == nullptr)
+        {
+            fmt::print("FAIL cannot write {}\n", baseline_path);
+            return 1;
+        }
+
+        std::fwrite(new_baseline.data(), 1, new_baseline.size(), file);
+        std::fclose(file);
+        return failures == 0 ? 0 : 1;
+    }
+
+    fmt::print("{} checks, {} failed\n", checks, failures);
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,1067 @@
+﻿/*********************************************************************************************
+MIT License
+
+Copyright (c) 2024 kumakoko www.xionggf.com
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*********************************************************************************************/
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "fmt/format.h"
+
+#include "tiny3d_aligned_class.h"
+#include "tiny3d_geometry.h"
+#include "tiny3d_matrix.h"
+#include "tiny3d_transform.h"
+#include "tiny3d_vector.h"
+#include "tiny3d_bench.h"
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define TINY3D_MICROBENCH_X86
+#include <immintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#else
+#include <x86intrin.h>
+#endif
+#endif
+
+// GCC和Clang要求使用AVX2指令的函数单独声明目标指令集，MSVC不需要
+#if defined(TINY3D_MICROBENCH_X86) && defined(__GNUC__)
+#define TINY3D_TARGET_AVX2 __attribute__((target("avx2,fma")))
+#else
+#define TINY3D_TARGET_AVX2
+#endif
+
+// 数学函数的微基准测试。每个函数有以下几种实现：
+//   engine   引擎中的实现，逐个元素调用，渲染器实际走的就是这条路径
+//   scalar   可移植的标量实现，同时作为误差比较的参考
+//   sse      逐个元素的SSE实现
+//   avx2     一条256位指令同时处理两个元素的AVX2实现，运行时检测CPU是否支持
+//   batched  SoA布局的批量标量循环，交给编译器自动向量化
+// 每种实现在同一组大数组上反复运行，取最快一次的每元素周期数。周期数来自时间戳计数器，
+// 它以固定的参考频率计数，和睿频之后的核心频率可能不同
+
+namespace
+{
+    const uint32_t kComponentCount = 4;
+
+    // 所有实现共用的输入输出数组
+    struct MicroData
+    {
+        size_t count;
+        T3DMatrix4X4* matrices;             // 输入矩阵
+        T3DMatrix4X4* matrices_out;
+        T3DMatrix4X4 matrix;                // 和每个输入相乘的固定矩阵
+        T3DVector4* vectors;                // 输入向量
+        T3DVector4* vectors_other;          // 叉乘的第二个操作数
+        T3DVector4* vectors_out;
+        float* soa[kComponentCount];        // 输入向量的SoA副本
+        float* soa_out[kComponentCount];
+        uint32_t* codes_out;                // CVV检查的结果
+        T3DVertex* vertices;                // 插值的两个端点
+        T3DVertex* vertices_other;
+        T3DVertex* vertices_out;
+        float t;                            // 插值参数
+        Transform transform;
+        float screen_width;
+        float screen_height;
+    };
+
+    // 输出的种类，决定比较误差时从哪里取数据
+    enum MicroOutput
+    {
+        MICRO_OUTPUT_MATRICES = 0,
+        MICRO_OUTPUT_VECTORS,
+        MICRO_OUTPUT_VECTORS_XYZ,       // 只比较xyz，引擎的SSE实现和标量实现对w的处理不同
+        MICRO_OUTPUT_SOA,
+        MICRO_OUTPUT_CODES,
+        MICRO_OUTPUT_VERTICES
+    };
+
+    typedef void (*MicroFunction)(MicroData& data);
+
+    struct MicroKernel
+    {
+        const char* name;
+        const char* variant;
+        MicroFunction function;
+        MicroOutput output;
+        bool needs_avx2;
+    };
+
+    //=================================================================
+    // 矩阵乘法 c = a * b
+    //=================================================================
+
+    void MatrixMultiplyEngine(MicroData& data)
+    {
+        for (size_t i = 0; i < data.count; ++i)
+        {
+            T3DMatrixMultiply(&data.matrices_out[i], &data.matrices[i], &data.matrix);
+        }
+    }
+
+    void MatrixMultiplyScalar(MicroData& data)
+    {
+        const T3DMatrix4X4& b = data.matrix;
+
+        for (size_t n = 0; n < data.count; ++n)
+        {
+            const T3DMatrix4X4& a = data.matrices[n];
+            T3DMatrix4X4& c = data.matrices_out[n];
+
+            for (int i = 0; i < 4; ++i)
+            {
+                for (int j = 0; j < 4; ++j)
+                {
+                    c.m[i][j] = a.m[i][0] * b.m[0][j] + a.m[i][1] * b.m[1][j] + a.m[i][2] * b.m[2][j] + a.m[i][3] * b.m[3][j];
+                }
+            }
+        }
+    }
+
+#if defined(TINY3D_MICROBENCH_X86)
+    void MatrixMultiplySSE(MicroData& data)
+    {
+        // c的每一行是b的四行以a的对应行为系数的线性组合，不需要水平加法
+        __m128 b0 = _mm_loadu_ps(data.matrix.m[0]);
+        __m128 b1 = _mm_loadu_ps(data.matrix.m[1]);
+        __m128 b2 = _mm_loadu_ps(data.matrix.m[2]);
+        __m128 b3 = _mm_loadu_ps(data.matrix.m[3]);
+
+        for (size_t n = 0; n < data.count; ++n)
+        {
+            const T3DMatrix4X4& a = data.matrices[n];
+            T3DMatrix4X4& c = data.matrices_out[n];
+
+            for (int i = 0; i < 4; ++i)
+            {
+                __m128 row = _mm_mul_ps(_mm_set1_ps(a.m[i][0]), b0);
+                row = _mm_add_ps(row, _mm_mul_ps(_mm_set1_ps(a.m[i][1]), b1));
+                row = _mm_add_ps(row, _mm_mul_ps(_mm_set1_ps(a.m[i][2]), b2));
+                row = _mm_add_ps(row, _mm_mul_ps(_mm_set1_ps(a.m[i][3]), b3));
+                _mm_store_ps(c.m[i], row);
+            }
+        }
+    }
+
+    TINY3D_TARGET_AVX2 void MatrixMultiplyAVX2(MicroData& data)
+    {
+        // 一个256位寄存器放c的两行，b的每一行在高低两半各放一份
+        __m256 b0 = _mm256_broadcast_ps(reinterpret_cast<const __m128*>(data.matrix.m[0]));
+        __m256 b1 = _mm256_broadcast_ps(reinterpret_cast<const __m128*>(data.matrix.m[1]));
+        __m256 b2 = _mm256_broadcast_ps(reinterpret_cast<const __m128*>(data.matrix.m[2]));
+        __m256 b3 = _mm256_broadcast_ps(reinterpret_cast<const __m128*>(data.matrix.m[3]));
+
+        for (size_t n = 0; n < data.count; ++n)
+        {
+            const float* a = &data.matrices[n].m[0][0];
+            float* c = &data.matrices_out[n].m[0][0];
+
+            for (int i = 0; i < 16; i += 8)
+            {
+                // 两行a，每个128位的一半里用permute把第k个系数广播到四个分量
+                __m256 rows = _mm256_load_ps(a + i);
+                __m256 result = _mm256_mul_ps(_mm256_permute_ps(rows, 0x00), b0);
+                result = _mm256_fmadd_ps(_mm256_permute_ps(rows, 0x55), b1, result);
+                result = _mm256_fmadd_ps(_mm256_permute_ps(rows, 0xAA), b2, result);
+                result = _mm256_fmadd_ps(_mm256_permute_ps(rows, 0xFF), b3, result);
+                _mm256_store_ps(c + i, result);
+            }
+        }
+    }
+#endif
+
+    //=================================================================
+    // 向量乘矩阵 y = x * m
+    //=================================================================
+
+    void MatrixApplyEngine(MicroData& data)
+    {
+        for (size_t i = 0; i < data.count; ++i)
+        {
+            T3DMatrixApply(&data.vectors_out[i], &data.vectors[i], &data.matrix);
+        }
+    }
+
+    void MatrixApplyScalar(MicroData& data)
+    {
+        const T3DMatrix4X4& m = data.matrix;
+
+        for (size_t i = 0; i < data.count; ++i)
+        {
+            const T3DVector4& v = data.vectors[i];
+            T3DVector4& r = data.vectors_out[i];
+            r.x = v.x * m.m[0][0] + v.y * m.m[1][0] + v.z * m.m[2][0] + v.w * m.m[3][0];
+            r.y = v.x * m.m[0][1] + v.y * m.m[1][1] + v.z * m.m[2][1] + v.w * m.m[3][1];
+            r.z = v.x * m.m[0][2] + v.y * m.m[1][2] + v.z * m.m[2][2] + v.w * m.m[3][2];
+            r.w = v.x * m.m[0][3] + v.y * m.m[1][3] + v.z * m.m[2][3] + v.w * m.m[3][3];
+        }
+    }
+
+    void MatrixApplyBatched(MicroData& data)
+    {
+        const T3DMatrix4X4& m = data.matrix;
+        const float* x = data.soa[0];
+        const float* y = data.soa[1];
+        const float* z = data.soa[2];
+        const float* w = data.soa[3];
+
+        for (uint32_t c = 0; c < kComponentCount; ++c)
+        {
+            float m0 = m.m[0][c], m1 = m.m[1][c], m2 = m.m[2][c], m3 = m.m[3][c];
+            float* out = data.soa_out[c];
+
+            for (size_t i = 0; i < data.count; ++i)
+            {
+                out[i] = x[i] * m0 + y[i] * m1 + z[i] * m2 + w[i] * m3;
+            }
+        }
+    }
+
+#if defined(TINY3D_MICROBENCH_X86)
+    void MatrixApplySSE(MicroData& data)
+    {
+        __m128 row0 = _mm_loadu_ps(data.matrix.m[0]);
+        __m128 row1 = _mm_loadu_ps(data.matrix.m[1]);
+        __m128 row2 = _mm_loadu_ps(data.matrix.m[2]);
+        __m128 row3 = _mm_loadu_ps(data.matrix.m[3]);
+
+        for (size_t i = 0; i < data.count; ++i)
+        {
+            __m128 v = _mm_load_ps(data.vectors[i].m);
+            __m128 r = _mm_mul_ps(_mm_shuffle_ps(v, v, _MM_SHUFFLE(0, 0, 0, 0)), row0);
+            r = _mm_add_ps(r, _mm_mul_ps(_mm_shuffle_ps(v, v, _MM_SHUFFLE(1, 1, 1, 1)), row1));
+            r = _mm_add_ps(r, _mm_mul_ps(_mm_shuffle_ps(v, v, _MM_SHUFFLE(2, 2, 2, 2)), row2));
+            r = _mm_add_ps(r, _mm_mul_ps(_mm_shuffle_ps(v, v, _MM_SHUFFLE(3, 3, 3, 3)), row3));
+            _mm_store_ps(data.vectors_out[i].m, r);
+        }
+    }
+
+    TINY3D_TARGET_AVX2 void MatrixApplyAVX2(MicroData& data)
+    {
+        __m256 row0 = _mm256_broadcast_ps(reinterpret_cast<const __m128*>(data.matrix.m[0]));
+        __m256 row1 = _mm256_broadcast_ps(reinterpret_cast<const __m128*>(data.matrix.m[1]));
+        __m256 row2 = _mm256_broadcast_ps(reinterpret_cast<const __m128*>(data.matrix.m[2]));
+        __m256 row3 = _mm256_broadcast_ps(reinterpret_cast<const __m128*>(data.matrix.m[3]));
+        size_t pairs = data.count & ~static_cast<size_t>(1);
+
+        for (size_t i = 0; i < pairs; i += 2)
+        {
+            __m256 v = _mm256_load_ps(data.vectors[i].m);
+            __m256 r = _mm256_mul_ps(_mm256_permute_ps(v, 0x00), row0);
+            r = _mm256_fmadd_ps(_mm256_permute_ps(v, 0x55), row1, r);
+            r = _mm256_fmadd_ps(_mm256_permute_ps(v, 0xAA), row2, r);
+            r = _mm256_fmadd_ps(_mm256_permute_ps(v, 0xFF), row3, r);
+            _mm256_store_ps(data.vectors_out[i].m, r);
+        }
+
+        for (size_t i = pairs; i < data.count; ++i)
+        {
+            T3DMatrixApply(&data.vectors_out[i], &data.vectors[i], &data.matrix);
+        }
+    }
+#endif
+
+    //=================================================================
+    // 向量单位化
+    //=================================================================
+
+    void NormalizeEngine(MicroData& data)
+    {
+        for (size_t i = 0; i < data.count; ++i)
+        {
+            data.vectors_out[i] = data.vectors[i];
+            T3DVector4Normalize(&data.vectors_out[i]);
+        }
+    }
+
+    void NormalizeScalar(MicroData& data)
+    {
+        for (size_t i = 0; i < data.count; ++i)
+        {
+            const T3DVector4& v = data.vectors[i];
+            T3DVector4& r = data.vectors_out[i];
+            float length = std::sqrt(v.x * v.x + v.y * v.y + v.z * v.z);
+            float inv = (length != 0.0f) ? 1.0f / length : 1.0f;
+            r.x = v.x * inv;
+            r.y = v.y * inv;
+            r.z = v.z * inv;
+            r.w = v.w;
+        }
+    }
+
+    void NormalizeBatched(MicroData& data)
+    {
+        const float* x = data.soa[0];
+        const float* y = data.soa[1];
+        const float* z = data.soa[2];
+
+        for (size_t i = 0; i < data.count; ++i)
+        {
+            float length = std::sqrt(x[i] * x[i] + y[i] * y[i] + z[i] * z[i]);
+            float inv = (length != 0.0f) ? 1.0f / length : 1.0f;
+            data.soa_out[0][i] = x[i] * inv;
+            data.soa_out[1][i] = y[i] * inv;
+            data.soa_out[2][i] = z[i] * inv;
+            data.soa_out[3][i] = data.soa[3][i];
+        }
+    }
+
+#if defined(TINY3D_MICROBENCH_X86)
+    void NormalizeSSE(MicroData& data)
+    {
+        const __m128 xyz_mask = _mm_castsi128_ps(_mm_set_epi32(0, -1, -1, -1));
+        const __m128 one = _mm_set1_ps(1.0f);
+
+        for (size_t i = 0; i < data.count; ++i)
+        {
+            __m128 v = _mm_load_ps(data.vectors[i].m);
+            __m128 sq = _mm_and_ps(_mm_mul_ps(v, v), xyz_mask);
+            __m128 sum = _mm_add_ps(sq, _mm_shuffle_ps(sq, sq, _MM_SHUFFLE(2, 3, 0, 1)));
+            sum = _mm_add_ps(sum, _mm_shuffle_ps(sum, sum, _MM_SHUFFLE(1, 0, 3, 2)));
+            __m128 length = _mm_sqrt_ps(sum);
+            __m128 nonzero = _mm_cmpneq_ps(length, _mm_setzero_ps());
+            __m128 inv = _mm_or_ps(_mm_and_ps(nonzero, _mm_div_ps(one, length)), _mm_andnot_ps(nonzero, one));
+            // w保持不变
+            inv = _mm_or_ps(_mm_and_ps(xyz_mask, inv), _mm_andnot_ps(xyz_mask, one));
+            _mm_store_ps(data.vectors_out[i].m, _mm_mul_ps(v, inv));
+        }
+    }
+
+    TINY3D_TARGET_AVX2 void NormalizeAVX2(MicroData& data)
+    {
+        const __m256 one = _mm256_set1_ps(1.0f);
+        const __m256 w_lanes = _mm256_castsi256_ps(_mm256_set_epi32(-1, 0, 0, 0, -1, 0, 0, 0));
+        size_t pairs = data.count & ~static_cast<size_t>(1);
+
+        for (size_t i = 0; i < pairs; i += 2)
+        {
+            __m256 v = _mm256_load_ps(data.vectors[i].m);
+            // dp_ps在两个128位的一半里分别求xyz的点积并广播到四个分量
+            __m256 length = _mm256_sqrt_ps(_mm256_dp_ps(v, v, 0x7F));
+            __m256 nonzero = _mm256_cmp_ps(length, _mm256_setzero_ps(), _CMP_NEQ_OQ);
+            __m256 inv = _mm256_blendv_ps(one, _mm256_div_ps(one, length), nonzero);
+            inv = _mm256_blendv_ps(inv, one, w_lanes);
+            _mm256_store_ps(data.vectors_out[i].m, _mm256_mul_ps(v, inv));
+        }
+
+        for (size_t i = pairs; i < data.count; ++i)
+        {
+            const T3DVector4& v = data.vectors[i];
+            float length = std::sqrt(v.x * v.x + v.y * v.y + v.z * v.z);
+            float inv = (length != 0.0f) ? 1.0f / length : 1.0f;
+            data.vectors_out[i] = v;
+            data.vectors_out[i].x *= inv;
+            data.vectors_out[i].y *= inv;
+            data.vectors_out[i].z *= inv;
+        }
+    }
+#endif
+
+    //=================================================================
+    // 向量叉乘
+    //=================================================================
+
+    void CrossEngine(MicroData& data)
+    {
+        for (size_t i = 0; i < data.count; ++i)
+        {
+            T3DVector4Cross(&data.vectors_out[i], &data.vectors[i], &data.vectors_other[i]);
+        }
+    }
+
+    void CrossScalar(MicroData& data)
+    {
+        for (size_t i = 0; i < data.count; ++i)
+        {
+            const T3DVector4& a = data.vectors[i];
+            const T3DVector4& b = data.vectors_other[i];
+            T3DVector4& r = data.vectors_out[i];
+            r.x = a.y * b.z - a.z * b.y;
+            r.y = a.z * b.x - a.x * b.z;
+            r.z = a.x * b.y - a.y * b.x;
+            r.w = 1.0f;
+        }
+    }
+
+#if defined(TINY3D_MICROBENCH_X86)
+    void CrossSSE(MicroData& data)
+    {
+        const __m128 w_one = _mm_set_ps(1.0f, 0.0f, 0.0f, 0.0f);
+        const __m128 xyz_mask = _mm_castsi128_ps(_mm_set_epi32(0, -1, -1, -1));
+
+        for (size_t i = 0; i < data.count; ++i)
+        {
+            __m128 a = _mm_load_ps(data.vectors[i].m);
+            __m128 b = _mm_load_ps(data.vectors_other[i].m);
+            __m128 a_yzx = _mm_shuffle_ps(a, a, _MM_SHUFFLE(3, 0, 2, 1));
+            __m128 b_yzx = _mm_shuffle_ps(b, b, _MM_SHUFFLE(3, 0, 2, 1));
+            // a × b = (a * b.yzx - a.yzx * b).yzx，只需要三次shuffle
+            __m128 c = _mm_sub_ps(_mm_mul_ps(a, b_yzx), _mm_mul_ps(a_yzx, b));
+            c = _mm_shuffle_ps(c, c, _MM_SHUFFLE(3, 0, 2, 1));
+            _mm_store_ps(data.vectors_out[i].m, _mm_or_ps(_mm_and_ps(c, xyz_mask), w_one));
+        }
+    }
+
+    TINY3D_TARGET_AVX2 void CrossAVX2(MicroData& data)
+    {
+        const __m256 w_one = _mm256_set_ps(1.0f, 0.0f, 0.0f, 0.0f, 1.0f, 0.0f, 0.0f, 0.0f);
+        const __m256 xyz_mask = _mm256_castsi256_ps(_mm256_set_epi32(0, -1, -1, -1, 0, -1, -1, -1));
+        size_t pairs = data.count & ~static_cast<size_t>(1);
+
+        for (size_t i = 0; i < pairs; i += 2)
+        {
+            __m256 a = _mm256_load_ps(data.vectors[i].m);
+            __m256 b = _mm256_load_ps(data.vectors_other[i].m);
+            __m256 a_yzx = _mm256_permute_ps(a, _MM_SHUFFLE(3, 0, 2, 1));
+            __m256 b_yzx = _mm256_permute_ps(b, _MM_SHUFFLE(3, 0, 2, 1));
+            __m256 c = _mm256_fmsub_ps(a, b_yzx, _mm256_mul_ps(a_yzx, b));
+            c = _mm256_permute_ps(c, _MM_SHUFFLE(3, 0, 2, 1));
+            _mm256_store_ps(data.vectors_out[i].m, _mm256_or_ps(_mm256_and_ps(c, xyz_mask), w_one));
+        }
+
+        for (size_t i = pairs; i < data.count; ++i)
+        {
+            T3DVector4Cross(&data.vectors_out[i], &data.vectors[i], &data.vectors_other[i]);
+        }
+    }
+#endif
+
+    //=================================================================
+    // CVV检查
+    //=================================================================
+
+    void CheckCVVEngine(MicroData& data)
+    {
+        for (size_t i = 0; i < data.count; ++i)
+        {
+            data.codes_out[i] = data.transform.CheckCVV(&data.vectors[i]);
+        }
+    }
+
+    void CheckCVVScalar(MicroData& data)
+    {
+        for (size_t i = 0; i < data.count; ++i)
+        {
+            const T3DVector4& v = data.vectors[i];
+            uint32_t check = 0;
+
+            if (v.z < 0.0f) check |= 0x01;
+            if (v.z > v.w) check |= 0x02;
+            if (v.x < -v.w) check |= 0x04;
+            if (v.x > v.w) check |= 0x08;
+            if (v.y < -v.w) check |= 0x10;
+            if (v.y > v.w) check |= 0x20;
+
+            data.codes_out[i] = check;
+        }
+    }
+
+    void CheckCVVBatched(MicroData& data)
+    {
+        const float* x = data.soa[0];
+        const float* y = data.soa[1];
+        const float* z = data.soa[2];
+        const float* w = data.soa[3];
+
+        // 没有分支，编译器可以把比较结果直接拼成位掩码
+        for (size_t i = 0; i < data.count; ++i)
+        {
+            data.codes_out[i] =
+                static_cast<uint32_t>(z[i] < 0.0f) |
+                (static_cast<uint32_t>(z[i] > w[i]) << 1) |
+                (static_cast<uint32_t>(x[i] < -w[i]) << 2) |
+                (static_cast<uint32_t>(x[i] > w[i]) << 3) |
+                (static_cast<uint32_t>(y[i] < -w[i]) << 4) |
+                (static_cast<uint32_t>(y[i] > w[i]) << 5);
+        }
+    }
+
+#if defined(TINY3D_MICROBENCH_X86)
+    void CheckCVVSSE(MicroData& data)
+    {
+        const __m128 sign = _mm_set1_ps(-0.0f);
+
+        for (size_t i = 0; i < data.count; ++i)
+        {
+            // 把 (z, z, x, x) 和 (0, w, -w, w) 比较，y的两项单独算
+            __m128 v = _mm_load_ps(data.vectors[i].m);
+            __m128 w = _mm_shuffle_ps(v, v, _MM_SHUFFLE(3, 3, 3, 3));
+            __m128 neg_w = _mm_xor_ps(w, sign);
+            __m128 lhs = _mm_shuffle_ps(v, v, _MM_SHUFFLE(0, 0, 2, 2));              // z z x x
+            __m128 bound = _mm_shuffle_ps(_mm_unpacklo_ps(_mm_setzero_ps(), w), _mm_unpacklo_ps(neg_w, w), _MM_SHUFFLE(1, 0, 1, 0));
+            // 位0、2为小于，位1、3为大于
+            __m128 less = _mm_cmplt_ps(lhs, bound);
+            __m128 greater = _mm_cmpgt_ps(lhs, bound);
+            uint32_t mask = static_cast<uint32_t>(_mm_movemask_ps(less) & 0x5) | static_cast<uint32_t>(_mm_movemask_ps(greater) & 0xA);
+            float y = data.vectors[i].y;
+            float wf = data.vectors[i].w;
+            mask |= (static_cast<uint32_t>(y < -wf) << 4) | (static_cast<uint32_t>(y > wf) << 5);
+            data.codes_out[i] = mask;
+        }
+    }
+
+    TINY3D_TARGET_AVX2 void CheckCVVAVX2(MicroData& data)
+    {
+        const __m256 zero = _mm256_setzero_ps();
+        const __m256 sign = _mm256_set1_ps(-0.0f);
+        size_t blocks = data.count & ~static_cast<size_t>(7);
+
+        // SoA输入，一次处理8个顶点，每个比较得到8位掩码，再按位展开到各顶点的结果中
+        for (size_t i = 0; i < blocks; i += 8)
+        {
+            __m256 x = _mm256_load_ps(data.soa[0] + i);
+            __m256 y = _mm256_load_ps(data.soa[1] + i);
+            __m256 z = _mm256_load_ps(data.soa[2] + i);
+            __m256 w = _mm256_load_ps(data.soa[3] + i);
+            __m256 neg_w = _mm256_xor_ps(w, sign);
+            __m256i codes = _mm256_and_si256(_mm256_castps_si256(_mm256_cmp_ps(z, zero, _CMP_LT_OQ)), _mm256_set1_epi32(0x01));
+            codes = _mm256_or_si256(codes, _mm256_and_si256(_mm256_castps_si256(_mm256_cmp_ps(z, w, _CMP_GT_OQ)), _mm256_set1_epi32(0x02)));
+            codes = _mm256_or_si256(codes, _mm256_and_si256(_mm256_castps_si256(_mm256_cmp_ps(x, neg_w, _CMP_LT_OQ)), _mm256_set1_epi32(0x04)));
+            codes = _mm256_or_si256(codes, _mm256_and_si256(_mm256_castps_si256(_mm256_cmp_ps(x, w, _CMP_GT_OQ)), _mm256_set1_epi32(0x08)));
+            codes = _mm256_or_si256(codes, _mm256_and_si256(_mm256_castps_si256(_mm256_cmp_ps(y, neg_w, _CMP_LT_OQ)), _mm256_set1_epi32(0x10)));
+            codes = _mm256_or_si256(codes, _mm256_and_si256(_mm256_castps_si256(_mm256_cmp_ps(y, w, _CMP_GT_OQ)), _mm256_set1_epi32(0x20)));
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(data.codes_out + i), codes);
+        }
+
+        for (size_t i = blocks; i < data.count; ++i)
+        {
+            data.codes_out[i] = data.transform.CheckCVV(&data.vectors[i]);
+        }
+    }
+#endif
+
+    //=================================================================
+    // 透视除法并映射到屏幕坐标
+    //=================================================================
+
+    void HomogenizeEngine(MicroData& data)
+    {
+        for (size_t i = 0; i < data.count; ++i)
+        {
+            data.transform.Homogenize(&data.vectors_out[i], &data.vectors[i]);
+        }
+    }
+
+    void HomogenizeScalar(MicroData& data)
+    {
+        float half_width = data.screen_width * 0.5f;
+        float half_height = data.screen_height * 0.5f;
+
+        for (size_t i = 0; i < data.count; ++i)
+        {
+            const T3DVector4& v = data.vectors[i];
+            T3DVector4& r = data.vectors_out[i];
+            float rhw = 1.0f / v.w;
+            r.x = (v.x * rhw + 1.0f) * half_width;
+            r.y = (1.0f - v.y * rhw) * half_height;
+            r.z = v.z * rhw;
+            r.w = 1.0f;
+        }
+    }
+
+    void HomogenizeBatched(MicroData& data)
+    {
+        float half_width = data.screen_width * 0.5f;
+        float half_height = data.screen_height * 0.5f;
+
+        for (size_t i = 0; i < data.count; ++i)
+        {
+            float rhw = 1.0f / data.soa[3][i];
+            data.soa_out[0][i] = (data.soa[0][i] * rhw + 1.0f) * half_width;
+            data.soa_out[1][i] = (1.0f - data.soa[1][i] * rhw) * half_height;
+            data.soa_out[2][i] = data.soa[2][i] * rhw;
+            data.soa_out[3][i] = 1.0f;
+        }
+    }
+
+#if defined(TINY3D_MICROBENCH_X86)
+    void HomogenizeSSE(MicroData& data)
+    {
+        // r = (v * rhw * scale + offset)，w分量的scale为0、offset为1
+        const __m128 scale = _mm_set_ps(0.0f, 1.0f, -data.screen_height * 0.5f, data.screen_width * 0.5f);
+        const __m128 offset = _mm_set_ps(1.0f, 0.0f, data.screen_height * 0.5f, data.screen_width * 0.5f);
+        const __m128 one = _mm_set1_ps(1.0f);
+
+        for (size_t i = 0; i < data.count; ++i)
+        {
+            __m128 v = _mm_load_ps(data.vectors[i].m);
+            __m128 rhw = _mm_div_ps(one, _mm_shuffle_ps(v, v, _MM_SHUFFLE(3, 3, 3, 3)));
+            __m128 r = _mm_add_ps(_mm_mul_ps(_mm_mul_ps(v, rhw), scale), offset);
+            _mm_store_ps(data.vectors_out[i].m, r);
+        }
+    }
+
+    TINY3D_TARGET_AVX2 void HomogenizeAVX2(MicroData& data)
+    {
+        const __m256 scale = _mm256_set_ps(0.0f, 1.0f, -data.screen_height * 0.5f, data.screen_width * 0.5f,
+            0.0f, 1.0f, -data.screen_height * 0.5f, data.screen_width * 0.5f);
+        const __m256 offset = _mm256_set_ps(1.0f, 0.0f, data.screen_height * 0.5f, data.screen_width * 0.5f,
+            1.0f, 0.0f, data.screen_height * 0.5f, data.screen_width * 0.5f);
+        const __m256 one = _mm256_set1_ps(1.0f);
+        size_t pairs = data.count & ~static_cast<size_t>(1);
+
+        for (size_t i = 0; i < pairs; i += 2)
+        {
+            __m256 v = _mm256_load_ps(data.vectors[i].m);
+            __m256 rhw = _mm256_div_ps(one, _mm256_permute_ps(v, 0xFF));
+            _mm256_store_ps(data.vectors_out[i].m, _mm256_fmadd_ps(_mm256_mul_ps(v, rhw), scale, offset));
+        }
+
+        for (size_t i = pairs; i < data.count; ++i)
+        {
+            data.transform.Homogenize(&data.vectors_out[i], &data.vectors[i]);
+        }
+    }
+#endif
+
+    //=================================================================
+    // 顶点插值
+    //=================================================================
+
+    const uint32_t kVertexFloats = sizeof(T3DVertex) / sizeof(float);
+
+    void VertexInterpolateEngine(MicroData& data)
+    {
+        for (size_t i = 0; i < data.count; ++i)
+        {
+            T3DVertexInterpolate(&data.vertices_out[i], &data.vertices[i], &data.vertices_other[i], data.t);
+        }
+    }
+
+    void VertexInterpolateScalar(MicroData& data)
+    {
+        for (size_t i = 0; i < data.count; ++i)
+        {
+            const float* a = reinterpret_cast<const float*>(&data.vertices[i]);
+            const float* b = reinterpret_cast<const float*>(&data.vertices_other[i]);
+            float* r = reinterpret_cast<float*>(&data.vertices_out[i]);
+
+            for (uint32_t k = 0; k < kVertexFloats; ++k)
+            {
+                r[k] = a[k] + (b[k] - a[k]) * data.t;
+            }
+
+            data.vertices_out[i].pos.w = 1.0f;
+        }
+    }
+
+    void VertexInterpolateBatched(MicroData& data)
+    {
+        // 顶点数组本身就是连续的float，整体当成一个长数组插值，最后再修正pos.w
+        const float* a = reinterpret_cast<const float*>(data.vertices);
+        const float* b = reinterpret_cast<const float*>(data.vertices_other);
+        float* r = reinterpret_cast<float*>(data.vertices_out);
+        size_t total = data.count * kVertexFloats;
+        float t = data.t;
+
+        for (size_t k = 0; k < total; ++k)
+        {
+            r[k] = a[k] + (b[k] - a[k]) * t;
+        }
+
+        for (size_t i = 0; i < data.count; ++i)
+        {
+            data.vertices_out[i].pos.w = 1.0f;
+        }
+    }
+
+#if defined(TINY3D_MICROBENCH_X86)
+    void VertexInterpolateSSE(MicroData& data)
+    {
+        __m128 t = _mm_set1_ps(data.t);
+
+        for (size_t i = 0; i < data.count; ++i)
+        {
+            const float* a = reinterpret_cast<const float*>(&data.vertices[i]);
+            const float* b = reinterpret_cast<const float*>(&data.vertices_other[i]);
+            float* r = reinterpret_cast<float*>(&data.vertices_out[i]);
+
+            // GCC上是10个float，两次4宽加两个标量；MSVC上T3DVector4按16字节对齐，共12个float，
+            // 尾部的填充也一起插值，不影响结果
+            for (uint32_t k = 0; k < 8; k += 4)
+            {
+                __m128 va = _mm_loadu_ps(a + k);
+                __m128 vb = _mm_loadu_ps(b + k);
+                _mm_storeu_ps(r + k, _mm_add_ps(va, _mm_mul_ps(_mm_sub_ps(vb, va), t)));
+            }
+
+            for (uint32_t k = 8; k < kVertexFloats; ++k)
+            {
+                r[k] = a[k] + (b[k] - a[k]) * data.t;
+            }
+
+            data.vertices_out[i].pos.w = 1.0f;
+        }
+    }
+
+    TINY3D_TARGET_AVX2 void VertexInterpolateAVX2(MicroData& data)
+    {
+        // 和batched一样把顶点数组当成连续的float，每次处理8个
+        const float* a = reinterpret_cast<const float*>(data.vertices);
+        const float* b = reinterpret_cast<const float*>(data.vertices_other);
+        float* r = reinterpret_cast<float*>(data.vertices_out);
+        size_t total = data.count * kVertexFloats;
+        size_t blocks = total & ~static_cast<size_t>(7);
+        __m256 t = _mm256_set1_ps(data.t);
+
+        for (size_t k = 0; k < blocks; k += 8)
+        {
+            __m256 va = _mm256_loadu_ps(a + k);
+            __m256 vb = _mm256_loadu_ps(b + k);
+            _mm256_storeu_ps(r + k, _mm256_fmadd_ps(_mm256_sub_ps(vb, va), t, va));
+        }
+
+        for (size_t k = blocks; k < total; ++k)
+        {
+            r[k] = a[k] + (b[k] - a[k]) * data.t;
+        }
+
+        for (size_t i = 0; i < data.count; ++i)
+        {
+            data.vertices_out[i].pos.w = 1.0f;
+        }
+    }
+#endif
+
+    const MicroKernel kMicroKernels[] =
+    {
+        // 每个函数的scalar实现必须排在第一个，其余实现和它比较误差
+        { "matrix_multiply", "scalar", MatrixMultiplyScalar, MICRO_OUTPUT_MATRICES, false },
+        { "matrix_multiply", "engine", MatrixMultiplyEngine, MICRO_OUTPUT_MATRICES, false },
+#if defined(TINY3D_MICROBENCH_X86)
+        { "matrix_multiply", "sse", MatrixMultiplySSE, MICRO_OUTPUT_MATRICES, false },
+        { "matrix_multiply", "avx2", MatrixMultiplyAVX2, MICRO_OUTPUT_MATRICES, true },
+#endif
+        { "matrix_apply", "scalar", MatrixApplyScalar, MICRO_OUTPUT_VECTORS, false },
+        { "matrix_apply", "engine", MatrixApplyEngine, MICRO_OUTPUT_VECTORS, false },
+        { "matrix_apply", "batched", MatrixApplyBatched, MICRO_OUTPUT_SOA, false },
+#if defined(TINY3D_MICROBENCH_X86)
+        { "matrix_apply", "sse", MatrixApplySSE, MICRO_OUTPUT_VECTORS, false },
+        { "matrix_apply", "avx2", MatrixApplyAVX2, MICRO_OUTPUT_VECTORS, true },
+#endif
+        { "vector_normalize", "scalar", NormalizeScalar, MICRO_OUTPUT_VECTORS_XYZ, false },
+        { "vector_normalize", "engine", NormalizeEngine, MICRO_OUTPUT_VECTORS_XYZ, false },
+        { "vector_normalize", "batched", NormalizeBatched, MICRO_OUTPUT_SOA, false },
+#if defined(TINY3D_MICROBENCH_X86)
+        { "vector_normalize", "sse", NormalizeSSE, MICRO_OUTPUT_VECTORS_XYZ, false },
+        { "vector_normalize", "avx2", NormalizeAVX2, MICRO_OUTPUT_VECTORS_XYZ, true },
+#endif
+        { "vector_cross", "scalar", CrossScalar, MICRO_OUTPUT_VECTORS, false },
+        { "vector_cross", "engine", CrossEngine, MICRO_OUTPUT_VECTORS, false },
+#if defined(TINY3D_MICROBENCH_X86)
+        { "vector_cross", "sse", CrossSSE, MICRO_OUTPUT_VECTORS, false },
+        { "vector_cross", "avx2", CrossAVX2, MICRO_OUTPUT_VECTORS, true },
+#endif
+        { "check_cvv", "scalar", CheckCVVScalar, MICRO_OUTPUT_CODES, false },
+        { "check_cvv", "engine", CheckCVVEngine, MICRO_OUTPUT_CODES, false },
+        { "check_cvv", "batched", CheckCVVBatched, MICRO_OUTPUT_CODES, false },
+#if defined(TINY3D_MICROBENCH_X86)
+        { "check_cvv", "sse", CheckCVVSSE, MICRO_OUTPUT_CODES, false },
+        { "check_cvv", "avx2", CheckCVVAVX2, MICRO_OUTPUT_CODES, true },
+#endif
+        { "homogenize", "scalar", HomogenizeScalar, MICRO_OUTPUT_VECTORS, false },
+        { "homogenize", "engine", HomogenizeEngine, MICRO_OUTPUT_VECTORS, false },
+        { "homogenize", "batched", HomogenizeBatched, MICRO_OUTPUT_SOA, false },
+#if defined(TINY3D_MICROBENCH_X86)
+        { "homogenize", "sse", HomogenizeSSE, MICRO_OUTPUT_VECTORS, false },
+        { "homogenize", "avx2", HomogenizeAVX2, MICRO_OUTPUT_VECTORS, true },
+#endif
+        { "vertex_interpolate", "scalar", VertexInterpolateScalar, MICRO_OUTPUT_VERTICES, false },
+        { "vertex_interpolate", "engine", VertexInterpolateEngine, MICRO_OUTPUT_VERTICES, false },
+        { "vertex_interpolate", "batched", VertexInterpolateBatched, MICRO_OUTPUT_VERTICES, false },
+#if defined(TINY3D_MICROBENCH_X86)
+        { "vertex_interpolate", "sse", VertexInterpolateSSE, MICRO_OUTPUT_VERTICES, false },
+        { "vertex_interpolate", "avx2", VertexInterpolateAVX2, MICRO_OUTPUT_VERTICES, true },
+#endif
+    };
+
+    bool CpuSupportsAVX2()
+    {
+#if defined(TINY3D_MICROBENCH_X86) && defined(_MSC_VER)
+        int info[4];
+        __cpuid(info, 0);
+
+        if (info[0] < 7)
+            return false;
+
+        __cpuidex(info, 7, 0);
+        bool avx2 = (info[1] & (1 << 5)) != 0;
+        __cpuid(info, 1);
+        bool fma = (info[2] & (1 << 12)) != 0;
+        bool os_avx = (info[2] & (1 << 27)) != 0 && (_xgetbv(0) & 0x6) == 0x6;
+        return avx2 && fma && os_avx;
+#elif defined(TINY3D_MICROBENCH_X86) && defined(__GNUC__)
+        return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+#else
+        return false;
+#endif
+    }
+
+    // 时间戳计数器。非x86平台没有rdtsc，退化为纳秒
+    inline uint64_t ReadCycleCounter()
+    {
+#if defined(TINY3D_MICROBENCH_X86)
+        return __rdtsc();
+#else
+        return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count());
+#endif
+    }
+
+    // 固定种子的线性同余发生器，保证每次运行的输入相同
+    struct MicroRandom
+    {
+        uint32_t state = 12345;
+
+        float Next(float lo, float hi)
+        {
+            state = state * 1664525u + 1013904223u;
+            return lo + (hi - lo) * static_cast<float>(state >> 8) * (1.0f / 16777216.0f);
+        }
+    };
+
+    MicroData* CreateMicroData(size_t count)
+    {
+        MicroData* data = new MicroData();
+        data->count = count;
+        data->matrices = static_cast<T3DMatrix4X4*>(AlignedMalloc(sizeof(T3DMatrix4X4) * count, 64));
+        data->matrices_out = static_cast<T3DMatrix4X4*>(AlignedMalloc(sizeof(T3DMatrix4X4) * count, 64));
+        data->vectors = static_cast<T3DVector4*>(AlignedMalloc(sizeof(T3DVector4) * count, 64));
+        data->vectors_other = static_cast<T3DVector4*>(AlignedMalloc(sizeof(T3DVector4) * count, 64));
+        data->vectors_out = static_cast<T3DVector4*>(AlignedMalloc(sizeof(T3DVector4) * count, 64));
+        data->codes_out = static_cast<uint32_t*>(AlignedMalloc(sizeof(uint32_t) * count, 64));
+        data->vertices = static_cast<T3DVertex*>(AlignedMalloc(sizeof(T3DVertex) * count, 64));
+        data->vertices_other = static_cast<T3DVertex*>(AlignedMalloc(sizeof(T3DVertex) * count, 64));
+        data->vertices_out = static_cast<T3DVertex*>(AlignedMalloc(sizeof(T3DVertex) * count, 64));
+
+        for (uint32_t c = 0; c < kComponentCount; ++c)
+        {
+            data->soa[c] = static_cast<float*>(AlignedMalloc(sizeof(float) * count, 64));
+            data->soa_out[c] = static_cast<float*>(AlignedMalloc(sizeof(float) * count, 64));
+        }
+
+        MicroRandom random;
+        float* matrix = &data->matrix.m[0][0];
+
+        for (uint32_t k = 0; k < 16; ++k)
+        {
+            matrix[k] = random.Next(-2.0f, 2.0f);
+        }
+
+        for (size_t i = 0; i < count; ++i)
+        {
+            float* m = &data->matrices[i].m[0][0];
+
+            for (uint32_t k = 0; k < 16; ++k)
+            {
+                m[k] = random.Next(-2.0f, 2.0f);
+            }
+
+            // w取正值，一部分顶点落在CVV之外
+            T3DVector4& v = data->vectors[i];
+            v.w = random.Next(0.5f, 2.0f);
+            v.x = random.Next(-1.5f, 1.5f) * v.w;
+            v.y = random.Next(-1.5f, 1.5f) * v.w;
+            v.z = random.Next(-0.25f, 1.25f) * v.w;
+
+            for (uint32_t c = 0; c < kComponentCount; ++c)
+            {
+                data->soa[c][i] = v.m[c];
+                data->vectors_other[i].m[c] = random.Next(-1.0f, 1.0f);
+            }
+
+            float* a = reinterpret_cast<float*>(&data->vertices[i]);
+            float* b = reinterpret_cast<float*>(&data->vertices_other[i]);
+
+            for (uint32_t k = 0; k < sizeof(T3DVertex) / sizeof(float); ++k)
+            {
+                a[k] = random.Next(-1.0f, 1.0f);
+                b[k] = random.Next(-1.0f, 1.0f);
+            }
+        }
+
+        data->t = 0.375f;
+        data->screen_width = 1920.0f;
+        data->screen_height = 1080.0f;
+        data->transform.Init(1920, 1080, 1.0f, 500.0f);
+        return data;
+    }
+
+    void DestroyMicroData(MicroData* data)
+    {
+        AlignedFree(data->matrices);
+        AlignedFree(data->matrices_out);
+        AlignedFree(data->vectors);
+        AlignedFree(data->vectors_other);
+        AlignedFree(data->vectors_out);
+        AlignedFree(data->codes_out);
+        AlignedFree(data->vertices);
+        AlignedFree(data->vertices_other);
+        AlignedFree(data->vertices_out);
+
+        for (uint32_t c = 0; c < kComponentCount; ++c)
+        {
+            AlignedFree(data->soa[c]);
+            AlignedFree(data->soa_out[c]);
+        }
+
+        delete data;
+    }
+
+    // 把输出按元素顺序展开成float数组，不同布局的实现可以直接比较
+    void FlattenOutput(const MicroData& data, MicroOutput output, std::vector<float>& values)
+    {
+        values.clear();
+
+        for (size_t i = 0; i < data.count; ++i)
+        {
+            switch (output)
+            {
+            case MICRO_OUTPUT_MATRICES:
+                values.insert(values.end(), &data.matrices_out[i].m[0][0], &data.matrices_out[i].m[0][0] + 16);
+                break;
+            case MICRO_OUTPUT_VECTORS:
+                values.insert(values.end(), data.vectors_out[i].m, data.vectors_out[i].m + 4);
+                break;
+            case MICRO_OUTPUT_VECTORS_XYZ:
+                values.insert(values.end(), data.vectors_out[i].m, data.vectors_out[i].m + 3);
+                break;
+            case MICRO_OUTPUT_SOA:
+                values.push_back(data.soa_out[0][i]);
+                values.push_back(data.soa_out[1][i]);
+                values.push_back(data.soa_out[2][i]);
+                values.push_back(data.soa_out[3][i]);
+                break;
+            case MICRO_OUTPUT_CODES:
+                values.push_back(static_cast<float>(data.codes_out[i]));
+                break;
+            case MICRO_OUTPUT_VERTICES:
+                values.insert(values.end(), reinterpret_cast<const float*>(&data.vertices_out[i]),
+                    reinterpret_cast<const float*>(&data.vertices_out[i]) + kVertexFloats);
+                break;
+            }
+        }
+    }
+
+    // 单位化只比较xyz，SoA输出里的w要去掉
+    void DropW(std::vector<float>& values)
+    {
+        size_t count = values.size() / 4;
+
+        for (size_t i = 0; i < count; ++i)
+        {
+            values[i * 3 + 0] = values[i * 4 + 0];
+            values[i * 3 + 1] = values[i * 4 + 1];
+            values[i * 3 + 2] = values[i * 4 + 2];
+        }
+
+        values.resize(count * 3);
+    }
+}
+
+std::string RunMicroBenchmarks(const BenchOptions& options)
+{
+    size_t count = options.micro_elements;
+    MicroData* data = CreateMicroData(count);
+    bool has_avx2 = CpuSupportsAVX2();
+    std::vector<float> reference;
+    std::vector<float> values;
+    std::string json;
+
+    for (const MicroKernel& kernel : kMicroKernels)
+    {
+        if (kernel.needs_avx2 && !has_avx2)
+            continue;
+
+        if (!options.kernel.empty() && options.kernel != kernel.name)
+            continue;
+
+        // 每次重复都取最快的一次，排除中断和调度的干扰
+        uint64_t best_cycles = UINT64_MAX;
+        uint64_t best_nanoseconds = UINT64_MAX;
+
+        for (uint32_t repeat = 0; repeat < options.warmup + options.frames; ++repeat)
+        {
+            std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+            uint64_t start_cycles = ReadCycleCounter();
+            kernel.function(*data);
+            uint64_t cycles = ReadCycleCounter() - start_cycles;
+            uint64_t nanoseconds = static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now() - start).count());
+
+            if (repeat < options.warmup)
+                continue;
+
+            best_cycles = std::min(best_cycles, cycles);
+            best_nanoseconds = std::min(best_nanoseconds, nanoseconds);
+        }
+
+        FlattenOutput(*data, kernel.output, values);
+
+        if (kernel.output == MICRO_OUTPUT_SOA && std::strcmp(kernel.name, "vector_normalize") == 0)
+            DropW(values);
+
+        if (std::strcmp(kernel.variant, "scalar") == 0)
+            reference = values;
+
+        float max_error = 0.0f;
+
+        for (size_t i = 0; i < values.size() && i < reference.size(); ++i)
+        {
+            float error = std::fabs(values[i] - reference[i]) / std::max(1.0f, std::fabs(reference[i]));
+            max_error = std::max(max_error, error);
+        }
+
+        json += fmt::format(
+            "{}    {{ \"kernel\": \"{}\", \"variant\": \"{}\", \"cycles_per_element\": {:.3f}, \"ns_per_element\": {:.3f}, \"max_relative_error\": {:.3g} }}",
+            json.empty() ? "" : ",\n", kernel.name, kernel.variant,
+            static_cast<double>(best_cycles) / static_cast<double>(count),
+            static_cast<double>(best_nanoseconds) / static_cast<double>(count), max_error);
+    }
+
+    DestroyMicroData(data);
+
+    if (json.empty())
+        return std::string();
+
+#if defined(TINY3D_MICROBENCH_X86)
+    const char* counter = "tsc";
+#else
+    const char* counter = "nanoseconds";
+#endif
+
+    return fmt::format(
+        "{{\n"
+        "  \"elements\": {},\n"
+        "  \"repeats\": {},\n"
+        "  \"cycle_counter\": \"{}\",\n"
+        "  \"avx2\": {},\n"
+        "  \"kernels\": [\n{}\n  ]\n"
+        "}}\n",
+        count, options.frames, counter, has_avx2 ? "true" : "false", json);
+}
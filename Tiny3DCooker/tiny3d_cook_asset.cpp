@@ -0,0 +1,181 @@
+﻿/*********************************************************************************************
+MIT License
+
+Copyright (c) 2024 kumakoko www.xionggf.com
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*********************************************************************************************/
+#include <algorithm>
+#include <cctype>
+#include <cstring>
+#include <filesystem>
+#include <vector>
+
+#include "fmt/format.h"
+#include "SDL.h"
+#include "SDL_image.h"
+
+#include "tiny3d_error.h"
+#include "tiny3d_mesh.h"
+#include "tiny3d_mesh_file.h"
+#include "tiny3d_mesh_optimizer.h"
+#include "tiny3d_obj_loader.h"
+#include "tiny3d_plg_loader.h"
+#include "tiny3d_texture_file.h"
+#include "tiny3d_cooker.h"
+
+namespace
+{
+    std::string LowerExtension(const std::string& path)
+    {
+        std::string extension = std::filesystem::path(path).extension().string();
+        std::transform(extension.begin(), extension.end(), extension.begin(),
+            [](unsigned char c) { return static_cast<char>(std::tolower(c)); });
+        return extension;
+    }
+
+    // MurmurHash3的64位终结函数，让每个输入位都影响到全部输出位
+    inline uint64_t Mix64(uint64_t h)
+    {
+        h ^= h >> 33;
+        h *= 0xFF51AFD7ED558CCDull;
+        h ^= h >> 33;
+        h *= 0xC4CEB9FE1A85EC53ull;
+        h ^= h >> 33;
+        return h;
+    }
+}
+
+AssetKind ClassifyAsset(const std::string& path)
+{
+    std::string extension = LowerExtension(path);
+
+    if (extension == ".plg" || extension == ".plx" || extension == ".obj")
+        return ASSET_KIND_MESH;
+
+    if (extension == ".bmp" || extension == ".jpg" || extension == ".jpeg" || extension == ".tga" || extension == ".png")
+        return ASSET_KIND_TEXTURE;
+
+    return ASSET_KIND_UNKNOWN;
+}
+
+const char* CookedExtension(AssetKind kind)
+{
+    switch (kind)
+    {
+    case ASSET_KIND_MESH:
+        return ObjLoader::kCacheExtension;
+    case ASSET_KIND_TEXTURE:
+        return ".t3dtex";
+    default:
+        return "";
+    }
+}
+
+uint64_t HashContent(const char* data, size_t size, uint64_t seed)
+{
+    // 每次吃进8个字节，输入文件已经映射在内存里，哈希的速度远高于磁盘读取的速度
+    const uint64_t kMultiplier = 0x9E3779B97F4A7C15ull;
+    uint64_t h = Mix64(seed) ^ (static_cast<uint64_t>(size) * kMultiplier);
+    size_t offset = 0;
+
+    for (; offset + sizeof(uint64_t) <= size; offset += sizeof(uint64_t))
+    {
+        uint64_t word;
+        std::memcpy(&word, data + offset, sizeof(word));
+        h = (h ^ Mix64(word)) * kMultiplier;
+        h ^= h >> 29;
+    }
+
+    if (offset < size)
+    {
+        uint64_t word = 0;
+        std::memcpy(&word, data + offset, size - offset);
+        h = (h ^ Mix64(word)) * kMultiplier;
+    }
+
+    return Mix64(h);
+}
+
+void CookMesh(const std::string& input_path, const char* data, size_t size, const std::string& output_path, JobSystem* job_system,
+    VertexCacheStats* before, VertexCacheStats* after)
+{
+    T3DMesh mesh;
+
+    if (LowerExtension(input_path) == ".obj")
+        ObjLoader::LoadFromMemory(data, size, &mesh, job_system);
+    else
+        PlgLoader::LoadFromMemory(data, size, &mesh);
+
+    if (mesh.name.empty())
+        mesh.name = std::filesystem::path(input_path).stem().string();
+
+    // 先定三角形的顺序，再按这个顺序排列顶点，变换阶段按顶点流的顺序读取
+    *before = AnalyzeVertexCache(mesh, kVertexCacheSize);
+    OptimizeVertexCache(&mesh, kVertexCacheSize);
+    OptimizeVertexFetch(&mesh);
+    *after = AnalyzeVertexCache(mesh, kVertexCacheSize);
+
+    // 烘焙结果不和某个源文件绑定，源文件的大小和修改时间都记为0
+    if (!MeshFile::Write(output_path.c_str(), mesh, 0, 0))
+        throw Error(fmt::format("Cannot write mesh file {}", output_path));
+}
+
+void CookTexture(const std::string& input_path, const char* data, size_t size, const std::string& output_path, bool tiled)
+{
+    // TGA没有文件标识，只能按扩展名告诉SDL_image文件的类型
+    std::string type = LowerExtension(input_path).substr(1);
+    std::transform(type.begin(), type.end(), type.begin(),
+        [](unsigned char c) { return static_cast<char>(std::toupper(c)); });
+
+    SDL_RWops* stream = SDL_RWFromConstMem(data, static_cast<int>(size));
+    SDL_Surface* image = IMG_LoadTyped_RW(stream, 1, type.c_str());
+
+    if (image == nullptr)
+        throw Error(fmt::format("Cannot decode image {}: {}", input_path, IMG_GetError()));
+
+    // 转换成ABGR8888之后每个像素就是引擎的纹素格式：从低到高依次为R、G、B、A
+    SDL_Surface* converted = SDL_ConvertSurfaceFormat(image, SDL_PIXELFORMAT_ABGR8888, 0);
+    SDL_FreeSurface(image);
+
+    if (converted == nullptr)
+        throw Error(fmt::format("Cannot convert image {}: {}", input_path, SDL_GetError()));
+
+    uint32_t width = static_cast<uint32_t>(converted->w);
+    uint32_t height = static_cast<uint32_t>(converted->h);
+    std::vector<uint32_t> texels(static_cast<size_t>(width) * height);
+    SDL_LockSurface(converted);
+
+    // 和Device::CreateTextureFromFile一样忽略图片的透明度
+    for (uint32_t y = 0; y < height; ++y)
+    {
+        const uint32_t* row = reinterpret_cast<const uint32_t*>(static_cast<const uint8_t*>(converted->pixels) + y * converted->pitch);
+
+        for (uint32_t x = 0; x < width; ++x)
+        {
+            texels[y * width + x] = row[x] | 0xFF000000;
+        }
+    }
+
+    SDL_UnlockSurface(converted);
+    SDL_FreeSurface(converted);
+
+    if (!TextureFile::Write(output_path.c_str(), texels.data(), width, height, tiled))
+        throw Error(fmt::format("Cannot write texture file {}", output_path));
+}
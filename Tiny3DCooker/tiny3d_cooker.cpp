@@ -0,0 +1,393 @@
+﻿/*********************************************************************************************
+MIT License
+
+Copyright (c) 2024 kumakoko www.xionggf.com
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*********************************************************************************************/
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <exception>
+#include <filesystem>
+#include <string>
+#include <system_error>
+#include <unordered_map>
+#include <vector>
+
+#include "fmt/format.h"
+#include "SDL_image.h"
+
+#include "tiny3d_error.h"
+#include "tiny3d_job_system.h"
+#include "tiny3d_log.h"
+#include "tiny3d_mapped_file.h"
+#include "tiny3d_cooker.h"
+
+// 离线资源烘焙工具。把PLG/PLX/OBJ模型和BMP/JPG/TGA/PNG图片转换成运行时直接映射使用的
+// 网格文件和纹理文件，运行时不再需要解析文本、解码图片、生成mipmap。
+// 多个文件在任务系统上并行烘焙；输出目录里的清单记录了每个输出对应的输入内容哈希，
+// 输入内容和烘焙选项都没有变化并且输出文件还在时跳过这个文件。
+//
+// 用法：Tiny3DCooker [--output 目录] [--threads N] [--linear] [--force] 文件或目录...
+
+namespace
+{
+    const char* const kManifestName = "cook_manifest.txt";
+
+    enum CookStatus
+    {
+        COOK_STATUS_COOKED = 0,
+        COOK_STATUS_UP_TO_DATE,
+        COOK_STATUS_FAILED,
+    };
+
+    struct CookTask
+    {
+        std::string input_path;
+        std::string output_name;        // 输出文件名，不含目录
+        AssetKind kind;
+        CookStatus status;
+        uint64_t hash;
+        double milliseconds;
+        VertexCacheStats cache_before;  // 模型优化前后的顶点缓存统计
+        VertexCacheStats cache_after;
+        std::string message;            // 失败的原因
+    };
+
+    bool ParseOptions(int argc, char* argv[], CookerOptions& options)
+    {
+        options.output_dir = "cooked";
+        options.threads = 0;
+        options.tiled = true;
+        options.force = false;
+
+        for (int i = 1; i < argc; ++i)
+        {
+            const char* arg = argv[i];
+            const char* value = (i + 1 < argc) ? argv[i + 1] : nullptr;
+
+            if (std::strcmp(arg, "--linear") == 0)
+            {
+                options.tiled = false;
+                continue;
+            }
+
+            if (std::strcmp(arg, "--force") == 0)
+            {
+                options.force = true;
+                continue;
+            }
+
+            if (std::strncmp(arg, "--", 2) != 0)
+            {
+                options.inputs.push_back(arg);
+                continue;
+            }
+
+            if (value == nullptr)
+            {
+                fmt::print(stderr, "missing value for {}\n", arg);
+                return false;
+            }
+
+            if (std::strcmp(arg, "--output") == 0)
+                options.output_dir = value;
+            else if (std::strcmp(arg, "--threads") == 0)
+                options.threads = static_cast<uint32_t>(std::strtoul(value, nullptr, 10));
+            else
+            {
+                fmt::print(stderr, "unknown option {}\n", arg);
+                return false;
+            }
+
+            ++i;
+        }
+
+        if (options.inputs.empty())
+        {
+            fmt::print(stderr, "usage: Tiny3DCooker [--output dir] [--threads N] [--linear] [--force] inputs...\n");
+            return false;
+        }
+
+        return true;
+    }
+
+    // 展开输入的目录，按路径排序，保证多次运行的输出顺序一致
+    bool CollectTasks(const CookerOptions& options, std::vector<CookTask>& tasks)
+    {
+        std::vector<std::string> paths;
+        std::error_code error;
+
+        for (const std::string& input : options.inputs)
+        {
+            if (std::filesystem::is_directory(input, error))
+            {
+                for (std::filesystem::recursive_directory_iterator it(input, error), end; !error && it != end; it.increment(error))
+                {
+                    if (it->is_regular_file(error) && ClassifyAsset(it->path().string()) != ASSET_KIND_UNKNOWN)
+                        paths.push_back(it->path().lexically_normal().generic_string());
+                }
+
+                if (error)
+                {
+                    fmt::print(stderr, "cannot scan {}: {}\n", input, error.message());
+                    return false;
+                }
+            }
+            else if (std::filesystem::is_regular_file(input, error))
+            {
+                if (ClassifyAsset(input) == ASSET_KIND_UNKNOWN)
+                {
+                    fmt::print(stderr, "unsupported file type {}\n", input);
+                    return false;
+                }
+
+                paths.push_back(std::filesystem::path(input).lexically_normal().generic_string());
+            }
+            else
+            {
+                fmt::print(stderr, "cannot find {}\n", input);
+                return false;
+            }
+        }
+
+        std::sort(paths.begin(), paths.end());
+        paths.erase(std::unique(paths.begin(), paths.end()), paths.end());
+
+        // 输出文件都放在同一个目录下，不同目录里的同名文件会互相覆盖，提前报错
+        std::unordered_map<std::string, std::string> owners;
+
+        for (const std::string& path : paths)
+        {
+            CookTask task;
+            task.input_path = path;
+            task.kind = ClassifyAsset(path);
+            task.output_name = std::filesystem::path(path).stem().string() + CookedExtension(task.kind);
+            task.status = COOK_STATUS_FAILED;
+            task.hash = 0;
+            task.milliseconds = 0.0;
+            task.cache_before = VertexCacheStats{ 0.0f, 0.0f };
+            task.cache_after = VertexCacheStats{ 0.0f, 0.0f };
+
+            auto inserted = owners.emplace(task.output_name, path);
+
+            if (!inserted.second)
+            {
+                fmt::print(stderr, "{} and {} would both be cooked to {}\n", inserted.first->second, path, task.output_name);
+                return false;
+            }
+
+            tasks.push_back(task);
+        }
+
+        return true;
+    }
+
+    // 清单每行是“哈希 输出文件名”，哈希是16位十六进制数
+    std::unordered_map<std::string, uint64_t> ReadManifest(const std::string& manifest_path)
+    {
+        std::unordered_map<std::string, uint64_t> manifest;
+        FILE* file = std::fopen(manifest_path.c_str(), "rb");
+
+        if (file == nullptr)
+            return manifest;
+
+        char line[1024];
+
+        while (std::fgets(line, sizeof(line), file) != nullptr)
+        {
+            char* end = nullptr;
+            uint64_t hash = std::strtoull(line, &end, 16);
+
+            if (end == line || *end != ' ')
+                continue;
+
+            std::string name(end + 1);
+
+            while (!name.empty() && (name.back() == '\n' || name.back() == '\r'))
+                name.pop_back();
+
+            if (!name.empty())
+                manifest[name] = hash;
+        }
+
+        std::fclose(file);
+        return manifest;
+    }
+
+    // 先写临时文件再改名，烘焙中途被打断也不会留下写了一半的清单
+    bool WriteManifest(const std::string& manifest_path, const std::unordered_map<std::string, uint64_t>& manifest)
+    {
+        std::vector<std::pair<std::string, uint64_t>> entries(manifest.begin(), manifest.end());
+        std::sort(entries.begin(), entries.end());
+
+        std::string temp_path = manifest_path + ".tmp";
+        FILE* file = std::fopen(temp_path.c_str(), "wb");
+
+        if (file == nullptr)
+            return false;
+
+        for (const auto& entry : entries)
+        {
+            fmt::print(file, "{:016x} {}\n", entry.second, entry.first);
+        }
+
+        bool written = std::fclose(file) == 0;
+        std::error_code error;
+
+        if (written)
+            std::filesystem::rename(temp_path, manifest_path, error);
+
+        return written && !error;
+    }
+
+    void CookOne(CookTask& task, const CookerOptions& options, const std::unordered_map<std::string, uint64_t>& manifest, JobSystem* job_system)
+    {
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        std::string output_path = (std::filesystem::path(options.output_dir) / task.output_name).string();
+        MappedFile input;
+
+        if (!input.Open(task.input_path.c_str()))
+        {
+            task.message = "cannot read file";
+            return;
+        }
+
+        // 影响烘焙结果的选项也算进哈希，切换选项之后会重新烘焙
+        bool tiled = task.kind == ASSET_KIND_TEXTURE && options.tiled;
+        uint64_t seed = (static_cast<uint64_t>(kCookerVersion) << 8) | (static_cast<uint64_t>(task.kind) << 1) | (tiled ? 1 : 0);
+        task.hash = HashContent(input.data(), input.size(), seed);
+
+        auto found = manifest.find(task.output_name);
+        std::error_code error;
+
+        if (!options.force && found != manifest.end() && found->second == task.hash && std::filesystem::exists(output_path, error))
+        {
+            task.status = COOK_STATUS_UP_TO_DATE;
+            return;
+        }
+
+        try
+        {
+            if (task.kind == ASSET_KIND_MESH)
+                CookMesh(task.input_path, input.data(), input.size(), output_path, job_system, &task.cache_before, &task.cache_after);
+            else
+                CookTexture(task.input_path, input.data(), input.size(), output_path, tiled);
+
+            task.status = COOK_STATUS_COOKED;
+        }
+        catch (const Error& e)
+        {
+            task.message = e.Message();
+        }
+        catch (const std::exception& e)
+        {
+            task.message = e.what();
+        }
+
+        std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now();
+        task.milliseconds = std::chrono::duration<double, std::milli>(end - start).count();
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    CookerOptions options;
+    std::vector<CookTask> tasks;
+
+    if (!ParseOptions(argc, argv, options) || !CollectTasks(options, tasks))
+        return 1;
+
+    std::error_code error;
+    std::filesystem::create_directories(options.output_dir, error);
+
+    if (error)
+    {
+        fmt::print(stderr, "cannot create {}: {}\n", options.output_dir, error.message());
+        return 1;
+    }
+
+    std::string manifest_path = (std::filesystem::path(options.output_dir) / kManifestName).string();
+    std::unordered_map<std::string, uint64_t> manifest = ReadManifest(manifest_path);
+
+    IMG_Init(IMG_INIT_JPG | IMG_INIT_PNG);
+    JobSystem job_system;
+    job_system.Initialize(options.threads);
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+    // 每个文件一个任务；OBJ文件的解析本身也会在同一个任务系统上并行
+    job_system.ParallelFor(static_cast<uint32_t>(tasks.size()), 1, [&](uint32_t begin, uint32_t end)
+        {
+            for (uint32_t i = begin; i < end; ++i)
+            {
+                CookOne(tasks[i], options, manifest, &job_system);
+            }
+        });
+
+    std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now();
+    job_system.Shutdown();
+    IMG_Quit();
+
+    uint32_t counts[3] = { 0, 0, 0 };
+
+    for (const CookTask& task : tasks)
+    {
+        ++counts[task.status];
+
+        switch (task.status)
+        {
+        case COOK_STATUS_COOKED:
+            fmt::print("cooked      {} -> {} ({:.1f} ms)\n", task.input_path, task.output_name, task.milliseconds);
+
+            if (task.kind == ASSET_KIND_MESH)
+            {
+                fmt::print("            ACMR {:.3f} -> {:.3f}, ATVR {:.3f} -> {:.3f}\n",
+                    task.cache_before.acmr, task.cache_after.acmr, task.cache_before.atvr, task.cache_after.atvr);
+            }
+
+            manifest[task.output_name] = task.hash;
+            break;
+        case COOK_STATUS_UP_TO_DATE:
+            fmt::print("up to date  {}\n", task.input_path);
+            break;
+        default:
+            fmt::print(stderr, "failed      {}: {}\n", task.input_path, task.message);
+            manifest.erase(task.output_name);
+            break;
+        }
+    }
+
+    int exit_code = counts[COOK_STATUS_FAILED] > 0 ? 1 : 0;
+
+    if (counts[COOK_STATUS_COOKED] + counts[COOK_STATUS_FAILED] > 0 && !WriteManifest(manifest_path, manifest))
+    {
+        fmt::print(stderr, "cannot write {}\n", manifest_path);
+        exit_code = 1;
+    }
+
+    fmt::print("{} cooked, {} up to date, {} failed in {:.1f} ms\n",
+        counts[COOK_STATUS_COOKED], counts[COOK_STATUS_UP_TO_DATE], counts[COOK_STATUS_FAILED],
+        std::chrono::duration<double, std::milli>(end - start).count());
+
+    Log::Shutdown();
+    return exit_code;
+}
@@ -0,0 +1,110 @@
+﻿/*********************************************************************************************
+MIT License
+
+Copyright (c) 2024 kumakoko www.xionggf.com
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*********************************************************************************************/
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "tiny3d_job_system.h"
+#include "tiny3d_mesh_optimizer.h"
+
+//=====================================================================
+// 离线资源烘焙工具的公共部分
+//=====================================================================
+
+struct CookerOptions
+{
+    std::vector<std::string> inputs;    // 输入的文件或者目录，目录会被递归扫描
+    std::string output_dir;             // 烘焙结果和清单文件所在的目录
+    uint32_t threads;                   // 工作线程数，0表示硬件线程数-1
+    bool tiled;                         // 纹理按4x4的块存放
+    bool force;                         // 忽略清单，重新烘焙全部输入
+};
+
+enum AssetKind
+{
+    ASSET_KIND_UNKNOWN = 0,
+    ASSET_KIND_MESH,        // PLG/PLX/OBJ模型，烘焙成.t3dmesh
+    ASSET_KIND_TEXTURE,     // BMP/JPG/TGA/PNG图片，烘焙成.t3dtex
+};
+
+// 烘焙器的版本，烘焙的结果发生变化时要加1，让清单里的记录全部失效
+static const uint32_t kCookerVersion = 2;
+
+/**************************************************************************************
+按扩展名判断资源的类型，扩展名不区分大小写
+@name: ClassifyAsset
+@return: AssetKind
+@param: const std::string & path
+*************************************************************************************/
+AssetKind ClassifyAsset(const std::string& path);
+
+/**************************************************************************************
+烘焙结果的扩展名
+@name: CookedExtension
+@return: const char*
+@param: AssetKind kind
+*************************************************************************************/
+const char* CookedExtension(AssetKind kind);
+
+/**************************************************************************************
+计算输入文件内容的64位哈希值，用来判断输入自上次烘焙以来有没有变化
+@name: HashContent
+@return: uint64_t
+@param: const char * data
+@param: size_t size
+@param: uint64_t seed 包含烘焙器版本和影响烘焙结果的选项
+*************************************************************************************/
+uint64_t HashContent(const char* data, size_t size, uint64_t seed);
+
+/**************************************************************************************
+把映射到内存的模型文件烘焙成网格文件：解析、按顶点缓存和过度绘制重排三角形、
+按首次引用的顺序重排顶点、写出顶点流、meshlet和LOD。出错时抛出Error
+@name: CookMesh
+@return: void
+@param: const std::string & input_path
+@param: const char * data 输入文件的内容
+@param: size_t size
+@param: const std::string & output_path
+@param: JobSystem * job_system 解析OBJ文件时使用
+@param: VertexCacheStats * before 优化之前的顶点缓存统计
+@param: VertexCacheStats * after 优化之后的顶点缓存统计
+*************************************************************************************/
+void CookMesh(const std::string& input_path, const char* data, size_t size, const std::string& output_path, JobSystem* job_system,
+    VertexCacheStats* before, VertexCacheStats* after);
+
+/**************************************************************************************
+把图片烘焙成纹理文件：解码、转换成引擎的纹素格式、生成mipmap链并按需要分块存放。
+出错时抛出Error
+@name: CookTexture
+@return: void
+@param: const std::string & input_path
+@param: const char * data 输入文件的内容
+@param: size_t size
+@param: const std::string & output_path
+@param: bool tiled
+*************************************************************************************/
+void CookTexture(const std::string& input_path, const char* data, size_t size, const std::string& output_path, bool tiled);